@@ -39,17 +39,25 @@ namespace json = rapidjson;
 Driver::Driver(struct event_base* evbase,
                const string& page_models_list_file,
                const bool& sequential_page_selection,
+               const uint32_t& num_tabs,
                const string& browser_proxy_mode,
                const uint16_t tproxy_ipc_port,
                const uint16_t renderer_ipc_port)
     : evbase_(evbase)
     , sequential_page_selection_(sequential_page_selection)
+    , num_tabs_(num_tabs)
     , using_tproxy_(tproxy_ipc_port > 0)
     , tproxy_ipc_ch_ready_(false)
     , browser_proxy_mode_(browser_proxy_mode)
     , state_(State::INITIAL)
     , loadnum_(0)
+    , next_background_load_id_(s_first_background_load_id)
 {
+    CHECK_GE(num_tabs_, 1);
+    if (num_tabs_ > 1) {
+        logself(INFO) << "load pages in " << (num_tabs_ - 1)
+                      << " other tabs during each load";
+    }
 
     logself(INFO) << "using page models listed in " << page_models_list_file;
     _read_page_models_file(page_models_list_file);
@@ -71,6 +79,7 @@ Driver::Driver(struct event_base* evbase,
                 std::move(tcpch1),
                 boost::bind(&Driver::_tproxy_on_ipc_msg, this, _1, _2, _3, _4),
                 boost::bind(&Driver::_tproxy_on_ipc_ch_status, this, _1, _2)));
+        tproxy_ipc_ch_->offer_large_msgs();
     }
 
     logself(INFO) << "connect to renderer ipc port: " << renderer_ipc_port;
@@ -83,6 +92,7 @@ Driver::Driver(struct event_base* evbase,
             std::move(tcpch2),
             boost::bind(&Driver::_renderer_on_ipc_msg, this, _1, _2, _3, _4),
             boost::bind(&Driver::_renderer_on_ipc_ch_status, this, _1, _2)));
+    renderer_ipc_ch_->offer_large_msgs();
 
     page_load_timeout_timer_.reset(
         new Timer(evbase_, true,
@@ -201,7 +211,7 @@ Driver::_on_wait_for_more_requests_timer_fired(Timer* timer)
 
     _reset_this_page_load_info();
 
-    _renderer_reset();
+    _prepare_next_load();
 
     vlogself(2) << "done";
 }
@@ -239,12 +249,14 @@ Driver::_on_page_load_timeout(Timer* timer)
 
     _reset_this_page_load_info();
 
-    _renderer_reset();
-
+    // stop the defense before preparing for the next load, which
+    // tells tproxy to start it again on the next send
     if (using_tproxy_) {
         _tproxy_stop_defense(false);
     }
 
+    _prepare_next_load();
+
     vlogself(2) << "done";
 }
 
@@ -257,26 +269,91 @@ Driver::_on_think_time_timer_fired(Timer* timer)
 
     logself(INFO) << "done thinking";
 
-    CHECK_EQ(state_, State::THINKING);
+    CHECK_EQ(state_, State::PREPARING_NEXT_LOAD);
 
-    _renderer_load_page();
+    thinking_done_ = true;
+    _maybe_start_loading();
 
     vlogself(2) << "done";
 }
 
 void
-Driver::_do_start_thinking_or_loading()
+Driver::_prepare_next_load()
 {
+    vlogself(2) << "begin";
+
+    CHECK((state_ == State::INITIAL)
+          || (state_ == State::LOADING_PAGE)
+          || (state_ == State::WAIT_FOR_MORE_REQUESTS_AFTER_DOM_LOAD_EVENT))
+        << "unexpected state " << common::as_integer(state_);
+    state_ = State::PREPARING_NEXT_LOAD;
+
+    renderer_reset_done_ = false;
+    // tproxy gets prepared once the renderer has been reset, so that
+    // nothing left over from the last load can set off the defense
+    tproxy_prepared_ = !using_tproxy_;
+    thinking_done_ = false;
+
+    // while the last measured load is still there, so the renderer
+    // drops only these, and cancels their requests
+    _renderer_drop_background_tabs();
+
+    _pick_next_page_model();
+
+    _renderer_reset();
+
     if (loadnum_) {
         // we got here after a page load, so we need to think
-        logself(INFO) << ("we got here after a page load, so we need to think");
-        _start_thinking();
+        const auto think_time_ms = (*think_time_rand_gen_)();
+        logself(INFO) << "start thinking for " << think_time_ms << " ms";
+        think_time_timer_->start(think_time_ms);
     } else {
-        logself(INFO) << "start loading immediately since we got here from";
-        // start loading immediately since we got here from
-        // initializing
-        _renderer_load_page();
+        // we got here from initializing, so load as soon as we're
+        // prepared
+        logself(INFO) << "no thinking before the first load";
+        thinking_done_ = true;
     }
+
+    vlogself(2) << "done";
+}
+
+void
+Driver::_pick_next_page_model()
+{
+    if (!sequential_page_selection_) {
+        next_page_model_idx_ = (*page_model_rand_idx_gen_)();
+    } else {
+        if (loadnum_ == 0) {
+            // this is first page load, use first page model
+            next_page_model_idx_ = 0;
+        } else {
+            next_page_model_idx_ =
+                (prev_page_model_idx_ + 1) % page_models_.size();
+        }
+        prev_page_model_idx_ = next_page_model_idx_;
+    }
+    CHECK_GE(next_page_model_idx_, 0);
+    CHECK_LT(next_page_model_idx_, page_models_.size());
+
+    vlogself(1) << "picked new page_model_idx_= " << next_page_model_idx_;
+}
+
+void
+Driver::_maybe_start_loading()
+{
+    CHECK_EQ(state_, State::PREPARING_NEXT_LOAD);
+
+    if (!renderer_reset_done_ || !tproxy_prepared_ || !thinking_done_) {
+        vlogself(1) << "not ready to load yet: renderer reset= "
+                    << renderer_reset_done_ << " tproxy= " << tproxy_prepared_
+                    << " thinking= " << thinking_done_;
+        if (thinking_done_) {
+            logself(INFO) << "done thinking but still preparing for the next load";
+        }
+        return;
+    }
+
+    _renderer_load_page();
 }
 
 void
@@ -287,6 +364,10 @@ Driver::_tproxy_on_ipc_ch_status(GenericIpcChannel*,
     case GenericIpcChannel::ChannelStatus::READY: {
         tproxy_ipc_ch_ready_ = true;
         // _tproxy_maybe_establish_tunnel();
+        if ((state_ == State::PREPARING_NEXT_LOAD) && renderer_reset_done_) {
+            // the renderer got reset before we could talk to tproxy
+            _tproxy_set_auto_start_defense_on_next_send();
+        }
         break;
     }
 
@@ -307,7 +388,7 @@ Driver::_renderer_on_ipc_ch_status(GenericIpcChannel*,
 {
     switch (status) {
     case GenericIpcChannel::ChannelStatus::READY: {
-        _renderer_reset();
+        _prepare_next_load();
         break;
     }
 
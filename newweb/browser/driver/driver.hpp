@@ -8,6 +8,7 @@
 #include "../../utility/stream_channel.hpp"
 #include "../../utility/generic_message_channel.hpp"
 #include "../../utility/ipc/generic_ipc_channel.hpp"
+#include "../../utility/ipc/msg_buf_builder.hpp"
 #include "../../utility/object.hpp"
 
 #include "utility/ipc/renderer/gen/combined_headers"
@@ -43,6 +44,12 @@
  * load. while we wait, any new requests will reset the waiting logic
  *
  * --> when done go back to 1.
+ *
+ * with more than one "tab", each page load we measure has the other
+ * tabs loading other pages in the same renderer at the same time,
+ * competing for its io session. they are started right after the
+ * measured load, and dropped (with a Reset for each of their load
+ * ids) when we prepare the next one. we don't measure them
  * 
  */
 
@@ -58,6 +65,7 @@ public:
     explicit Driver(struct event_base*,
                     const std::string& page_models_list_file,
                     const bool& sequential_page_selection,
+                    const uint32_t& num_tabs,
                     const std::string& browser_proxy_mode,
                     const uint16_t tproxy_ipc_port,
                     const uint16_t renderer_ipc_port);
@@ -72,39 +80,44 @@ private:
     /*  for interacting with tproxy  */
 
     void _tproxy_on_ipc_msg(myipc::GenericIpcChannel*, uint8_t type,
-                            uint16_t len, const uint8_t *data);
+                            uint32_t len, const uint8_t *data);
     void _tproxy_on_ipc_ch_status(myipc::GenericIpcChannel*,
                                   myipc::GenericIpcChannel::ChannelStatus);
 
 #if 0
     void _tproxy_maybe_establish_tunnel();
     void _tproxy_on_establish_tunnel_resp(myipc::GenericIpcChannel::RespStatus,
-                                   uint16_t len, const uint8_t* buf);
+                                   uint32_t len, const uint8_t* buf);
 #endif
 
     void _tproxy_stop_defense(const bool& right_now);
     void _tproxy_on_stop_defense_resp(myipc::GenericIpcChannel::RespStatus,
-                                   uint16_t len, const uint8_t* buf);
+                                   uint32_t len, const uint8_t* buf);
 
     ///////////
 
     /*  for interacting with renderer  */
 
     void _renderer_on_ipc_msg(myipc::GenericIpcChannel*, uint8_t type,
-                              uint16_t len, const uint8_t *data);
+                              uint32_t len, const uint8_t *data);
     void _renderer_on_ipc_ch_status(myipc::GenericIpcChannel*,
                                     myipc::GenericIpcChannel::ChannelStatus);
 
     void _renderer_reset();
     void _renderer_on_reset_resp(myipc::GenericIpcChannel::RespStatus,
-                                 uint16_t len, const uint8_t* buf);
+                                 uint32_t len, const uint8_t* buf);
     void _renderer_load_page();
     void _renderer_on_load_page_resp(myipc::GenericIpcChannel::RespStatus,
-                                     uint16_t len, const uint8_t* buf);
+                                     uint32_t len, const uint8_t* buf);
+    /* start/drop the loads in the other tabs */
+    void _renderer_load_background_tabs();
+    void _renderer_drop_background_tabs();
+    void _renderer_on_background_tab_resp(myipc::GenericIpcChannel::RespStatus,
+                                          uint32_t len, const uint8_t* buf);
 
     void _tproxy_set_auto_start_defense_on_next_send();
     void _tproxy_on_set_auto_start_defense_on_next_send_resp(myipc::GenericIpcChannel::RespStatus,
-                                                          uint16_t, const uint8_t* buf);
+                                                          uint32_t, const uint8_t* buf);
 
     void _renderer_handle_PageLoaded(const myipc::renderer::messages::PageLoadedMsg*);
     void _renderer_handle_PageLoadFailed(const myipc::renderer::messages::PageLoadFailedMsg*);
@@ -127,10 +140,14 @@ private:
 
     myipc::GenericIpcChannel::UniquePtr renderer_ipc_ch_;
     myipc::GenericIpcChannel::UniquePtr tproxy_ipc_ch_;
+    /* reused to build the msgs we send on the channels */
+    myipc::MsgBufBuilder renderer_bufbuilder_;
+    myipc::MsgBufBuilder tproxy_bufbuilder_;
 
     /* list of <page name, file path to the page model> pairs */
     std::vector<std::pair<std::string, std::string> > page_models_;
     const bool sequential_page_selection_;
+    const uint32_t num_tabs_;
     bool using_tproxy_;
     bool tproxy_ipc_ch_ready_;
     const std::string browser_proxy_mode_;
@@ -141,8 +158,11 @@ private:
     {
         INITIAL,
 
-            RESET_RENDERER,
-            DONE_RESET_RENDERER,
+        /* the previous load is over (or there was none); we are
+         * thinking and getting ready for the next one, see
+         * _prepare_next_load()
+         */
+            PREPARING_NEXT_LOAD,
 #if 0
             ESTABLISH_TPROXY_TUNNEL,
             DONE_ESTABLISH_TPROXY_TUNNEL,
@@ -159,10 +179,22 @@ private:
          * reporting page load result
          */
             WAIT_FOR_MORE_REQUESTS_AFTER_DOM_LOAD_EVENT,
-
-            THINKING,
     } state_;
 
+    /* while in PREPARING_NEXT_LOAD: which of the things that must
+     * happen before the next load starts are done. the renderer reset
+     * and the think time run at the same time, and the tproxy is
+     * prepared as soon as the renderer has been reset, so normally
+     * everything is done by the time think time is over
+     */
+    bool renderer_reset_done_ = false;
+    bool tproxy_prepared_ = false;
+    bool thinking_done_ = false;
+
+    /* picked when we start preparing for the next load, so that the
+     * renderer can parse the page model while we think */
+    uint32_t next_page_model_idx_ = 0;
+
     Timer::UniquePtr page_load_timeout_timer_;
     Timer::UniquePtr wait_for_more_requests_timer_;
     Timer::UniquePtr think_time_timer_;
@@ -176,8 +208,15 @@ private:
     };
     static const char* s_page_load_status_to_string(const PageLoadStatus&);
 
+    static const uint32_t s_first_background_load_id = 1u << 31;
+
     uint32_t loadnum_;
 
+    /* the loads in the other tabs; their ids are from a range that
+     * loadnum_ doesn't get to */
+    std::vector<uint32_t> background_load_ids_;
+    uint32_t next_background_load_id_;
+
     struct OnePageLoadInfo
     {
         uint32_t page_model_idx_;
@@ -189,6 +228,19 @@ private:
         uint32_t num_after_DOM_load_event_reqs_;
         int32_t num_pending_reqs_;
 
+        /* sums, over all finished requests, of the time each spent in
+         * the io process's network phases */
+        uint64_t sum_queue_ms_;
+        uint64_t sum_connect_ms_;
+        uint64_t sum_wait_ms_;
+        uint64_t sum_transfer_ms_;
+
+        /* how long, up to the DOM load event, at least one request was
+         * pending; the rest of the plt is spent not waiting on the
+         * network */
+        uint64_t net_busy_ms_;
+        uint64_t net_busy_since_;
+
         PageLoadStatus page_load_status_;
         uint32_t ttfb_ms_;
 
@@ -198,10 +250,17 @@ private:
     // so that we can do sequential page selection
     uint32_t prev_page_model_idx_ = 0;
 
-    void _do_start_thinking_or_loading();
-    void _start_thinking();
+    /* start getting ready for the next page load: pick the page,
+     * reset the renderer (which will also parse the page model) and
+     * start thinking, all at once */
+    void _prepare_next_load();
+    void _pick_next_page_model();
+    /* start loading if we're done preparing */
+    void _maybe_start_loading();
     void _report_result();
     void _reset_this_page_load_info();
+    /* close the current period during which requests were pending */
+    void _end_net_busy_period();
 };
 
 #endif /* end driver_hpp */
@@ -1,4 +1,5 @@
 
+#include <algorithm>
 #include <boost/bind.hpp>
 
 #include "../../utility/common.hpp"
@@ -39,11 +40,10 @@ static const auto wait_for_more_requests_ms = 2*1000;
     VLOG(2) << "begin building msg type: " << unsigned(__type);         \
     renderermsgs::TYPE ## MsgBuilder msgbuilder(bufbuilder);            \
     SCOPE_EXIT {                                                        \
-        auto msg = msgbuilder.Finish();                                 \
-        bufbuilder.Finish(msg);                                         \
+        const auto __len = bufbuilder.finish_msg(msgbuilder);           \
         VLOG(2) << "send msg type: " << unsigned(__type);               \
         renderer_ipc_ch_->call(                                         \
-            __type, bufbuilder.GetSize(),                               \
+            __type, __len,                                              \
             bufbuilder.GetBufferPointer(), __resp_type,                 \
             on_resp_status, &s_ipc_cmd_resp_timeout_secs);              \
     }
@@ -58,7 +58,7 @@ static const auto wait_for_more_requests_ms = 2*1000;
 
 void
 Driver::_renderer_on_ipc_msg(GenericIpcChannel*, uint8_t type,
-                             uint16_t, const uint8_t *data)
+                             uint32_t, const uint8_t *data)
 {
     vlogself(2) << "type: " << renderermsgs::EnumNametype((renderermsgs::type)type);
 
@@ -84,6 +84,12 @@ Driver::_renderer_handle_RequestWillBeSent(
     // the page might have fired the "load" event already
     // CHECK_EQ(state_, State::LOADING_PAGE);
 
+    if (msg->load_id() != loadnum_) {
+        // sent before the renderer got our reset
+        vlogself(1) << "ignore request of load " << msg->load_id();
+        return;
+    }
+
     const auto resInstNum = msg->resInstNum();
     const auto reqChainIdx = msg->reqChainIdx();
 
@@ -94,6 +100,9 @@ Driver::_renderer_handle_RequestWillBeSent(
 
     ++this_page_load_info_.num_reqs_;
 
+    if (this_page_load_info_.num_pending_reqs_ == 0) {
+        this_page_load_info_.net_busy_since_ = common::gettimeofdayMs();
+    }
     ++this_page_load_info_.num_pending_reqs_;
 
     if (this_page_load_info_.DOM_load_event_fired_timepoint_ > 0) {
@@ -119,6 +128,11 @@ Driver::_renderer_handle_RequestFinished(
     // the page might have fired the "load" event already
     // CHECK_EQ(state_, State::LOADING_PAGE);
 
+    if (msg->load_id() != loadnum_) {
+        vlogself(1) << "ignore request of load " << msg->load_id();
+        return;
+    }
+
     const auto resInstNum = msg->resInstNum();
     const auto reqChainIdx = msg->reqChainIdx();
     const auto success = msg->success();
@@ -126,6 +140,20 @@ Driver::_renderer_handle_RequestFinished(
     CHECK_GT(resInstNum, 0);
     CHECK_GE(reqChainIdx, 0);
 
+    logself(INFO) << "reqTiming= " << resInstNum << ":" << reqChainIdx
+                  << " success= " << success
+                  << " queue= " << msg->queue_ms()
+                  << " connect= " << msg->connect_ms()
+                  << " wait= " << msg->wait_ms()
+                  << " transfer= " << msg->transfer_ms()
+                  << " cnx= " << msg->conn_id();
+
+    auto& tpli = this_page_load_info_;
+    tpli.sum_queue_ms_ += msg->queue_ms();
+    tpli.sum_connect_ms_ += msg->connect_ms();
+    tpli.sum_wait_ms_ += msg->wait_ms();
+    tpli.sum_transfer_ms_ += msg->transfer_ms();
+
     if (!success) {
         ++this_page_load_info_.num_failed_reqs_;
         LOG(WARNING) << "request " << resInstNum << ":" << reqChainIdx
@@ -141,6 +169,8 @@ Driver::_renderer_handle_RequestFinished(
     if (this_page_load_info_.num_pending_reqs_ < 0) {
         logself(WARNING) << "negative num_pending_reqs_; set to 0";
         this_page_load_info_.num_pending_reqs_ = 0;
+    } else if (this_page_load_info_.num_pending_reqs_ == 0) {
+        _end_net_busy_period();
     }
 
     if ((this_page_load_info_.DOM_load_event_fired_timepoint_ > 0)
@@ -164,6 +194,12 @@ Driver::_reset_this_page_load_info()
     this_page_load_info_.num_reqs_ = 0;
     this_page_load_info_.num_pending_reqs_ = 0;
     this_page_load_info_.num_after_DOM_load_event_reqs_ = 0;
+    this_page_load_info_.sum_queue_ms_ = 0;
+    this_page_load_info_.sum_connect_ms_ = 0;
+    this_page_load_info_.sum_wait_ms_ = 0;
+    this_page_load_info_.sum_transfer_ms_ = 0;
+    this_page_load_info_.net_busy_ms_ = 0;
+    this_page_load_info_.net_busy_since_ = 0;
     this_page_load_info_.load_start_timepoint_ = 0;
     this_page_load_info_.DOM_load_event_fired_timepoint_ = 0;
     this_page_load_info_.page_model_idx_ = 0;
@@ -174,6 +210,26 @@ Driver::_reset_this_page_load_info()
     this_page_load_info_.forced_load_resInstNums_.clear();
 }
 
+void
+Driver::_end_net_busy_period()
+{
+    auto& tpli = this_page_load_info_;
+    if (!tpli.net_busy_since_) {
+        return;
+    }
+
+    // only count up to the load event, so that it's comparable to
+    // the plt
+    auto end = common::gettimeofdayMs();
+    if (tpli.DOM_load_event_fired_timepoint_ > 0) {
+        end = std::min(end, tpli.DOM_load_event_fired_timepoint_);
+    }
+    if (end > tpli.net_busy_since_) {
+        tpli.net_busy_ms_ += (end - tpli.net_busy_since_);
+    }
+    tpli.net_busy_since_ = 0;
+}
+
 #include <iomanip>
 
 void
@@ -191,6 +247,12 @@ Driver::_report_result()
 
     const auto plt = tpli.DOM_load_event_fired_timepoint_ - tpli.load_start_timepoint_;
 
+    if (tpli.num_pending_reqs_ > 0) {
+        _end_net_busy_period();
+    }
+    const auto net_busy_ms =
+        (pageloadstatus == PageLoadStatus::OK) ? std::min<uint64_t>(tpli.net_busy_ms_, plt) : 0;
+
     LOG(INFO)
         << "loadnum= " << loadnum_
         << ", webmode= vanilla"
@@ -205,6 +267,12 @@ Driver::_report_result()
         << " numFailed= " << tpli.num_failed_reqs_
         << " numAfterDOMLoadEvent= " << tpli.num_after_DOM_load_event_reqs_
         << " numForced= " << tpli.forced_load_resInstNums_.size()
+        << " sumQueueMs= " << tpli.sum_queue_ms_
+        << " sumConnectMs= " << tpli.sum_connect_ms_
+        << " sumWaitMs= " << tpli.sum_wait_ms_
+        << " sumTransferMs= " << tpli.sum_transfer_ms_
+        << " netBusyMs= " << net_busy_ms
+        << " nonNetMs= " << (pageloadstatus == PageLoadStatus::OK ? (plt - net_busy_ms) : 0)
         ;
 }
 
@@ -213,6 +281,11 @@ Driver::_renderer_handle_PageLoaded(const myipc::renderer::messages::PageLoadedM
 {
     vlogself(2) << "begin";
 
+    if (msg->load_id() >= s_first_background_load_id) {
+        vlogself(1) << "background tab load " << msg->load_id() << " loaded";
+        return;
+    }
+
     CHECK_EQ(msg->load_id(), loadnum_)
         << "expect " << loadnum_ << " got " << msg->load_id();
 
@@ -249,6 +322,11 @@ Driver::_renderer_handle_PageLoadFailed(const myipc::renderer::messages::PageLoa
 {
     vlogself(2) << "begin";
 
+    if (msg->load_id() >= s_first_background_load_id) {
+        logself(WARNING) << "background tab load " << msg->load_id() << " failed";
+        return;
+    }
+
     CHECK_EQ(msg->load_id(), loadnum_)
         << "expect " << loadnum_ << " got " << msg->load_id();
 
@@ -282,12 +360,12 @@ Driver::_renderer_handle_PageLoadFailed(const myipc::renderer::messages::PageLoa
 
     _reset_this_page_load_info();
 
-    _renderer_reset();
-
     if (using_tproxy_) {
         _tproxy_stop_defense(false);
     }
 
+    _prepare_next_load();
+
     vlogself(2) << "done";
 }
 
@@ -296,16 +374,20 @@ Driver::_renderer_reset()
 {
     vlogself(2) << "begin";
 
-    // CHECK((state_ == State::INITIAL)
-    //       || (state_ == State::LOADING_PAGE)
-    //       || (state_ == State::LOADING_PAGE));
-    state_ = State::RESET_RENDERER;
+    CHECK_EQ(state_, State::PREPARING_NEXT_LOAD);
 
     {
-        flatbuffers::FlatBufferBuilder bufbuilder;
+        auto& bufbuilder = renderer_bufbuilder_.start();
+        // have the renderer parse the next page model now instead of
+        // when we tell it to load
+        const auto& model_path = page_models_[next_page_model_idx_].second;
+        auto model_fpath = bufbuilder.CreateString(model_path);
+
         BEGIN_BUILD_CALL_MSG_AND_SEND_AT_END(
             Reset, bufbuilder,
             boost::bind(&Driver::_renderer_on_reset_resp, this, _2, _3, _4));
+
+        msgbuilder.add_next_model_fpath(model_fpath);
     }
 
     vlogself(2) << "done";
@@ -313,58 +395,38 @@ Driver::_renderer_reset()
 
 void
 Driver::_renderer_on_reset_resp(GenericIpcChannel::RespStatus status,
-                                uint16_t len, const uint8_t* buf)
+                                uint32_t len, const uint8_t* buf)
 {
     vlogself(2) << "begin";
 
-    CHECK_EQ(state_, State::RESET_RENDERER);
+    CHECK_EQ(state_, State::PREPARING_NEXT_LOAD);
 
     if (status == GenericIpcChannel::RespStatus::TIMEDOUT) {
         logself(FATAL) << "reset command times out";
     }
 
-    state_ = State::DONE_RESET_RENDERER;
+    renderer_reset_done_ = true;
 
-    // if (using_tproxy_) {
+    if (using_tproxy_ && tproxy_ipc_ch_ready_) {
+        // otherwise we'll do it when the channel becomes ready
+        _tproxy_set_auto_start_defense_on_next_send();
+    }
 
-    //     if (loadnum_ == 0) {
-    //         _tproxy_maybe_establish_tunnel();
-    //     } else {
-    //         _tproxy_set_auto_start_defense_on_next_send();
-    //     }
-    // } else {
-        _do_start_thinking_or_loading();
-    // }
+    _maybe_start_loading();
 
     vlogself(2) << "done";
 }
 
-void
-Driver::_start_thinking()
-{
-    CHECK(state_ == State::DONE_RESET_RENDERER);
-    state_ = State::THINKING;
-
-    const auto think_time_ms = (*think_time_rand_gen_)();
-    logself(INFO) << "start thinking for " << think_time_ms << " ms";
-    think_time_timer_->start(think_time_ms);
-}
-
 void
 Driver::_renderer_load_page()
 {
     vlogself(2) << "begin";
 
-    /* normally we get here after thinking, except for the very
-     * first load, for which there was no thinking before it
+    /* everything else was done while we were thinking, see
+     * _prepare_next_load()
      */
-    CHECK((state_ == State::THINKING)
-          || (state_ == State::DONE_RESET_RENDERER))
-        << "unexpected state " << common::as_integer(state_);
-
-    if (using_tproxy_) {
-        _tproxy_set_auto_start_defense_on_next_send();
-    }
+    CHECK_EQ(state_, State::PREPARING_NEXT_LOAD);
+    CHECK(renderer_reset_done_ && tproxy_prepared_ && thinking_done_);
 
     state_ = State::LOADING_PAGE;
 
@@ -373,33 +435,15 @@ Driver::_renderer_load_page()
     auto& tpli = this_page_load_info_;
     tpli.load_start_timepoint_ = common::gettimeofdayMs();
     tpli.page_load_status_ = PageLoadStatus::PENDING;
+    tpli.page_model_idx_ = next_page_model_idx_;
     ++loadnum_;
 
-    // select which page to load
-    if (!sequential_page_selection_) {
-        tpli.page_model_idx_ = (*page_model_rand_idx_gen_)();
-    } else {
-        // very first page load has loadnum = 1, not 0
-        if (loadnum_ == 1) {
-            // this is first page load, use first page model
-            tpli.page_model_idx_ = 0;
-        } else {
-            tpli.page_model_idx_ =
-                (prev_page_model_idx_ + 1) % page_models_.size();
-        }
-        prev_page_model_idx_ = tpli.page_model_idx_;
-    }
-    CHECK_GE(tpli.page_model_idx_, 0);
-    CHECK_LT(tpli.page_model_idx_, page_models_.size());
-
     wait_for_more_requests_timer_->cancel();
 
-    vlogself(1) << "picked new page_model_idx_= " << tpli.page_model_idx_;
-
     logself(INFO) << "start loading page [" << page_models_[tpli.page_model_idx_].first << "]";
 
     {
-        flatbuffers::FlatBufferBuilder bufbuilder;
+        auto& bufbuilder = renderer_bufbuilder_.start();
         const auto& model_path = page_models_[tpli.page_model_idx_].second;
         auto model_fpath = bufbuilder.CreateString(model_path);
 
@@ -411,12 +455,74 @@ Driver::_renderer_load_page()
         msgbuilder.add_load_id(loadnum_);
     }
 
+    // after ours, so that ours gets the page model the renderer
+    // parsed when we reset it
+    _renderer_load_background_tabs();
+
     vlogself(2) << "done";
 }
 
+void
+Driver::_renderer_load_background_tabs()
+{
+    CHECK(background_load_ids_.empty());
+
+    for (uint32_t i = 1; i < num_tabs_; ++i) {
+        // the pages that come after ours in the list
+        const auto page_model_idx =
+            (this_page_load_info_.page_model_idx_ + i) % page_models_.size();
+        const auto load_id = next_background_load_id_++;
+        if (next_background_load_id_ == 0) {
+            next_background_load_id_ = s_first_background_load_id;
+        }
+
+        logself(INFO) << "load page [" << page_models_[page_model_idx].first
+                      << "] in another tab, load id= " << load_id;
+
+        background_load_ids_.push_back(load_id);
+
+        auto& bufbuilder = renderer_bufbuilder_.start();
+        const auto& model_path = page_models_[page_model_idx].second;
+        auto model_fpath = bufbuilder.CreateString(model_path);
+
+        BEGIN_BUILD_CALL_MSG_AND_SEND_AT_END(
+            LoadPage, bufbuilder,
+            boost::bind(&Driver::_renderer_on_background_tab_resp, this, _2, _3, _4));
+
+        msgbuilder.add_model_fpath(model_fpath);
+        msgbuilder.add_load_id(load_id);
+    }
+}
+
+void
+Driver::_renderer_drop_background_tabs()
+{
+    for (const auto load_id : background_load_ids_) {
+        vlogself(1) << "drop the load in another tab, load id= " << load_id;
+
+        auto& bufbuilder = renderer_bufbuilder_.start();
+
+        BEGIN_BUILD_CALL_MSG_AND_SEND_AT_END(
+            Reset, bufbuilder,
+            boost::bind(&Driver::_renderer_on_background_tab_resp, this, _2, _3, _4));
+
+        msgbuilder.add_load_id(load_id);
+    }
+    background_load_ids_.clear();
+}
+
+void
+Driver::_renderer_on_background_tab_resp(GenericIpcChannel::RespStatus status,
+                                         uint32_t, const uint8_t*)
+{
+    if (status == GenericIpcChannel::RespStatus::TIMEDOUT) {
+        logself(FATAL) << "background tab command times out";
+    }
+}
+
 void
 Driver::_renderer_on_load_page_resp(GenericIpcChannel::RespStatus status,
-                      uint16_t len, const uint8_t* buf)
+                      uint32_t len, const uint8_t* buf)
 {
     CHECK_EQ(state_, State::LOADING_PAGE);
     if (status == GenericIpcChannel::RespStatus::TIMEDOUT) {
@@ -38,19 +38,18 @@ static const uint8_t s_resp_timeout_secs = 5;
             << tproxymsgs::EnumNametype(__type);                        \
     tproxymsgs::TYPE ## MsgBuilder msgbuilder(bufbuilder);              \
     SCOPE_EXIT {                                                        \
-        auto msg = msgbuilder.Finish();                                 \
-        bufbuilder.Finish(msg);                                         \
+        const auto __len = bufbuilder.finish_msg(msgbuilder);           \
         VLOG(2) << "send msg";                                          \
         static const uint8_t __resp_timeout_secs = (resp_timeout_secs); \
         tproxy_ipc_ch_->call(                                           \
-            __type, bufbuilder.GetSize(),                               \
+            __type, __len,                                              \
             bufbuilder.GetBufferPointer(), __resp_type,                 \
             on_resp_status, &__resp_timeout_secs);                      \
     }
 
 void
 Driver::_tproxy_on_ipc_msg(GenericIpcChannel*, uint8_t,
-                           uint16_t, const uint8_t *)
+                           uint32_t, const uint8_t *)
 {
     logself(WARNING) << "ignoring msgs from tproxy";
 }
@@ -75,7 +74,7 @@ Driver::_tproxy_maybe_establish_tunnel()
     state_ = State::ESTABLISH_TPROXY_TUNNEL;
 
     {
-        flatbuffers::FlatBufferBuilder bufbuilder;
+        auto& bufbuilder = tproxy_bufbuilder_.start();
 
         BEGIN_BUILD_CALL_MSG_AND_SEND_AT_END(
             EstablishTunnel, bufbuilder,
@@ -89,7 +88,7 @@ Driver::_tproxy_maybe_establish_tunnel()
 
 void
 Driver::_tproxy_on_establish_tunnel_resp(GenericIpcChannel::RespStatus status,
-                                  uint16_t len, const uint8_t* buf)
+                                  uint32_t len, const uint8_t* buf)
 {
     vlogself(2) << "begin";
 
@@ -132,7 +131,7 @@ Driver::_tproxy_set_auto_start_defense_on_next_send()
     // state_ = State::SET_TPROXY_AUTO_START;
 
     {
-        flatbuffers::FlatBufferBuilder bufbuilder;
+        auto& bufbuilder = tproxy_bufbuilder_.start();
 
         BEGIN_BUILD_CALL_MSG_AND_SEND_AT_END(
             SetAutoStartDefenseOnNextSend, bufbuilder,
@@ -147,11 +146,11 @@ Driver::_tproxy_set_auto_start_defense_on_next_send()
 void
 Driver::_tproxy_on_set_auto_start_defense_on_next_send_resp(
     GenericIpcChannel::RespStatus status,
-    uint16_t, const uint8_t* buf)
+    uint32_t, const uint8_t* buf)
 {
     vlogself(2) << "begin";
 
-    // CHECK_EQ(state_, State::SET_TPROXY_AUTO_START);
+    CHECK_EQ(state_, State::PREPARING_NEXT_LOAD);
 
     if (status == GenericIpcChannel::RespStatus::TIMEDOUT) {
         logself(WARNING) << "timed out setting tunnel auto start";
@@ -164,9 +163,9 @@ Driver::_tproxy_on_set_auto_start_defense_on_next_send_resp(
         }
     }
 
-    // state_ = State::DONE_SET_TPROXY_AUTO_START;
-
-    // _do_start_thinking_or_loading();
+    // proceed any way, like we did when we didn't wait for this
+    tproxy_prepared_ = true;
+    _maybe_start_loading();
 
     vlogself(2) << "done";
 }
@@ -181,7 +180,7 @@ Driver::_tproxy_stop_defense(const bool& right_now)
     // CHECK_EQ(state_, State::GRACE_PERIOD_AFTER_DOM_LOAD_EVENT);
 
     {
-        flatbuffers::FlatBufferBuilder bufbuilder;
+        auto& bufbuilder = tproxy_bufbuilder_.start();
 
         BEGIN_BUILD_CALL_MSG_AND_SEND_AT_END(
             StopDefense, bufbuilder,
@@ -196,7 +195,7 @@ Driver::_tproxy_stop_defense(const bool& right_now)
 void
 Driver::_tproxy_on_stop_defense_resp(
     GenericIpcChannel::RespStatus status,
-    uint16_t, const uint8_t* buf)
+    uint32_t, const uint8_t* buf)
 {
     vlogself(2) << "begin";
 
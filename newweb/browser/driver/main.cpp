@@ -39,6 +39,10 @@ struct MyConfig
      * models file */
     bool sequential_page_selection = false;
 
+    /* how many pages the renderer loads at the same time: the one we
+     * measure, plus ones in the other "tabs" */
+    uint32_t num_tabs = 1;
+
 #ifdef IN_SHADOW
     std::string browser_proxy_mode_spec_file;
 #endif
@@ -71,6 +75,11 @@ set_my_config(MyConfig& conf,
             conf.sequential_page_selection = true;
         }
 
+        else if (name == "num-tabs") {
+            conf.num_tabs = boost::lexical_cast<uint32_t>(value);
+            CHECK_GE(conf.num_tabs, 1);
+        }
+
 //         else if (name == "load-page-then-exit") {
 // #ifdef IN_SHADOW
 //             LOG(FATAL) << "load-page-then-exit does not yet make sense in shadow";
@@ -171,6 +180,7 @@ int main(int argc, char **argv)
     Driver::UniquePtr driver(
         new Driver(evbase.get(), conf.page_models_list_file.path,
                    conf.sequential_page_selection,
+                   conf.num_tabs,
                    proxy_mode,
                    conf.tproxy_ipcport, conf.renderer_ipcport));
 
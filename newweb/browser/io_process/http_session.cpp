@@ -1,14 +1,15 @@
 
 #include <boost/bind.hpp>
+#include <algorithm>
+#include <unordered_set>
 
 #include "http_session.hpp"
+#include "../render_process/webengine/fetch/ResourceLoadPriority.hpp"
 #include "../../utility/easylogging++.h"
 #include "../../utility/folly/ScopeGuard.h"
 
 
-using std::shared_ptr;
 using std::string;
-using std::make_pair;
 
 
 #define _LOG_PREFIX(inst) << "hsess= " << (inst)->objId() << ": "
@@ -28,6 +29,25 @@ using http::Request;
 using http::ConnectionManager;
 
 
+/* the limits chrome's ResourceScheduler used. note that chrome maps
+ * webkit's priorities one level down onto net priorities, so what
+ * chrome calls MEDIUM is webkit's High
+ */
+
+/* requests below this priority are delayable */
+static const int8_t kDelayablePriorityThreshold =
+    blink::ResourceLoadPriorityHigh;
+/* requests at or above this priority block layout */
+static const int8_t kLayoutBlockingPriorityThreshold =
+    blink::ResourceLoadPriorityVeryHigh;
+
+static const size_t kMaxNumDelayableRequests = 10;
+static const size_t kMaxNumDelayableRequestsPerHost = 6;
+/* before the body, while there are layout-blocking requests in
+ * flight */
+static const size_t kMaxNumDelayableWhileLayoutBlocking = 1;
+
+
 HttpNetworkSession::HttpNetworkSession(struct event_base* evbase,
                                        IPCServer* ipcserver,
                                        uint32_t routing_id,
@@ -35,6 +55,10 @@ HttpNetworkSession::HttpNetworkSession(struct event_base* evbase,
     : evbase_(evbase)
     , ipcserver_(ipcserver), routing_id_(routing_id)
     , netconf_(netconf)
+    , next_throttled_req_seq_(0)
+    , has_body_(false)
+    , num_delayable_in_flight_(0)
+    , num_layout_blocking_in_flight_(0)
 {
     connman_.reset(
         new ConnectionManager(
@@ -42,7 +66,9 @@ HttpNetworkSession::HttpNetworkSession(struct event_base* evbase,
             netconf->socks5_addr(), netconf->socks5_port(),
             boost::bind(&HttpNetworkSession::_response_done_cb, this,
                         _1, false),
-            8, 0));
+            8, netconf->max_retries_per_resource(),
+            netconf->use_spdy(), netconf->http_pipeline_depth(),
+            netconf->hedge_ttfb_percentile()));
     CHECK_NOTNULL(connman_.get());
 }
 
@@ -60,6 +86,12 @@ HttpNetworkSession::handle_ResetSession()
      * pointer's reset() method) */
     connman_->reset();
 
+    throttled_requests_.clear();
+    has_body_ = false;
+    num_delayable_in_flight_ = 0;
+    num_layout_blocking_in_flight_ = 0;
+    num_delayable_in_flight_per_host_.clear();
+
     /*
      * now we can clear the pending requests, which will destroy the
      * Request's
@@ -76,48 +108,218 @@ HttpNetworkSession::handle_RequestResource(const int req_res_req_id,
                                            const uint16_t port,
                                            const size_t req_total_size,
                                            const size_t resp_meta_size,
-                                           const size_t resp_body_size)
+                                           const size_t resp_body_size,
+                                           const int8_t priority)
 {
-    const string hostname(host);
-
     vlogself(2) << "got RequestResource: id " << req_res_req_id
-                << " [" << hostname << ":" << port << "] "
+                << " [" << host << ":" << port << "] "
                 << ", " << req_total_size
                 << ", " << resp_meta_size
-                << ", " << resp_body_size;
-
-    shared_ptr<Request> req(
-        new Request(
-            webkit_resInstNum,
-            hostname, port, req_total_size,
-            resp_meta_size, resp_body_size,
-            NULL,
-            boost::bind(
-                &HttpNetworkSession::_response_meta_cb, this, _1, _2, _3),
-            boost::bind(
-                &HttpNetworkSession::_response_body_data_cb, this, _1, _2, _3),
-            boost::bind(
-                &HttpNetworkSession::_response_done_cb, this, _1, true)
-            ),
-        [](Request* req) { req->destroy(); }
-        );
-    connman_->submit_request(req.get());
-
-    PendingRequestInfo pri;
+                << ", " << resp_body_size
+                << ", priority " << int(priority);
+
+    CHECK_GE(priority, blink::ResourceLoadPriorityLowest);
+    CHECK_LE(priority, blink::ResourceLoadPriorityHighest);
+
+    auto req = new Request(
+        this, webkit_resInstNum,
+        connman_->get_netloc_id(host, port),
+        req_total_size, resp_meta_size, resp_body_size);
+    req->set_priority(priority);
+    // our throttling counts as queueing too
+    req->set_submit_time_ms(common::gettimeofdayMs(nullptr));
+
+    auto& pri = pending_requests_[req->objId()];
+    CHECK(!pri.req);
     pri.req_res_req_id = req_res_req_id;
-    pri.req = req;
-    const auto ret = pending_requests_.insert(make_pair(req->objId(), pri));
-    CHECK(ret.second);
+    pri.req.reset(req);
+    pri.in_flight = false;
+    pri.cancelled = false;
 
     vlogself(2) << "req id: " << req_res_req_id
                 << " res:" << webkit_resInstNum
                 << " linked up with req= " << req->objId();
+
+    // don't let it jump ahead of throttled requests of the same or
+    // higher priority
+    const bool outranks_throttled =
+        throttled_requests_.empty()
+        || (priority > throttled_requests_.begin()->req->priority());
+    if (outranks_throttled
+        && (_should_start_request(req) == StartDecision::START))
+    {
+        _start_request(req);
+    } else {
+        vlogself(2) << "throttle req= " << req->objId();
+        throttled_requests_.insert({req, next_throttled_req_seq_++});
+    }
+}
+
+void
+HttpNetworkSession::handle_CancelRequests(const std::vector<int>& req_res_req_ids,
+                                          const bool has_body)
+{
+    vlogself(2) << "begin, cancel " << req_res_req_ids.size()
+                << " requests, has_body= " << has_body;
+
+    const std::unordered_set<int> ids(req_res_req_ids.begin(),
+                                      req_res_req_ids.end());
+    std::vector<uint32_t> req_objIds;
+    for (const auto& kv : pending_requests_) {
+        if (!kv.second.cancelled && inSet(ids, kv.second.req_res_req_id)) {
+            req_objIds.push_back(kv.first);
+        }
+    }
+
+    for (const auto& req_objId : req_objIds) {
+        // taking back one request can fail others, which the conn
+        // man tells us about right away
+        auto it = pending_requests_.find(req_objId);
+        if (it == pending_requests_.end()) {
+            continue;
+        }
+        auto& pri = it->second;
+        auto req = pri.req.get();
+
+        if (!pri.in_flight) {
+            auto throttled_it = std::find_if(
+                throttled_requests_.begin(), throttled_requests_.end(),
+                [&](const ThrottledRequest& tr) { return tr.req == req; });
+            CHECK(throttled_it != throttled_requests_.end());
+            throttled_requests_.erase(throttled_it);
+        } else {
+            _uncount_in_flight_request(req);
+            if (!connman_->cancel_request(req)) {
+                vlogself(2) << "keep cancelled req= " << req_objId
+                            << " until it's done";
+                pri.cancelled = true;
+                continue;
+            }
+        }
+
+        vlogself(2) << "cancelled req= " << req_objId;
+        pending_requests_.erase(it);
+    }
+
+    has_body_ = has_body_ && has_body;
+
+    // the cancelled ones might have been holding others back
+    _maybe_start_throttled_requests();
+
+    vlogself(2) << "done";
 }
 
 void
-HttpNetworkSession::_response_meta_cb(const int& status,
-                                      char **headers,
-                                      Request* req)
+HttpNetworkSession::handle_WillInsertBody()
+{
+    vlogself(2) << "begin";
+
+    has_body_ = true;
+    _maybe_start_throttled_requests();
+
+    vlogself(2) << "done";
+}
+
+void
+HttpNetworkSession::handle_Preconnect(const char* host,
+                                      const uint16_t port,
+                                      const uint8_t num_connections)
+{
+    vlogself(2) << "preconnect " << unsigned(num_connections)
+                << " connections to [" << host << "]:" << port;
+
+    connman_->preconnect(host, port, num_connections);
+}
+
+HttpNetworkSession::StartDecision
+HttpNetworkSession::_should_start_request(Request* req) const
+{
+    if (!netconf_->throttle_delayable_requests()) {
+        return StartDecision::START;
+    }
+
+    if (req->priority() >= kDelayablePriorityThreshold) {
+        return StartDecision::START;
+    }
+
+    if (num_delayable_in_flight_ >= kMaxNumDelayableRequests) {
+        return StartDecision::STOP_SEARCHING;
+    }
+
+    if (!has_body_ && num_layout_blocking_in_flight_
+        && (num_delayable_in_flight_ >= kMaxNumDelayableWhileLayoutBlocking))
+    {
+        return StartDecision::STOP_SEARCHING;
+    }
+
+    const auto it = num_delayable_in_flight_per_host_.find(req->netloc_id_);
+    if ((it != num_delayable_in_flight_per_host_.end())
+        && (it->second >= kMaxNumDelayableRequestsPerHost))
+    {
+        return StartDecision::KEEP_SEARCHING;
+    }
+
+    return StartDecision::START;
+}
+
+void
+HttpNetworkSession::_start_request(Request* req)
+{
+    vlogself(2) << "start req= " << req->objId();
+
+    auto& pri = pending_requests_[req->objId()];
+    CHECK(!pri.in_flight);
+    pri.in_flight = true;
+
+    if (req->priority() < kDelayablePriorityThreshold) {
+        ++num_delayable_in_flight_;
+        ++num_delayable_in_flight_per_host_[req->netloc_id_];
+    } else if (req->priority() >= kLayoutBlockingPriorityThreshold) {
+        ++num_layout_blocking_in_flight_;
+    }
+
+    connman_->submit_request(req);
+}
+
+void
+HttpNetworkSession::_uncount_in_flight_request(Request* req)
+{
+    if (req->priority() < kDelayablePriorityThreshold) {
+        CHECK_GT(num_delayable_in_flight_, 0);
+        --num_delayable_in_flight_;
+        auto& per_host = num_delayable_in_flight_per_host_[req->netloc_id_];
+        CHECK_GT(per_host, 0);
+        --per_host;
+    } else if (req->priority() >= kLayoutBlockingPriorityThreshold) {
+        CHECK_GT(num_layout_blocking_in_flight_, 0);
+        --num_layout_blocking_in_flight_;
+    }
+}
+
+void
+HttpNetworkSession::_maybe_start_throttled_requests()
+{
+    auto it = throttled_requests_.begin();
+    while (it != throttled_requests_.end()) {
+        auto req = it->req;
+        const auto decision = _should_start_request(req);
+        if (decision == StartDecision::START) {
+            throttled_requests_.erase(it);
+            _start_request(req);
+            // the conn man might have called us back and changed the
+            // set, so start over
+            it = throttled_requests_.begin();
+        } else if (decision == StartDecision::KEEP_SEARCHING) {
+            ++it;
+        } else {
+            break;
+        }
+    }
+}
+
+void
+HttpNetworkSession::onResponseMeta(Request* req, const int status,
+                                   char **headers) noexcept
 {
     const auto req_objId = req->objId();
     vlogself(2) << "begin, res:" << req->webkit_resInstNum_;
@@ -128,7 +330,11 @@ HttpNetworkSession::_response_meta_cb(const int& status,
         logself(FATAL) << "unknown req= " << req_objId;
     }
 
-    const auto req_res_req_id = pending_requests_[req_objId].req_res_req_id;
+    const auto& pri = pending_requests_[req_objId];
+    if (pri.cancelled) {
+        return;
+    }
+    const auto req_res_req_id = pri.req_res_req_id;
 
     // tell renderer
     ipcserver_->send_ReceivedResponse(routing_id_, req_res_req_id,
@@ -138,8 +344,8 @@ HttpNetworkSession::_response_meta_cb(const int& status,
 }
 
 void
-HttpNetworkSession::_response_body_data_cb(
-    const uint8_t *data, const size_t& len, Request* req)
+HttpNetworkSession::onResponseBodyData(Request* req, const uint8_t *data,
+                                       const size_t& len) noexcept
 {
     const auto req_objId = req->objId();
     vlogself(2) << "begin, res:" << req->webkit_resInstNum_
@@ -151,7 +357,11 @@ HttpNetworkSession::_response_body_data_cb(
         logself(FATAL) << "unknown req= " << req_objId;
     }
 
-    const auto req_res_req_id = pending_requests_[req_objId].req_res_req_id;
+    const auto& pri = pending_requests_[req_objId];
+    if (pri.cancelled) {
+        return;
+    }
+    const auto req_res_req_id = pri.req_res_req_id;
 
     // tell renderer about the body data chunk (just its size)
     ipcserver_->send_DataReceived(routing_id_, req_res_req_id, len);
@@ -159,6 +369,11 @@ HttpNetworkSession::_response_body_data_cb(
     vlogself(2) << "done";
 }
 
+void
+HttpNetworkSession::onResponseDone(Request* req) noexcept
+{
+    _response_done_cb(req, true);
+}
 
 void
 HttpNetworkSession::_response_done_cb(Request* req, bool success)
@@ -170,16 +385,48 @@ HttpNetworkSession::_response_done_cb(Request* req, bool success)
         logself(FATAL) << "unknown req= " << req_objId;
     }
 
-    const auto req_res_req_id = pending_requests_[req_objId].req_res_req_id;
+    const auto& pri = pending_requests_[req_objId];
+    // only requests we have started can get here
+    CHECK(pri.in_flight);
+    if (pri.cancelled) {
+        // already uncounted, and the renderer doesn't want to know
+        vlogself(2) << "cancelled req= " << req_objId << " is done";
+        pending_requests_.erase(req_objId);
+        return;
+    }
+    const auto req_res_req_id = pri.req_res_req_id;
 
     if (!success) {
         logself(WARNING) << "req= " << req_objId << " failed";
     }
 
+    /* break the request's time down into network phases. the first
+     * byte might be from an earlier try */
+    const auto now = common::gettimeofdayMs(nullptr);
+    const auto& sent_ms = req->sent_time_ms();
+    const auto& first_byte_ms = req->first_byte_time_ms();
+    const auto& connect_ms = req->connect_wait_ms();
+    uint32_t queue_ms = 0, wait_ms = 0, transfer_ms = 0;
+    if (sent_ms) {
+        queue_ms = sent_ms - req->submit_time_ms() - connect_ms;
+        if (first_byte_ms >= sent_ms) {
+            wait_ms = first_byte_ms - sent_ms;
+        }
+    }
+    if (first_byte_ms) {
+        transfer_ms = now - first_byte_ms;
+    }
+
     // tell renderer we're done with the request
-    ipcserver_->send_RequestComplete(routing_id_, req_res_req_id, success);
+    ipcserver_->send_RequestComplete(routing_id_, req_res_req_id, success,
+                                     queue_ms, connect_ms, wait_ms,
+                                     transfer_ms, req->sent_on_conn_id());
+
+    _uncount_in_flight_request(req);
 
     pending_requests_.erase(req_objId);
 
+    _maybe_start_throttled_requests();
+
     vlogself(2) << "done";
 }
@@ -23,6 +23,9 @@
 
 #include <memory>
 #include <map>
+#include <set>
+#include <unordered_map>
+#include <vector>
 
 #include "../../utility/object.hpp"
 #include "../../utility/http/request.hpp"
@@ -34,6 +37,7 @@
 
 
 class HttpNetworkSession : public Object
+                         , public http::RequestObserver
 {
 public:
     typedef std::unique_ptr<HttpNetworkSession, /*folly::*/Destructor> UniquePtr;
@@ -49,18 +53,54 @@ public:
                                            const uint16_t port,
                                            const size_t req_total_size,
                                            const size_t resp_meta_size,
-                                const size_t resp_body_size);
+                                const size_t resp_body_size,
+                                const int8_t priority);
 
     void handle_ResetSession();
+    /* the renderer no longer wants these requests (its ids, as in
+     * RequestResource), e.g., their page load has been dropped. we
+     * won't tell it about them anymore. "has_body" is whether the
+     * renderer's remaining page loads still count as having their
+     * body (see WillInsertBody) */
+    void handle_CancelRequests(const std::vector<int>& req_res_req_ids,
+                               const bool has_body);
+    void handle_WillInsertBody();
+    void handle_Preconnect(const char* host, const uint16_t port,
+                           const uint8_t num_connections);
 
 private:
 
     virtual ~HttpNetworkSession() = default;
 
-    void _response_meta_cb(const int& status, char **headers,
-                           http::Request* req);
-    void _response_body_data_cb(const uint8_t *data, const size_t& len,
-                                http::Request* req);
+    /***** RequestObserver interface, for all our requests */
+    virtual void onResponseMeta(http::Request*, const int status,
+                                char **headers) noexcept override;
+    virtual void onResponseBodyData(http::Request*, const uint8_t *data,
+                                    const size_t& len) noexcept override;
+    virtual void onResponseDone(http::Request*) noexcept override;
+
+    /* like chrome's ResourceScheduler: "delayable" (i.e., low
+     * priority) requests are held back while they would compete with
+     * requests that block layout, so that e.g. images don't take the
+     * connections that the stylesheets need. non-delayable requests
+     * are never held back.
+     *
+     * the conn man then dispatches whatever we start highest priority
+     * first.
+     */
+    enum class StartDecision
+    {
+        START,
+        /* this one can't start, but a lower priority one might */
+        KEEP_SEARCHING,
+        STOP_SEARCHING,
+    };
+    StartDecision _should_start_request(http::Request*) const;
+    void _start_request(http::Request*);
+    void _maybe_start_throttled_requests();
+    /* the started request no longer counts against the limits */
+    void _uncount_in_flight_request(http::Request*);
+
     void _response_done_cb(http::Request* req, bool success);
 
     /////////////
@@ -78,9 +118,43 @@ private:
     struct PendingRequestInfo
     {
         int req_res_req_id; /* from the requestresource msg */
-        std::shared_ptr<http::Request> req;
+        http::Request::UniquePtr req;
+        /* submitted to the conn man, i.e., not throttled (anymore) */
+        bool in_flight;
+        /* the renderer has cancelled it, but the conn man couldn't
+         * take it back, so we keep it until it's done, without
+         * telling the renderer about it */
+        bool cancelled;
     };
     std::map<uint32_t, PendingRequestInfo > pending_requests_;
+
+    /* the requests we're holding back, in the order we want to start
+     * them */
+    struct ThrottledRequest
+    {
+        http::Request* req;
+        uint64_t seq;
+
+        bool operator<(const ThrottledRequest& other) const
+        {
+            if (req->priority() != other.req->priority()) {
+                return req->priority() > other.req->priority();
+            }
+            return seq < other.seq;
+        }
+    };
+    std::set<ThrottledRequest> throttled_requests_;
+    uint64_t next_throttled_req_seq_;
+
+    /* the renderer has told us it's about to have the body element.
+     * if the renderer is loading several pages, this is for whichever
+     * got its body first, until the renderer cancels that page's
+     * requests */
+    bool has_body_;
+    size_t num_delayable_in_flight_;
+    size_t num_layout_blocking_in_flight_;
+    /* keyed by the conn man's netloc id */
+    std::unordered_map<uint32_t, size_t> num_delayable_in_flight_per_host_;
 };
 
 #endif /* end http_session_hpp */
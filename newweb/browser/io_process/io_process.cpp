@@ -6,6 +6,7 @@
 #include <boost/lexical_cast.hpp>
 
 #include "../../utility/tcp_server.hpp"
+#include "../../utility/shm_ring_server.hpp"
 #include "../../utility/common.hpp"
 #include "../../utility/easylogging++.h"
 #include "ipc.hpp"
@@ -22,12 +23,40 @@ struct MyConfig
     MyConfig()
         : socks5_port(0)
         , ioservice_ipcport(common::ports::io_service_ipc)
+        , ioservice_ipc_transport("tcp")
+        , use_spdy(false)
+        , http_pipeline_depth(1)
+        , throttle_delayable_requests(true)
+        , max_retries_per_resource(0)
+        , hedge_ttfb_percentile(0)
+        , data_received_flush_bytes(64 * 1024)
     {
     }
 
     std::string socks5_host;
     uint16_t socks5_port;
     uint16_t ioservice_ipcport;
+    /* "tcp" or "shm": how the renderer talks to us. must match the
+     * renderer's. "shm" is native only */
+    std::string ioservice_ipc_transport;
+    /* talk spdy to the webservers: one multiplexed connection per
+     * server */
+    bool use_spdy;
+    /* max number of http requests in flight per connection; 1 means
+     * no pipelining */
+    uint8_t http_pipeline_depth;
+    /* hold back low priority requests while they'd compete with the
+     * ones that block layout, like chrome does */
+    bool throttle_delayable_requests;
+    /* how many times to re-send a request whose connection fails */
+    uint8_t max_retries_per_resource;
+    /* send a copy of a request that has waited this percentile of
+     * recent times-to-first-byte; 0 means don't */
+    uint8_t hedge_ttfb_percentile;
+    /* we tell the renderer about response body data at most once per
+     * event loop iteration, unless a route has this many bytes to
+     * tell it about; 0 means tell it about each chunk right away */
+    uint32_t data_received_flush_bytes;
 
 #ifdef IN_SHADOW
     uint16_t tor_socks_port;
@@ -56,6 +85,53 @@ set_my_config(MyConfig& conf,
             conf.ioservice_ipcport = boost::lexical_cast<uint16_t>(value);
         }
 
+        else if (name == "ioservice-ipc-transport") {
+            CHECK((value == "tcp") || (value == "shm"))
+                << "use tcp or shm for ioservice-ipc-transport";
+#ifdef IN_SHADOW
+            CHECK_EQ(value, "tcp") << "shadow doesn't have shared memory";
+#endif
+            conf.ioservice_ipc_transport = value;
+        }
+
+        else if (name == "use-spdy") {
+            CHECK((value == "yes") || (value == "no"))
+                << "use yes or no for use-spdy";
+            conf.use_spdy = (value == "yes");
+        }
+
+        else if (name == "http-pipeline-depth") {
+            // lexical_cast<uint8_t> would take just one character
+            const auto depth = boost::lexical_cast<uint16_t>(value);
+            CHECK((depth > 0) && (depth <= 255))
+                << "bad value for http-pipeline-depth: " << value;
+            conf.http_pipeline_depth = depth;
+        }
+
+        else if (name == "throttle-delayable-requests") {
+            CHECK((value == "yes") || (value == "no"))
+                << "use yes or no for throttle-delayable-requests";
+            conf.throttle_delayable_requests = (value == "yes");
+        }
+
+        else if (name == "max-retries-per-resource") {
+            const auto retries = boost::lexical_cast<uint16_t>(value);
+            CHECK_LE(retries, 255)
+                << "bad value for max-retries-per-resource: " << value;
+            conf.max_retries_per_resource = retries;
+        }
+
+        else if (name == "hedge-ttfb-percentile") {
+            const auto percentile = boost::lexical_cast<uint16_t>(value);
+            CHECK_LE(percentile, 100)
+                << "bad value for hedge-ttfb-percentile: " << value;
+            conf.hedge_ttfb_percentile = percentile;
+        }
+
+        else if (name == "data-received-flush-bytes") {
+            conf.data_received_flush_bytes = boost::lexical_cast<uint32_t>(value);
+        }
+
         else if (name == "tor-socks-port") {
 #ifdef IN_SHADOW
             conf.tor_socks_port = boost::lexical_cast<uint16_t>(value);
@@ -179,13 +255,60 @@ int main(int argc, char **argv)
         netconf.set_socks5_port(conf.socks5_port);
     }
 
-    LOG(INFO) << "my ipc server listens on " << conf.ioservice_ipcport;
+    if (conf.use_spdy) {
+        LOG(INFO) << "using spdy to talk to webservers";
+        netconf.set_use_spdy(true);
+    }
+
+    if (conf.http_pipeline_depth > 1) {
+        LOG(INFO) << "pipelining up to " << unsigned(conf.http_pipeline_depth)
+                  << " http requests per connection";
+        netconf.set_http_pipeline_depth(conf.http_pipeline_depth);
+    }
+
+    if (!conf.throttle_delayable_requests) {
+        LOG(INFO) << "not throttling delayable requests";
+        netconf.set_throttle_delayable_requests(false);
+    }
+
+    if (conf.max_retries_per_resource) {
+        LOG(INFO) << "retrying requests up to "
+                  << unsigned(conf.max_retries_per_resource) << " times";
+        netconf.set_max_retries_per_resource(conf.max_retries_per_resource);
+    }
 
-    myio::TCPServer::UniquePtr tcpServerForIPC(
-        new myio::TCPServer(evbase.get(), common::getaddr("localhost"),
-                            conf.ioservice_ipcport, nullptr));
+    if (conf.hedge_ttfb_percentile) {
+        LOG(INFO) << "hedging requests slower than the "
+                  << unsigned(conf.hedge_ttfb_percentile)
+                  << "th percentile time-to-first-byte";
+        netconf.set_hedge_ttfb_percentile(conf.hedge_ttfb_percentile);
+    }
+
+    if (conf.data_received_flush_bytes) {
+        LOG(INFO) << "coalescing DataReceived's of up to "
+                  << conf.data_received_flush_bytes << " bytes";
+    } else {
+        LOG(INFO) << "not coalescing DataReceived's";
+    }
+    netconf.set_data_received_flush_bytes(conf.data_received_flush_bytes);
+
+    myio::StreamServer::UniquePtr serverForIPC;
+#ifndef IN_SHADOW
+    if (conf.ioservice_ipc_transport == "shm") {
+        const auto name = common::ioservice_ipc_shm_name(conf.ioservice_ipcport);
+        LOG(INFO) << "my ipc server listens on shm " << name;
+        serverForIPC.reset(
+            new myio::ShmRingServer(evbase.get(), name, nullptr));
+    } else
+#endif
+    {
+        LOG(INFO) << "my ipc server listens on " << conf.ioservice_ipcport;
+        serverForIPC.reset(
+            new myio::TCPServer(evbase.get(), common::getaddr("localhost"),
+                                conf.ioservice_ipcport, nullptr));
+    }
     IPCServer::UniquePtr ipcserver(
-        new IPCServer(evbase.get(), std::move(tcpServerForIPC), &netconf));
+        new IPCServer(evbase.get(), std::move(serverForIPC), &netconf));
 
     /* ***************************************** */
 
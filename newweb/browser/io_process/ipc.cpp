@@ -1,5 +1,6 @@
 
 #include <boost/bind.hpp>
+#include <algorithm>
 
 #include "ipc.hpp"
 #include "../../utility/common.hpp"
@@ -18,6 +19,11 @@ namespace msgs = myipc::ioservice::messages;
 using msgs::type;
 
 using std::shared_ptr;
+using std::pair;
+
+/* a DataReceivedBatch message has to fit in the ipc channel's
+ * max_msg_len(); this is room for what it has besides the entries */
+static const size_t kDataReceivedBatchOverhead = 256;
 
 
 #define _LOG_PREFIX(inst) << "ipcserv= " << (inst)->objId() << ": "
@@ -39,11 +45,10 @@ using std::shared_ptr;
     VLOG(2) << "begin building msg type: " << msgs::EnumNametype(__type); \
     msgs::TYPE ## MsgBuilder msgbuilder(bufbuilder);                    \
     SCOPE_EXIT {                                                        \
-        auto msg = msgbuilder.Finish();                                 \
-        bufbuilder.Finish(msg);                                         \
+        const auto __len = bufbuilder.finish_msg(msgbuilder);           \
         VLOG(2) << "send msg";                                          \
         ipc_ch->sendMsg(                                                \
-            __type, bufbuilder.GetSize(),                               \
+            __type, __len,                                              \
             bufbuilder.GetBufferPointer());                             \
     }
 
@@ -59,6 +64,11 @@ IPCServer::IPCServer(struct event_base* evbase,
     stream_server_->set_observer(this);
     vlogself(2) << "tell stream server to start accepting";
     stream_server_->start_accepting();
+
+    flush_data_received_timer_.reset(
+        new Timer(evbase_, true,
+                  boost::bind(&IPCServer::_on_flush_data_received_timer_fired,
+                              this, _1)));
 }
 
 void
@@ -69,11 +79,13 @@ IPCServer::send_ReceivedResponse(const int& routing_id,
     vlogself(2) << "begin, req_id: " << req_id
                 << " first_byte_time_ms: " << first_byte_time_ms;
 
+    _flush_data_received(routing_id);
+
     CHECK(inMap(client_ipc_channels_, routing_id));
     auto ipc_ch = client_ipc_channels_[routing_id].get();
     CHECK_NOTNULL(ipc_ch);
     {
-        flatbuffers::FlatBufferBuilder bufbuilder;
+        auto& bufbuilder = bufbuilder_.start();
         BEGIN_BUILD_MSG_AND_SEND_AT_END(ReceivedResponse, bufbuilder, ipc_ch);
 
         msgbuilder.add_req_id(req_id);
@@ -91,37 +103,121 @@ IPCServer::send_DataReceived(const int& routing_id,
     vlogself(2) << "begin, req_id: " << req_id
                 << " len: " << len;
 
+    CHECK(inMap(client_ipc_channels_, routing_id));
+    CHECK_GT(len, 0);
+
+    // larger once the renderer has taken up our offer of large msgs
+    const auto max_num_per_batch =
+        (client_ipc_channels_[routing_id]->max_msg_len()
+         - kDataReceivedBatchOverhead) / sizeof(msgs::DataReceivedEntry);
+
+    auto& pending = pending_data_received_[routing_id];
+    auto it = std::find_if(
+        pending.lengths.begin(), pending.lengths.end(),
+        [&](const pair<int, uint32_t>& p) { return p.first == req_id; });
+    if (it != pending.lengths.end()) {
+        it->second += len;
+    } else {
+        pending.lengths.push_back(std::make_pair(req_id, len));
+    }
+    pending.num_bytes += len;
+
+    if ((pending.num_bytes >= netconf_->data_received_flush_bytes())
+        || (pending.lengths.size() >= max_num_per_batch))
+    {
+        _flush_data_received(routing_id);
+    } else if (!flush_data_received_timer_->is_running()) {
+        // a zero timeout fires once the loop has handled the other
+        // events that are ready now
+        flush_data_received_timer_->start(0u);
+    }
+
+    vlogself(2) << "done";
+}
+
+void
+IPCServer::_flush_data_received(const uint32_t& routing_id)
+{
+    auto it = pending_data_received_.find(routing_id);
+    if ((it == pending_data_received_.end()) || it->second.lengths.empty()) {
+        return;
+    }
+
+    auto& lengths = it->second.lengths;
+    vlogself(2) << "tell route " << routing_id << " about "
+                << it->second.num_bytes << " bytes of "
+                << lengths.size() << " requests";
+
     CHECK(inMap(client_ipc_channels_, routing_id));
     auto ipc_ch = client_ipc_channels_[routing_id].get();
     CHECK_NOTNULL(ipc_ch);
-    {
-        flatbuffers::FlatBufferBuilder bufbuilder;
+
+    if (lengths.size() == 1) {
+        auto& bufbuilder = bufbuilder_.start();
         BEGIN_BUILD_MSG_AND_SEND_AT_END(DataReceived, bufbuilder, ipc_ch);
 
-        msgbuilder.add_req_id(req_id);
-        msgbuilder.add_length(len);
+        msgbuilder.add_req_id(lengths[0].first);
+        msgbuilder.add_length(lengths[0].second);
+    } else {
+        auto& bufbuilder = bufbuilder_.start();
+        data_received_entries_.clear();
+        for (const auto& p : lengths) {
+            data_received_entries_.push_back(
+                msgs::DataReceivedEntry(p.first, p.second));
+        }
+        auto entries = bufbuilder.CreateVectorOfStructs(data_received_entries_);
+
+        BEGIN_BUILD_MSG_AND_SEND_AT_END(DataReceivedBatch, bufbuilder, ipc_ch);
+
+        msgbuilder.add_entries(entries);
     }
 
-    vlogself(2) << "done";
+    lengths.clear();
+    it->second.num_bytes = 0;
+}
+
+void
+IPCServer::_on_flush_data_received_timer_fired(Timer*)
+{
+    for (auto it = pending_data_received_.begin();
+         it != pending_data_received_.end(); )
+    {
+        // sending might remove the route
+        const auto routing_id = it->first;
+        ++it;
+        _flush_data_received(routing_id);
+    }
 }
 
 void
 IPCServer::send_RequestComplete(const int& routing_id,
                                 const int& req_id,
-                                const bool& success)
+                                const bool& success,
+                                const uint32_t& queue_ms,
+                                const uint32_t& connect_ms,
+                                const uint32_t& wait_ms,
+                                const uint32_t& transfer_ms,
+                                const uint32_t& conn_id)
 {
     vlogself(2) << "begin, req_id: " << req_id
                 << " success: " << success;
 
+    _flush_data_received(routing_id);
+
     CHECK(inMap(client_ipc_channels_, routing_id));
     auto ipc_ch = client_ipc_channels_[routing_id].get();
     CHECK_NOTNULL(ipc_ch);
     {
-        flatbuffers::FlatBufferBuilder bufbuilder;
+        auto& bufbuilder = bufbuilder_.start();
         BEGIN_BUILD_MSG_AND_SEND_AT_END(RequestComplete, bufbuilder, ipc_ch);
 
         msgbuilder.add_req_id(req_id);
         msgbuilder.add_success(success);
+        msgbuilder.add_queue_ms(queue_ms);
+        msgbuilder.add_connect_ms(connect_ms);
+        msgbuilder.add_wait_ms(wait_ms);
+        msgbuilder.add_transfer_ms(transfer_ms);
+        msgbuilder.add_conn_id(conn_id);
     }
 
     vlogself(2) << "done";
@@ -134,7 +230,8 @@ IPCServer::_handle_RequestResource(const int& routing_id,
     hsessions_[routing_id]->handle_RequestResource(
         msg->req_id(), msg->webkit_resInstNum(),
         msg->host()->c_str(), msg->port(),
-        msg->req_total_size(), msg->resp_meta_size(), msg->resp_body_size());
+        msg->req_total_size(), msg->resp_meta_size(), msg->resp_body_size(),
+        msg->priority());
 }
 
 void
@@ -144,6 +241,36 @@ IPCServer::_handle_ResetSession(const int& routing_id,
     hsessions_[routing_id]->handle_ResetSession();
 }
 
+void
+IPCServer::_handle_CancelRequests(const int& routing_id,
+                                  const msgs::CancelRequestsMsg* msg)
+{
+    const auto ids = msg->req_ids();
+    CHECK_NOTNULL(ids);
+
+    std::vector<int> req_ids;
+    req_ids.reserve(ids->size());
+    for (const auto req_id : *ids) {
+        req_ids.push_back(req_id);
+    }
+    hsessions_[routing_id]->handle_CancelRequests(req_ids, msg->has_body());
+}
+
+void
+IPCServer::_handle_WillInsertBody(const int& routing_id,
+                                  const msgs::WillInsertBodyMsg*)
+{
+    hsessions_[routing_id]->handle_WillInsertBody();
+}
+
+void
+IPCServer::_handle_Preconnect(const int& routing_id,
+                              const msgs::PreconnectMsg* msg)
+{
+    hsessions_[routing_id]->handle_Preconnect(
+        msg->host()->c_str(), msg->port(), msg->num_connections());
+}
+
 void
 IPCServer::onAccepted(StreamServer*, StreamChannel::UniquePtr channel) noexcept
 {
@@ -162,6 +289,8 @@ IPCServer::_setup_client(StreamChannel::UniquePtr channel)
             boost::bind(&IPCServer::_on_msg_recv, this, _1, _2, _3, _4),
             boost::bind(&IPCServer::_on_called, this, _1, _2, _3, _4, _5),
             boost::bind(&IPCServer::_on_channel_status, this, _1, _2)));
+    // DataReceivedBatch msgs can be big
+    ch->offer_large_msgs();
 
     // use the id of the generic msg channel, not the stream channel,
     // as the routing id
@@ -188,7 +317,7 @@ IPCServer::_setup_client(StreamChannel::UniquePtr channel)
 
 void
 IPCServer::_on_msg_recv(GenericIpcChannel* channel, uint8_t type,
-                        uint16_t len, const uint8_t* buf)
+                        uint32_t len, const uint8_t* buf)
 {
     const auto routing_id = channel->objId();
 
@@ -199,6 +328,9 @@ IPCServer::_on_msg_recv(GenericIpcChannel* channel, uint8_t type,
 
         IPC_MSG_HANDLER(RequestResource)
         IPC_MSG_HANDLER(ResetSession)
+        IPC_MSG_HANDLER(CancelRequests)
+        IPC_MSG_HANDLER(WillInsertBody)
+        IPC_MSG_HANDLER(Preconnect)
 
     default:
         logself(FATAL) << "invalid IPC message type " << type;
@@ -209,7 +341,7 @@ IPCServer::_on_msg_recv(GenericIpcChannel* channel, uint8_t type,
 
 void
 IPCServer::_on_called(GenericIpcChannel*, uint32_t id, uint8_t type,
-                        uint16_t len, const uint8_t* buf)
+                        uint32_t len, const uint8_t* buf)
 {
     logself(FATAL) << "to do";
 }
@@ -228,6 +360,7 @@ IPCServer::_remove_route(const uint32_t& routing_id)
 {
     client_ipc_channels_.erase(routing_id);
     hsessions_.erase(routing_id);
+    pending_data_received_.erase(routing_id);
 }
 
 void
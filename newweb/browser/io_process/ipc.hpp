@@ -2,10 +2,13 @@
 #define ipc_hpp
 
 #include <map>
+#include <vector>
 
 #include "../../utility/stream_server.hpp"
 #include "../../utility/ipc/generic_ipc_channel.hpp"
+#include "../../utility/ipc/msg_buf_builder.hpp"
 #include "../../utility/object.hpp"
+#include "../../utility/timer.hpp"
 #include "utility/ipc/io_service/gen/combined_headers"
 
 #include "net_config.hpp"
@@ -35,14 +38,28 @@ public:
                                const int& req_id,
                                const uint64_t& first_byte_time_ms);
 
-    /* notify renderer a chunk of response body is received */
+    /* notify renderer a chunk of response body is received.
+     *
+     * the renderer doesn't get told right away: we add up the lengths
+     * per request, and tell it about all the requests of the route in
+     * one message at the end of this event loop iteration, or sooner
+     * if the route has netconf's data_received_flush_bytes() to tell
+     * about. any other message to the route first flushes these, so
+     * e.g. RequestComplete still comes after all of the request's
+     * data */
     void send_DataReceived(const int& routing_id,
                            const int& req_id,
                            const int& len);
 
+    /* with the request's network phases: see RequestCompleteMsg */
     void send_RequestComplete(const int& routing_id,
                               const int& req_id,
-                              const bool& success);
+                              const bool& success,
+                              const uint32_t& queue_ms,
+                              const uint32_t& connect_ms,
+                              const uint32_t& wait_ms,
+                              const uint32_t& transfer_ms,
+                              const uint32_t& conn_id);
 
 private:
 
@@ -58,14 +75,24 @@ private:
                                  const myipc::ioservice::messages::RequestResourceMsg*);
     void _handle_ResetSession(const int&,
                               const myipc::ioservice::messages::ResetSessionMsg*);
+    void _handle_CancelRequests(const int&,
+                                const myipc::ioservice::messages::CancelRequestsMsg*);
+    void _handle_WillInsertBody(const int&,
+                                const myipc::ioservice::messages::WillInsertBodyMsg*);
+    void _handle_Preconnect(const int&,
+                            const myipc::ioservice::messages::PreconnectMsg*);
 
     void _setup_client(StreamChannel::UniquePtr);
     void _remove_route(const uint32_t& routing_id);
 
+    /* send the route's coalesced DataReceived's, if any */
+    void _flush_data_received(const uint32_t& routing_id);
+    void _on_flush_data_received_timer_fired(Timer*);
+
     void _on_msg_recv(myipc::GenericIpcChannel*, uint8_t,
-                      uint16_t, const uint8_t*);
+                      uint32_t, const uint8_t*);
     void _on_called(myipc::GenericIpcChannel*, uint32_t, uint8_t,
-                      uint16_t, const uint8_t*);
+                      uint32_t, const uint8_t*);
     void _on_channel_status(myipc::GenericIpcChannel*,
                             myipc::GenericIpcChannel::ChannelStatus);
 
@@ -86,6 +113,26 @@ private:
     /* multiple clients, with different routing ids, can share the
      * same session */
     std::map<uint32_t, std::shared_ptr<HttpNetworkSession> > hsessions_;
+
+    /* reused to build the msgs we send, to all the routes */
+    myipc::MsgBufBuilder bufbuilder_;
+
+    /* the body data lengths, per request, that we have yet to tell a
+     * route about */
+    struct PendingDataReceived
+    {
+        /* (req_id, length), in the order of their first data */
+        std::vector<std::pair<int, uint32_t> > lengths;
+        size_t num_bytes = 0;
+    };
+    /* map keys are the routing ids. we keep a route's entry, once
+     * created, until the route is gone, to reuse its vector */
+    std::map<uint32_t, PendingDataReceived> pending_data_received_;
+    /* fires at the end of the event loop iteration in which there
+     * first was pending data */
+    Timer::UniquePtr flush_data_received_timer_;
+    /* scratch space for building DataReceivedBatch messages */
+    std::vector<myipc::ioservice::messages::DataReceivedEntry> data_received_entries_;
 };
 
 #endif /* end ipc_hpp */
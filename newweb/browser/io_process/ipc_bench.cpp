@@ -0,0 +1,392 @@
+/* benchmark of the renderer <-> io process ipc transports: runs a
+ * GenericIpcChannel over each transport, between this process and a
+ * forked echo server, the way the renderer talks to the io process.
+ *
+ * usage: ipc-bench [--transports=tcp,shm] [--msg-sizes=64,512,4096]
+ *            [--num-msgs=200000] [--window=64] [--tcp-port=16000]
+ *
+ * for each (transport, msg size), we keep "window" msgs in flight
+ * until the server has echoed "num-msgs" msgs back. the results go to
+ * stdout as csv, one row per (transport, msg size):
+ *
+ *   - msgs_per_sec: echoed msgs per second of the run
+ *   - cpu_us_per_msg: cpu (user + sys) of both processes over the
+ *     run, per echoed msg
+ *   - mean_rtt_us: mean time from sending a msg until its echo
+ *     arrives; includes queueing behind the rest of the window
+ */
+
+#include <stdio.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/algorithm/string.hpp>
+#include <event2/event.h>
+
+#include "../../utility/common.hpp"
+#include "../../utility/tcp_channel.hpp"
+#include "../../utility/tcp_server.hpp"
+#include "../../utility/shm_ring_channel.hpp"
+#include "../../utility/shm_ring_server.hpp"
+#include "../../utility/ipc/generic_ipc_channel.hpp"
+#include "../../utility/easylogging++.h"
+
+
+using std::vector;
+using std::pair;
+using std::string;
+using myipc::GenericIpcChannel;
+
+typedef std::chrono::steady_clock Clock;
+
+
+static const char transports_name[] = "transports";
+static const char msg_sizes_name[] = "msg-sizes";
+static const char num_msgs_name[] = "num-msgs";
+static const char window_name[] = "window";
+static const char tcp_port_name[] = "tcp-port";
+
+static const uint8_t echo_msg_type = 1;
+
+struct BenchResult
+{
+    double wall_ms = 0;
+    double cpu_us = 0;
+    double mean_rtt_us = 0;
+};
+
+
+static double
+s_cpu_us(const int who)
+{
+    struct rusage ru;
+    const auto rv = getrusage(who, &ru);
+    CHECK_EQ(rv, 0);
+    return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000.0
+        + ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+static string
+s_shm_name(const uint16_t tcp_port)
+{
+    return "newweb-ipc-bench-" + std::to_string(tcp_port);
+}
+
+
+/* the echo server, in the child process */
+class EchoServer : public myio::StreamServerObserver
+{
+public:
+    explicit EchoServer(struct event_base* evbase)
+        : evbase_(evbase)
+    {}
+
+    virtual void onAccepted(myio::StreamServer*,
+                            myio::StreamChannel::UniquePtr channel) noexcept override
+    {
+        CHECK(!ipc_ch_);
+        ipc_ch_.reset(
+            new GenericIpcChannel(
+                evbase_, std::move(channel),
+                boost::bind(&EchoServer::_on_msg, this, _1, _2, _3, _4),
+                boost::bind(&EchoServer::_on_called, this, _1, _2, _3, _4, _5),
+                boost::bind(&EchoServer::_on_status, this, _1, _2)));
+    }
+
+    virtual void onAcceptError(myio::StreamServer*, int errorcode) noexcept override
+    {
+        LOG(FATAL) << "accept error: " << errorcode;
+    }
+
+private:
+
+    void _on_msg(GenericIpcChannel* ch, uint8_t type, uint32_t len,
+                 const uint8_t* data)
+    {
+        ch->sendMsg(type, len, data);
+    }
+
+    void _on_called(GenericIpcChannel*, uint32_t, uint8_t, uint32_t,
+                    const uint8_t*)
+    {
+        LOG(FATAL) << "not reached";
+    }
+
+    void _on_status(GenericIpcChannel*, GenericIpcChannel::ChannelStatus status)
+    {
+        if (status == GenericIpcChannel::ChannelStatus::CLOSED) {
+            // the bench is done with us
+            event_base_loopbreak(evbase_);
+        }
+    }
+
+    struct event_base* evbase_;
+    GenericIpcChannel::UniquePtr ipc_ch_;
+};
+
+/* fork the echo server; returns its pid once it is listening */
+static pid_t
+s_fork_echo_server(const string& transport, const uint16_t tcp_port)
+{
+    int pipefds[2];
+    auto rv = pipe(pipefds);
+    CHECK_EQ(rv, 0);
+
+    const auto pid = fork();
+    CHECK_GE(pid, 0);
+
+    if (pid) {
+        ::close(pipefds[1]);
+        char c;
+        rv = ::read(pipefds[0], &c, 1);
+        CHECK_EQ(rv, 1) << "echo server didn't start";
+        ::close(pipefds[0]);
+        return pid;
+    }
+
+    ::close(pipefds[0]);
+
+    // a fresh evbase: libevent's don't survive fork
+    std::unique_ptr<struct event_base, void(*)(struct event_base*)> evbase(
+        common::init_evbase(), event_base_free);
+    EchoServer echo_server(evbase.get());
+
+    myio::StreamServer::UniquePtr server;
+    if (transport == "shm") {
+        server.reset(new myio::ShmRingServer(
+                         evbase.get(), s_shm_name(tcp_port), &echo_server));
+    } else {
+        server.reset(new myio::TCPServer(
+                         evbase.get(), common::getaddr("localhost"),
+                         tcp_port, &echo_server));
+    }
+    server->start_accepting();
+
+    rv = ::write(pipefds[1], "r", 1);
+    CHECK_EQ(rv, 1);
+    ::close(pipefds[1]);
+
+    event_base_dispatch(evbase.get());
+    _exit(0);
+}
+
+
+/* the client side of one run */
+class BenchRun
+{
+public:
+    BenchRun(const string& transport, const uint16_t msg_size,
+             const uint32_t num_msgs, const uint32_t window,
+             const uint16_t tcp_port)
+        : transport_(transport), msg_size_(msg_size), num_msgs_(num_msgs)
+        , window_(window), tcp_port_(tcp_port)
+        , msg_(msg_size, 'x')
+    {}
+
+    BenchResult run();
+
+private:
+
+    void _send_one();
+    void _on_msg(GenericIpcChannel*, uint8_t type, uint32_t len,
+                 const uint8_t* data);
+    void _on_status(GenericIpcChannel*, GenericIpcChannel::ChannelStatus);
+
+    const string transport_;
+    const uint16_t msg_size_;
+    const uint32_t num_msgs_;
+    const uint32_t window_;
+    const uint16_t tcp_port_;
+
+    struct event_base* evbase_ = nullptr;
+    GenericIpcChannel::UniquePtr ipc_ch_;
+    /* the first bytes carry the send time */
+    string msg_;
+
+    uint32_t num_sent_ = 0;
+    uint32_t num_recv_ = 0;
+    double total_rtt_us_ = 0;
+};
+
+BenchResult
+BenchRun::run()
+{
+    const auto child_cpu_us_before = s_cpu_us(RUSAGE_CHILDREN);
+    const auto pid = s_fork_echo_server(transport_, tcp_port_);
+
+    std::unique_ptr<struct event_base, void(*)(struct event_base*)> evbase(
+        common::init_evbase(), event_base_free);
+    evbase_ = evbase.get();
+
+    myio::StreamChannel::UniquePtr channel;
+    if (transport_ == "shm") {
+        channel.reset(new myio::ShmRingChannel(
+                          evbase_, s_shm_name(tcp_port_), nullptr));
+    } else {
+        channel.reset(new myio::TCPChannel(
+                          evbase_, common::getaddr("localhost"),
+                          tcp_port_, nullptr));
+    }
+
+    const auto cpu_us_before = s_cpu_us(RUSAGE_SELF);
+    const auto start_tp = Clock::now();
+
+    ipc_ch_.reset(
+        new GenericIpcChannel(
+            evbase_, std::move(channel),
+            boost::bind(&BenchRun::_on_msg, this, _1, _2, _3, _4),
+            boost::bind(&BenchRun::_on_status, this, _1, _2)));
+
+    event_base_dispatch(evbase_);
+    CHECK_EQ(num_recv_, num_msgs_) << "channel closed early";
+
+    BenchResult result;
+    result.wall_ms = std::chrono::duration<double, std::milli>(
+        Clock::now() - start_tp).count();
+    result.cpu_us = s_cpu_us(RUSAGE_SELF) - cpu_us_before;
+    result.mean_rtt_us = total_rtt_us_ / num_recv_;
+
+    // closing the channel tells the server to exit
+    ipc_ch_.reset();
+    int status = 0;
+    const auto rv = waitpid(pid, &status, 0);
+    CHECK_EQ(rv, pid);
+    CHECK(WIFEXITED(status) && (WEXITSTATUS(status) == 0));
+    result.cpu_us += s_cpu_us(RUSAGE_CHILDREN) - child_cpu_us_before;
+
+    evbase_ = nullptr;
+    return result;
+}
+
+void
+BenchRun::_send_one()
+{
+    const int64_t now_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        Clock::now().time_since_epoch()).count();
+    memcpy(&msg_[0], &now_ns, sizeof now_ns);
+    ipc_ch_->sendMsg(echo_msg_type, msg_size_, (const uint8_t*)msg_.data());
+    ++num_sent_;
+}
+
+void
+BenchRun::_on_msg(GenericIpcChannel*, uint8_t type, uint32_t len,
+                  const uint8_t* data)
+{
+    CHECK_EQ(type, echo_msg_type);
+    CHECK_EQ(len, msg_size_);
+
+    int64_t sent_ns = 0;
+    memcpy(&sent_ns, data, sizeof sent_ns);
+    const int64_t now_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        Clock::now().time_since_epoch()).count();
+    total_rtt_us_ += (now_ns - sent_ns) / 1000.0;
+
+    ++num_recv_;
+    if (num_recv_ == num_msgs_) {
+        event_base_loopbreak(evbase_);
+    } else if (num_sent_ < num_msgs_) {
+        _send_one();
+    }
+}
+
+void
+BenchRun::_on_status(GenericIpcChannel*, GenericIpcChannel::ChannelStatus status)
+{
+    if (status == GenericIpcChannel::ChannelStatus::READY) {
+        while ((num_sent_ < window_) && (num_sent_ < num_msgs_)) {
+            _send_one();
+        }
+    } else {
+        event_base_loopbreak(evbase_);
+    }
+}
+
+
+static vector<string>
+s_parse_list(const string& value)
+{
+    vector<string> parts;
+    boost::split(parts, value, boost::is_any_of(","));
+    return parts;
+}
+
+INITIALIZE_EASYLOGGINGPP
+
+int main(int argc, char **argv)
+{
+    common::init_common();
+    common::init_easylogging();
+
+    START_EASYLOGGINGPP(argc, argv);
+
+    bool found_conf_name = false;
+    string found_conf_value;
+    vector<pair<string, string> > name_value_pairs;
+    auto rv = common::get_cmd_line_name_value_pairs(argc, (const char**)argv,
+                                                  found_conf_name, found_conf_value,
+                                                  name_value_pairs);
+    CHECK(rv == 0);
+
+    vector<string> transports = {"tcp", "shm"};
+    vector<uint16_t> msg_sizes = {64, 512, 4096};
+    uint32_t num_msgs = 200000;
+    uint32_t window = 64;
+    uint16_t tcp_port = 16000;
+
+    try {
+        for (const auto& nv_pair : name_value_pairs) {
+            const auto& name = nv_pair.first;
+            const auto& value = nv_pair.second;
+
+            if (name == transports_name) {
+                transports = s_parse_list(value);
+                for (const auto& transport : transports) {
+                    CHECK((transport == "tcp") || (transport == "shm"))
+                        << "bad transport: " << transport;
+                }
+            } else if (name == msg_sizes_name) {
+                msg_sizes.clear();
+                for (const auto& size : s_parse_list(value)) {
+                    msg_sizes.push_back(boost::lexical_cast<uint16_t>(size));
+                    CHECK_GE(msg_sizes.back(), sizeof (int64_t))
+                        << "msgs must fit a timestamp";
+                }
+            } else if (name == num_msgs_name) {
+                num_msgs = boost::lexical_cast<uint32_t>(value);
+            } else if (name == window_name) {
+                window = boost::lexical_cast<uint32_t>(value);
+            } else if (name == tcp_port_name) {
+                tcp_port = boost::lexical_cast<uint16_t>(value);
+            }
+        }
+    }
+    catch (const boost::bad_lexical_cast&) {
+        LOG(FATAL) << "bad number in the options";
+    }
+
+    CHECK_GT(num_msgs, 0);
+    CHECK_GT(window, 0);
+
+    printf("transport,msg_size,msgs,wall_ms,msgs_per_sec,cpu_us_per_msg,"
+           "mean_rtt_us\n");
+
+    for (const auto& transport : transports) {
+        for (const auto& msg_size : msg_sizes) {
+            const auto result = BenchRun(transport, msg_size, num_msgs,
+                                         window, tcp_port).run();
+            printf("%s,%u,%u,%.1f,%.0f,%.3f,%.1f\n",
+                   transport.c_str(), msg_size, num_msgs, result.wall_ms,
+                   num_msgs / (result.wall_ms / 1000),
+                   result.cpu_us / num_msgs, result.mean_rtt_us);
+            fflush(stdout);
+        }
+    }
+
+    return 0;
+}
@@ -10,6 +10,10 @@ public:
               const in_port_t& socks5_port
         )
         : socks5_addr_(socks5_addr), socks5_port_(socks5_port)
+        , use_spdy_(false), http_pipeline_depth_(1)
+        , throttle_delayable_requests_(true)
+        , max_retries_per_resource_(0), hedge_ttfb_percentile_(0)
+        , data_received_flush_bytes_(64 * 1024)
     {}
 
     NetConfig()
@@ -18,15 +22,33 @@ public:
 
     const in_addr_t& socks5_addr() const { return socks5_addr_; }
     const in_port_t& socks5_port() const { return socks5_port_; }
+    const bool& use_spdy() const { return use_spdy_; }
+    const uint8_t& http_pipeline_depth() const { return http_pipeline_depth_; }
+    const bool& throttle_delayable_requests() const { return throttle_delayable_requests_; }
+    const uint8_t& max_retries_per_resource() const { return max_retries_per_resource_; }
+    const uint8_t& hedge_ttfb_percentile() const { return hedge_ttfb_percentile_; }
+    const uint32_t& data_received_flush_bytes() const { return data_received_flush_bytes_; }
 
     void set_socks5_addr(const in_addr_t& a) { socks5_addr_ = a; }
     void set_socks5_port(const in_port_t& p) { socks5_port_ = p; }
+    void set_use_spdy(const bool& u) { use_spdy_ = u; }
+    void set_http_pipeline_depth(const uint8_t& d) { http_pipeline_depth_ = d; }
+    void set_throttle_delayable_requests(const bool& t) { throttle_delayable_requests_ = t; }
+    void set_max_retries_per_resource(const uint8_t& r) { max_retries_per_resource_ = r; }
+    void set_hedge_ttfb_percentile(const uint8_t& p) { hedge_ttfb_percentile_ = p; }
+    void set_data_received_flush_bytes(const uint32_t& b) { data_received_flush_bytes_ = b; }
 
 private:
 
     in_addr_t socks5_addr_;
     in_port_t socks5_port_;
-    
+    bool use_spdy_;
+    uint8_t http_pipeline_depth_;
+    bool throttle_delayable_requests_;
+    uint8_t max_retries_per_resource_;
+    uint8_t hedge_ttfb_percentile_;
+    uint32_t data_received_flush_bytes_;
+
 };
 
 #endif /* end net_config_hpp */
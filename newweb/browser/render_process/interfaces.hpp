@@ -1,6 +1,21 @@
 #ifndef interfaces_hpp
 #define interfaces_hpp
 
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+/* how long a request spent in each network phase, as the io service
+ * measured it: see its RequestCompleteMsg */
+struct RequestNetTiming
+{
+    uint32_t queue_ms = 0;
+    uint32_t connect_ms = 0;
+    uint32_t wait_ms = 0;
+    uint32_t transfer_ms = 0;
+    uint32_t conn_id = 0;
+};
+
 class ResourceMsgHandler
 {
     /* implement this and tell ioserviceipcclient about yourself and
@@ -11,15 +26,26 @@ public:
     virtual void handle_ReceivedResponse(const int& req_id,
                                          const uint64_t& first_byte_time_ms) = 0;
     virtual void handle_DataReceived(const int& req_id, const size_t& length) = 0;
-    virtual void handle_RequestComplete(const int& req_id, const bool success) = 0;
+    /* same as handle_DataReceived() for each (req_id, length) */
+    virtual void handle_DataReceivedBatch(
+        const std::vector<std::pair<int, size_t> >& lengths) = 0;
+    virtual void handle_RequestComplete(const int& req_id, const bool success,
+                                        const RequestNetTiming& timing) = 0;
 };
 
 class DriverMsgHandler
 {
 
 public:
+    /* "load_id" identifies the page load in later msgs; it must not
+     * be that of a page load we still have */
     virtual void handle_LoadPage(const uint32_t load_id, const char* model_fpath) = 0;
-    virtual void handle_Reset() = 0;
+    /* drop the page load "load_id", or all of them if it's 0.
+     *
+     * "next_model_fpath" can be nullptr; otherwise it's the page
+     * model that the next handle_LoadPage() will most likely use */
+    virtual void handle_Reset(const uint32_t load_id,
+                              const char* next_model_fpath) = 0;
 };
 
 #endif /* interfaces_hpp */
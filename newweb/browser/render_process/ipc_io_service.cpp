@@ -40,6 +40,8 @@ IOServiceIPCClient::IOServiceIPCClient(struct event_base* evbase,
             std::move(stream_channel),
             boost::bind(&IOServiceIPCClient::_on_msg, this, _1, _2, _3, _4),
             boost::bind(&IOServiceIPCClient::_on_channel_status, this, _1, _2)));
+    // the io process offers too; takes effect once connected
+    gen_ipc_chan_->offer_large_msgs();
 }
 
 #undef BEGIN_BUILD_MSG_AND_SEND_AT_END
@@ -48,11 +50,10 @@ IOServiceIPCClient::IOServiceIPCClient(struct event_base* evbase,
     VLOG(2) << "begin building msg type: " << __type;                   \
     msgs::TYPE ## MsgBuilder msgbuilder(bufbuilder);                    \
     SCOPE_EXIT {                                                        \
-        auto msg = msgbuilder.Finish();                                 \
-        bufbuilder.Finish(msg);                                         \
+        const auto __len = bufbuilder.finish_msg(msgbuilder);           \
         VLOG(2) << "send msg type: " << __type;                         \
         gen_ipc_chan_->sendMsg(                                         \
-            __type, bufbuilder.GetSize(),                               \
+            __type, __len,                                              \
             bufbuilder.GetBufferPointer());                             \
     }
 
@@ -69,12 +70,14 @@ IOServiceIPCClient::request_resource(const int& req_id,
                           const uint16_t& port,
                           const size_t& req_total_size,
                           const size_t& resp_meta_size,
-                          const size_t& resp_body_size)
+                          const size_t& resp_body_size,
+                          const int8_t& priority)
 {
-    vlogself(2) << "begin, [" << host << "]:" << port;
+    vlogself(2) << "begin, [" << host << "]:" << port
+                << " priority " << int(priority);
 
     {
-        flatbuffers::FlatBufferBuilder bufbuilder;
+        auto& bufbuilder = bufbuilder_.start();
         auto hoststr = bufbuilder.CreateString(host);
 
         BEGIN_BUILD_MSG_AND_SEND_AT_END(RequestResource, bufbuilder);
@@ -86,6 +89,7 @@ IOServiceIPCClient::request_resource(const int& req_id,
         msgbuilder.add_req_total_size(req_total_size);
         msgbuilder.add_resp_meta_size(resp_meta_size);
         msgbuilder.add_resp_body_size(resp_body_size);
+        msgbuilder.add_priority(priority);
     }
 
     vlogself(2) << "done";
@@ -97,21 +101,76 @@ IOServiceIPCClient::send_ResetSession()
     vlogself(2) << "begin";
 
     {
-        flatbuffers::FlatBufferBuilder bufbuilder;
+        auto& bufbuilder = bufbuilder_.start();
         BEGIN_BUILD_MSG_AND_SEND_AT_END(ResetSession, bufbuilder);
     }
 
     vlogself(2) << "done";
 }
 
+void
+IOServiceIPCClient::send_CancelRequests(const std::vector<int>& req_ids,
+                                        const bool& has_body)
+{
+    vlogself(2) << "begin, " << req_ids.size() << " requests";
+
+    {
+        auto& bufbuilder = bufbuilder_.start();
+        auto req_ids_vec = bufbuilder.CreateVector(req_ids);
+
+        BEGIN_BUILD_MSG_AND_SEND_AT_END(CancelRequests, bufbuilder);
+
+        msgbuilder.add_req_ids(req_ids_vec);
+        msgbuilder.add_has_body(has_body);
+    }
+
+    vlogself(2) << "done";
+}
+
+void
+IOServiceIPCClient::send_WillInsertBody()
+{
+    vlogself(2) << "begin";
+
+    {
+        auto& bufbuilder = bufbuilder_.start();
+        BEGIN_BUILD_MSG_AND_SEND_AT_END(WillInsertBody, bufbuilder);
+    }
+
+    vlogself(2) << "done";
+}
+
+void
+IOServiceIPCClient::send_Preconnect(const char* host,
+                                    const uint16_t& port,
+                                    const uint8_t& num_connections)
+{
+    vlogself(2) << "begin, [" << host << "]:" << port
+                << " num cnx " << unsigned(num_connections);
+
+    {
+        auto& bufbuilder = bufbuilder_.start();
+        auto hoststr = bufbuilder.CreateString(host);
+
+        BEGIN_BUILD_MSG_AND_SEND_AT_END(Preconnect, bufbuilder);
+
+        msgbuilder.add_host(hoststr);
+        msgbuilder.add_port(port);
+        msgbuilder.add_num_connections(num_connections);
+    }
+
+    vlogself(2) << "done";
+}
+
 void
 IOServiceIPCClient::_on_msg(GenericIpcChannel*, uint8_t type,
-                            uint16_t len, const uint8_t *data)
+                            uint32_t len, const uint8_t *data)
 {
     switch (type) {
 
         IPC_MSG_HANDLER(ReceivedResponse)
         IPC_MSG_HANDLER(DataReceived)
+        IPC_MSG_HANDLER(DataReceivedBatch)
         IPC_MSG_HANDLER(RequestComplete)
 
     default:
@@ -141,13 +200,35 @@ IOServiceIPCClient::_handle_DataReceived(
         msg->req_id(), msg->length());
 }
 
+void
+IOServiceIPCClient::_handle_DataReceivedBatch(
+    const msgs::DataReceivedBatchMsg* msg)
+{
+    CHECK_NOTNULL(resource_msg_handler_);
+    const auto entries = msg->entries();
+    CHECK_NOTNULL(entries);
+
+    data_received_lengths_.clear();
+    for (const auto entry : *entries) {
+        data_received_lengths_.push_back(
+            std::make_pair(entry->req_id(), size_t(entry->length())));
+    }
+    resource_msg_handler_->handle_DataReceivedBatch(data_received_lengths_);
+}
+
 void
 IOServiceIPCClient::_handle_RequestComplete(
     const msgs::RequestCompleteMsg* msg)
 {
     CHECK_NOTNULL(resource_msg_handler_);
+    RequestNetTiming timing;
+    timing.queue_ms = msg->queue_ms();
+    timing.connect_ms = msg->connect_ms();
+    timing.wait_ms = msg->wait_ms();
+    timing.transfer_ms = msg->transfer_ms();
+    timing.conn_id = msg->conn_id();
     resource_msg_handler_->handle_RequestComplete(
-        msg->req_id(), msg->success());
+        msg->req_id(), msg->success(), timing);
 }
 
 void
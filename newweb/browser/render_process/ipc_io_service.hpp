@@ -4,6 +4,7 @@
 #include "../../utility/stream_channel.hpp"
 #include "../../utility/generic_message_channel.hpp"
 #include "../../utility/ipc/generic_ipc_channel.hpp"
+#include "../../utility/ipc/msg_buf_builder.hpp"
 #include "../../utility/object.hpp"
 // #include "utility/ipc/renderer/gen/combined_headers"
 #include "utility/ipc/io_service/gen/combined_headers"
@@ -41,9 +42,16 @@ public:
                           const uint16_t& port,
                           const size_t& req_total_size,
                           const size_t& resp_meta_size,
-                          const size_t& resp_body_size);
+                          const size_t& resp_body_size,
+                          const int8_t& priority);
 
     void send_ResetSession();
+    /* "has_body": see CancelRequestsMsg */
+    void send_CancelRequests(const std::vector<int>& req_ids,
+                             const bool& has_body);
+    void send_WillInsertBody();
+    void send_Preconnect(const char* host, const uint16_t& port,
+                         const uint8_t& num_connections);
 
 protected:
 
@@ -53,12 +61,13 @@ protected:
 private:
 
     void _on_msg(myipc::GenericIpcChannel*, uint8_t type,
-                 uint16_t len, const uint8_t *data);
+                 uint32_t len, const uint8_t *data);
     void _on_channel_status(myipc::GenericIpcChannel*,
                             myipc::GenericIpcChannel::ChannelStatus);
 
     void _handle_ReceivedResponse(const myipc::ioservice::messages::ReceivedResponseMsg* msg);
     void _handle_DataReceived(const myipc::ioservice::messages::DataReceivedMsg* msg);
+    void _handle_DataReceivedBatch(const myipc::ioservice::messages::DataReceivedBatchMsg* msg);
     void _handle_RequestComplete(const myipc::ioservice::messages::RequestCompleteMsg* msg);
 
 
@@ -66,8 +75,13 @@ private:
 
     ChannelStatusCb ch_status_cb_;
     myipc::GenericIpcChannel::UniquePtr gen_ipc_chan_;
+    /* reused to build the msgs we send */
+    myipc::MsgBufBuilder bufbuilder_;
 
     ResourceMsgHandler* resource_msg_handler_;
+
+    /* reused for every DataReceivedBatch */
+    std::vector<std::pair<int, size_t> > data_received_lengths_;
 };
 
 
@@ -49,11 +49,10 @@ IPCServer::IPCServer(struct event_base* evbase,
     VLOG(2) << "begin building msg type: " << msgs::EnumNametype(__type); \
     msgs::TYPE ## MsgBuilder msgbuilder(bufbuilder);                    \
     SCOPE_EXIT {                                                        \
-        auto msg = msgbuilder.Finish();                                 \
-        bufbuilder.Finish(msg);                                         \
+        const auto __len = bufbuilder.finish_msg(msgbuilder);           \
         VLOG(2) << "send msg";                                          \
         ipc_client_channel_->sendMsg(                                   \
-            __type, bufbuilder.GetSize(),                               \
+            __type, __len,                                              \
             bufbuilder.GetBufferPointer());                             \
     }
 
@@ -63,11 +62,10 @@ IPCServer::IPCServer(struct event_base* evbase,
     VLOG(2) << "begin building msg type: " << msgs::EnumNametype(__type); \
     msgs::TYPE ## MsgBuilder msgbuilder(bufbuilder);                    \
     SCOPE_EXIT {                                                        \
-        auto msg = msgbuilder.Finish();                                 \
-        bufbuilder.Finish(msg);                                         \
+        const auto __len = bufbuilder.finish_msg(msgbuilder);           \
         VLOG(2) << "send msg";                                          \
         ipc_client_channel_->reply(                                     \
-            id, __type, bufbuilder.GetSize(),                           \
+            id, __type, __len,                                          \
             bufbuilder.GetBufferPointer());                             \
     }
 
@@ -76,7 +74,7 @@ void
 IPCServer::send_PageLoaded(const uint32_t load_id, const uint64_t ttfb_ms)
 {
     {
-        flatbuffers::FlatBufferBuilder bufbuilder;
+        auto& bufbuilder = bufbuilder_.start();
         BEGIN_BUILD_MSG_AND_SEND_AT_END(PageLoaded, bufbuilder);
 
         msgbuilder.add_load_id(load_id);
@@ -88,7 +86,7 @@ void
 IPCServer::send_PageLoadFailed(const uint32_t load_id)
 {
     {
-        flatbuffers::FlatBufferBuilder bufbuilder;
+        auto& bufbuilder = bufbuilder_.start();
         BEGIN_BUILD_MSG_AND_SEND_AT_END(PageLoadFailed, bufbuilder);
 
         msgbuilder.add_load_id(load_id);
@@ -96,14 +94,16 @@ IPCServer::send_PageLoadFailed(const uint32_t load_id)
 }
 
 void
-IPCServer::send_RequestWillBeSent(const uint32_t& resInstNum,
+IPCServer::send_RequestWillBeSent(const uint32_t load_id,
+                                  const uint32_t& resInstNum,
                                   const uint32_t& reqChainIdx,
                                   const bool& forced)
 {
     {
-        flatbuffers::FlatBufferBuilder bufbuilder;
+        auto& bufbuilder = bufbuilder_.start();
         BEGIN_BUILD_MSG_AND_SEND_AT_END(RequestWillBeSent, bufbuilder);
 
+        msgbuilder.add_load_id(load_id);
         msgbuilder.add_resInstNum(resInstNum);
         msgbuilder.add_reqChainIdx(reqChainIdx);
         msgbuilder.add_forced(forced);
@@ -111,17 +111,25 @@ IPCServer::send_RequestWillBeSent(const uint32_t& resInstNum,
 }
 
 void
-IPCServer::send_RequestFinished(const uint32_t& resInstNum,
+IPCServer::send_RequestFinished(const uint32_t load_id,
+                                const uint32_t& resInstNum,
                                 const uint32_t& reqChainIdx,
-                                const bool& success)
+                                const bool& success,
+                                const RequestNetTiming& timing)
 {
     {
-        flatbuffers::FlatBufferBuilder bufbuilder;
+        auto& bufbuilder = bufbuilder_.start();
         BEGIN_BUILD_MSG_AND_SEND_AT_END(RequestFinished, bufbuilder);
 
+        msgbuilder.add_load_id(load_id);
         msgbuilder.add_resInstNum(resInstNum);
         msgbuilder.add_reqChainIdx(reqChainIdx);
         msgbuilder.add_success(success);
+        msgbuilder.add_queue_ms(timing.queue_ms);
+        msgbuilder.add_connect_ms(timing.connect_ms);
+        msgbuilder.add_wait_ms(timing.wait_ms);
+        msgbuilder.add_transfer_ms(timing.transfer_ms);
+        msgbuilder.add_conn_id(timing.conn_id);
     }
 }
 
@@ -139,7 +147,7 @@ IPCServer::_handle_LoadPage(const uint32_t& id,
 
     {
         // send the response for the call
-        flatbuffers::FlatBufferBuilder bufbuilder;
+        auto& bufbuilder = bufbuilder_.start();
         BEGIN_BUILD_RESP_MSG_AND_SEND_AT_END(
             LoadPageResp, bufbuilder, load_call_id_);
     }
@@ -157,11 +165,13 @@ IPCServer::_handle_Reset(const uint32_t& id,
     CHECK_EQ(reset_call_id_, 0) << reset_call_id_;
     reset_call_id_ = id;
 
-    driver_msg_handler_->handle_Reset();
+    driver_msg_handler_->handle_Reset(
+        msg->load_id(),
+        msg->next_model_fpath() ? msg->next_model_fpath()->c_str() : nullptr);
 
     {
         // send the response for the call
-        flatbuffers::FlatBufferBuilder bufbuilder;
+        auto& bufbuilder = bufbuilder_.start();
         BEGIN_BUILD_RESP_MSG_AND_SEND_AT_END(
             ResetResp, bufbuilder, reset_call_id_);
     }
@@ -197,11 +207,13 @@ IPCServer::_setup_client(StreamChannel::UniquePtr channel)
             boost::bind(&IPCServer::_on_msg, this, _2, _3, _4),
             boost::bind(&IPCServer::_on_called, this, _2, _3, _4, _5),
             boost::bind(&IPCServer::_on_client_channel_status, this, _2)));
+    // the driver is of the same build, so it knows how
+    ipc_client_channel_->offer_large_msgs();
 }
 
 void
 IPCServer::_on_msg(uint8_t type,
-                   uint16_t len, const uint8_t* data)
+                   uint32_t len, const uint8_t* data)
 {
     logself(FATAL) << "to do";
 }
@@ -214,7 +226,7 @@ IPCServer::_on_msg(uint8_t type,
 
 void
 IPCServer::_on_called(uint32_t id, uint8_t type,
-                      uint16_t len, const uint8_t* data)
+                      uint32_t len, const uint8_t* data)
 {
     switch (type) {
 
@@ -5,6 +5,7 @@
 #include "../../utility/stream_server.hpp"
 #include "../../utility/generic_message_channel.hpp"
 #include "../../utility/ipc/generic_ipc_channel.hpp"
+#include "../../utility/ipc/msg_buf_builder.hpp"
 #include "../../utility/object.hpp"
 #include "utility/ipc/renderer/gen/combined_headers"
 
@@ -23,12 +24,15 @@ public:
 
     void send_PageLoaded(const uint32_t load_id, const uint64_t ttfb_ms);
     void send_PageLoadFailed(const uint32_t load_id);
-    void send_RequestWillBeSent(const uint32_t& resInstNum,
+    void send_RequestWillBeSent(const uint32_t load_id,
+                                const uint32_t& resInstNum,
                                 const uint32_t& reqChainIdx,
                                 const bool& forced=false);
-    void send_RequestFinished(const uint32_t& resInstNum,
+    void send_RequestFinished(const uint32_t load_id,
+                              const uint32_t& resInstNum,
                               const uint32_t& reqChainIdx,
-                              const bool& success);
+                              const bool& success,
+                              const RequestNetTiming& timing);
 
     void set_driver_msg_handler(DriverMsgHandler* handler)
     {
@@ -43,9 +47,9 @@ private:
 
     ////////////
 
-    void _on_msg(uint8_t type, uint16_t len, const uint8_t* data);
+    void _on_msg(uint8_t type, uint32_t len, const uint8_t* data);
     void _on_called(uint32_t id, uint8_t type,
-                    uint16_t len, const uint8_t* data);
+                    uint32_t len, const uint8_t* data);
     void _on_client_channel_status(myipc::GenericIpcChannel::ChannelStatus);
 
     void _setup_client(myio::StreamChannel::UniquePtr channel);
@@ -60,6 +64,8 @@ private:
     myio::StreamServer::UniquePtr stream_server_; /* to accept ipc clients */
     /* currently support only one ipc client */
     myipc::GenericIpcChannel::UniquePtr ipc_client_channel_;
+    /* reused to build the msgs we send */
+    myipc::MsgBufBuilder bufbuilder_;
 
     DriverMsgHandler* driver_msg_handler_;
 
@@ -16,10 +16,10 @@ using std::endl;
 #include "../../utility/easylogging++.h"
 #include "../../utility/tcp_channel.hpp"
 #include "../../utility/tcp_server.hpp"
+#include "../../utility/shm_ring_channel.hpp"
 #include "ipc_io_service.hpp"
 #include "ipc_renderer.hpp"
-
-#include "webengine/webengine.hpp"
+#include "renderer.hpp"
 
 
 
@@ -27,7 +27,7 @@ using std::unique_ptr;
 
 static IOServiceIPCClient::UniquePtr io_service_ipc_client;
 static IPCServer::UniquePtr ipcserver;
-static blink::Webengine::UniquePtr webengine;
+static Renderer::UniquePtr renderer;
 
 
 
@@ -41,11 +41,20 @@ struct MyConfig
     MyConfig()
         : renderer_ipcport(common::ports::default_renderer_ipc)
         , ioservice_ipcport(common::ports::io_service_ipc)
+        , ioservice_ipc_transport("tcp")
+        , preconnect_max_hosts(6)
+        , preconnect_max_cnx_per_host(2)
     {
     }
 
     uint16_t renderer_ipcport;
     uint16_t ioservice_ipcport;
+    /* "tcp" or "shm"; must match the io service's */
+    std::string ioservice_ipc_transport;
+    /* how many of the page's hosts to preconnect to, and with how
+     * many connections each; 0 hosts to disable */
+    uint8_t preconnect_max_hosts;
+    uint8_t preconnect_max_cnx_per_host;
 };
 
 static void
@@ -64,6 +73,28 @@ set_my_config(MyConfig& conf,
             conf.ioservice_ipcport = boost::lexical_cast<uint16_t>(value);
         }
 
+        else if (name == "ioservice-ipc-transport") {
+            CHECK((value == "tcp") || (value == "shm"))
+                << "use tcp or shm for ioservice-ipc-transport";
+#ifdef IN_SHADOW
+            CHECK_EQ(value, "tcp") << "shadow doesn't have shared memory";
+#endif
+            conf.ioservice_ipc_transport = value;
+        }
+
+        else if (name == "preconnect-max-hosts") {
+            // lexical_cast<uint8_t> would take just one character
+            const auto num = boost::lexical_cast<uint16_t>(value);
+            CHECK_LE(num, 255) << "bad value for preconnect-max-hosts: " << value;
+            conf.preconnect_max_hosts = num;
+        }
+
+        else if (name == "preconnect-max-cnx-per-host") {
+            const auto num = boost::lexical_cast<uint16_t>(value);
+            CHECK_LE(num, 255) << "bad value for preconnect-max-cnx-per-host: " << value;
+            conf.preconnect_max_cnx_per_host = num;
+        }
+
         else {
             // ignore other args
         }
@@ -76,7 +107,9 @@ INITIALIZE_EASYLOGGINGPP
 static void
 s_on_io_service_ipc_client_status(IOServiceIPCClient::ChannelStatus status,
                                   struct event_base* evbase,
-                                  uint16_t renderer_ipcport)
+                                  uint16_t renderer_ipcport,
+                                  uint8_t preconnect_max_hosts,
+                                  uint8_t preconnect_max_cnx_per_host)
 {
     CHECK_EQ(status, IOServiceIPCClient::ChannelStatus::READY);
 
@@ -92,10 +125,12 @@ s_on_io_service_ipc_client_status(IOServiceIPCClient::ChannelStatus status,
             renderer_ipcport, nullptr));
     ipcserver.reset(new IPCServer(evbase, std::move(tcpServerForIPC)));
 
-    webengine.reset(
-        new blink::Webengine(evbase,
-                             io_service_ipc_client.get(),
-                             ipcserver.get()));
+    renderer.reset(
+        new Renderer(evbase,
+                     io_service_ipc_client.get(),
+                     ipcserver.get(),
+                     preconnect_max_hosts,
+                     preconnect_max_cnx_per_host));
 
     VLOG(2) << "ioservice ip client: " << io_service_ipc_client.get()
             << " , my ipcserver: " <<  ipcserver.get();
@@ -142,18 +177,30 @@ int main(int argc, char **argv)
     /* ***************************************** */
 
 
-    LOG(INFO) << "use ioservice on ipc port " << conf.ioservice_ipcport;
     LOG(INFO) << "renderer ipc server listens on " << conf.renderer_ipcport;
 
-    myio::TCPChannel::UniquePtr tcpch1(
-        new myio::TCPChannel(evbase.get(), common::getaddr("localhost"),
-                             conf.ioservice_ipcport, nullptr));
+    myio::StreamChannel::UniquePtr ch1;
+#ifndef IN_SHADOW
+    if (conf.ioservice_ipc_transport == "shm") {
+        const auto name = common::ioservice_ipc_shm_name(conf.ioservice_ipcport);
+        LOG(INFO) << "use ioservice on shm " << name;
+        ch1.reset(new myio::ShmRingChannel(evbase.get(), name, nullptr));
+    } else
+#endif
+    {
+        LOG(INFO) << "use ioservice on ipc port " << conf.ioservice_ipcport;
+        ch1.reset(
+            new myio::TCPChannel(evbase.get(), common::getaddr("localhost"),
+                                 conf.ioservice_ipcport, nullptr));
+    }
 
     io_service_ipc_client.reset(
         new IOServiceIPCClient(
-            evbase.get(), std::move(tcpch1),
+            evbase.get(), std::move(ch1),
             boost::bind(s_on_io_service_ipc_client_status,
-                        _2, evbase.get(), conf.renderer_ipcport)));
+                        _2, evbase.get(), conf.renderer_ipcport,
+                        conf.preconnect_max_hosts,
+                        conf.preconnect_max_cnx_per_host)));
 
     /* ***************************************** */
 
@@ -0,0 +1,278 @@
+
+#include "../../utility/easylogging++.h"
+#include "../../utility/common.hpp"
+#include "../../utility/folly/ScopeGuard.h"
+
+#include "renderer.hpp"
+
+
+using blink::Webengine;
+using blink::PageModel;
+
+
+#define _LOG_PREFIX(inst) << "renderer= " << (inst)->objId() << ": "
+
+/* "inst" stands for instance, as in, instance of a class */
+#define vloginst(level, inst) VLOG(level) _LOG_PREFIX(inst)
+#define vlogself(level) vloginst(level, this)
+
+#define dvloginst(level, inst) DVLOG(level) _LOG_PREFIX(inst)
+#define dvlogself(level) dvloginst(level, this)
+
+#define loginst(level, inst) LOG(level) _LOG_PREFIX(inst)
+#define logself(level) loginst(level, this)
+
+
+Renderer::Renderer(struct event_base* evbase,
+                   IOServiceIPCClient* ioservice_ipcclient,
+                   IPCServer* renderer_ipcserver,
+                   const uint8_t preconnect_max_hosts,
+                   const uint8_t preconnect_max_cnx_per_host)
+    : evbase_(evbase)
+    , ioservice_ipcclient_(ioservice_ipcclient)
+    , renderer_ipcserver_(renderer_ipcserver)
+    , preconnect_max_hosts_(preconnect_max_hosts)
+    , preconnect_max_cnx_per_host_(preconnect_max_cnx_per_host)
+    , as_script_engine_(nullptr)
+{
+    static bool initialized = false;
+
+    // there should be ONLY one renderer per process
+    CHECK(!initialized);
+
+    CHECK_NOTNULL(ioservice_ipcclient_);
+    CHECK_NOTNULL(renderer_ipcserver_);
+
+    ioservice_ipcclient_->set_resource_msg_handler(this);
+    renderer_ipcserver_->set_driver_msg_handler(this);
+
+    as_script_engine_ = Webengine::create_script_engine();
+
+    initialized = true;
+}
+
+Renderer::~Renderer()
+{
+    // the webengines have script contexts from the engine
+    webengines_.clear();
+
+    CHECK(as_script_engine_);
+    as_script_engine_->Release();
+    as_script_engine_ = nullptr;
+}
+
+void
+Renderer::add_request_route(const int req_id, const uint32_t load_id)
+{
+    const auto ret = request_load_ids_.insert(std::make_pair(req_id, load_id));
+    CHECK(ret.second) << "req_id= " << req_id;
+}
+
+void
+Renderer::release_io_session(const uint32_t load_id)
+{
+    for (const auto& kv : webengines_) {
+        if (kv.first != load_id) {
+            vlogself(2) << "load " << kv.first << " still uses the io session";
+            return;
+        }
+    }
+
+    logself(INFO) << "no page load is using the io session; reset it";
+    ioservice_ipcclient_->send_ResetSession();
+    request_load_ids_.clear();
+}
+
+void
+Renderer::handle_LoadPage(const uint32_t load_id, const char* model_fpath)
+{
+    logself(INFO) << "start loading page, model [" << model_fpath << "] "
+                  << "load id= " << load_id;
+    CHECK_GT(load_id, 0);
+    CHECK(!inMap(webengines_, load_id)) << "already have load " << load_id;
+
+    PageModel::UniquePtr page_model;
+    if (next_page_model_ && (next_page_model_fpath_ == model_fpath)) {
+        // parsed it when we were reset
+        page_model = std::move(next_page_model_);
+    } else {
+        page_model.reset(new PageModel(model_fpath));
+    }
+    next_page_model_.reset();
+    next_page_model_fpath_.clear();
+
+    Webengine::UniquePtr webengine(
+        new Webengine(evbase_, this, ioservice_ipcclient_, renderer_ipcserver_,
+                      as_script_engine_, load_id, std::move(page_model),
+                      preconnect_max_hosts_, preconnect_max_cnx_per_host_));
+    auto webengine_ptr = webengine.get();
+    const auto ret = webengines_.insert(std::make_pair(load_id, std::move(webengine)));
+    CHECK(ret.second);
+
+    logself(INFO) << "now have " << webengines_.size() << " page loads";
+
+    DestructorGuard dg(webengine_ptr);
+    webengine_ptr->load();
+}
+
+void
+Renderer::handle_Reset(const uint32_t load_id, const char* next_model_fpath)
+{
+    if (load_id) {
+        const auto num_others =
+            webengines_.size() - (inMap(webengines_, load_id) ? 1 : 0);
+        if (!num_others) {
+            // nothing else is going on, so start from scratch
+            _reset_all();
+        } else {
+            _drop_load(load_id);
+        }
+    } else {
+        _reset_all();
+    }
+
+    if (next_model_fpath) {
+        logself(INFO) << "parse next page model [" << next_model_fpath << "]";
+        next_page_model_.reset(new PageModel(next_model_fpath));
+        next_page_model_fpath_ = next_model_fpath;
+    } else if (!load_id) {
+        next_page_model_.reset();
+        next_page_model_fpath_.clear();
+    }
+    // else dropping a load doesn't change what we expect to load next
+}
+
+void
+Renderer::_reset_all()
+{
+    logself(INFO) << "reset renderer...";
+    ioservice_ipcclient_->send_ResetSession();
+    webengines_.clear();
+    request_load_ids_.clear();
+    logself(INFO) << "done";
+}
+
+void
+Renderer::_drop_load(const uint32_t load_id)
+{
+    logself(INFO) << "drop page load " << load_id;
+    webengines_.erase(load_id);
+
+    dropped_req_ids_.clear();
+    for (auto it = request_load_ids_.begin(); it != request_load_ids_.end();) {
+        if (it->second == load_id) {
+            dropped_req_ids_.push_back(it->first);
+            it = request_load_ids_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    // even with no requests to cancel, the io service should know if
+    // the dropped load was the one with the body
+    bool has_body = false;
+    for (const auto& kv : webengines_) {
+        if (kv.second->notified_will_insert_body()) {
+            has_body = true;
+            break;
+        }
+    }
+
+    logself(INFO) << "cancel its " << dropped_req_ids_.size()
+                  << " outstanding requests";
+    ioservice_ipcclient_->send_CancelRequests(dropped_req_ids_, has_body);
+}
+
+Webengine*
+Renderer::_get_request_webengine(const int req_id, const bool remove_route)
+{
+    auto it = request_load_ids_.find(req_id);
+    if (it == request_load_ids_.end()) {
+        // this can happen because there's a race between our
+        // resetting, or cancelling the request, and io service's
+        // notifying us about the request
+        return nullptr;
+    }
+
+    const auto load_id = it->second;
+    if (remove_route) {
+        request_load_ids_.erase(it);
+    }
+
+    auto it2 = webengines_.find(load_id);
+    CHECK(it2 != webengines_.end()) << "load " << load_id << " is gone";
+    return it2->second.get();
+}
+
+void
+Renderer::handle_ReceivedResponse(const int& req_id,
+                                  const uint64_t& first_byte_time_ms)
+{
+    auto webengine = _get_request_webengine(req_id);
+    if (webengine) {
+        DestructorGuard dg(webengine);
+        webengine->handle_ReceivedResponse(req_id, first_byte_time_ms);
+    }
+}
+
+void
+Renderer::handle_DataReceived(const int& req_id, const size_t& length)
+{
+    auto webengine = _get_request_webengine(req_id);
+    if (webengine) {
+        DestructorGuard dg(webengine);
+        webengine->handle_DataReceived(req_id, length);
+    }
+}
+
+void
+Renderer::handle_DataReceivedBatch(
+    const std::vector<std::pair<int, size_t> >& lengths)
+{
+    // give each webengine its part of the batch, so it still does
+    // its end of task work once
+    for (auto& kv : data_received_lengths_) {
+        kv.second.clear();
+    }
+    for (const auto& p : lengths) {
+        const auto it = request_load_ids_.find(p.first);
+        if (it != request_load_ids_.end()) {
+            data_received_lengths_[it->second].push_back(p);
+        }
+    }
+
+    for (auto& kv : data_received_lengths_) {
+        if (kv.second.empty()) {
+            continue;
+        }
+        auto it = webengines_.find(kv.first);
+        if (it == webengines_.end()) {
+            continue;
+        }
+        auto webengine = it->second.get();
+        DestructorGuard dg(webengine);
+        webengine->handle_DataReceivedBatch(kv.second);
+    }
+
+    // don't keep entries for loads that are gone
+    for (auto it = data_received_lengths_.begin();
+         it != data_received_lengths_.end();)
+    {
+        if (!inMap(webengines_, it->first)) {
+            it = data_received_lengths_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void
+Renderer::handle_RequestComplete(const int& req_id, const bool success,
+                                 const RequestNetTiming& timing)
+{
+    auto webengine = _get_request_webengine(req_id, true);
+    if (webengine) {
+        DestructorGuard dg(webengine);
+        webengine->handle_RequestComplete(req_id, success, timing);
+    }
+}
@@ -0,0 +1,117 @@
+#ifndef renderer_hpp
+#define renderer_hpp
+
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <angelscript.h>
+
+#include "../../utility/object.hpp"
+
+#include "interfaces.hpp"
+#include "ipc_io_service.hpp"
+#include "ipc_renderer.hpp"
+
+#include "webengine/page_model.hpp"
+#include "webengine/webengine.hpp"
+
+/*
+ * hosts the page loads of this render process, like several tabs of
+ * a browser. each page load has its own webengine (with its own
+ * document, resources, script context, etc.), keyed by the load id
+ * that the driver gave it in the LoadPage msg. the loads run
+ * independently of one another, but they all use the same io service
+ * connection, and therefore the same http session and connection pool
+ * in the io process.
+ *
+ * we get the driver's and io service's msgs, and pass each on to the
+ * webengine it is for
+ */
+
+class Renderer : public Object
+               , public ResourceMsgHandler
+               , public DriverMsgHandler
+{
+public:
+    typedef std::unique_ptr<Renderer, /*folly::*/Destructor> UniquePtr;
+
+    /* see Webengine for the preconnect args */
+    explicit Renderer(struct event_base*,
+                      IOServiceIPCClient*,
+                      IPCServer*,
+                      const uint8_t preconnect_max_hosts,
+                      const uint8_t preconnect_max_cnx_per_host);
+
+    /* ------- for the webengines --------- */
+
+    /* the io service will tell us about request "req_id" and we
+     * should pass that on to the webengine of "load_id" */
+    void add_request_route(const int req_id, const uint32_t load_id);
+    /* the webengine of "load_id" is no longer using the io service,
+     * e.g., its main resource failed. if no other page load is using
+     * it either, reset the io service's session, which closes its
+     * connections, drops its requests, etc. */
+    void release_io_session(const uint32_t load_id);
+
+    /* implement ResourceMsgHandler interface */
+    virtual void handle_ReceivedResponse(const int& req_id,
+                                         const uint64_t& first_byte_time_ms) override;
+    virtual void handle_DataReceived(const int& req_id, const size_t& length) override;
+    virtual void handle_DataReceivedBatch(
+        const std::vector<std::pair<int, size_t> >& lengths) override;
+    virtual void handle_RequestComplete(const int& req_id, const bool success,
+                                        const RequestNetTiming& timing) override;
+
+    /* DriverMsgHandler interface */
+    void handle_LoadPage(const uint32_t load_id, const char* model_fpath) override;
+    void handle_Reset(const uint32_t load_id, const char* next_model_fpath) override;
+
+protected:
+
+    virtual ~Renderer();
+
+    /* the webengine that request "req_id" is for, or nullptr if
+     * that page load is gone. if "remove_route", the request won't
+     * be routed anymore */
+    blink::Webengine* _get_request_webengine(const int req_id,
+                                             const bool remove_route=false);
+
+    void _reset_all();
+    /* drop the webengine of "load_id", and have the io service drop
+     * its requests, while the other page loads go on */
+    void _drop_load(const uint32_t load_id);
+
+    /////
+
+    struct event_base* evbase_;
+    IOServiceIPCClient* ioservice_ipcclient_;
+    IPCServer* renderer_ipcserver_;
+    const uint8_t preconnect_max_hosts_;
+    const uint8_t preconnect_max_cnx_per_host_;
+
+    /* the webengines share the engine, but each has its own script
+     * context */
+    asIScriptEngine* as_script_engine_;
+
+    /* keyed by load id */
+    std::map<uint32_t, blink::Webengine::UniquePtr> webengines_;
+
+    /* map from the request id (for IPC) to the load id of the
+     * webengine that made the request. the webengine might be gone
+     * by the time the io service tells us about the request */
+    std::unordered_map<int, uint32_t> request_load_ids_;
+
+    /* parsed at reset time for the load that will likely follow */
+    blink::PageModel::UniquePtr next_page_model_;
+    std::string next_page_model_fpath_;
+
+    /* reused to collect the requests of a dropped load */
+    std::vector<int> dropped_req_ids_;
+
+    /* reused to split up each DataReceivedBatch by webengine */
+    std::map<uint32_t, std::vector<std::pair<int, size_t> > > data_received_lengths_;
+};
+
+#endif /* renderer_hpp */
@@ -154,6 +154,7 @@ Document::add_elem(const uint32_t& elemInstNum)
     else if (elem_info.tag == "body") {
         CHECK(!has_body_element_);
         has_body_element_ = true;
+        webengine_->ioservice_notify_will_insert_body();
         webengine_->maybe_sched_INITIAL_render_update_scope();
         return;
     }
@@ -310,6 +311,10 @@ void
 Document::responseReceived(Resource* resource)
 {
     CHECK_EQ(main_resource_.get(), resource);
+
+    // the html will tell us soon enough what hosts we need, but we
+    // already know from the page model
+    webengine_->ioservice_preconnect_top_hosts();
 }
 
 } // end namespace blink
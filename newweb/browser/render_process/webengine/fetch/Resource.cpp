@@ -85,6 +85,9 @@ Resource::receivedResponseMeta(const uint64_t first_byte_time_ms)
         CHECK_EQ(first_byte_time_ms_, 0);
         first_byte_time_ms_ = first_byte_time_ms;
     }
+    if (_receiving_real_resource()) {
+        _notify_response_received();
+    }
 }
 
 void
@@ -117,14 +120,14 @@ Resource::removeClient(ResourceClient* client)
 }
 
 void
-Resource::finish(bool success)
+Resource::finish(bool success, const RequestNetTiming& timing)
 {
     vlogself(2) << "begin, success= " << success;
 
     CHECK_EQ(load_state_, LoadState::LOADING);
 
     webengine_->renderer_notify_RequestFinished(
-        instNum(), current_req_chain_idx_, success);
+        instNum(), current_req_chain_idx_, success, timing);
 
     if (success) {
         CHECK_EQ(current_req_body_bytes_recv_,
@@ -181,6 +184,16 @@ Resource::_notify_finished(bool success)
     vlogself(2) << "done";
 }
 
+void
+Resource::_notify_response_received()
+{
+    DestructorGuard dg(this);
+
+    for (auto client : m_clients) {
+        client->responseReceived(this);
+    }
+}
+
 void
 Resource::_notify_new_data(const size_t& length)
 {
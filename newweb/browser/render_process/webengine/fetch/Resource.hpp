@@ -5,6 +5,7 @@
 
 #include "../../../../utility/object.hpp"
 #include "../page_model.hpp"
+#include "../../interfaces.hpp"
 
 namespace blink {
 
@@ -57,7 +58,7 @@ public:
     void appendData(size_t length);
 
     /* tell the resource it has now finished receiving the response */
-    virtual void finish(bool success);
+    virtual void finish(bool success, const RequestNetTiming& timing);
 
     void addClient(ResourceClient*);
     void removeClient(ResourceClient*);
@@ -84,6 +85,7 @@ protected:
 
     /////////
 
+    void _notify_response_received();
     void _notify_new_data(const size_t&);
     void _notify_finished(bool);
 
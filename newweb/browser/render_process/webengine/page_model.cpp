@@ -2,6 +2,8 @@
 #include <fstream>
 #include <string>
 #include <sstream>      // std::stringstream
+#include <map>
+#include <algorithm>
 #include <boost/lexical_cast.hpp>
 
 #include "page_model.hpp"
@@ -170,6 +172,35 @@ PageModel::get_all_resource_instNums(std::vector<uint32_t>& res_instNums) const
     }
 }
 
+void
+PageModel::get_hosts_by_num_requests(std::vector<HostInfo>& hosts) const
+{
+    std::vector<uint32_t> res_instNums;
+    get_all_resource_instNums(res_instNums);
+
+    std::map<std::pair<std::string, uint16_t>, uint32_t> num_requests;
+    for (const auto& resInstNum : res_instNums) {
+        ResourceInfo res_info;
+        const auto rv = get_resource_info(resInstNum, res_info);
+        CHECK(rv);
+        for (const auto& req_info : res_info.req_chain) {
+            ++num_requests[make_pair(req_info.host, req_info.port)];
+        }
+    }
+
+    hosts.clear();
+    for (const auto& kv : num_requests) {
+        hosts.push_back({kv.first.first, kv.first.second, kv.second});
+    }
+
+    // stable so that ties stay in host order, to be deterministic
+    std::stable_sort(hosts.begin(), hosts.end(),
+                     [](const HostInfo& a, const HostInfo& b)
+                     {
+                         return a.num_requests > b.num_requests;
+                     });
+}
+
 bool
 PageModel::get_element_info(const uint32_t& elemInstNum,
                             ElementInfo& info) const
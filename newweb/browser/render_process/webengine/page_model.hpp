@@ -86,6 +86,14 @@ public:
         std::vector<std::pair<std::string, uint32_t> > event_handling_scopes;
     };
 
+    struct HostInfo
+    {
+        std::string host;
+        uint16_t port;
+        /* across all resources' request chains */
+        uint32_t num_requests;
+    };
+
     explicit PageModel(const char* json_fpath);
 
     bool get_main_resource_info(ResourceInfo&) const;
@@ -97,6 +105,9 @@ public:
 
     void get_all_resource_instNums(std::vector<uint32_t>&) const;
 
+    /* every host:port the page requests from, most requested first */
+    void get_hosts_by_num_requests(std::vector<HostInfo>&) const;
+
     /* popuplate "elem_info" with information about the element
      */
     bool get_element_info(const uint32_t& elemInstNum,
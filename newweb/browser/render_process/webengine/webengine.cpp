@@ -1,6 +1,7 @@
 
 #include <unistd.h>
 #include <string>
+#include <algorithm>
 #include <iostream>
 #include <boost/algorithm/string/join.hpp>
 #include <boost/bind.hpp>
@@ -13,6 +14,7 @@
 #include "../../../utility/folly/ScopeGuard.h"
 
 #include "webengine.hpp"
+#include "../renderer.hpp"
 
 #include "xml/XMLHttpRequest.hpp"
 
@@ -49,133 +51,118 @@ s_as_MessageCallback(const asSMessageInfo *msg, void *param)
               << "): " << type << " : " << msg->message;
 }
 
-Webengine::Webengine(
-    struct ::event_base* evbase,
-    IOServiceIPCClient* ioservice_ipcclient,
-    IPCServer* renderer_ipcserver
-    )
-    : evbase_(evbase)
-    , ioservice_ipcclient_(ioservice_ipcclient)
-    , renderer_ipcserver_(renderer_ipcserver)
-    , as_script_engine_(nullptr)
-    , as_script_ctx_(nullptr)
-    , start_load_time_ms_(0)
-    , current_load_id_(0)
-    , state_(State::IDLE)
-    , scheduled_render_tree_update_scope_id_(0)
-    , checkCompleted_timer_(
-        new Timer(evbase_, true,
-                  boost::bind(&Webengine::checkCompleted_timer_fired, this, _1)))
-{
-    static bool initialized = false;
-
-    // there should be ONLY one webengine per process
-    CHECK(!initialized);
-
-    CHECK_NOTNULL(ioservice_ipcclient_);
-
-    ioservice_ipcclient_->set_resource_msg_handler(this);
-    renderer_ipcserver_->set_driver_msg_handler(this);
-
-    _init_angelscript_engine();
-
-    initialized = true;
-}
-
-Webengine::~Webengine()
+asIScriptEngine*
+Webengine::create_script_engine()
 {
-    CHECK(as_script_engine_);
-    CHECK(as_script_ctx_);
-
-    as_script_ctx_->Release();
-    as_script_ctx_ = nullptr;
-}
-
-void
-Webengine::_init_angelscript_engine()
-{
-    CHECK(!as_script_engine_);
-    as_script_engine_ = asCreateScriptEngine();
-    CHECK_NOTNULL(as_script_engine_);
-
-    as_script_ctx_ = as_script_engine_->CreateContext();
-    CHECK_NOTNULL(as_script_ctx_);
+    auto engine = asCreateScriptEngine();
+    CHECK_NOTNULL(engine);
 
-    LOG(INFO) << "angelscript engine= " << as_script_engine_;
+    LOG(INFO) << "angelscript engine= " << engine;
 
-    as_script_engine_->SetMessageCallback(
+    engine->SetMessageCallback(
         asFUNCTION(s_as_MessageCallback), 0, asCALL_CDECL);
 
-    RegisterStdString(as_script_engine_);
+    RegisterStdString(engine);
 
     auto rv = 0;
 
-#define REGISTER_MY_METHOD_AS_GLOBAL_FUNC(signature_str, my_impl_func)  \
+#define REGISTER_SCRIPT_FUNC(signature_str, func)                       \
     do {                                                                \
-        rv = as_script_engine_->RegisterGlobalFunction(                 \
-                signature_str, asMETHOD(Webengine, my_impl_func),       \
-                asCALL_THISCALL_ASGLOBAL, this);                        \
+        rv = engine->RegisterGlobalFunction(                            \
+                signature_str, asFUNCTION(func), asCALL_CDECL);         \
         CHECK_GE(rv, 0);                                                \
     } while (0)
 
-    REGISTER_MY_METHOD_AS_GLOBAL_FUNC(
-        "void __msleep(double)", msleep);
+    REGISTER_SCRIPT_FUNC(
+        "void __msleep(double)", s_script_msleep);
+
+    REGISTER_SCRIPT_FUNC(
+        "void add_elem(uint)", s_script_add_elem);
 
-    REGISTER_MY_METHOD_AS_GLOBAL_FUNC(
-        "void add_elem(uint)", add_elem_to_doc);
+    REGISTER_SCRIPT_FUNC(
+        "void sched_render_update_scope(uint)", s_script_sched_render_update_scope);
 
-    REGISTER_MY_METHOD_AS_GLOBAL_FUNC(
-        "void sched_render_update_scope(uint)", sched_render_update_scope);
+    REGISTER_SCRIPT_FUNC(
+        "void start_timer(uint)", s_script_start_timer);
 
-    REGISTER_MY_METHOD_AS_GLOBAL_FUNC(
-        "void start_timer(uint)", start_timer);
+    REGISTER_SCRIPT_FUNC(
+        "void cancel_timer(uint)", s_script_cancel_timer);
 
-    REGISTER_MY_METHOD_AS_GLOBAL_FUNC(
-        "void cancel_timer(uint)", cancel_timer);
+    REGISTER_SCRIPT_FUNC(
+        "void set_elem_res(uint, uint)", s_script_set_elem_res);
 
-    REGISTER_MY_METHOD_AS_GLOBAL_FUNC(
-        "void set_elem_res(uint, uint)", set_elem_res);
+    REGISTER_SCRIPT_FUNC(
+        "void send_xhr(uint)", s_script_send_xhr);
 
-    REGISTER_MY_METHOD_AS_GLOBAL_FUNC(
-        "void send_xhr(uint)", send_xhr);
+    REGISTER_SCRIPT_FUNC(
+        "void fetch_res(uint)", s_script_fetch_res);
 
-    REGISTER_MY_METHOD_AS_GLOBAL_FUNC(
-        "void fetch_res(uint)", fetch_res);
+#undef REGISTER_SCRIPT_FUNC
+
+    return engine;
 }
 
-void
-Webengine::_reset()
+Webengine::Webengine(
+    struct ::event_base* evbase,
+    ::Renderer* renderer,
+    IOServiceIPCClient* ioservice_ipcclient,
+    IPCServer* renderer_ipcserver,
+    asIScriptEngine* as_script_engine,
+    const uint32_t load_id,
+    PageModel::UniquePtr page_model,
+    const uint8_t preconnect_max_hosts,
+    const uint8_t preconnect_max_cnx_per_host
+    )
+    : evbase_(evbase)
+    , renderer_(renderer)
+    , ioservice_ipcclient_(ioservice_ipcclient)
+    , renderer_ipcserver_(renderer_ipcserver)
+    , preconnect_max_hosts_(preconnect_max_hosts)
+    , preconnect_max_cnx_per_host_(preconnect_max_cnx_per_host)
+    , as_script_engine_(as_script_engine)
+    , as_script_ctx_(nullptr)
+    , as_module_name_("load" + std::to_string(load_id))
+    , state_(State::IDLE)
+    , start_load_time_ms_(0)
+    , load_id_(load_id)
+    , notified_will_insert_body_(false)
+    , page_model_(std::move(page_model))
+    , checkCompleted_timer_(
+        new Timer(evbase_, true,
+                  boost::bind(&Webengine::checkCompleted_timer_fired, this, _1)))
+    , scheduled_render_tree_update_scope_id_(0)
 {
-    LOG(INFO) << "reset webengine...";
-    ioservice_ipcclient_->send_ResetSession();
-    _reset_loading_state();
-    LOG(INFO) << "done";
+    CHECK_NOTNULL(renderer_);
+    CHECK_NOTNULL(ioservice_ipcclient_);
+    CHECK_NOTNULL(as_script_engine_);
+    CHECK_NOTNULL(page_model_.get());
+    CHECK_GT(load_id_, 0);
+
+    as_script_ctx_ = as_script_engine_->CreateContext();
+    CHECK_NOTNULL(as_script_ctx_);
+    // so the functions scripts call know which webengine it is
+    as_script_ctx_->SetUserData(this);
 }
 
-void
-Webengine::handle_Reset()
+Webengine::~Webengine()
 {
-    _reset();
+    _reset_loading_state();
+
+    CHECK(as_script_ctx_);
+
+    as_script_ctx_->Release();
+    as_script_ctx_ = nullptr;
 }
 
 void
-Webengine::handle_LoadPage(const uint32_t load_id,
-                           const char* model_fpath)
+Webengine::load()
 {
     // we are probably doing some of what DocumentLoader does
 
-    // tell io service to drop whatever connections, requests, etc. it
-    // might have currently
-
-    LOG(INFO) << "start loading page, model [" << model_fpath << "] "
-              << "load id= " << load_id;
-    CHECK_NE(load_id, current_load_id_);
-    CHECK_GT(load_id, 0);
+    LOG(INFO) << "start loading page, load id= " << load_id_;
+    CHECK_EQ(state_, State::IDLE);
+    CHECK(!document_);
 
-    /* maybe _reset() ?*/
-    // _reset();
-
-    page_model_.reset(new PageModel(model_fpath));
     initial_render_tree_update_scope_id_ =
         page_model_->get_initial_render_tree_update_scope_id();
 
@@ -192,7 +179,6 @@ Webengine::handle_LoadPage(const uint32_t load_id,
     document_->load();
 
     start_load_time_ms_ = common::gettimeofdayMs();
-    current_load_id_ = load_id;
     state_ = State::PAGE_LOADING;
 }
 
@@ -211,7 +197,6 @@ Webengine::_reset_loading_state()
     scheduled_render_tree_update_scope_id_ = 0;
     initial_render_tree_update_scope_id_ = 0;
     start_load_time_ms_ = 0;
-    current_load_id_ = 0;
     forced_load_resInstNums_.clear();
 }
 
@@ -227,9 +212,41 @@ Webengine::ioservice_request_resource(const PageModel::RequestInfo& req_info,
         req_info.port,
         req_info.req_total_size,
         req_info.resp_meta_size,
-        req_info.resp_body_size);
+        req_info.resp_body_size,
+        req_info.priority);
     const auto ret = pending_requests_.insert(make_pair(req_id, res));
     CHECK(ret.second);
+    renderer_->add_request_route(req_id, load_id_);
+}
+
+void
+Webengine::ioservice_notify_will_insert_body()
+{
+    notified_will_insert_body_ = true;
+    ioservice_ipcclient_->send_WillInsertBody();
+}
+
+void
+Webengine::ioservice_preconnect_top_hosts()
+{
+    if (!preconnect_max_hosts_ || !preconnect_max_cnx_per_host_) {
+        return;
+    }
+
+    std::vector<PageModel::HostInfo> hosts;
+    page_model_->get_hosts_by_num_requests(hosts);
+
+    for (size_t i = 0; i < hosts.size() && i < preconnect_max_hosts_; ++i) {
+        const auto& host = hosts[i];
+        // no point having more connections than requests
+        const uint8_t num_cnx = std::min<uint32_t>(
+            host.num_requests, preconnect_max_cnx_per_host_);
+        VLOG(2) << "preconnect " << unsigned(num_cnx) << " to ["
+                << host.host << "]:" << host.port << " ("
+                << host.num_requests << " requests)";
+        ioservice_ipcclient_->send_Preconnect(
+            host.host.c_str(), host.port, num_cnx);
+    }
 }
 
 void
@@ -240,28 +257,30 @@ Webengine::renderer_notify_RequestWillBeSent(const uint32_t& resInstNum,
         return;
     }
     const auto forced = inSet(forced_load_resInstNums_, resInstNum);
-    renderer_ipcserver_->send_RequestWillBeSent(resInstNum, reqChainIdx, forced);
+    renderer_ipcserver_->send_RequestWillBeSent(
+        load_id_, resInstNum, reqChainIdx, forced);
 }
 
 void
 Webengine::renderer_notify_RequestFinished(const uint32_t& resInstNum,
                                          const uint32_t& reqChainIdx,
-                                         const bool& success)
+                                         const bool& success,
+                                         const RequestNetTiming& timing)
 {
     if (!renderer_ipcserver_) {
         return;
     }
     renderer_ipcserver_->send_RequestFinished(
-        resInstNum, reqChainIdx, success);
+        load_id_, resInstNum, reqChainIdx, success, timing);
 }
 
 void
 Webengine::_main_resource_failed()
 {
     LOG(WARNING) << "main resource failed to load, so reset and notify user";
-    const auto load_id = current_load_id_;
-    _reset();
-    renderer_ipcserver_->send_PageLoadFailed(load_id);
+    _reset_loading_state();
+    renderer_->release_io_session(load_id_);
+    renderer_ipcserver_->send_PageLoadFailed(load_id_);
 }
 
 void
@@ -271,6 +290,64 @@ Webengine::msleep(const double msec)
     usleep(msec * 1000);
 }
 
+Webengine*
+Webengine::s_script_webengine()
+{
+    auto ctx = asGetActiveContext();
+    CHECK_NOTNULL(ctx);
+    auto webengine = (Webengine*)ctx->GetUserData();
+    CHECK_NOTNULL(webengine);
+    return webengine;
+}
+
+void
+Webengine::s_script_msleep(double msec)
+{
+    s_script_webengine()->msleep(msec);
+}
+
+void
+Webengine::s_script_add_elem(uint32_t elemInstNum)
+{
+    s_script_webengine()->add_elem_to_doc(elemInstNum);
+}
+
+void
+Webengine::s_script_sched_render_update_scope(uint32_t scope_id)
+{
+    s_script_webengine()->sched_render_update_scope(scope_id);
+}
+
+void
+Webengine::s_script_start_timer(uint32_t timerID)
+{
+    s_script_webengine()->start_timer(timerID);
+}
+
+void
+Webengine::s_script_cancel_timer(uint32_t timerID)
+{
+    s_script_webengine()->cancel_timer(timerID);
+}
+
+void
+Webengine::s_script_set_elem_res(uint32_t elemInstNum, uint32_t resInstNum)
+{
+    s_script_webengine()->set_elem_res(elemInstNum, resInstNum);
+}
+
+void
+Webengine::s_script_send_xhr(uint32_t instNum)
+{
+    s_script_webengine()->send_xhr(instNum);
+}
+
+void
+Webengine::s_script_fetch_res(uint32_t instNum)
+{
+    s_script_webengine()->fetch_res(instNum);
+}
+
 void
 Webengine::add_elem_to_doc(const uint32_t elemInstNum)
 {
@@ -415,7 +492,8 @@ Webengine::execute_scope(const uint32_t scope_id)
 
 
     // Create a new script module
-    asIScriptModule *mod = as_script_engine_->GetModule(0, asGM_ALWAYS_CREATE);
+    asIScriptModule *mod = as_script_engine_->GetModule(
+        as_module_name_.c_str(), asGM_ALWAYS_CREATE);
     CHECK_NOTNULL(mod);
 
     SCOPE_EXIT {
@@ -435,8 +513,7 @@ Webengine::execute_scope(const uint32_t scope_id)
     // asIScriptContext *ctx = engine->CreateContext();
     // CHECK_NOTNULL(ctx);
 
-    asIScriptFunction *func =
-        as_script_engine_->GetModule(0)->GetFunctionByDecl(__MAIN_FUNC_PROTO);
+    asIScriptFunction *func = mod->GetFunctionByDecl(__MAIN_FUNC_PROTO);
     CHECK_NOTNULL(func);
 
     rv = as_script_ctx_->Prepare(func);
@@ -491,6 +568,27 @@ Webengine::handle_ReceivedResponse(const int& req_id,
 
 void
 Webengine::handle_DataReceived(const int& req_id, const size_t& length)
+{
+    _handle_data_received(req_id, length);
+
+    //////
+    _do_end_of_task_work();
+}
+
+void
+Webengine::handle_DataReceivedBatch(
+    const std::vector<std::pair<int, size_t> >& lengths)
+{
+    for (const auto& p : lengths) {
+        _handle_data_received(p.first, p.second);
+    }
+
+    //////
+    _do_end_of_task_work();
+}
+
+void
+Webengine::_handle_data_received(const int& req_id, const size_t& length)
 {
     auto it = pending_requests_.find(req_id);
     if (it == pending_requests_.end()) {
@@ -504,13 +602,11 @@ Webengine::handle_DataReceived(const int& req_id, const size_t& length)
     CHECK_NOTNULL(resource);
 
     resource->appendData(length);
-
-    //////
-    _do_end_of_task_work();
 }
 
 void
-Webengine::handle_RequestComplete(const int& req_id, const bool success)
+Webengine::handle_RequestComplete(const int& req_id, const bool success,
+                                  const RequestNetTiming& timing)
 {
     auto it = pending_requests_.find(req_id);
     if (it == pending_requests_.end()) {
@@ -529,7 +625,7 @@ Webengine::handle_RequestComplete(const int& req_id, const bool success)
     if (!success && (1 == resource->instNum())) {
         _main_resource_failed();
     } else {
-        resource->finish(success);
+        resource->finish(success, timing);
 
         //////
         _do_end_of_task_work();
@@ -597,7 +693,7 @@ Webengine::checkCompleted_timer_fired(Timer*)
 
     const auto ttfb_ms = document_->first_byte_time_ms() - start_load_time_ms_;
 
-    renderer_ipcserver_->send_PageLoaded(current_load_id_, ttfb_ms);
+    renderer_ipcserver_->send_PageLoaded(load_id_, ttfb_ms);
 
     _maybe_load_unloaded_resources();
     
@@ -2,6 +2,7 @@
 #define webengine_hpp
 
 #include <memory>
+#include <string>
 #include <angelscript.h>
 
 #include "../../../utility/object.hpp"
@@ -38,46 +39,80 @@
  * messages, and (2) after each DOMTimer fires (make DOMTimer a friend
  * class so it can call our _do_end_of_task_work())
  *
+ * a webengine does ONE page load, the one with "load_id"; the
+ * Renderer can have several of them going at the same time, and
+ * gives each the io service msgs for its requests
+ *
  */
 
+class Renderer;
+
 namespace blink
 {
 
 class Webengine : public Object
-                , public ResourceMsgHandler
-                , public DriverMsgHandler
 {
 public:
     typedef std::unique_ptr<Webengine, /*folly::*/Destructor> UniquePtr;
 
+    /* create the script engine that webengines share, with the
+     * functions that the page model's scripts call already
+     * registered */
+    static asIScriptEngine* create_script_engine();
+
+    /* once the main html response starts arriving, we ask the io
+     * service to preconnect to the page's "preconnect_max_hosts" most
+     * requested hosts, up to "preconnect_max_cnx_per_host" connections
+     * each. zero hosts means don't preconnect
+     *
+     * "as_script_engine" must be from create_script_engine(). call
+     * load() to start loading the page
+     */
     explicit Webengine(struct ::event_base*,
+                       ::Renderer*,
                        IOServiceIPCClient*,
-                       IPCServer*
+                       IPCServer*,
+                       asIScriptEngine* as_script_engine,
+                       const uint32_t load_id,
+                       PageModel::UniquePtr page_model,
+                       const uint8_t preconnect_max_hosts,
+                       const uint8_t preconnect_max_cnx_per_host
         );
 
+    void load();
+
+    uint32_t load_id() const { return load_id_; }
+    /* we have told the io service we're about to have the body */
+    bool notified_will_insert_body() const { return notified_will_insert_body_; }
+
     /* ------- send messages to io service --------- */
     /* will send a request to the io process, and will notify the
      * Resource response/data
      */
     void ioservice_request_resource(const PageModel::RequestInfo& req_info,
                                     Resource* res);
+    /* tell the io service we're about to have the body element, so it
+     * can stop holding back low priority requests */
+    void ioservice_notify_will_insert_body();
+    void ioservice_preconnect_top_hosts();
 
     /* ------- send messages to client of renderer ipc --------- */
     void renderer_notify_RequestWillBeSent(const uint32_t& resInstNum,
                                            const uint32_t& reqChainIdx);
     void renderer_notify_RequestFinished(const uint32_t& resInstNum,
                                          const uint32_t& reqChainIdx,
-                                         const bool& success);
-
-    /* implement ResourceMsgHandler interface */
-    virtual void handle_ReceivedResponse(const int& req_id,
-                                         const uint64_t& first_byte_time_ms) override;
-    virtual void handle_DataReceived(const int& req_id, const size_t& length) override;
-    virtual void handle_RequestComplete(const int& req_id, const bool success) override;
-
-    /* DriverMsgHandler interface */
-    void handle_LoadPage(const uint32_t load_id, const char* model_fpath) override;
-    void handle_Reset() override;
+                                         const bool& success,
+                                         const RequestNetTiming& timing);
+
+    /* from the io service, about our requests; see
+     * ResourceMsgHandler */
+    void handle_ReceivedResponse(const int& req_id,
+                                 const uint64_t& first_byte_time_ms);
+    void handle_DataReceived(const int& req_id, const size_t& length);
+    void handle_DataReceivedBatch(
+        const std::vector<std::pair<int, size_t> >& lengths);
+    void handle_RequestComplete(const int& req_id, const bool success,
+                                const RequestNetTiming& timing);
 
     void msleep(const double ms);
 
@@ -93,9 +128,7 @@ protected:
 
     //////
 
-    void _init_angelscript_engine();
     void checkCompleted_timer_fired(Timer*);
-    void _reset();
     void _main_resource_failed();
 
     friend class DOMTimer;
@@ -103,6 +136,10 @@ protected:
 
     void _do_end_of_task_work();
 
+    /* the part of handle_DataReceived() that doesn't include the end
+     * of task work */
+    void _handle_data_received(const int& req_id, const size_t& length);
+
     void _maybe_load_unloaded_resources();
 
     // reset to prepare for new page load, including clearing any
@@ -120,14 +157,32 @@ protected:
     void send_xhr(const uint32_t xhrInstNum);
     void fetch_res(const uint32_t resInstNum);
 
+    /* what scripts actually call: they pass the call on to the
+     * webengine whose script context is running */
+    static Webengine* s_script_webengine();
+    static void s_script_msleep(double);
+    static void s_script_add_elem(uint32_t);
+    static void s_script_sched_render_update_scope(uint32_t);
+    static void s_script_start_timer(uint32_t);
+    static void s_script_cancel_timer(uint32_t);
+    static void s_script_set_elem_res(uint32_t, uint32_t);
+    static void s_script_send_xhr(uint32_t);
+    static void s_script_fetch_res(uint32_t);
+
     /////
 
     struct ::event_base* evbase_;
+    ::Renderer* renderer_;
     IOServiceIPCClient* ioservice_ipcclient_;
     IPCServer* renderer_ipcserver_;
+    const uint8_t preconnect_max_hosts_;
+    const uint8_t preconnect_max_cnx_per_host_;
 
-    asIScriptEngine* as_script_engine_;
+    asIScriptEngine* as_script_engine_; // don't free
     asIScriptContext* as_script_ctx_;
+    /* the module our scopes are built in, so that we don't use
+     * another webengine's */
+    const std::string as_module_name_;
 
     /* state will be "page_loading" until the "load" event is
      * fired. once the page's load event has fired, we are back to
@@ -139,7 +194,8 @@ protected:
 
     uint64_t start_load_time_ms_;
 
-    uint32_t current_load_id_;
+    const uint32_t load_id_;
+    bool notified_will_insert_body_;
 
     /* map from the request id (for IPC!! not the resInstNum) that we
      * generate to the resource for which we're requesting. this is
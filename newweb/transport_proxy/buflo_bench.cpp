@@ -0,0 +1,680 @@
+
+/* offline benchmark of the buflo mux channel: connects a csp-side and
+ * an ssp-side BufloMuxChannelImplSpdy over a socketpair, in one
+ * process, and replays a trace of streams through them, once for
+ * every (cell size, interval, L) configuration.
+ *
+ * usage: buflo-bench --trace=<file> [--cell-sizes=750]
+ *            [--intervals=5,20] [--Ls=100] [--time-limit-secs=60]
+ *            [--threaded-cell-pacer=no]
+ *
+ * the trace has one stream per line, "#" starts a comment:
+ *
+ *     <start offset ms> <request bytes> <response bytes>
+ *
+ * the offset is relative to the first stream. e.g., take the
+ * RequestWillBeSent/RequestFinished times of a page load from the
+ * driver's log and the sizes from the page model.
+ *
+ * at every start offset, the csp creates a stream and sends the
+ * request; once the ssp has received the whole request it sends the
+ * response. the stream is done when the csp has received the whole
+ * response. with a defense, the csp starts the session on the first
+ * send, and stops it once all streams are done; the run ends when
+ * the session is done in both directions.
+ *
+ * a baseline without cells or defense (cell size 0) is always run
+ * first, and the latencies of the other configurations are also
+ * given relative to it. the results go to stdout as csv, one row per
+ * configuration:
+ *
+ *   - cells_per_sec: cells sent by both sides, per second of the run
+ *   - cpu_us_per_cell: process cpu (user + sys) over the run, per cell
+ *   - dummy_ratio: dummy cells over all cells
+ *   - mean_latency_ms: mean time from a stream's start offset until
+ *     its whole response has arrived
+ *   - last_done_ms: when the last stream was done, i.e., the "page"
+ *     time
+ *
+ * this runs in real time: the replay is paced by the trace, and the
+ * defense by its interval
+ */
+
+#include <stdio.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <fcntl.h>
+#include <arpa/inet.h>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/algorithm/string.hpp>
+#include <event2/event.h>
+#include <event2/buffer.h>
+
+#include "../utility/common.hpp"
+#include "../utility/timer.hpp"
+#include "../utility/buflo_mux_channel_impl_spdy.hpp"
+#include "../utility/easylogging++.h"
+
+
+using std::vector;
+using std::pair;
+using std::string;
+using myio::buflo::BufloMuxChannel;
+using myio::buflo::BufloMuxChannelImplSpdy;
+using myio::buflo::BufloCellPacer;
+using myio::buflo::BufloMuxChannelStreamObserver;
+
+typedef std::chrono::steady_clock Clock;
+
+
+static const char trace_name[] = "trace";
+static const char cell_sizes_name[] = "cell-sizes";
+static const char intervals_name[] = "intervals";
+static const char Ls_name[] = "Ls";
+static const char time_limit_secs_name[] = "time-limit-secs";
+static const char threaded_cell_pacer_name[] = "threaded-cell-pacer";
+
+
+struct TraceEntry
+{
+    uint32_t start_offset_ms;
+    size_t req_bytes;
+    size_t resp_bytes;
+};
+
+struct BenchConfig
+{
+    uint32_t cell_size;
+    uint32_t intvl_ms;
+    uint32_t L;
+};
+
+struct BenchResult
+{
+    double wall_ms = 0;
+    uint64_t num_cells = 0;
+    uint64_t num_dummy_cells = 0;
+    double cpu_us = 0;
+    double mean_latency_ms = 0;
+    double last_done_ms = 0;
+};
+
+
+static double
+s_ms_since(const Clock::time_point& tp)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - tp).count();
+}
+
+static double
+s_process_cpu_us()
+{
+    struct rusage ru;
+    const auto rv = getrusage(RUSAGE_SELF, &ru);
+    CHECK_EQ(rv, 0);
+    return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000.0
+        + ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+/* add "len" bytes of filler to "buf", without copying */
+static void
+s_add_filler_bytes(struct evbuffer* buf, size_t len)
+{
+    while (len) {
+        const auto chunk = std::min(len, common::static_bytes_length);
+        const auto rv = evbuffer_add_reference(
+            buf, common::static_bytes->c_str(), chunk, nullptr, nullptr);
+        CHECK_EQ(rv, 0);
+        len -= chunk;
+    }
+}
+
+
+class BenchRun;
+
+/* one stream of the trace. it observes its stream on both channels */
+class BenchStream : public BufloMuxChannelStreamObserver
+{
+public:
+    BenchStream(BenchRun* run, const size_t idx, const TraceEntry& entry)
+        : run_(run), idx_(idx), entry_(entry)
+    {}
+
+    /* "scheduled_tp": when the trace says we start; our latency is
+     * counted from there */
+    void start(BufloMuxChannelImplSpdy* csp_ch,
+               const Clock::time_point& scheduled_tp);
+
+    /* the ssp has received our connect request */
+    void on_ssp_connect_request(BufloMuxChannelImplSpdy* ssp_ch, int sid);
+
+    virtual void onStreamIdAssigned(BufloMuxChannel*, int sid) override;
+    virtual void onStreamCreateResult(BufloMuxChannel*, bool,
+                                      const in_addr_t&, const uint16_t&) override;
+    virtual void onStreamNewDataAvailable(BufloMuxChannel*, int sid) override;
+    virtual void onStreamRecvEOF(BufloMuxChannel*, int) override {}
+    virtual void onStreamClosed(BufloMuxChannel*, int) override {}
+
+    bool is_done() const { return done_; }
+    const double& latency_ms() const { return latency_ms_; }
+
+private:
+
+    void _ssp_send_response();
+
+    BenchRun* run_;
+    const size_t idx_;
+    const TraceEntry entry_;
+
+    BufloMuxChannelImplSpdy* csp_ch_ = nullptr;
+    BufloMuxChannelImplSpdy* ssp_ch_ = nullptr;
+    int csp_sid_ = -1;
+    int ssp_sid_ = -1;
+
+    size_t req_recv_ = 0;
+    size_t resp_recv_ = 0;
+
+    Clock::time_point start_tp_;
+    double latency_ms_ = 0;
+    bool done_ = false;
+};
+
+class BenchRun
+{
+public:
+    BenchRun(struct event_base* evbase, const vector<TraceEntry>& trace,
+             const BenchConfig& conf, const uint32_t time_limit_secs,
+             const bool threaded_cell_pacer)
+        : evbase_(evbase), trace_(trace), conf_(conf)
+        , time_limit_secs_(time_limit_secs)
+        , threaded_cell_pacer_(threaded_cell_pacer)
+    {}
+
+    BenchResult run();
+
+    void on_stream_done(BenchStream*);
+
+private:
+
+    bool _is_defended() const { return conf_.cell_size > 0; }
+
+    void _on_csp_channel_status(BufloMuxChannel*, BufloMuxChannel::ChannelStatus);
+    void _on_ssp_channel_status(BufloMuxChannel*, BufloMuxChannel::ChannelStatus);
+    void _on_ssp_new_stream_connect_request(BufloMuxChannel*, int sid,
+                                            const char* host, uint16_t port);
+    void _replay_timer_fired(Timer*);
+    void _finish();
+
+    struct event_base* evbase_;
+    const vector<TraceEntry>& trace_;
+    const BenchConfig conf_;
+    const uint32_t time_limit_secs_;
+    const bool threaded_cell_pacer_;
+
+    BufloMuxChannelImplSpdy::UniquePtr csp_ch_;
+    BufloMuxChannelImplSpdy::UniquePtr ssp_ch_;
+    vector<std::unique_ptr<BenchStream> > streams_;
+    Timer::UniquePtr replay_timer_;
+
+    Clock::time_point start_tp_;
+    double start_cpu_us_ = 0;
+    size_t next_stream_idx_ = 0;
+    bool defense_started_ = false;
+    size_t num_streams_done_ = 0;
+    double last_done_ms_ = 0;
+    bool finished_ = false;
+    BenchResult result_;
+};
+
+
+void
+BenchStream::start(BufloMuxChannelImplSpdy* csp_ch,
+                   const Clock::time_point& scheduled_tp)
+{
+    csp_ch_ = csp_ch;
+    start_tp_ = scheduled_tp;
+
+    // the ssp finds us by the port
+    const auto rv = csp_ch_->create_stream2("bench", idx_ + 1, this);
+    CHECK_EQ(rv, 0);
+}
+
+void
+BenchStream::onStreamIdAssigned(BufloMuxChannel*, int sid)
+{
+    csp_sid_ = sid;
+}
+
+void
+BenchStream::onStreamCreateResult(BufloMuxChannel*, bool ok,
+                                  const in_addr_t&, const uint16_t&)
+{
+    CHECK(ok);
+    CHECK_GE(csp_sid_, 0);
+
+    if (entry_.req_bytes) {
+        struct evbuffer* buf = evbuffer_new();
+        CHECK_NOTNULL(buf);
+        s_add_filler_bytes(buf, entry_.req_bytes);
+        const auto rv = csp_ch_->write_buffer(csp_sid_, buf);
+        CHECK_EQ(rv, 0);
+        evbuffer_free(buf);
+    }
+    csp_ch_->set_write_eof(csp_sid_);
+}
+
+void
+BenchStream::on_ssp_connect_request(BufloMuxChannelImplSpdy* ssp_ch, int sid)
+{
+    ssp_ch_ = ssp_ch;
+    ssp_sid_ = sid;
+    ssp_ch_->set_stream_observer(sid, this);
+    ssp_ch_->set_stream_connected(sid);
+
+    if (!entry_.req_bytes) {
+        _ssp_send_response();
+    }
+}
+
+void
+BenchStream::onStreamNewDataAvailable(BufloMuxChannel* ch, int sid)
+{
+    auto buf = ch->get_input_evbuf(sid);
+    CHECK_NOTNULL(buf);
+    const auto len = evbuffer_get_length(buf);
+    const auto rv = evbuffer_drain(buf, len);
+    CHECK_EQ(rv, 0);
+
+    if (ch == ssp_ch_) {
+        req_recv_ += len;
+        CHECK_LE(req_recv_, entry_.req_bytes);
+        if (len && (req_recv_ == entry_.req_bytes)) {
+            _ssp_send_response();
+        }
+    } else {
+        CHECK_EQ(ch, csp_ch_);
+        resp_recv_ += len;
+        CHECK_LE(resp_recv_, entry_.resp_bytes);
+        if (!done_ && (resp_recv_ == entry_.resp_bytes)) {
+            done_ = true;
+            latency_ms_ = s_ms_since(start_tp_);
+            run_->on_stream_done(this);
+        }
+    }
+}
+
+void
+BenchStream::_ssp_send_response()
+{
+    // every response has at least one byte, so the csp knows when
+    // it's done
+    CHECK_GT(entry_.resp_bytes, 0);
+
+    struct evbuffer* buf = evbuffer_new();
+    CHECK_NOTNULL(buf);
+    s_add_filler_bytes(buf, entry_.resp_bytes);
+    const auto rv = ssp_ch_->write_buffer(ssp_sid_, buf);
+    CHECK_EQ(rv, 0);
+    evbuffer_free(buf);
+    ssp_ch_->set_write_eof(ssp_sid_);
+}
+
+BenchResult
+BenchRun::run()
+{
+    LOG(INFO) << "run: cell size= " << conf_.cell_size
+              << " interval= " << conf_.intvl_ms << " L= " << conf_.L;
+
+    int fds[2];
+    auto rv = socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    CHECK_EQ(rv, 0);
+    for (const auto fd : fds) {
+        rv = fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        CHECK_EQ(rv, 0);
+    }
+
+    const auto time_limit = _is_defended() ? time_limit_secs_ : 0;
+    const in_addr_t myaddr = INADDR_LOOPBACK;
+
+    // the ssp must exist first to read the csp's hello
+    ssp_ch_.reset(
+        new BufloMuxChannelImplSpdy(
+            evbase_, fds[1], false, myaddr, conf_.cell_size,
+            conf_.intvl_ms, 0, conf_.L, time_limit,
+            boost::bind(&BenchRun::_on_ssp_channel_status, this, _1, _2),
+            boost::bind(&BenchRun::_on_ssp_new_stream_connect_request,
+                        this, _1, _2, _3, _4)));
+    csp_ch_.reset(
+        new BufloMuxChannelImplSpdy(
+            evbase_, fds[0], true, myaddr, conf_.cell_size,
+            conf_.intvl_ms, conf_.intvl_ms, conf_.L, time_limit,
+            boost::bind(&BenchRun::_on_csp_channel_status, this, _1, _2),
+            NULL));
+
+    if (_is_defended() && threaded_cell_pacer_) {
+        csp_ch_->enable_threaded_cell_pacer(-1);
+        ssp_ch_->enable_threaded_cell_pacer(-1);
+    }
+
+    for (size_t i = 0; i < trace_.size(); ++i) {
+        streams_.emplace_back(new BenchStream(this, i, trace_[i]));
+    }
+
+    replay_timer_.reset(
+        new Timer(evbase_, true,
+                  boost::bind(&BenchRun::_replay_timer_fired, this, _1)));
+
+    common::dispatch_evbase(evbase_);
+    CHECK(finished_);
+
+    // the channels first, they point to the streams
+    replay_timer_.reset();
+    csp_ch_.reset();
+    ssp_ch_.reset();
+    streams_.clear();
+
+    return result_;
+}
+
+void
+BenchRun::_on_csp_channel_status(BufloMuxChannel*,
+                                 BufloMuxChannel::ChannelStatus status)
+{
+    switch (status) {
+    case BufloMuxChannel::ChannelStatus::READY:
+        LOG(INFO) << "channels ready; start replay";
+        if (_is_defended()) {
+            csp_ch_->set_auto_start_defense_session_on_next_send();
+        }
+        start_tp_ = Clock::now();
+        start_cpu_us_ = s_process_cpu_us();
+        _replay_timer_fired(nullptr);
+        break;
+
+    case BufloMuxChannel::ChannelStatus::A_DEFENSE_SESSION_STARTED:
+        // resume the replay, but not from within this callback
+        defense_started_ = true;
+        replay_timer_->cancel();
+        replay_timer_->start(0u);
+        break;
+
+    case BufloMuxChannel::ChannelStatus::A_DEFENSE_SESSION_DONE:
+        CHECK_EQ(num_streams_done_, streams_.size());
+        _finish();
+        break;
+
+    case BufloMuxChannel::ChannelStatus::CLOSED:
+        LOG(FATAL) << "csp channel closed unexpectedly";
+        break;
+    }
+}
+
+void
+BenchRun::_on_ssp_channel_status(BufloMuxChannel*,
+                                 BufloMuxChannel::ChannelStatus status)
+{
+    if (status == BufloMuxChannel::ChannelStatus::CLOSED) {
+        LOG(FATAL) << "ssp channel closed unexpectedly";
+    }
+}
+
+void
+BenchRun::_on_ssp_new_stream_connect_request(BufloMuxChannel*, int sid,
+                                             const char*, uint16_t port)
+{
+    CHECK_GT(port, 0);
+    CHECK_LE(port, streams_.size());
+    streams_[port - 1]->on_ssp_connect_request(ssp_ch_.get(), sid);
+}
+
+void
+BenchRun::_replay_timer_fired(Timer*)
+{
+    const auto elapsed_ms = s_ms_since(start_tp_);
+
+    while ((next_stream_idx_ < trace_.size())
+           && (trace_[next_stream_idx_].start_offset_ms <= elapsed_ms))
+    {
+        if (_is_defended() && !defense_started_ && next_stream_idx_) {
+            /* until the channel has sent the first stream's cell and
+             * started the session, it can take only that one cell.
+             * we'll continue once it has started */
+            return;
+        }
+        const auto& entry = trace_[next_stream_idx_];
+        streams_[next_stream_idx_]->start(
+            csp_ch_.get(),
+            start_tp_ + std::chrono::milliseconds(entry.start_offset_ms));
+        ++next_stream_idx_;
+    }
+
+    if (next_stream_idx_ < trace_.size()) {
+        const auto delay_ms =
+            trace_[next_stream_idx_].start_offset_ms - (uint32_t)elapsed_ms;
+        replay_timer_->start(std::max(delay_ms, 1u));
+    }
+}
+
+void
+BenchRun::on_stream_done(BenchStream*)
+{
+    ++num_streams_done_;
+    if (num_streams_done_ < streams_.size()) {
+        return;
+    }
+
+    last_done_ms_ = s_ms_since(start_tp_);
+    LOG(INFO) << "all " << num_streams_done_ << " streams done at "
+              << last_done_ms_ << " ms";
+
+    if (_is_defended()) {
+        // wait for the session to be done in both directions
+        csp_ch_->stop_defense_session();
+    } else {
+        _finish();
+    }
+}
+
+void
+BenchRun::_finish()
+{
+    CHECK(!finished_);
+    finished_ = true;
+
+    result_.wall_ms = s_ms_since(start_tp_);
+    result_.cpu_us = s_process_cpu_us() - start_cpu_us_;
+    result_.last_done_ms = last_done_ms_;
+
+    double sum_latency_ms = 0;
+    for (const auto& stream : streams_) {
+        sum_latency_ms += stream->latency_ms();
+    }
+    result_.mean_latency_ms = streams_.empty() ? 0 : (sum_latency_ms / streams_.size());
+
+    if (_is_defended()) {
+        result_.num_cells =
+            csp_ch_->all_send_cell_count() + ssp_ch_->all_send_cell_count();
+        result_.num_dummy_cells =
+            csp_ch_->dummy_send_cell_count() + ssp_ch_->dummy_send_cell_count();
+    }
+
+    event_base_loopbreak(evbase_);
+}
+
+static vector<uint32_t>
+s_parse_list(const string& value, const char* name)
+{
+    vector<string> parts;
+    boost::split(parts, value, boost::is_any_of(","));
+    vector<uint32_t> retval;
+    for (const auto& part : parts) {
+        try {
+            retval.push_back(boost::lexical_cast<uint32_t>(part));
+        }
+        catch (...) {
+            LOG(FATAL) << "bad value for " << name;
+        }
+    }
+    return retval;
+}
+
+static vector<TraceEntry>
+s_read_trace(const string& fpath)
+{
+    std::ifstream ifs(fpath);
+    CHECK(ifs.is_open()) << "cannot open \"" << fpath << "\"";
+
+    vector<TraceEntry> trace;
+    string line;
+    size_t lineno = 0;
+    while (std::getline(ifs, line)) {
+        ++lineno;
+        const auto comment_pos = line.find('#');
+        if (comment_pos != string::npos) {
+            line.erase(comment_pos);
+        }
+        boost::trim(line);
+        if (line.empty()) {
+            continue;
+        }
+
+        std::istringstream iss(line);
+        TraceEntry entry;
+        iss >> entry.start_offset_ms >> entry.req_bytes >> entry.resp_bytes;
+        CHECK(!iss.fail()) << "bad trace line " << lineno;
+        CHECK_GT(entry.resp_bytes, 0) << "empty response on trace line " << lineno;
+        trace.push_back(entry);
+    }
+
+    CHECK(!trace.empty()) << "empty trace";
+    CHECK_LT(trace.size(), 65535) << "too many streams";
+
+    std::stable_sort(trace.begin(), trace.end(),
+                     [](const TraceEntry& a, const TraceEntry& b)
+                     { return a.start_offset_ms < b.start_offset_ms; });
+    // relative to the first stream
+    const auto first_offset_ms = trace.front().start_offset_ms;
+    for (auto& entry : trace) {
+        entry.start_offset_ms -= first_offset_ms;
+    }
+
+    return trace;
+}
+
+static void
+s_print_result(const BenchConfig& conf, const BenchResult& res,
+               const BenchResult& baseline)
+{
+    const double secs = res.wall_ms / 1000;
+    printf("%u,%u,%u,%.1f,%lu,%.1f,%.2f,%.4f,%.2f,%.2f,%.1f,%.1f\n",
+           conf.cell_size, conf.intvl_ms, conf.L,
+           res.wall_ms,
+           (unsigned long)res.num_cells,
+           secs > 0 ? (res.num_cells / secs) : 0.0,
+           res.num_cells ? (res.cpu_us / res.num_cells) : 0.0,
+           res.num_cells ? ((double)res.num_dummy_cells / res.num_cells) : 0.0,
+           res.mean_latency_ms,
+           res.mean_latency_ms - baseline.mean_latency_ms,
+           res.last_done_ms,
+           res.last_done_ms - baseline.last_done_ms);
+    fflush(stdout);
+}
+
+INITIALIZE_EASYLOGGINGPP
+
+int main(int argc, char **argv)
+{
+    common::init_common();
+    common::init_easylogging();
+
+    START_EASYLOGGINGPP(argc, argv);
+
+    bool found_conf_name = false;
+    string found_conf_value;
+    vector<pair<string, string> > name_value_pairs;
+    auto rv = common::get_cmd_line_name_value_pairs(argc, (const char**)argv,
+                                                  found_conf_name, found_conf_value,
+                                                  name_value_pairs);
+    CHECK(rv == 0);
+
+    string trace_fpath;
+    vector<uint32_t> cell_sizes = {750};
+    vector<uint32_t> intervals = {5, 20};
+    vector<uint32_t> Ls = {100};
+    uint32_t time_limit_secs = 60;
+    bool threaded_cell_pacer = false;
+
+    for (const auto& nv_pair : name_value_pairs) {
+        const auto& name = nv_pair.first;
+        const auto& value = nv_pair.second;
+
+        if (name == trace_name) {
+            trace_fpath = value;
+        } else if (name == cell_sizes_name) {
+            cell_sizes = s_parse_list(value, cell_sizes_name);
+        } else if (name == intervals_name) {
+            intervals = s_parse_list(value, intervals_name);
+        } else if (name == Ls_name) {
+            Ls = s_parse_list(value, Ls_name);
+        } else if (name == time_limit_secs_name) {
+            try {
+                time_limit_secs = boost::lexical_cast<uint32_t>(value);
+            }
+            catch (...) {
+                LOG(FATAL) << "bad value for " << time_limit_secs_name;
+            }
+        } else if (name == threaded_cell_pacer_name) {
+            CHECK((value == "yes") || (value == "no"))
+                << "use yes or no for " << threaded_cell_pacer_name;
+            threaded_cell_pacer = (value == "yes");
+        }
+    }
+
+    CHECK(!trace_fpath.empty()) << "need --" << trace_name;
+    if (threaded_cell_pacer) {
+        for (const auto cell_size : cell_sizes) {
+            CHECK_LE(cell_size, BufloCellPacer::max_cell_size)
+                << "the threaded cell pacer can't do cell size " << cell_size;
+        }
+    }
+    const auto trace = s_read_trace(trace_fpath);
+    LOG(INFO) << "replaying " << trace.size() << " streams";
+
+    std::unique_ptr<struct event_base, void(*)(struct event_base*)> evbase(
+        common::init_evbase(), event_base_free);
+
+    printf("cell_size,interval_ms,L,wall_ms,cells,cells_per_sec,"
+           "cpu_us_per_cell,dummy_ratio,mean_latency_ms,added_mean_latency_ms,"
+           "last_done_ms,added_last_done_ms\n");
+
+    const BenchConfig baseline_conf = {0, 0, 0};
+    const auto baseline = BenchRun(evbase.get(), trace, baseline_conf,
+                                   time_limit_secs, false).run();
+    s_print_result(baseline_conf, baseline, baseline);
+
+    for (const auto cell_size : cell_sizes) {
+        if (!cell_size) {
+            // that's the baseline
+            continue;
+        }
+        for (const auto intvl_ms : intervals) {
+            for (const auto L : Ls) {
+                const BenchConfig conf = {cell_size, intvl_ms, L};
+                const auto res = BenchRun(evbase.get(), trace, conf,
+                                          time_limit_secs,
+                                          threaded_cell_pacer).run();
+                s_print_result(conf, res, baseline);
+            }
+        }
+    }
+
+    return 0;
+}
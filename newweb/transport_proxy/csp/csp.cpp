@@ -44,7 +44,8 @@ ClientSideProxy::ClientSideProxy(struct event_base* evbase,
                                  const uint32_t& buflo_packet_intvl_ms,
                                  const uint32_t& ssp_buflo_packet_intvl_ms,
                                  const uint32_t& buflo_L,
-                                 const uint32_t& buflo_time_limit_secs)
+                                 const uint32_t& buflo_time_limit_secs,
+                                 const uint16_t& stream_ctrl_batch_window_ms)
     : evbase_(evbase)
     , stream_server_(std::move(streamserver))
     , peer_host_(peer_host), peer_port_(peer_port)
@@ -54,6 +55,7 @@ ClientSideProxy::ClientSideProxy(struct event_base* evbase,
     , ssp_buflo_packet_intvl_ms_(ssp_buflo_packet_intvl_ms)
     , buflo_L_(buflo_L)
     , buflo_time_limit_secs_(buflo_time_limit_secs)
+    , stream_ctrl_batch_window_ms_(stream_ctrl_batch_window_ms)
     , state_(State::INITIAL)
     , myaddr_(INADDR_NONE)
     , log_stats_timer_(
@@ -395,6 +397,14 @@ ClientSideProxy::_on_connected_to_ssp()
             ));
     CHECK_NOTNULL(buflo_ch_.get());
 
+    if (stream_ctrl_batch_window_ms_) {
+        buflo_ch_->set_stream_ctrl_batch_window_ms(stream_ctrl_batch_window_ms_);
+    }
+
+    if (use_threaded_cell_pacer_) {
+        buflo_ch_->enable_threaded_cell_pacer(cell_pacer_cpu_);
+    }
+
     state_ = State::SETTING_UP_BUFLO_CHANNEL;
 }
 
@@ -465,8 +475,14 @@ ClientSideProxy::_on_buflo_channel_status(BufloMuxChannel*,
         LOG(FATAL) << "buflo channel is closed, so we're exiting";
 #endif
 
+    } else if (status == BufloMuxChannel::ChannelStatus::A_DEFENSE_SESSION_STARTED) {
+
+        write_stats_record(tproxy_stats::DEFENSE_SESSION_STARTED);
+
     } else if (status == BufloMuxChannel::ChannelStatus::A_DEFENSE_SESSION_DONE) {
 
+        write_stats_record(tproxy_stats::DEFENSE_SESSION_DONE);
+
         if (a_defense_session_done_cb_) {
             DestructorGuard dg(this);
             a_defense_session_done_cb_(this);
@@ -529,6 +545,7 @@ void
 ClientSideProxy::_log_stats_timer_fired(Timer*)
 {
     log_stats();
+    write_stats_record(tproxy_stats::PERIODIC);
     _schedule_log_timer();
 }
 
@@ -544,6 +561,32 @@ ClientSideProxy::log_stats() const
                   << " dummy_cells_avoided_so_far= " << num_dummy_cells_avoided_so_far();
 }
 
+void
+ClientSideProxy::write_stats_record(const tproxy_stats::RecordType type) const
+{
+    if (!stats_file_writer_) {
+        return;
+    }
+
+    tproxy_stats::Record rec;
+    memset(&rec, 0, sizeof rec);
+    rec.type = type;
+    rec.source_id = objId();
+    rec.peer_addr = buflo_ch_ ? buflo_ch_->peer_addr() : 0;
+
+    rec.all_recv_bytes = all_recv_byte_count_so_far();
+    rec.useful_recv_bytes = useful_recv_byte_count_so_far();
+    rec.dummy_recv_cells = dummy_recv_cell_count_so_far();
+
+    rec.all_send_bytes = all_send_byte_count_so_far();
+    rec.useful_send_bytes = useful_send_byte_count_so_far();
+    rec.dummy_send_cells = dummy_send_cell_count_so_far();
+
+    rec.dummy_cells_avoided = num_dummy_cells_avoided_so_far();
+
+    stats_file_writer_->write(rec);
+}
+
 void
 ClientSideProxy::_reap_buflo_channel_timer_fired(Timer*)
 {
@@ -10,6 +10,7 @@
 #include "../../utility/buflo_mux_channel_impl_spdy.hpp"
 
 #include "client_handler.hpp"
+#include "../stats_file_writer.hpp"
 
 namespace csp
 {
@@ -45,6 +46,11 @@ public:
      * "socks5_addr": if not zero, then it's the ip address of the
      * socks5 proxy (e.g., local Tor client) that we should use to
      * reach the peer.
+     *
+     * "stream_ctrl_batch_window_ms": if not zero, stream creates that
+     * happen within this window (e.g., the browser opening several
+     * connections at the start of a page load) are sent to the ssp
+     * together; see BufloMuxChannelImplSpdy::set_stream_ctrl_batch_window_ms()
      */
     explicit ClientSideProxy(struct event_base* evbase,
                             myio::StreamServer::UniquePtr,
@@ -55,7 +61,8 @@ public:
                              const uint32_t& buflo_packet_intvl_ms,
                              const uint32_t& ssp_buflo_packet_intvl_ms,
                              const uint32_t& buflo_L,
-                             const uint32_t& buflo_time_limit_secs);
+                             const uint32_t& buflo_time_limit_secs,
+                             const uint16_t& stream_ctrl_batch_window_ms);
 
     enum class EstablishReturnValue
     {
@@ -90,6 +97,21 @@ public:
 
     void log_stats() const;
 
+    /* if set, we also write our counters into the stats file:
+     * periodically, and at the start and end of every defense
+     * session. we don't own the writer */
+    void set_stats_file_writer(StatsFileWriter* writer) { stats_file_writer_ = writer; }
+    void write_stats_record(const tproxy_stats::RecordType type) const;
+
+    /* native builds only: the buflo channel will send its cells from
+     * a dedicated thread, pinned to "cpu" unless it's negative. must
+     * be called before we connect to the ssp */
+    void enable_threaded_cell_pacer(const int cpu)
+    {
+        use_threaded_cell_pacer_ = true;
+        cell_pacer_cpu_ = cpu;
+    }
+
 protected:
 
     virtual ~ClientSideProxy();
@@ -149,6 +171,7 @@ protected:
     const uint32_t ssp_buflo_packet_intvl_ms_;
     const uint32_t buflo_L_;
     const uint32_t buflo_time_limit_secs_;
+    const uint16_t stream_ctrl_batch_window_ms_;
 
     myio::TCPChannel::UniquePtr peer_channel_;
     myio::Socks5Connector::UniquePtr socks_connector_;
@@ -195,6 +218,11 @@ protected:
     // log stats when current time is a multiple of 30 seconds
     Timer::UniquePtr log_stats_timer_;
 
+    StatsFileWriter* stats_file_writer_ = nullptr;
+
+    bool use_threaded_cell_pacer_ = false;
+    int cell_pacer_cpu_ = -1;
+
     // generally: we don't want to use a channel older than 5
     // minutes. so every 5 minutes we recreate the channel, unless it
     // is being used, then we wait until it is no longer used. this is
@@ -52,11 +52,10 @@ IPCServer::IPCServer(struct event_base* evbase,
     VLOG(2) << "begin building msg type: " << __type;                   \
     msgs::TYPE ## MsgBuilder msgbuilder(bufbuilder);                    \
     SCOPE_EXIT {                                                        \
-        auto msg = msgbuilder.Finish();                                 \
-        bufbuilder.Finish(msg);                                         \
+        const auto __len = bufbuilder.finish_msg(msgbuilder);           \
         VLOG(2) << "send msg type: " << __type;                         \
         ipc_client_channel_->sendMsg(                                   \
-            __type, bufbuilder.GetSize(),                               \
+            __type, __len,                                              \
             bufbuilder.GetBufferPointer());                             \
     }
 
@@ -65,11 +64,10 @@ IPCServer::IPCServer(struct event_base* evbase,
     VLOG(2) << "begin building msg type: " << __type;                   \
     msgs::TYPE ## MsgBuilder msgbuilder(bufbuilder);                    \
     SCOPE_EXIT {                                                        \
-        auto msg = msgbuilder.Finish();                                 \
-        bufbuilder.Finish(msg);                                         \
+        const auto __len = bufbuilder.finish_msg(msgbuilder);           \
         VLOG(2) << "send msg type: " << __type;                         \
         ipc_client_channel_->reply(                                     \
-            id, __type, bufbuilder.GetSize(),                           \
+            id, __type, __len,                                          \
             bufbuilder.GetBufferPointer());                             \
     }
 
@@ -101,7 +99,7 @@ IPCServer::_send_TunnelClosed()
     vlogself(2) << "begin";
 
     {
-        flatbuffers::FlatBufferBuilder bufbuilder;
+        auto& bufbuilder = bufbuilder_.start();
         BEGIN_BUILD_MSG_AND_SEND_AT_END(
             TunnelClosed, bufbuilder);
     }
@@ -126,7 +124,7 @@ IPCServer::_have_establish_tunnel_result(const bool& ok)
 
     {
         // send the response
-        flatbuffers::FlatBufferBuilder bufbuilder;
+        auto& bufbuilder = bufbuilder_.start();
         const auto id = establish_tunnel_call_id_;
 
         BEGIN_BUILD_RESP_MSG_AND_SEND_AT_END(
@@ -174,7 +172,7 @@ IPCServer::_handle_SetAutoStartDefenseOnNextSend(const uint32_t& id,
 
     {
         // send the response
-        flatbuffers::FlatBufferBuilder bufbuilder;
+        auto& bufbuilder = bufbuilder_.start();
         BEGIN_BUILD_RESP_MSG_AND_SEND_AT_END(
             SetAutoStartDefenseOnNextSendResp, bufbuilder, id);
         msgbuilder.add_ok(ok);
@@ -193,7 +191,7 @@ IPCServer::_handle_StopDefense(const uint32_t& id,
 
     {
         // send the response
-        flatbuffers::FlatBufferBuilder bufbuilder;
+        auto& bufbuilder = bufbuilder_.start();
         BEGIN_BUILD_RESP_MSG_AND_SEND_AT_END(
             StopDefenseResp, bufbuilder, id);
     }
@@ -226,6 +224,8 @@ IPCServer::_setup_client(StreamChannel::UniquePtr channel)
             boost::bind(&IPCServer::_on_msg, this, _2, _3, _4),
             boost::bind(&IPCServer::_on_called, this, _2, _3, _4, _5),
             boost::bind(&IPCServer::_on_client_channel_status, this, _2)));
+    // the driver is of the same build, so it knows how
+    ipc_client_channel_->offer_large_msgs();
 }
 
 #define IPC_MSG_HANDLER(TYPE)                                           \
@@ -236,7 +236,7 @@ IPCServer::_setup_client(StreamChannel::UniquePtr channel)
 
 void
 IPCServer::_on_msg(uint8_t type,
-                   uint16_t len, const uint8_t* data)
+                   uint32_t len, const uint8_t* data)
 {
     logself(FATAL) << "to do";
 }
@@ -249,7 +249,7 @@ IPCServer::_on_msg(uint8_t type,
 
 void
 IPCServer::_on_called(uint32_t id, uint8_t type,
-                      uint16_t len, const uint8_t* data)
+                      uint32_t len, const uint8_t* data)
 {
     switch (type) {
 
@@ -5,6 +5,7 @@
 
 #include "../utility/stream_server.hpp"
 #include "../utility/ipc/generic_ipc_channel.hpp"
+#include "../utility/ipc/msg_buf_builder.hpp"
 #include "../utility/object.hpp"
 #include "utility/ipc/transport_proxy/gen/combined_headers"
 #include "csp/csp.hpp"
@@ -33,9 +34,9 @@ private:
 
     ////////////
 
-    void _on_msg(uint8_t type, uint16_t len, const uint8_t* data);
+    void _on_msg(uint8_t type, uint32_t len, const uint8_t* data);
     void _on_called(uint32_t id, uint8_t type,
-                    uint16_t len, const uint8_t* data);
+                    uint32_t len, const uint8_t* data);
     void _on_client_channel_status(myipc::GenericIpcChannel::ChannelStatus);
 
     void _setup_client(myio::StreamChannel::UniquePtr channel);
@@ -57,6 +58,8 @@ private:
     myio::StreamServer::UniquePtr stream_server_; /* to accept ipc clients */
     /* currently support only one ipc client */
     myipc::GenericIpcChannel::UniquePtr ipc_client_channel_;
+    /* reused to build the msgs we send */
+    myipc::MsgBufBuilder bufbuilder_;
     csp::ClientSideProxy::UniquePtr csp_;
 
     uint32_t establish_tunnel_call_id_;
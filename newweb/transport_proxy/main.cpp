@@ -11,6 +11,7 @@
 #include "ipc.hpp"
 #include "csp/csp.hpp"
 #include "ssp/ssp.hpp"
+#include "stats_file_writer.hpp"
 
 #include "../experiment_common.hpp"
 
@@ -80,6 +81,7 @@ s_on_SIGTERM_SIGINT(int, short, void *arg)
 
     LOG(INFO) << "received SIGTERM or SIGINT... logging stats";
     csp->log_stats();
+    csp->write_stats_record(tproxy_stats::PERIODIC);
 
     LOG(INFO) << "exiting now";
     exit(0);
@@ -111,6 +113,36 @@ static const char tamaraw_L_name[] =
 static const char tamaraw_time_limit_secs_name[] =
     "tamaraw-time-limit-secs";
 
+/* per-csp resource limits on the ssp. zero (the default) means no
+ * limit */
+static const char ssp_max_streams_per_csp_name[] =
+    "ssp-max-streams-per-csp";
+static const char ssp_max_pending_outer_connects_per_csp_name[] =
+    "ssp-max-pending-outer-connects-per-csp";
+static const char ssp_max_buffered_bytes_per_csp_name[] =
+    "ssp-max-buffered-bytes-per-csp";
+
+/* if not zero, stream control frames (stream creates on the csp,
+ * their replies on the ssp) submitted within this many milliseconds
+ * of each other are sent together, packed into as few cells as
+ * possible */
+static const char stream_ctrl_batch_window_ms_name[] =
+    "stream-ctrl-batch-window-ms";
+
+/* path to the binary stats file (see stats_file.hpp) to append to, in
+ * addition to the stats we log. use the tproxy-stats-tool to read and
+ * merge these files */
+static const char stats_file_name[] =
+    "stats-file";
+
+/* native only: during defense sessions, send the buflo cells from a
+ * dedicated thread (one per buflo channel) instead of from the event
+ * loop, optionally pinned to a cpu */
+static const char threaded_cell_pacer_name[] =
+    "threaded-cell-pacer";
+static const char cell_pacer_cpu_name[] =
+    "cell-pacer-cpu";
+
 
 struct MyConfig
 {
@@ -124,6 +156,7 @@ struct MyConfig
         , tamaraw_L(0)
         , tamaraw_time_limit_secs(0)
         , ssp_log_outer_connect_latency(false)
+        , stream_ctrl_batch_window_ms(0)
 #ifndef IN_SHADOW
         , auto_start_defense_session_on_next_send(false)
 #endif
@@ -141,6 +174,9 @@ struct MyConfig
     uint16_t tamaraw_L;
     uint32_t tamaraw_time_limit_secs;
     bool ssp_log_outer_connect_latency;
+    ssp::CSPResourceLimits ssp_csp_limits;
+    uint16_t stream_ctrl_batch_window_ms;
+    std::string stats_file;
 
 #ifdef IN_SHADOW
     std::string browser_proxy_mode_spec_file;
@@ -153,6 +189,9 @@ struct MyConfig
     std::shared_ptr<std::string> write_file_on_a_defense_session_done;
     bool exit_on_a_defense_session_done = false;
 
+    bool threaded_cell_pacer = false;
+    int cell_pacer_cpu = -1;
+
 #endif
 
 };
@@ -229,6 +268,49 @@ set_my_config(MyConfig& conf,
             conf.ssp_log_outer_connect_latency = true;
         }
 
+        else if (name == ssp_max_streams_per_csp_name) {
+            try {
+                conf.ssp_csp_limits.max_streams = boost::lexical_cast<uint32_t>(value);
+            }
+            catch (...) {
+                LOG(FATAL) << "bad value for " << ssp_max_streams_per_csp_name;
+            }
+        }
+
+        else if (name == ssp_max_pending_outer_connects_per_csp_name) {
+            try {
+                conf.ssp_csp_limits.max_pending_outer_connects =
+                    boost::lexical_cast<uint32_t>(value);
+            }
+            catch (...) {
+                LOG(FATAL) << "bad value for " << ssp_max_pending_outer_connects_per_csp_name;
+            }
+        }
+
+        else if (name == ssp_max_buffered_bytes_per_csp_name) {
+            try {
+                conf.ssp_csp_limits.max_buffered_bytes = boost::lexical_cast<uint64_t>(value);
+            }
+            catch (...) {
+                LOG(FATAL) << "bad value for " << ssp_max_buffered_bytes_per_csp_name;
+            }
+        }
+
+        else if (name == stream_ctrl_batch_window_ms_name) {
+            try {
+                conf.stream_ctrl_batch_window_ms = boost::lexical_cast<uint16_t>(value);
+            }
+            catch (...) {
+                LOG(FATAL) << "bad value for " << stream_ctrl_batch_window_ms_name;
+            }
+        }
+
+        else if (name == stats_file_name) {
+            CHECK(value.length())
+                << stats_file_name << " requires non-empty value";
+            conf.stats_file = value;
+        }
+
         else if (name == expcommon::conf_names::browser_proxy_mode_spec_file) {
 #ifdef IN_SHADOW
             conf.browser_proxy_mode_spec_file = value;
@@ -271,6 +353,31 @@ set_my_config(MyConfig& conf,
 #endif
         }
 
+        else if (name == threaded_cell_pacer_name) {
+#ifdef IN_SHADOW
+            LOG(FATAL) << threaded_cell_pacer_name
+                       << " makes sense only outside shadow";
+#else
+            CHECK((value == "yes") || (value == "no"))
+                << "use yes or no for " << threaded_cell_pacer_name;
+            conf.threaded_cell_pacer = (value == "yes");
+#endif
+        }
+
+        else if (name == cell_pacer_cpu_name) {
+#ifdef IN_SHADOW
+            LOG(FATAL) << cell_pacer_cpu_name
+                       << " makes sense only outside shadow";
+#else
+            try {
+                conf.cell_pacer_cpu = boost::lexical_cast<int>(value);
+            }
+            catch (...) {
+                LOG(FATAL) << "bad value for " << cell_pacer_cpu_name;
+            }
+#endif
+        }
+
         else {
             // ignore other args
         }
@@ -314,6 +421,7 @@ s_on_buflo_channel_defense_session_done(csp::ClientSideProxy* csp,
     if (conf.exit_on_a_defense_session_done) {
         LOG(INFO) << "defense session done... logging stats";
         csp->log_stats();
+        csp->write_stats_record(tproxy_stats::PERIODIC);
         LOG(INFO) << "exiting as instructed";
         exit(0);
     }
@@ -379,6 +487,9 @@ int main(int argc, char **argv)
 
     /* ***************************************** */
 
+    /* declared first so it outlives the csp/ssp that use it */
+    StatsFileWriter::UniquePtr stats_file_writer;
+
     csp::ClientSideProxy::UniquePtr csp;
     ssp::ServerSideProxy::UniquePtr ssp;
 
@@ -463,11 +574,24 @@ int main(int argc, char **argv)
                           conf.tamaraw_pkt_intvl_ms,
                           conf.ssp_tamaraw_pkt_intvl_ms,
                           conf.tamaraw_L,
-                          conf.tamaraw_time_limit_secs));
+                          conf.tamaraw_time_limit_secs,
+                          conf.stream_ctrl_batch_window_ms));
 
             csp->set_a_defense_session_done_cb(
                 boost::bind(s_on_buflo_channel_defense_session_done, _1, conf));
 
+            if (!conf.stats_file.empty()) {
+                stats_file_writer.reset(
+                    new StatsFileWriter(conf.stats_file.c_str(), true));
+                csp->set_stats_file_writer(stats_file_writer.get());
+            }
+
+#ifndef IN_SHADOW
+            if (conf.threaded_cell_pacer) {
+                csp->enable_threaded_cell_pacer(conf.cell_pacer_cpu);
+            }
+#endif
+
             csp->establish_tunnel_2(true);
 
 #ifdef IN_SHADOW
@@ -560,6 +684,11 @@ int main(int argc, char **argv)
         CHECK(!conf.ssp_tamaraw_pkt_intvl_ms)
             << "ssp doesn't support " << ssp_tamaraw_packet_interval_name;
 
+        if (!conf.stats_file.empty()) {
+            stats_file_writer.reset(
+                new StatsFileWriter(conf.stats_file.c_str(), false));
+        }
+
         /* tcpserver to accept connections from CSPs */
         myio::TCPServer::UniquePtr tcpserver(
             new myio::TCPServer(evbase.get(),
@@ -571,7 +700,16 @@ int main(int argc, char **argv)
                                            conf.tamaraw_pkt_intvl_ms,
                                            conf.tamaraw_L,
                                            conf.tamaraw_time_limit_secs,
-                                           conf.ssp_log_outer_connect_latency));
+                                           conf.ssp_log_outer_connect_latency,
+                                           conf.ssp_csp_limits,
+                                           conf.stream_ctrl_batch_window_ms,
+                                           stats_file_writer.get()));
+
+#ifndef IN_SHADOW
+        if (conf.threaded_cell_pacer) {
+            ssp->enable_threaded_cell_pacer(conf.cell_pacer_cpu);
+        }
+#endif
     }
 
     /* ***************************************** */
@@ -1,4 +1,5 @@
 
+#include <algorithm>
 #include <boost/bind.hpp>
 
 #include "csp_handler.hpp"
@@ -35,10 +36,18 @@ CSPHandler::CSPHandler(struct event_base* evbase,
                        const uint32_t& tamaraw_time_limit_secs,
                        StreamChannel::UniquePtr csp_channel,
                        const bool& log_outer_connect_latency,
+                       const CSPResourceLimits& limits,
+                       const uint16_t& stream_ctrl_batch_window_ms,
+                       StatsFileWriter* stats_file_writer,
                        CSPHandlerDoneCb handler_done_cb)
     : evbase_(evbase)
     , log_outer_connect_latency_(log_outer_connect_latency)
+    , limits_(limits)
+    , stats_file_writer_(stats_file_writer)
     , handler_done_cb_(handler_done_cb)
+    , admission_timer_(
+        new Timer(evbase, false,
+                  boost::bind(&CSPHandler::_admission_timer_fired, this, _1)))
 {
     const auto fd = csp_channel->release_fd();
     csp_channel.reset();
@@ -61,6 +70,10 @@ CSPHandler::CSPHandler(struct event_base* evbase,
             boost::bind(&CSPHandler::_on_buflo_new_stream_connect_request,
                         this, _1, _2, _3, _4)
             ));
+
+    if (stream_ctrl_batch_window_ms) {
+        buflo_channel_->set_stream_ctrl_batch_window_ms(stream_ctrl_batch_window_ms);
+    }
 }
 
 void
@@ -73,6 +86,10 @@ CSPHandler::_on_buflo_channel_status(BufloMuxChannel*,
     if (status == BufloMuxChannel::ChannelStatus::CLOSED) {
         DestructorGuard dg(this);
         handler_done_cb_(this);
+    } else if (status == BufloMuxChannel::ChannelStatus::A_DEFENSE_SESSION_STARTED) {
+        write_stats_record(tproxy_stats::DEFENSE_SESSION_STARTED);
+    } else if (status == BufloMuxChannel::ChannelStatus::A_DEFENSE_SESSION_DONE) {
+        write_stats_record(tproxy_stats::DEFENSE_SESSION_DONE);
     }
 }
 
@@ -80,6 +97,41 @@ void
 CSPHandler::_on_buflo_new_stream_connect_request(
     BufloMuxChannel*, int sid,
     const char* host, uint16_t port)
+{
+    const auto num_buffered_bytes = _get_buffered_byte_count();
+    max_buffered_bytes_ = std::max(max_buffered_bytes_, num_buffered_bytes);
+
+    /* keep arrival order: if others are already waiting, this one
+     * waits behind them */
+    if (queued_requests_.empty()
+        && _is_under_limits(shandlers_.size(),
+                            _get_pending_outer_connect_count(),
+                            num_buffered_bytes))
+    {
+        _admit_stream(sid, host, port);
+        return;
+    }
+
+    vlogself(2) << "over resource limits; queue stream " << sid
+                << " to [" << host << "]:" << port;
+
+    // observe the stream so we know if the csp closes it while it's
+    // still waiting
+    buflo_channel_->set_stream_observer(sid, this);
+
+    queued_requests_.push_back(
+        {sid, host, port, common::gettimeofdayMs()});
+    ++num_streams_queued_;
+    max_queue_length_ = std::max(max_queue_length_,
+                                 (uint32_t)queued_requests_.size());
+
+    if (!admission_timer_->is_running()) {
+        admission_timer_->start(50);
+    }
+}
+
+void
+CSPHandler::_admit_stream(const int sid, const char* host, const uint16_t port)
 {
     // hand off the stream to handler
 
@@ -91,6 +143,169 @@ CSPHandler::_on_buflo_new_stream_connect_request(
     const auto ret = shandlers_.insert(
         make_pair(shid, std::move(shandler)));
     CHECK(ret.second); // insist it was newly inserted
+
+    ++num_streams_admitted_;
+    max_concurrent_streams_ = std::max(max_concurrent_streams_,
+                                       (uint32_t)shandlers_.size());
+}
+
+void
+CSPHandler::_maybe_admit_queued_streams()
+{
+    if (admitting_) {
+        // a stream handler we just created is already done; the loop
+        // below will pick up where it is
+        return;
+    }
+
+    admitting_ = true;
+
+    // the buffered bytes don't change as we admit, but the stream
+    // counts do
+    const auto num_buffered_bytes = _get_buffered_byte_count();
+    max_buffered_bytes_ = std::max(max_buffered_bytes_, num_buffered_bytes);
+
+    while (!queued_requests_.empty()
+           && _is_under_limits(shandlers_.size(),
+                               _get_pending_outer_connect_count(),
+                               num_buffered_bytes))
+    {
+        const QueuedStreamRequest req = queued_requests_.front();
+        queued_requests_.pop_front();
+
+        const auto now_ms = common::gettimeofdayMs();
+        total_queueing_delay_ms_ += (now_ms - req.queued_time_ms);
+
+        vlogself(2) << "admit queued stream " << req.sid << " after "
+                    << (now_ms - req.queued_time_ms) << " ms";
+
+        _admit_stream(req.sid, req.host.c_str(), req.port);
+    }
+
+    if (queued_requests_.empty() && sids_to_reset_.empty()) {
+        admission_timer_->cancel();
+    }
+
+    admitting_ = false;
+}
+
+bool
+CSPHandler::_is_under_limits(const size_t num_streams,
+                             const size_t num_pending_outer_connects,
+                             const uint64_t num_buffered_bytes) const
+{
+    if (limits_.max_streams
+        && (num_streams >= limits_.max_streams))
+    {
+        return false;
+    }
+    if (limits_.max_pending_outer_connects
+        && (num_pending_outer_connects >= limits_.max_pending_outer_connects))
+    {
+        return false;
+    }
+    if (limits_.max_buffered_bytes
+        && (num_buffered_bytes >= limits_.max_buffered_bytes))
+    {
+        return false;
+    }
+    return true;
+}
+
+uint64_t
+CSPHandler::_get_buffered_byte_count() const
+{
+    if (!limits_.max_buffered_bytes) {
+        // not limiting, so don't bother walking the handlers
+        return 0;
+    }
+
+    uint64_t count = buflo_channel_ ? buflo_channel_->buffered_send_byte_count() : 0;
+    for (const auto& it : shandlers_) {
+        count += it.second->outer_output_length();
+    }
+    return count;
+}
+
+size_t
+CSPHandler::_get_pending_outer_connect_count() const
+{
+    if (!limits_.max_pending_outer_connects) {
+        return 0;
+    }
+
+    size_t count = 0;
+    for (const auto& it : shandlers_) {
+        if (it.second->is_connecting_target()) {
+            ++count;
+        }
+    }
+    return count;
+}
+
+void
+CSPHandler::_admission_timer_fired(Timer*)
+{
+    for (const auto sid : sids_to_reset_) {
+        buflo_channel_->close_stream(sid);
+    }
+    sids_to_reset_.clear();
+
+    _maybe_admit_queued_streams();
+}
+
+void
+CSPHandler::onStreamNewDataAvailable(BufloMuxChannel*, int sid) noexcept
+{
+    // the csp should not send data before we reply to the stream
+    // connect request, and we can't hand the stream off with data
+    // already buffered in it, so give up on the stream: drop the
+    // data and reset the stream
+    auto buf = buflo_channel_->get_input_evbuf(sid);
+    const auto len = evbuffer_get_length(buf);
+    auto rv = evbuffer_drain(buf, len);
+    CHECK_EQ(rv, 0);
+    num_early_data_bytes_dropped_ += len;
+
+    for (auto it = queued_requests_.begin(); it != queued_requests_.end(); ++it) {
+        if (it->sid == sid) {
+            logself(WARNING) << "csp sent " << len << " bytes on queued stream "
+                             << sid << "; reset it";
+            queued_requests_.erase(it);
+            ++num_queued_streams_reset_;
+            // we're inside the channel's recv callback, so don't reset
+            // the stream here; the admission timer will do it
+            sids_to_reset_.push_back(sid);
+            break;
+        }
+    }
+
+    if (!sids_to_reset_.empty() && !admission_timer_->is_running()) {
+        admission_timer_->start(50);
+    }
+}
+
+void
+CSPHandler::onStreamClosed(BufloMuxChannel*, int sid) noexcept
+{
+    // it might be one we were about to reset
+    sids_to_reset_.erase(
+        std::remove(sids_to_reset_.begin(), sids_to_reset_.end(), sid),
+        sids_to_reset_.end());
+
+    // the csp gave up on a stream that is still waiting
+    for (auto it = queued_requests_.begin(); it != queued_requests_.end(); ++it) {
+        if (it->sid == sid) {
+            vlogself(2) << "queued stream " << sid << " closed by csp";
+            queued_requests_.erase(it);
+            ++num_queued_streams_closed_;
+            break;
+        }
+    }
+
+    if (queued_requests_.empty() && sids_to_reset_.empty()) {
+        admission_timer_->cancel();
+    }
 }
 
 void
@@ -98,6 +313,10 @@ CSPHandler::_on_stream_handler_done(StreamHandler* shandler)
 {
     const auto shid = shandler->objId();
     shandlers_.erase(shid);
+
+    if (!queued_requests_.empty()) {
+        _maybe_admit_queued_streams();
+    }
 }
 
 void
@@ -114,11 +333,39 @@ CSPHandler::_report_stats() const
                   << " dummy_cells= " << buflo_channel_->dummy_send_cell_count()
                   << " dummy_cells_avoided= " << buflo_channel_->num_dummy_cells_avoided();
     }
+
+    logself(INFO)
+        << "admission: streams_admitted= " << num_streams_admitted_
+        << " streams_queued= " << num_streams_queued_
+        << " queued_streams_closed= " << num_queued_streams_closed_
+        << " queued_streams_reset= " << num_queued_streams_reset_
+        << " early_data_bytes_dropped= " << num_early_data_bytes_dropped_
+        << " still_queued= " << queued_requests_.size()
+        << " max_queue_len= " << max_queue_length_
+        << " max_concurrent_streams= " << max_concurrent_streams_
+        << " max_buffered_bytes= " << max_buffered_bytes_
+        << " total_queueing_delay_ms= " << total_queueing_delay_ms_;
+}
+
+void
+CSPHandler::enable_threaded_cell_pacer(const int cpu)
+{
+    buflo_channel_->enable_threaded_cell_pacer(cpu);
+}
+
+void
+CSPHandler::write_stats_record(const tproxy_stats::RecordType type) const
+{
+    if (stats_file_writer_ && buflo_channel_) {
+        stats_file_writer_->write_channel_record(
+            type, objId(), *buflo_channel_);
+    }
 }
 
 CSPHandler::~CSPHandler()
 {
     _report_stats();
+    write_stats_record(tproxy_stats::CHANNEL_CLOSED);
 }
 
 }
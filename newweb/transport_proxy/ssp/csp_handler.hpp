@@ -6,29 +6,62 @@
  * csp
  *
  * when the buflo mux channel notifies me of a new stream connect
- * request, i simply hand it off to a StreamHandler
+ * request, i simply hand it off to a StreamHandler, unless that would
+ * put the csp over its resource limits, in which case the request is
+ * queued until the csp is back under the limits
  */
 
 
 #include <memory>
+#include <deque>
+#include <vector>
 #include <boost/function.hpp>
 
 #include "../../utility/tcp_channel.hpp"
 #include "../../utility/stream_channel.hpp"
+#include "../../utility/timer.hpp"
 #include "../../utility/buflo_mux_channel_impl_spdy.hpp"
 
 #include "stream_handler.hpp"
+#include "../stats_file_writer.hpp"
 
 
 namespace ssp
 {
 
 
+/* per-csp resource limits. zero means no limit.
+ *
+ * we never refuse a stream connect request because of these limits;
+ * excess requests wait in a queue, in arrival order
+ */
+struct CSPResourceLimits
+{
+    /* number of streams handed off to StreamHandlers, i.e., either
+     * connecting to or forwarding to/from their targets */
+    uint32_t max_streams = 0;
+
+    /* number of outer connections (to targets) that are still being
+     * connected */
+    uint32_t max_pending_outer_connects = 0;
+
+    /* bytes buffered towards the csp (in the buflo channel) plus bytes
+     * buffered towards the targets (in the outer connections) */
+    uint64_t max_buffered_bytes = 0;
+
+    bool any() const
+    {
+        return max_streams || max_pending_outer_connects || max_buffered_bytes;
+    }
+};
+
+
 class CSPHandler;
 
 typedef boost::function<void(CSPHandler*)> CSPHandlerDoneCb;
 
 class CSPHandler : public Object
+                 , public myio::buflo::BufloMuxChannelStreamObserver
 {
 public:
     typedef std::unique_ptr<CSPHandler, /*folly::*/Destructor> UniquePtr;
@@ -39,12 +72,42 @@ public:
                         const uint32_t& tamaraw_time_limit_secs,
                         myio::StreamChannel::UniquePtr csp_channel,
                         const bool& log_outer_connect_latency,
+                        const CSPResourceLimits& limits,
+                        const uint16_t& stream_ctrl_batch_window_ms,
+                        StatsFileWriter* stats_file_writer,
                         CSPHandlerDoneCb);
 
+    /* write a snapshot of our channel's counters into the stats file,
+     * if any */
+    void write_stats_record(const tproxy_stats::RecordType type) const;
+
+    /* see BufloMuxChannelImplSpdy::enable_threaded_cell_pacer() */
+    void enable_threaded_cell_pacer(const int cpu);
+
 protected:
 
     virtual ~CSPHandler();
 
+    /* implement BufloMuxChannelStreamObserver interface. we observe
+     * only the streams that are queued, i.e., not yet handed off to
+     * a StreamHandler
+     */
+    virtual void onStreamIdAssigned(myio::buflo::BufloMuxChannel*,
+                                    int) override
+    {
+        LOG(FATAL) << "not reached";
+    }
+    virtual void onStreamCreateResult(myio::buflo::BufloMuxChannel*,
+                                      bool,
+                                      const in_addr_t&,
+                                      const uint16_t&) override
+    {
+        LOG(FATAL) << "not reached";
+    }
+    virtual void onStreamNewDataAvailable(myio::buflo::BufloMuxChannel*, int) noexcept override;
+    virtual void onStreamRecvEOF(myio::buflo::BufloMuxChannel*, int) noexcept override {};
+    virtual void onStreamClosed(myio::buflo::BufloMuxChannel*, int) noexcept override;
+
     ////////////
 
     void _on_buflo_channel_status(myio::buflo::BufloMuxChannel*,
@@ -53,6 +116,15 @@ protected:
         myio::buflo::BufloMuxChannel*, int, const char*, uint16_t);
     void _on_stream_handler_done(StreamHandler*);
 
+    void _admit_stream(const int sid, const char* host, const uint16_t port);
+    void _maybe_admit_queued_streams();
+    bool _is_under_limits(const size_t num_streams,
+                          const size_t num_pending_outer_connects,
+                          const uint64_t num_buffered_bytes) const;
+    uint64_t _get_buffered_byte_count() const;
+    size_t _get_pending_outer_connect_count() const;
+    void _admission_timer_fired(Timer*);
+
     void _report_stats() const;
 
     //////////
@@ -62,10 +134,43 @@ protected:
     myio::buflo::BufloMuxChannelImplSpdy::UniquePtr buflo_channel_;
 
     const bool log_outer_connect_latency_;
+    const CSPResourceLimits limits_;
+    /* not owned; can be null */
+    StatsFileWriter* stats_file_writer_;
 
     CSPHandlerDoneCb handler_done_cb_;
 
     std::map<uint32_t, StreamHandler::UniquePtr> shandlers_;
+
+    struct QueuedStreamRequest
+    {
+        int sid;
+        std::string host;
+        uint16_t port;
+        uint64_t queued_time_ms;
+    };
+    std::deque<QueuedStreamRequest> queued_requests_;
+
+    /* while there are queued requests, we periodically check whether
+     * we can admit them, because the buffered bytes drain without
+     * telling us */
+    Timer::UniquePtr admission_timer_;
+    bool admitting_ = false;
+
+    /* queued streams on which the csp sent data early; we reset them
+     * from the admission timer */
+    std::vector<int> sids_to_reset_;
+
+    /* admission stats */
+    uint32_t num_streams_admitted_ = 0;
+    uint32_t num_streams_queued_ = 0;
+    uint32_t num_queued_streams_closed_ = 0;
+    uint32_t num_queued_streams_reset_ = 0;
+    uint64_t num_early_data_bytes_dropped_ = 0;
+    uint32_t max_queue_length_ = 0;
+    uint32_t max_concurrent_streams_ = 0;
+    uint64_t max_buffered_bytes_ = 0;
+    uint64_t total_queueing_delay_ms_ = 0;
 };
 
 }
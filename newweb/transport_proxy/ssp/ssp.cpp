@@ -36,19 +36,66 @@ ServerSideProxy::ServerSideProxy(struct event_base* evbase,
                                  const uint32_t& tamaraw_pkt_intvl_ms,
                                  const uint32_t& tamaraw_L,
                                  const uint32_t& tamaraw_time_limit_secs,
-                                 const bool& log_outer_connect_latency)
+                                 const bool& log_outer_connect_latency,
+                                 const CSPResourceLimits& csp_limits,
+                                 const uint16_t& stream_ctrl_batch_window_ms,
+                                 StatsFileWriter* stats_file_writer)
     : evbase_(evbase)
     , stream_server_(std::move(streamserver))
     , tamaraw_pkt_intvl_ms_(tamaraw_pkt_intvl_ms)
     , tamaraw_L_(tamaraw_L)
     , tamaraw_time_limit_secs_(tamaraw_time_limit_secs)
     , log_outer_connect_latency_(log_outer_connect_latency)
+    , csp_limits_(csp_limits)
+    , stream_ctrl_batch_window_ms_(stream_ctrl_batch_window_ms)
+    , stats_file_writer_(stats_file_writer)
 {
+    if (csp_limits_.any()) {
+        logself(INFO) << "per-csp limits:"
+                      << " max_streams= " << csp_limits_.max_streams
+                      << " max_pending_outer_connects= "
+                      << csp_limits_.max_pending_outer_connects
+                      << " max_buffered_bytes= " << csp_limits_.max_buffered_bytes;
+    }
+
+    if (stats_file_writer_) {
+        stats_timer_.reset(
+            new Timer(evbase_, true,
+                      boost::bind(&ServerSideProxy::_stats_timer_fired,
+                                  this, _1)));
+        _schedule_stats_timer();
+    }
+
     stream_server_->set_observer(this);
     const auto rv = stream_server_->start_accepting();
     CHECK(rv);
 }
 
+void
+ServerSideProxy::_schedule_stats_timer()
+{
+    static const uint64_t interval_ms = 30*1000; // 30 seconds
+    const auto current_time_ms = common::gettimeofdayMs();
+
+    // compute delay so that we'll write when current time is a
+    // multiple of interval
+    const auto delay_ms = (interval_ms - ((current_time_ms) % interval_ms));
+    CHECK(delay_ms <= interval_ms) << "bad delay_ms: " << delay_ms;
+
+    stats_timer_->cancel();
+    stats_timer_->start(delay_ms);
+}
+
+void
+ServerSideProxy::_stats_timer_fired(Timer*)
+{
+    vlogself(2) << "write stats of " << csp_handlers_.size() << " csps";
+    for (const auto& kv_pair : csp_handlers_) {
+        kv_pair.second->write_stats_record(tproxy_stats::PERIODIC);
+    }
+    _schedule_stats_timer();
+}
+
 void
 ServerSideProxy::_on_csp_handler_done(CSPHandler* chandler)
 {
@@ -70,8 +117,15 @@ ServerSideProxy::onAccepted(StreamServer*, StreamChannel::UniquePtr channel) noe
                        tamaraw_time_limit_secs_,
                        std::move(channel),
                        log_outer_connect_latency_,
+                       csp_limits_,
+                       stream_ctrl_batch_window_ms_,
+                       stats_file_writer_,
                        boost::bind(&ServerSideProxy::_on_csp_handler_done,
                                    this, _1)));
+    if (use_threaded_cell_pacer_) {
+        chandler->enable_threaded_cell_pacer(cell_pacer_cpu_);
+    }
+
     const auto chid = chandler->objId();
     const auto ret = csp_handlers_.insert(
         make_pair(chid, std::move(chandler)));
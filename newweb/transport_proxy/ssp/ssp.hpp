@@ -4,6 +4,7 @@
 #include "../../utility/object.hpp"
 #include "../../utility/stream_server.hpp"
 #include "../../utility/tcp_channel.hpp"
+#include "../../utility/timer.hpp"
 
 #include "csp_handler.hpp"
 
@@ -24,7 +25,19 @@ public:
                              const uint32_t& tamaraw_pkt_intvl_ms,
                              const uint32_t& tamaraw_L,
                              const uint32_t& tamaraw_time_limit_secs,
-                             const bool& log_outer_connect_latency);
+                             const bool& log_outer_connect_latency,
+                             const CSPResourceLimits& csp_limits,
+                             const uint16_t& stream_ctrl_batch_window_ms,
+                             StatsFileWriter* stats_file_writer);
+
+    /* native builds only: every csp handler's buflo channel will send
+     * its cells from its own dedicated thread, pinned to "cpu" unless
+     * it's negative */
+    void enable_threaded_cell_pacer(const int cpu)
+    {
+        use_threaded_cell_pacer_ = true;
+        cell_pacer_cpu_ = cpu;
+    }
 
 protected:
 
@@ -41,6 +54,9 @@ protected:
     // the CSPHandler tells us it's closing down
     void _on_csp_handler_done(CSPHandler*);
 
+    void _stats_timer_fired(Timer*);
+    void _schedule_stats_timer();
+
     struct event_base* evbase_;
     /* server to listen for client connections */
     myio::StreamServer::UniquePtr stream_server_;
@@ -52,6 +68,22 @@ protected:
     const uint32_t tamaraw_time_limit_secs_;
 
     const bool log_outer_connect_latency_;
+
+    /* applied to each csp independently */
+    const CSPResourceLimits csp_limits_;
+
+    /* how long to hold stream connect replies so they can be sent to
+     * the csp together. zero means don't */
+    const uint16_t stream_ctrl_batch_window_ms_;
+
+    /* not owned; can be null. if set, every csp handler writes its
+     * counters when the current time is a multiple of 30 seconds,
+     * same as the csp does */
+    StatsFileWriter* stats_file_writer_;
+    Timer::UniquePtr stats_timer_;
+
+    bool use_threaded_cell_pacer_ = false;
+    int cell_pacer_cpu_ = -1;
 };
 
 }
@@ -28,6 +28,16 @@ public:
                            const bool& log_connect_latency,
                              StreamHandlerDoneCb);
 
+    /* whether we are still trying to connect to the target */
+    bool is_connecting_target() const { return state_ == State::CONNECTING_TARGET; }
+
+    /* number of bytes buffered in the outer connection waiting to be
+     * written to the target */
+    size_t outer_output_length() const
+    {
+        return target_channel_ ? target_channel_->get_output_length() : 0;
+    }
+
 protected:
 
     virtual ~StreamHandler();
@@ -0,0 +1,116 @@
+#ifndef STATS_FILE_HPP
+#define STATS_FILE_HPP
+
+/* layout of the tproxy stats file. this header is shared by the
+ * tproxy (writer) and the stats tool (reader), so it must not depend
+ * on anything else in the tree.
+ *
+ * a stats file is one FileHeader followed by zero or more Records,
+ * appended as they happen. every Record has the same size, so a
+ * reader can seek/mmap/count without parsing, and a truncated last
+ * record (e.g., the process was killed mid-write) is simply ignored.
+ *
+ * all integers are in host byte order, except Record::peer_addr
+ * which is in network byte order, same as in_addr_t.
+ *
+ * if you change a struct here, bump "format_version".
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+
+namespace tproxy_stats
+{
+
+static const char file_magic[8] = {'T', 'P', 'S', 'T', 'A', 'T', 'S', '\0'};
+static const uint16_t format_version = 1;
+
+struct FileHeader
+{
+    char magic[8];
+    uint16_t version;
+    /* sizeof(Record), so a reader can sanity check */
+    uint16_t record_size;
+    /* 1 if the file is written by a csp, 0 if by an ssp */
+    uint8_t is_client_side;
+    uint8_t pad_[3];
+    /* nul-terminated, possibly truncated */
+    char hostname[48];
+} __attribute__((packed));
+
+static_assert(sizeof(FileHeader) == 64, "unexpected FileHeader size");
+
+
+enum RecordType : uint8_t
+{
+    /* counters so far, written periodically (when the current time
+     * is a multiple of 30 seconds) */
+    PERIODIC = 1,
+    /* counters of a channel that is going away. only the ssp writes
+     * these, as the csp's periodic counters already include its past
+     * channels */
+    CHANNEL_CLOSED = 2,
+    /* counters at the moment a defense session starts and ends; the
+     * difference is what the session cost */
+    DEFENSE_SESSION_STARTED = 3,
+    DEFENSE_SESSION_DONE = 4,
+};
+
+struct Record
+{
+    uint8_t type; /* RecordType */
+    uint8_t pad_[3];
+    /* objId() of the csp, or of the CSPHandler on the ssp; with the
+     * file's hostname this identifies the channel */
+    uint32_t source_id;
+    uint64_t timestamp_ms;
+    uint32_t peer_addr;
+    uint32_t dummy_recv_cells;
+
+    uint64_t all_recv_bytes;
+    uint64_t useful_recv_bytes;
+    uint64_t all_send_bytes;
+    uint64_t useful_send_bytes;
+
+    uint32_t dummy_send_cells;
+    uint32_t dummy_cells_avoided;
+} __attribute__((packed));
+
+static_assert(sizeof(Record) == 64, "unexpected Record size");
+
+
+inline void
+init_file_header(FileHeader& hdr, const char* hostname, const bool is_client_side)
+{
+    memset(&hdr, 0, sizeof hdr);
+    memcpy(hdr.magic, file_magic, sizeof hdr.magic);
+    hdr.version = format_version;
+    hdr.record_size = sizeof(Record);
+    hdr.is_client_side = is_client_side ? 1 : 0;
+    strncpy(hdr.hostname, hostname, (sizeof hdr.hostname) - 1);
+}
+
+inline bool
+is_valid_file_header(const FileHeader& hdr)
+{
+    return (!memcmp(hdr.magic, file_magic, sizeof hdr.magic))
+           && (hdr.version == format_version)
+           && (hdr.record_size == sizeof(Record));
+}
+
+inline const char*
+record_type_name(const uint8_t type)
+{
+    switch (type) {
+    case PERIODIC: return "periodic";
+    case CHANNEL_CLOSED: return "channel_closed";
+    case DEFENSE_SESSION_STARTED: return "defense_started";
+    case DEFENSE_SESSION_DONE: return "defense_done";
+    default: return "unknown";
+    }
+}
+
+} // namespace tproxy_stats
+
+#endif /* STATS_FILE_HPP */
@@ -0,0 +1,132 @@
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "stats_file_writer.hpp"
+#include "../utility/common.hpp"
+#include "../utility/easylogging++.h"
+
+
+#define _LOG_PREFIX(inst) << "statswriter= " << (inst)->objId() << ": "
+
+/* "inst" stands for instance, as in, instance of a class */
+#define vloginst(level, inst) VLOG(level) _LOG_PREFIX(inst)
+#define vlogself(level) vloginst(level, this)
+
+#define dvloginst(level, inst) DVLOG(level) _LOG_PREFIX(inst)
+#define dvlogself(level) dvloginst(level, this)
+
+#define loginst(level, inst) LOG(level) _LOG_PREFIX(inst)
+#define logself(level) loginst(level, this)
+
+
+using myio::buflo::BufloMuxChannelImplSpdy;
+
+
+StatsFileWriter::StatsFileWriter(const char* fpath, const bool is_client_side)
+    : is_client_side_(is_client_side)
+{
+    char myhostname[80] = {0};
+    const auto rv = gethostname(myhostname, (sizeof myhostname) - 1);
+    CHECK_EQ(rv, 0);
+
+    tproxy_stats::FileHeader myhdr;
+    tproxy_stats::init_file_header(myhdr, myhostname, is_client_side_);
+
+    struct stat st;
+    const bool file_exists = (stat(fpath, &st) == 0) && (st.st_size > 0);
+
+    if (file_exists) {
+        // make sure we're appending to one of ours
+        std::ifstream ifs(fpath, std::ifstream::in | std::ifstream::binary);
+        tproxy_stats::FileHeader hdr;
+        ifs.read((char*)&hdr, sizeof hdr);
+        CHECK(ifs.gcount() == sizeof hdr) << "\"" << fpath << "\" is too short";
+        CHECK(tproxy_stats::is_valid_file_header(hdr))
+            << "\"" << fpath << "\" is not a stats file, or is of another version";
+        CHECK_EQ(hdr.is_client_side, myhdr.is_client_side)
+            << "\"" << fpath << "\" was written by the other side";
+        ifs.close();
+
+        // drop a partial last record, otherwise all the records we
+        // append would be misaligned
+        const auto extra = (st.st_size - sizeof hdr) % sizeof(tproxy_stats::Record);
+        if (extra) {
+            logself(WARNING) << "dropping " << extra
+                             << " bytes of partial record at end of \""
+                             << fpath << "\"";
+            const auto rv = truncate(fpath, st.st_size - extra);
+            CHECK_EQ(rv, 0);
+        }
+    }
+
+    ofs_.open(fpath, std::ofstream::out | std::ofstream::app | std::ofstream::binary);
+    CHECK(ofs_.is_open()) << "cannot open \"" << fpath << "\" for writing";
+
+    if (!file_exists) {
+        ofs_.write((const char*)&myhdr, sizeof myhdr);
+        ofs_.flush();
+        CHECK(ofs_.good());
+    }
+
+    logself(INFO) << (file_exists ? "appending" : "writing")
+                  << " stats records to \"" << fpath << "\"";
+}
+
+void
+StatsFileWriter::fill_counters(tproxy_stats::Record& rec,
+                               const BufloMuxChannelImplSpdy& channel)
+{
+    rec.peer_addr = channel.peer_addr();
+
+    rec.all_recv_bytes = channel.all_recv_byte_count();
+    rec.useful_recv_bytes = channel.useful_recv_byte_count();
+    rec.dummy_recv_cells = channel.dummy_recv_cell_count();
+
+    rec.all_send_bytes = channel.all_send_byte_count();
+    rec.useful_send_bytes = channel.useful_send_byte_count();
+    rec.dummy_send_cells = channel.dummy_send_cell_count();
+
+    rec.dummy_cells_avoided = channel.num_dummy_cells_avoided();
+}
+
+void
+StatsFileWriter::write(tproxy_stats::Record& rec)
+{
+    if (!rec.timestamp_ms) {
+        rec.timestamp_ms = common::gettimeofdayMs();
+    }
+
+    vlogself(2) << "write record type= " << tproxy_stats::record_type_name(rec.type)
+                << " source= " << rec.source_id;
+
+    ofs_.write((const char*)&rec, sizeof rec);
+    ofs_.flush();
+    if (!ofs_.good()) {
+        // don't bring down the proxy over stats
+        logself(WARNING) << "failed to write stats record";
+        ofs_.clear();
+        return;
+    }
+
+    ++num_records_written_;
+}
+
+void
+StatsFileWriter::write_channel_record(const tproxy_stats::RecordType type,
+                                      const uint32_t source_id,
+                                      const BufloMuxChannelImplSpdy& channel)
+{
+    tproxy_stats::Record rec;
+    memset(&rec, 0, sizeof rec);
+    rec.type = type;
+    rec.source_id = source_id;
+    fill_counters(rec, channel);
+    write(rec);
+}
+
+StatsFileWriter::~StatsFileWriter()
+{
+    logself(INFO) << "wrote " << num_records_written_ << " stats records";
+    ofs_.close();
+}
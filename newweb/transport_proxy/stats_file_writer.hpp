@@ -0,0 +1,53 @@
+#ifndef STATS_FILE_WRITER_HPP
+#define STATS_FILE_WRITER_HPP
+
+#include <memory>
+#include <fstream>
+
+#include "../utility/object.hpp"
+#include "../utility/buflo_mux_channel_impl_spdy.hpp"
+
+#include "stats_file.hpp"
+
+
+/* appends fixed-size records (see stats_file.hpp) to the tproxy's
+ * stats file, one file per process.
+ *
+ * if the file already exists (e.g., the csp is restarted for every
+ * page load outside shadow), we append to it, so its header must
+ * match ours.
+ *
+ * records are flushed as they're written: they're infrequent, and the
+ * process might be killed (or exit()) at any time
+ */
+class StatsFileWriter : public Object
+{
+public:
+    typedef std::unique_ptr<StatsFileWriter, /*folly::*/Destructor> UniquePtr;
+
+    explicit StatsFileWriter(const char* fpath, const bool is_client_side);
+
+    /* fill in the counters of "rec" from the channel's */
+    static void fill_counters(tproxy_stats::Record& rec,
+                              const myio::buflo::BufloMuxChannelImplSpdy& channel);
+
+    /* if its timestamp is zero, "rec" gets the current time */
+    void write(tproxy_stats::Record& rec);
+
+    /* convenience for records that are just a snapshot of a
+     * channel's counters */
+    void write_channel_record(const tproxy_stats::RecordType type,
+                              const uint32_t source_id,
+                              const myio::buflo::BufloMuxChannelImplSpdy& channel);
+
+protected:
+
+    virtual ~StatsFileWriter();
+
+    std::ofstream ofs_;
+    const bool is_client_side_;
+
+    uint32_t num_records_written_ = 0;
+};
+
+#endif /* STATS_FILE_WRITER_HPP */
@@ -0,0 +1,240 @@
+
+/* reads one or more tproxy stats files (see stats_file.hpp), e.g.,
+ * from all the csp and ssp hosts of an experiment, and merges them
+ * into a single csv on stdout, sorted by time.
+ *
+ * usage: tproxy-stats-tool [--sessions] <stats file>...
+ *
+ * by default every record is printed. with "--sessions", each defense
+ * session (a DEFENSE_SESSION_STARTED and the following
+ * DEFENSE_SESSION_DONE from the same source) is printed as one row of
+ * counter deltas, i.e., what that session cost.
+ *
+ * this is a standalone tool, so it uses only the standard library
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "stats_file.hpp"
+
+
+using tproxy_stats::Record;
+using tproxy_stats::FileHeader;
+
+
+struct StatsFile
+{
+    std::string path;
+    std::string hostname;
+    bool is_client_side;
+};
+
+struct MergedRecord
+{
+    /* index into the vector of StatsFile */
+    size_t file_idx;
+    Record rec;
+};
+
+
+static bool
+s_read_file(const char* path, const size_t file_idx,
+            std::vector<StatsFile>& files,
+            std::vector<MergedRecord>& records)
+{
+    std::ifstream ifs(path, std::ifstream::in | std::ifstream::binary);
+    if (!ifs.is_open()) {
+        fprintf(stderr, "cannot open \"%s\"\n", path);
+        return false;
+    }
+
+    FileHeader hdr;
+    ifs.read((char*)&hdr, sizeof hdr);
+    if ((ifs.gcount() != sizeof hdr) || !tproxy_stats::is_valid_file_header(hdr)) {
+        fprintf(stderr, "\"%s\" is not a stats file, or is of another version\n", path);
+        return false;
+    }
+
+    hdr.hostname[(sizeof hdr.hostname) - 1] = '\0';
+    files.push_back({path, hdr.hostname, (hdr.is_client_side != 0)});
+
+    size_t num_records = 0;
+    while (true) {
+        MergedRecord mr;
+        mr.file_idx = file_idx;
+        ifs.read((char*)&mr.rec, sizeof mr.rec);
+        const auto got = ifs.gcount();
+        if (got == sizeof mr.rec) {
+            records.push_back(mr);
+            ++num_records;
+        } else {
+            if (got > 0) {
+                // the writer was probably killed mid-write
+                fprintf(stderr, "\"%s\": ignoring truncated last record\n", path);
+            }
+            break;
+        }
+    }
+
+    fprintf(stderr, "\"%s\": host= %s side= %s records= %zu\n",
+            path, hdr.hostname, hdr.is_client_side ? "csp" : "ssp", num_records);
+    return true;
+}
+
+static std::string
+s_peer_str(const uint32_t peer_addr)
+{
+    if (!peer_addr) {
+        return "-";
+    }
+    struct in_addr ip_addr;
+    ip_addr.s_addr = peer_addr;
+    return inet_ntoa(ip_addr);
+}
+
+static void
+s_print_records(const std::vector<StatsFile>& files,
+                const std::vector<MergedRecord>& records)
+{
+    printf("timestamp_ms,host,side,type,source_id,peer,"
+           "recv_all_bytes,recv_useful_bytes,recv_dummy_cells,"
+           "send_all_bytes,send_useful_bytes,send_dummy_cells,"
+           "dummy_cells_avoided\n");
+
+    for (const auto& mr : records) {
+        const auto& file = files[mr.file_idx];
+        const auto& rec = mr.rec;
+        printf("%llu,%s,%s,%s,%u,%s,%llu,%llu,%u,%llu,%llu,%u,%u\n",
+               (unsigned long long)rec.timestamp_ms,
+               file.hostname.c_str(),
+               file.is_client_side ? "csp" : "ssp",
+               tproxy_stats::record_type_name(rec.type),
+               rec.source_id,
+               s_peer_str(rec.peer_addr).c_str(),
+               (unsigned long long)rec.all_recv_bytes,
+               (unsigned long long)rec.useful_recv_bytes,
+               rec.dummy_recv_cells,
+               (unsigned long long)rec.all_send_bytes,
+               (unsigned long long)rec.useful_send_bytes,
+               rec.dummy_send_cells,
+               rec.dummy_cells_avoided);
+    }
+}
+
+static void
+s_print_sessions(const std::vector<StatsFile>& files,
+                 const std::vector<MergedRecord>& records)
+{
+    printf("start_ms,duration_ms,host,side,source_id,peer,"
+           "recv_all_bytes,recv_useful_bytes,recv_dummy_cells,"
+           "send_all_bytes,send_useful_bytes,send_dummy_cells,"
+           "dummy_cells_avoided\n");
+
+    /* (file, source) -> the record at the start of its currently
+     * open session */
+    std::map<std::pair<size_t, uint32_t>, const Record*> open_sessions;
+    size_t num_unmatched = 0;
+
+    for (const auto& mr : records) {
+        const auto key = std::make_pair(mr.file_idx, mr.rec.source_id);
+
+        if (mr.rec.type == tproxy_stats::DEFENSE_SESSION_STARTED) {
+            if (open_sessions.count(key)) {
+                ++num_unmatched;
+            }
+            open_sessions[key] = &mr.rec;
+            continue;
+        }
+
+        if (mr.rec.type != tproxy_stats::DEFENSE_SESSION_DONE) {
+            continue;
+        }
+
+        const auto it = open_sessions.find(key);
+        if (it == open_sessions.end()) {
+            ++num_unmatched;
+            continue;
+        }
+
+        const auto& file = files[mr.file_idx];
+        const auto& s = *(it->second);
+        const auto& e = mr.rec;
+        printf("%llu,%llu,%s,%s,%u,%s,%llu,%llu,%u,%llu,%llu,%u,%u\n",
+               (unsigned long long)s.timestamp_ms,
+               (unsigned long long)(e.timestamp_ms - s.timestamp_ms),
+               file.hostname.c_str(),
+               file.is_client_side ? "csp" : "ssp",
+               e.source_id,
+               s_peer_str(e.peer_addr ? e.peer_addr : s.peer_addr).c_str(),
+               (unsigned long long)(e.all_recv_bytes - s.all_recv_bytes),
+               (unsigned long long)(e.useful_recv_bytes - s.useful_recv_bytes),
+               e.dummy_recv_cells - s.dummy_recv_cells,
+               (unsigned long long)(e.all_send_bytes - s.all_send_bytes),
+               (unsigned long long)(e.useful_send_bytes - s.useful_send_bytes),
+               e.dummy_send_cells - s.dummy_send_cells,
+               e.dummy_cells_avoided - s.dummy_cells_avoided);
+
+        open_sessions.erase(it);
+    }
+
+    num_unmatched += open_sessions.size();
+    if (num_unmatched) {
+        fprintf(stderr, "%zu session boundaries without a match\n", num_unmatched);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    bool sessions = false;
+    std::vector<const char*> paths;
+
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--sessions")) {
+            sessions = true;
+        } else if (argv[i][0] == '-') {
+            fprintf(stderr, "unknown option \"%s\"\n", argv[i]);
+            return 1;
+        } else {
+            paths.push_back(argv[i]);
+        }
+    }
+
+    if (paths.empty()) {
+        fprintf(stderr, "usage: %s [--sessions] <stats file>...\n", argv[0]);
+        return 1;
+    }
+
+    std::vector<StatsFile> files;
+    std::vector<MergedRecord> records;
+
+    for (const auto path : paths) {
+        if (!s_read_file(path, files.size(), files, records)) {
+            return 1;
+        }
+    }
+
+    // each file is already in time order, so a stable sort keeps the
+    // order of records with the same timestamp
+    std::stable_sort(records.begin(), records.end(),
+                     [](const MergedRecord& a, const MergedRecord& b)
+                     {
+                         return a.rec.timestamp_ms < b.rec.timestamp_ms;
+                     });
+
+    if (sessions) {
+        s_print_sessions(files, records);
+    } else {
+        s_print_records(files, records);
+    }
+
+    return 0;
+}
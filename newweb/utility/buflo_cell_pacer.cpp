@@ -0,0 +1,446 @@
+
+#ifndef IN_SHADOW
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "buflo_cell_pacer.hpp"
+#include "easylogging++.h"
+
+
+#define _LOG_PREFIX(inst) << "cellpacer= " << (inst)->objId() << ": "
+
+/* "inst" stands for instance, as in, instance of a class */
+#define vloginst(level, inst) VLOG(level) _LOG_PREFIX(inst)
+#define vlogself(level) vloginst(level, this)
+
+#define dvloginst(level, inst) DVLOG(level) _LOG_PREFIX(inst)
+#define dvlogself(level) dvloginst(level, this)
+
+#define loginst(level, inst) LOG(level) _LOG_PREFIX(inst)
+#define logself(level) loginst(level, this)
+
+/* NOTE: the pacer thread itself must NOT log, because easylogging is
+ * not built thread-safe; only the I/O thread logs */
+
+
+using std::unique_lock;
+using std::mutex;
+
+
+namespace myio { namespace buflo
+{
+
+BufloCellPacer::BufloCellPacer(struct event_base* evbase,
+                               int fd, size_t cell_size,
+                               const uint8_t* dummy_cell, int cpu,
+                               TickedCb ticked_cb)
+    : fd_(fd)
+    , cell_size_(cell_size)
+    , ticked_cb_(ticked_cb)
+    , notify_fd_(-1)
+    , notify_ev_(nullptr, event_free)
+    , interval_(0)
+{
+    CHECK_GT(fd_, 0);
+    CHECK_GT(cell_size_, 0);
+    CHECK_LE(cell_size_, max_cell_size);
+    CHECK(ticked_cb_);
+
+    filler_cell_.data_len = 0;
+    filler_cell_.is_filler = true;
+    memcpy(filler_cell_.bytes, dummy_cell, cell_size_);
+
+    notify_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    CHECK_GE(notify_fd_, 0) << "eventfd: " << strerror(errno);
+
+    notify_ev_.reset(
+        event_new(evbase, notify_fd_, EV_READ | EV_PERSIST, s_on_notified, this));
+    CHECK_NOTNULL(notify_ev_.get());
+    const auto rv = event_add(notify_ev_.get(), nullptr);
+    CHECK_EQ(rv, 0);
+
+    thread_ = std::thread(&BufloCellPacer::_run, this);
+
+    if (cpu >= 0) {
+        cpu_set_t cpuset;
+        CPU_ZERO(&cpuset);
+        CPU_SET(cpu, &cpuset);
+        const auto rv = pthread_setaffinity_np(
+            thread_.native_handle(), sizeof cpuset, &cpuset);
+        if (rv) {
+            logself(WARNING) << "cannot pin pacer thread to cpu " << cpu
+                             << ": " << strerror(rv);
+        } else {
+            logself(INFO) << "pacer thread pinned to cpu " << cpu;
+        }
+    }
+}
+
+void
+BufloCellPacer::start(const uint32_t& interval_ms, const uint32_t& L,
+                      const bool& first_tick_now,
+                      const size_t& front_cell_sent_progress)
+{
+    CHECK_GT(interval_ms, 0);
+    CHECK_GT(L, 0);
+    CHECK_LT(front_cell_sent_progress, cell_size_);
+
+    unique_lock<mutex> lk(mutex_);
+
+    CHECK(!ticking_);
+    CHECK(!has_cur_ && !has_next_);
+    if (front_cell_sent_progress) {
+        CHECK(!ring_.empty());
+    }
+
+    ticks_ = 0;
+    L_ = L;
+    stop_at_multiple_of_L_ = false;
+    stop_now_ = false;
+    write_errno_ = 0;
+    pending_front_progress_ = front_cell_sent_progress;
+    interval_ = std::chrono::milliseconds(interval_ms);
+    next_tick_time_ = std::chrono::steady_clock::now();
+    if (!first_tick_now) {
+        next_tick_time_ += interval_;
+    }
+    ticking_ = true;
+
+    cv_.notify_all();
+}
+
+void
+BufloCellPacer::request_stop_at_multiple_of_L()
+{
+    unique_lock<mutex> lk(mutex_);
+    stop_at_multiple_of_L_ = true;
+}
+
+void
+BufloCellPacer::stop()
+{
+    unique_lock<mutex> lk(mutex_);
+    if (!ticking_) {
+        return;
+    }
+    stop_now_ = true;
+    cv_.notify_all();
+    idle_cv_.wait(lk, [this] { return !ticking_; });
+}
+
+bool
+BufloCellPacer::is_ticking() const
+{
+    unique_lock<mutex> lk(mutex_);
+    return ticking_;
+}
+
+uint32_t
+BufloCellPacer::num_ticks() const
+{
+    unique_lock<mutex> lk(mutex_);
+    return ticks_;
+}
+
+int
+BufloCellPacer::write_errno() const
+{
+    unique_lock<mutex> lk(mutex_);
+    return write_errno_;
+}
+
+BufloCellPacer::Counters
+BufloCellPacer::collect_counters()
+{
+    unique_lock<mutex> lk(mutex_);
+    const auto retval = counters_;
+    counters_ = Counters();
+    return retval;
+}
+
+bool
+BufloCellPacer::push_cell(const uint8_t* bytes, const uint16_t& data_len)
+{
+    auto slot = ring_.begin_push();
+    if (!slot) {
+        return false;
+    }
+    slot->data_len = data_len;
+    slot->is_filler = false;
+    memcpy(slot->bytes, bytes, cell_size_);
+    ring_.commit_push();
+    return true;
+}
+
+size_t
+BufloCellPacer::num_queued_cells() const
+{
+    unique_lock<mutex> lk(mutex_);
+    return ring_.size() + (has_cur_ ? 1 : 0) + (has_next_ ? 1 : 0);
+}
+
+size_t
+BufloCellPacer::take_unsent_cells(struct evbuffer* buf,
+                                  std::deque<uint16_t>& data_lens)
+{
+    unique_lock<mutex> lk(mutex_);
+    CHECK(!ticking_);
+
+    size_t front_progress = 0;
+    auto rv = 0;
+
+    if (has_cur_) {
+        if (cur_progress_ || !cur_.is_filler) {
+            front_progress = cur_progress_;
+            rv = evbuffer_add(buf, cur_.bytes + cur_progress_,
+                              cell_size_ - cur_progress_);
+            CHECK_EQ(rv, 0);
+            data_lens.push_back(cur_.data_len);
+        }
+        has_cur_ = false;
+        cur_progress_ = 0;
+    }
+
+    if (has_next_) {
+        if (!next_.is_filler) {
+            rv = evbuffer_add(buf, next_.bytes, cell_size_);
+            CHECK_EQ(rv, 0);
+            data_lens.push_back(next_.data_len);
+        }
+        has_next_ = false;
+    }
+
+    // the pacer might have been stopped before it took the
+    // partially-written cell it was started with
+    size_t skip = pending_front_progress_;
+    if (skip) {
+        front_progress = skip;
+    }
+
+    // we are the consumer now that the pacer is idle
+    while (auto cell = ring_.front()) {
+        rv = evbuffer_add(buf, cell->bytes + skip, cell_size_ - skip);
+        CHECK_EQ(rv, 0);
+        data_lens.push_back(cell->data_len);
+        ring_.pop();
+        skip = 0;
+    }
+
+    pending_front_progress_ = 0;
+
+    return front_progress;
+}
+
+void
+BufloCellPacer::_run()
+{
+    unique_lock<mutex> lk(mutex_);
+
+    while (true) {
+        cv_.wait(lk, [this] { return exiting_ || ticking_; });
+        if (exiting_) {
+            break;
+        }
+
+        const bool interrupted = cv_.wait_until(
+            lk, next_tick_time_, [this] { return exiting_ || stop_now_; });
+        if (interrupted) {
+            ticking_ = false;
+            stop_now_ = false;
+            idle_cv_.notify_all();
+            continue;
+        }
+
+        struct iovec iov[2];
+        int iovcnt = 0;
+        bool keep_ticking = _begin_tick_locked(iov, iovcnt);
+        if (keep_ticking) {
+            /* don't hold the lock across the syscall, so the I/O
+             * thread can keep pushing cells and collecting
+             * counters. only we touch the cells we're sending while
+             * we're ticking */
+            lk.unlock();
+            struct msghdr msg;
+            memset(&msg, 0, sizeof msg);
+            msg.msg_iov = iov;
+            msg.msg_iovlen = iovcnt;
+            const auto num_written = sendmsg(fd_, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+            const int write_errno = (num_written < 0) ? errno : 0;
+            lk.lock();
+
+            keep_ticking = _end_tick_locked(num_written, write_errno);
+        }
+
+        // like a persistent libevent timer, we don't try to catch up
+        // on ticks we've missed
+        const auto now = std::chrono::steady_clock::now();
+        next_tick_time_ += interval_;
+        if (next_tick_time_ < now) {
+            next_tick_time_ = now + interval_;
+        }
+
+        if (!keep_ticking) {
+            ticking_ = false;
+            idle_cv_.notify_all();
+        }
+
+        lk.unlock();
+        const uint64_t one = 1;
+        const auto rv = ::write(notify_fd_, &one, sizeof one);
+        (void)rv; // the counter can't overflow from our writes
+        lk.lock();
+    }
+
+    ticking_ = false;
+    idle_cv_.notify_all();
+}
+
+bool
+BufloCellPacer::_begin_tick_locked(struct iovec (&iov)[2], int& iovcnt)
+{
+    iovcnt = 0;
+
+    if (stop_at_multiple_of_L_ && (0 == (ticks_ % L_))) {
+        return false;
+    }
+
+    // like the single-threaded channel, every tick counts as an
+    // attempt, whether or not the socket takes the bytes
+    ++ticks_;
+
+    if (!has_cur_) {
+        _take_next_cell(cur_);
+        has_cur_ = true;
+        cur_progress_ = pending_front_progress_;
+        pending_front_progress_ = 0;
+    }
+
+    // write one cell's worth of bytes: the rest of the current cell,
+    // and the start of the next one if the current was partially
+    // written
+    iovcnt = 1;
+    iov[0].iov_base = cur_.bytes + cur_progress_;
+    iov[0].iov_len = cell_size_ - cur_progress_;
+    if (cur_progress_) {
+        if (!has_next_) {
+            _take_next_cell(next_);
+            has_next_ = true;
+        }
+        iov[1].iov_base = next_.bytes;
+        iov[1].iov_len = cur_progress_;
+        iovcnt = 2;
+    }
+
+    return true;
+}
+
+bool
+BufloCellPacer::_end_tick_locked(const ssize_t num_written, const int write_errno)
+{
+    if (num_written < 0) {
+        if ((write_errno == EAGAIN) || (write_errno == EWOULDBLOCK)
+            || (write_errno == EINTR))
+        {
+            // like cs-buflo, the attempt still counts
+            ++counters_.short_writes;
+            goto check_stop;
+        }
+        // the I/O thread picks this up when we notify it
+        write_errno_ = write_errno;
+        return false;
+    }
+
+    counters_.bytes_written += num_written;
+    if ((size_t)num_written < cell_size_) {
+        ++counters_.short_writes;
+    }
+
+    cur_progress_ += num_written;
+    if (cur_progress_ >= cell_size_) {
+        _account_sent_cell(cur_);
+        if (has_next_) {
+            cur_ = next_;
+            has_next_ = false;
+            cur_progress_ -= cell_size_;
+        } else {
+            // without a next cell we offered only the rest of the
+            // current one, so there can't be any leftover
+            has_cur_ = false;
+            cur_progress_ = 0;
+        }
+    }
+
+check_stop:
+    return !(stop_at_multiple_of_L_ && (0 == (ticks_ % L_)));
+}
+
+void
+BufloCellPacer::_take_next_cell(Cell& cell)
+{
+    if (auto queued = ring_.front()) {
+        cell = *queued;
+        ring_.pop();
+    } else {
+        cell = filler_cell_;
+    }
+}
+
+void
+BufloCellPacer::_account_sent_cell(const Cell& cell)
+{
+    ++counters_.cells_sent;
+    if (cell.data_len) {
+        counters_.useful_bytes_sent += cell.data_len;
+    } else {
+        ++counters_.dummy_cells_sent;
+    }
+}
+
+void
+BufloCellPacer::_on_notified(int fd, short what)
+{
+    uint64_t count = 0;
+    const auto rv = ::read(notify_fd_, &count, sizeof count);
+    if (rv != sizeof count) {
+        CHECK((rv == -1) && (errno == EAGAIN)) << "read rv= " << rv;
+        return;
+    }
+
+    DestructorGuard dg(this);
+    ticked_cb_(this);
+}
+
+void
+BufloCellPacer::s_on_notified(int fd, short what, void* arg)
+{
+    auto pacer = (BufloCellPacer*)arg;
+    pacer->_on_notified(fd, what);
+}
+
+BufloCellPacer::~BufloCellPacer()
+{
+    {
+        unique_lock<mutex> lk(mutex_);
+        exiting_ = true;
+        cv_.notify_all();
+    }
+    thread_.join();
+
+    notify_ev_.reset();
+    if (notify_fd_ >= 0) {
+        ::close(notify_fd_);
+        notify_fd_ = -1;
+    }
+}
+
+}
+}
+
+#endif /* IN_SHADOW */
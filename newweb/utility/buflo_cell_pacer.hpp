@@ -0,0 +1,192 @@
+#ifndef buflo_cell_pacer_hpp
+#define buflo_cell_pacer_hpp
+
+/* native builds only: shadow runs plugins single-threaded, so there
+ * the buflo channel sends its cells from its own timer on the event
+ * loop */
+#ifndef IN_SHADOW
+
+#include <memory>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <condition_variable>
+#include <sys/uio.h>
+#include <event2/event.h>
+#include <event2/buffer.h>
+#include <boost/function.hpp>
+
+#include "object.hpp"
+#include "spsc_ring.hpp"
+
+
+namespace myio { namespace buflo
+{
+
+/* sends a buflo channel's cells into its socket, one cell's worth
+ * per tick, from a dedicated thread, so the ticks don't jitter when
+ * the event loop is busy (e.g., processing a burst of client data).
+ *
+ * the channel (on the event loop, "I/O thread") prepares whole cells
+ * and hands them over through a lock-free single-producer
+ * single-consumer ring. on a tick with no cell queued, the pacer
+ * sends the filler dummy cell given at construction. the pacer never
+ * decides anything about the defense itself, except to stop on its
+ * own at the next multiple of L once asked to, so it never sends more
+ * than the channel would have.
+ *
+ * after every tick the pacer notifies the I/O thread (through an
+ * eventfd on the event loop), so the channel can keep the ring
+ * topped up, fold in the counters, and check the session time limit.
+ *
+ * the socket is only ever written by one thread at a time: the pacer
+ * while it's ticking, the channel otherwise. stop() blocks until the
+ * pacer is idle.
+ */
+class BufloCellPacer : public Object
+{
+public:
+    typedef std::unique_ptr<BufloCellPacer, Destructor> UniquePtr;
+    typedef boost::function<void(BufloCellPacer*)> TickedCb;
+
+    static const size_t max_cell_size = 750;
+
+    /* how many cells the channel should keep queued ahead of the
+     * pacer. more absorbs longer stalls of the event loop; fewer
+     * keeps late flags (e.g., STOP) from waiting behind queued
+     * cells */
+    static const size_t lookahead_cells = 4;
+
+    struct Counters
+    {
+        uint64_t bytes_written = 0;
+        /* these are for whole cells that have been fully
+         * written */
+        uint64_t useful_bytes_sent = 0;
+        uint32_t cells_sent = 0;
+        uint32_t dummy_cells_sent = 0;
+        /* ticks on which the socket took less than a cell's worth */
+        uint32_t short_writes = 0;
+    };
+
+    /* "dummy_cell" is copied. "cpu" is the cpu to pin the thread to,
+     * or negative to not pin */
+    explicit BufloCellPacer(struct event_base*, int fd, size_t cell_size,
+                            const uint8_t* dummy_cell, int cpu,
+                            TickedCb);
+
+    /**** everything below is for the I/O thread only ****/
+
+    /* start ticking every "interval_ms". if "first_tick_now" the
+     * first tick is right away, otherwise after one interval.
+     *
+     * "front_cell_sent_progress": how much of the first cell queued
+     * has already been written into the socket
+     */
+    void start(const uint32_t& interval_ms, const uint32_t& L,
+               const bool& first_tick_now,
+               const size_t& front_cell_sent_progress);
+
+    /* the pacer will stop once the number of ticks reaches a multiple
+     * of L, i.e., Tamaraw's stopping rule */
+    void request_stop_at_multiple_of_L();
+
+    /* stop now; blocks until the pacer is idle (at most the duration
+     * of one tick, which never blocks on the socket) */
+    void stop();
+
+    bool is_ticking() const;
+    uint32_t num_ticks() const;
+    /* non-zero if a write failed (other than EAGAIN); the pacer stops
+     * ticking by itself then */
+    int write_errno() const;
+
+    /* counters since the last call */
+    Counters collect_counters();
+
+    /* returns false if the ring is full */
+    bool push_cell(const uint8_t* bytes, const uint16_t& data_len);
+
+    /* cells queued or in progress */
+    size_t num_queued_cells() const;
+
+    /* the pacer must not be ticking. move every cell not yet fully
+     * written into "buf", appending to "data_lens" the useful data
+     * length of each. filler dummy cells not yet started are
+     * dropped.
+     *
+     * returns how much of the first cell has already been written
+     */
+    size_t take_unsent_cells(struct evbuffer* buf, std::deque<uint16_t>& data_lens);
+
+protected:
+
+    virtual ~BufloCellPacer();
+
+    struct Cell
+    {
+        uint16_t data_len;
+        /* the dummy cells the pacer sends on its own */
+        bool is_filler;
+        uint8_t bytes[max_cell_size];
+    };
+
+    void _run();
+    /* a tick: begin under the lock, write "iov" into the socket
+     * without it, then end under the lock. each returns false if the
+     * pacer should go idle */
+    bool _begin_tick_locked(struct iovec (&iov)[2], int& iovcnt);
+    bool _end_tick_locked(const ssize_t num_written, const int write_errno);
+    void _take_next_cell(Cell& cell);
+    void _account_sent_cell(const Cell& cell);
+
+    void _on_notified(int fd, short what);
+    static void s_on_notified(int fd, short what, void* arg);
+
+    const int fd_;
+    const size_t cell_size_;
+    Cell filler_cell_;
+    TickedCb ticked_cb_;
+
+    /* eventfd the pacer writes to after every tick */
+    int notify_fd_;
+    std::unique_ptr<struct event, void(*)(struct event*)> notify_ev_;
+
+    SPSCRing<Cell, 64> ring_;
+
+    /* everything below is protected by mutex_ */
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    std::condition_variable idle_cv_;
+
+    bool exiting_ = false;
+    bool ticking_ = false;
+    bool stop_now_ = false;
+    bool stop_at_multiple_of_L_ = false;
+    uint32_t L_ = 0;
+    uint32_t ticks_ = 0;
+    int write_errno_ = 0;
+    std::chrono::milliseconds interval_;
+    std::chrono::steady_clock::time_point next_tick_time_;
+
+    /* the cell being written, and the one after it, which we start
+     * writing when the current one has been partially written */
+    Cell cur_;
+    bool has_cur_ = false;
+    size_t cur_progress_ = 0;
+    Cell next_;
+    bool has_next_ = false;
+    size_t pending_front_progress_ = 0;
+
+    Counters counters_;
+
+    std::thread thread_;
+};
+
+}
+}
+
+#endif /* IN_SHADOW */
+
+#endif /* buflo_cell_pacer_hpp */
@@ -52,6 +52,9 @@ public:
     enum class ChannelStatus : short
     {
         READY,
+        A_DEFENSE_SESSION_STARTED /* informational only; the user
+                                   * must not close/destroy the
+                                   * channel from this callback */,
         A_DEFENSE_SESSION_DONE /* i.e., both send and recv directions
                                 * are done */,
         CLOSED
@@ -292,11 +292,17 @@ BufloMuxChannelImplSpdy::BufloMuxChannelImplSpdy(
     , dummy_recv_cell_count_(0)
     , all_send_byte_count_(0)
     , all_users_data_send_byte_count_(0)
+    , all_send_cell_count_(0)
     , dummy_send_cell_count_(0)
+    , stream_ctrl_batch_window_ms_(0)
+    , num_batched_stream_ctrl_frames_(0)
+    , num_stream_ctrl_batches_sent_(0)
+    , num_stream_ctrl_frames_batched_(0)
 {
-    /* the value used by tamaraw paper */
-    CHECK((cell_size == 750)
-          || (cell_size == 0));
+    /* the peer info carries the cell size in 2 bytes */
+    CHECK((cell_size == 0)
+          || ((cell_size > CELL_HEADER_SIZE) && (cell_size <= 0xffff)))
+        << "bad cell size: " << cell_size;
 
     if (defense_session_time_limit_) {
         CHECK_LE(defense_session_time_limit_, 60 * 3);
@@ -339,6 +345,11 @@ BufloMuxChannelImplSpdy::BufloMuxChannelImplSpdy(
                               this, _1),
                   0));
 
+    stream_ctrl_batch_timer_.reset(
+        new Timer(evbase, true,
+                  boost::bind(&BufloMuxChannelImplSpdy::_stream_ctrl_batch_timer_fired,
+                              this, _1)));
+
     _setup_spdylay_session();
 
 #define ALLOC_EVBUF(buf) \
@@ -433,7 +444,7 @@ BufloMuxChannelImplSpdy::create_stream2(const char* host,
     int rv = spdylay_submit_syn_stream(spdysess_, 0, 0, 0, nv, observer);
     CHECK_EQ(rv, 0);
 
-    _pump_spdy_send();
+    _on_stream_ctrl_frame_submitted();
 
     vlogself(2) << "done";
     return 0;
@@ -441,6 +452,12 @@ BufloMuxChannelImplSpdy::create_stream2(const char* host,
 
 bool
 BufloMuxChannelImplSpdy::start_defense_session()
+{
+    return _start_defense_session(false);
+}
+
+bool
+BufloMuxChannelImplSpdy::_start_defense_session(const bool first_write_now)
 {
     CHECK_EQ(defense_info_.state, DefenseState::NONE)
         << "currently only support starting session when none is active";
@@ -466,7 +483,44 @@ BufloMuxChannelImplSpdy::start_defense_session()
     intvl_tv.tv_sec = 0;
     intvl_tv.tv_usec = (tamaraw_pkt_intvl_ms_ * 1000);
 
+#ifndef IN_SHADOW
+    if (cell_pacer_) {
+        /* hand everything in cell_outbuf_ over to the pacer; from now
+         * on only the pacer writes into the socket, until we stop
+         * it */
+        _maybe_drop_whole_dummy_cell_at_end_outbuf(__LINE__, false);
+        CHECK_EQ(evbuffer_get_length(cell_outbuf_) + front_cell_sent_progress_,
+                 output_cells_data_bytes_info_.size() * cell_size_);
+
+        /* the front cell might have been partially written; the
+         * pacer only needs its remaining bytes to be in place */
+        const auto progress = front_cell_sent_progress_;
+        if (progress) {
+            uint8_t cell[BufloCellPacer::max_cell_size] = {0};
+            const auto rv = evbuffer_remove(
+                cell_outbuf_, cell + progress, cell_size_ - progress);
+            CHECK_EQ(rv, (cell_size_ - progress));
+            const auto pushed = cell_pacer_->push_cell(
+                cell, output_cells_data_bytes_info_.front());
+            CHECK(pushed);
+            output_cells_data_bytes_info_.pop_front();
+            front_cell_sent_progress_ = 0;
+        }
+
+        defense_info_.state = DefenseState::ACTIVE;
+
+        /* the rest of cell_outbuf_; whatever doesn't fit in the
+         * pacer's ring is fed later */
+        _feed_cell_pacer();
+
+        cell_pacer_->start(tamaraw_pkt_intvl_ms_, tamaraw_L_,
+                           first_write_now, progress);
+    } else {
+        buflo_timer_->start(&intvl_tv);
+    }
+#else
     buflo_timer_->start(&intvl_tv);
+#endif
 
     defense_info_.state = DefenseState::ACTIVE;
     defense_info_.done_defending_recv = false;
@@ -477,6 +531,9 @@ BufloMuxChannelImplSpdy::start_defense_session()
 
     logself(INFO) << "defense started";
 
+    DestructorGuard dg(this);
+    ch_status_cb_(this, ChannelStatus::A_DEFENSE_SESSION_STARTED);
+
     return true;
 }
 
@@ -519,6 +576,14 @@ BufloMuxChannelImplSpdy::stop_defense_session(bool right_now)
         if (is_client_side_) {
             defense_info_.need_stop_flag_in_next_cell = true;
         }
+
+#ifndef IN_SHADOW
+        if (cell_pacer_) {
+            cell_pacer_->request_stop_at_multiple_of_L();
+            // get the STOP flag queued
+            _feed_cell_pacer();
+        }
+#endif
     } else {
         CHECK(0) << "todo";
     }
@@ -547,7 +612,8 @@ BufloMuxChannelImplSpdy::set_stream_connected(int sid)
 
     _init_stream_data_provider(sid);
 
-    _pump_spdy_send();
+    unanswered_connect_sids_.erase(sid);
+    _on_stream_ctrl_frame_submitted();
 
     return true;
 }
@@ -663,6 +729,7 @@ BufloMuxChannelImplSpdy::close_stream(int sid)
     auto rv = spdylay_submit_rst_stream(spdysess_, sid, SPDYLAY_CANCEL);
     CHECK_EQ(rv, 0);
 
+    unanswered_connect_sids_.erase(sid);
     _pump_spdy_send();
 
     // we don't clean up things like stream state here; instead will
@@ -681,90 +748,11 @@ BufloMuxChannelImplSpdy::_buflo_timer_fired(Timer* timer)
     CHECK_EQ(rv, 0);
 
     if (defense_info_.is_done_defending_send(tamaraw_L_)) {
-        logself(INFO) << "done defending send; defensive cells sent/attempted= "
-                      << defense_info_.num_write_attempts;
-        defense_info_.saved_num_write_attempts = defense_info_.num_write_attempts;
-        buflo_timer_->cancel();
-
-        // we are finally done according to normal operation
-
-        /* reset so state becomes none so _pump_spdy_send() will
-         * flush. but need to save and restore the
-         * need_stop_flag_in_next_cell
-         */
-
-        const auto saved_bool = defense_info_.need_stop_flag_in_next_cell;
-        defense_info_.reset();
-        defense_info_.need_stop_flag_in_next_cell = saved_bool;
-
-        if (!is_client_side_) {
-            // ssp tells csp that it's done defending its send
-            // direction, i.e., csp's receive direction
-            defense_info_.need_done_flag_in_next_cell = true;
-        }
-
-        /* this will flush data cells and toggle write monitoring
-         * appropriately */
-        _pump_spdy_send(true);
-
-        if (defense_info_.need_stop_flag_in_next_cell || defense_info_.need_done_flag_in_next_cell)
-        {
-            vlogself(2) << "still need to send the stop/done flag, so we send a dummy cell";
-            /* the flag could not piggyback on any cell, so we have to
-             * add a control/dummy cell ourselves here
-             */
-
-            _maybe_drop_whole_dummy_cell_at_end_outbuf(__LINE__, false);
-            CHECK(!whole_dummy_cell_at_end_outbuf_);
-
-            _add_ONE_dummy_cell_to_outbuf();
-            _maybe_toggle_write_monitoring(ForceToggleMode::FORCE_ENABLE);
-        } else {
-            vlogself(2) << "the stop flag has been added";
-        }
-
-        CHECK(!defense_info_.need_stop_flag_in_next_cell);
-        CHECK(!defense_info_.need_done_flag_in_next_cell);
-
-        _check_notify_a_defense_session_done(__LINE__);
-
+        _on_done_defending_send();
+        goto done;
+    } else if (evutil_timercmp(&current_tv, &defense_info_.auto_stop_time_point, >=)) {
+        _on_defense_time_limit_reached();
         goto done;
-    } else {
-        if (evutil_timercmp(&current_tv, &defense_info_.auto_stop_time_point, >=)) {
-            if (is_client_side_) {
-                logself(FATAL) << "exceeding defense session time limit! "
-                               << "perhaps you forgot to stop defense after "
-                               << "you're done with a page load?";
-            } else {
-                // we're on ssp
-                logself(WARNING) << "exceeding defense session time limit! "
-                                 << "auto-stopping; number of defensive cells sent/attempted: "
-                                 << defense_info_.num_write_attempts;
-                defense_info_.saved_num_write_attempts = defense_info_.num_write_attempts;
-                buflo_timer_->cancel();
-
-                defense_info_.reset();
-                defense_info_.need_auto_stopped_flag_in_next_cell = true;
-
-                _pump_spdy_send(true);
-
-                if (defense_info_.need_auto_stopped_flag_in_next_cell) {
-                    /* the flag could not piggyback on any cell, so we
-                     * have to add a control/dummy cell ourselves here
-                     */
-
-                    _maybe_drop_whole_dummy_cell_at_end_outbuf(__LINE__, false);
-                    CHECK(!whole_dummy_cell_at_end_outbuf_);
-
-                    _add_ONE_dummy_cell_to_outbuf();
-                    _maybe_toggle_write_monitoring(ForceToggleMode::FORCE_ENABLE);
-                }
-
-                CHECK(!defense_info_.need_auto_stopped_flag_in_next_cell);
-
-                goto done;
-            }
-        }
     }
 
     vlogself(2) << "defense is still on-going";
@@ -803,6 +791,134 @@ done:
     vlogself(2) << "done ---";
 }
 
+void
+BufloMuxChannelImplSpdy::_on_done_defending_send()
+{
+    logself(INFO) << "done defending send; defensive cells sent/attempted= "
+                  << defense_info_.num_write_attempts;
+    defense_info_.saved_num_write_attempts = defense_info_.num_write_attempts;
+    _stop_sending_defensive_cells();
+
+    // we are finally done according to normal operation
+
+    /* reset so state becomes none so _pump_spdy_send() will
+     * flush. but need to save and restore the
+     * need_stop_flag_in_next_cell
+     */
+
+    const auto saved_bool = defense_info_.need_stop_flag_in_next_cell;
+    defense_info_.reset();
+    defense_info_.need_stop_flag_in_next_cell = saved_bool;
+
+    if (!is_client_side_) {
+        // ssp tells csp that it's done defending its send
+        // direction, i.e., csp's receive direction
+        defense_info_.need_done_flag_in_next_cell = true;
+    }
+
+    /* this will flush data cells and toggle write monitoring
+     * appropriately */
+    _pump_spdy_send(true);
+
+    if (defense_info_.need_stop_flag_in_next_cell || defense_info_.need_done_flag_in_next_cell)
+    {
+        vlogself(2) << "still need to send the stop/done flag, so we send a dummy cell";
+        /* the flag could not piggyback on any cell, so we have to
+         * add a control/dummy cell ourselves here
+         */
+
+        _maybe_drop_whole_dummy_cell_at_end_outbuf(__LINE__, false);
+        CHECK(!whole_dummy_cell_at_end_outbuf_);
+
+        _add_ONE_dummy_cell_to_outbuf();
+        _maybe_toggle_write_monitoring(ForceToggleMode::FORCE_ENABLE);
+    } else {
+        vlogself(2) << "the stop flag has been added";
+    }
+
+    CHECK(!defense_info_.need_stop_flag_in_next_cell);
+    CHECK(!defense_info_.need_done_flag_in_next_cell);
+
+    _check_notify_a_defense_session_done(__LINE__);
+}
+
+void
+BufloMuxChannelImplSpdy::_on_defense_time_limit_reached()
+{
+    if (is_client_side_) {
+        logself(FATAL) << "exceeding defense session time limit! "
+                       << "perhaps you forgot to stop defense after "
+                       << "you're done with a page load?";
+        return;
+    }
+
+    // we're on ssp
+    logself(WARNING) << "exceeding defense session time limit! "
+                     << "auto-stopping; number of defensive cells sent/attempted: "
+                     << defense_info_.num_write_attempts;
+    defense_info_.saved_num_write_attempts = defense_info_.num_write_attempts;
+    _stop_sending_defensive_cells();
+
+    defense_info_.reset();
+    defense_info_.need_auto_stopped_flag_in_next_cell = true;
+
+    _pump_spdy_send(true);
+
+    if (defense_info_.need_auto_stopped_flag_in_next_cell) {
+        /* the flag could not piggyback on any cell, so we have to
+         * add a control/dummy cell ourselves here
+         */
+
+        _maybe_drop_whole_dummy_cell_at_end_outbuf(__LINE__, false);
+        CHECK(!whole_dummy_cell_at_end_outbuf_);
+
+        _add_ONE_dummy_cell_to_outbuf();
+        _maybe_toggle_write_monitoring(ForceToggleMode::FORCE_ENABLE);
+    }
+
+    CHECK(!defense_info_.need_auto_stopped_flag_in_next_cell);
+}
+
+void
+BufloMuxChannelImplSpdy::_stop_sending_defensive_cells()
+{
+    buflo_timer_->cancel();
+
+#ifndef IN_SHADOW
+    if (!cell_pacer_) {
+        return;
+    }
+
+    cell_pacer_->stop();
+    _collect_cell_pacer_counters();
+
+    /* the cells the pacer hasn't sent go back to the front of
+     * cell_outbuf_, ahead of any that we couldn't feed it. they
+     * still carry the DEFENSIVE flag, which only affects the peer's
+     * count of defensive cells received
+     */
+    struct evbuffer* unsent = evbuffer_new();
+    CHECK_NOTNULL(unsent);
+    std::deque<uint16_t> unsent_data_lens;
+    const auto progress = cell_pacer_->take_unsent_cells(unsent, unsent_data_lens);
+
+    if (!unsent_data_lens.empty()) {
+        CHECK_EQ(front_cell_sent_progress_, 0);
+        auto rv = evbuffer_prepend_buffer(cell_outbuf_, unsent);
+        CHECK_EQ(rv, 0);
+        output_cells_data_bytes_info_.insert(
+            output_cells_data_bytes_info_.begin(),
+            unsent_data_lens.begin(), unsent_data_lens.end());
+        front_cell_sent_progress_ = progress;
+    }
+
+    evbuffer_free(unsent);
+
+    vlogself(2) << "took back " << unsent_data_lens.size()
+                << " cells from the pacer";
+#endif
+}
+
 /*
  * after telling spdy to write to its buf, if there is defense, then
  * FLUSH all spdy data to cell outbuf (i.e., call
@@ -814,6 +930,16 @@ BufloMuxChannelImplSpdy::_pump_spdy_send(const bool log_flushed_cell_count)
 {
     vlogself(2) << "begin";
 
+    if (num_batched_stream_ctrl_frames_) {
+        // whoever is pumping, the current batch goes out with it
+        vlogself(2) << "sending batch of " << num_batched_stream_ctrl_frames_
+                    << " stream control frames";
+        ++num_stream_ctrl_batches_sent_;
+        num_stream_ctrl_frames_batched_ += num_batched_stream_ctrl_frames_;
+        num_batched_stream_ctrl_frames_ = 0;
+        stream_ctrl_batch_timer_->cancel();
+    }
+
     // tell spdy session to send -- it will call our send_cb
     spdylay_session* session = spdysess_;
     auto rv = spdylay_session_send(session);
@@ -859,6 +985,11 @@ BufloMuxChannelImplSpdy::_pump_spdy_send(const bool log_flushed_cell_count)
     } else {
         vlogself(2) << "defense is active, we don't enable write monitoring";
         CHECK_EQ(defense_info_.state, DefenseState::ACTIVE);
+#ifndef IN_SHADOW
+        if (cell_pacer_) {
+            _feed_cell_pacer();
+        }
+#endif
     }
 
     vlogself(2) << "done";
@@ -1100,6 +1231,7 @@ BufloMuxChannelImplSpdy::_update_output_cell_progress(int num_written)
 
         if (front_cell_sent_progress_ == cell_size_) {
             vlogself(2) << "done sending front cell...";
+            ++all_send_cell_count_;
             const auto num_data_bytes_in_front_cell = output_cells_data_bytes_info_.at(0);
             if (num_data_bytes_in_front_cell > 0) {
                 vlogself(2) << "   ... with num_data_bytes_in_front_cell= "
@@ -1758,11 +1890,19 @@ BufloMuxChannelImplSpdy::_on_socket_writecb(int fd, short what)
                     vlogself(2) << "automatically starting the defense";
                     // start_defense_session() will set to ACTIVE
                     defense_info_.state = DefenseState::NONE;
-                    start_defense_session();
+                    _start_defense_session(true);
                     // we have only started the timer. we will fall through to
                     // do the first write here
                 }
+#ifndef IN_SHADOW
+                if (cell_pacer_ && (defense_info_.state == DefenseState::ACTIVE)) {
+                    vlogself(2) << "the pacer does the first write";
+                } else {
+                    _send_cell_outbuf();
+                }
+#else
                 _send_cell_outbuf();
+#endif
 
             } else {
                 /* we are operating as straigt-up regular proxy, i.e.,
@@ -1993,6 +2133,7 @@ BufloMuxChannelImplSpdy::_on_spdylay_on_stream_close_cb(spdylay_session *session
 
     // erase will do nothing if stream_id is not in map
     stream_states_.erase(stream_id);
+    unanswered_connect_sids_.erase(stream_id);
     vlogself(2) << "done";
 }
 
@@ -2159,6 +2300,7 @@ BufloMuxChannelImplSpdy::_on_spdylay_on_ctrl_recv_cb(spdylay_session *session,
         vlogself(2) << "host= [" << host_str << "] port= " << port;
 
         _init_stream_state(sid);
+        unanswered_connect_sids_.insert(sid);
 
         DestructorGuard dg(this);
         st_connect_req_cb_(this, sid, host_str.c_str(), port);
@@ -2478,6 +2620,9 @@ BufloMuxChannelImplSpdy::has_pending_bytes() const
         && (evbuffer_get_length(spdy_outbuf_) == 0)
         && (evbuffer_get_length(cell_inbuf_) == 0)
         && (evbuffer_get_length(cell_outbuf_) == 0)
+#ifndef IN_SHADOW
+        && (!cell_pacer_ || (cell_pacer_->num_queued_cells() == 0))
+#endif
         ;
     vlogself(2) << "has_pending_bytes= " << !all_empty;
     return !all_empty;
@@ -2499,9 +2644,212 @@ BufloMuxChannelImplSpdy::cell_outbuf_length() const
     return evbuffer_get_length(cell_outbuf_);
 }
 
+uint64_t
+BufloMuxChannelImplSpdy::buffered_send_byte_count() const
+{
+    uint64_t count = evbuffer_get_length(spdy_outbuf_)
+                     + evbuffer_get_length(cell_outbuf_);
+#ifndef IN_SHADOW
+    if (cell_pacer_) {
+        count += cell_pacer_->num_queued_cells() * cell_size_;
+    }
+#endif
+    for (const auto& it : stream_states_) {
+        if (it.second) {
+            count += evbuffer_get_length(it.second->inward_buf_);
+        }
+    }
+    return count;
+}
+
+void
+BufloMuxChannelImplSpdy::set_stream_ctrl_batch_window_ms(const uint16_t& window_ms)
+{
+    logself(INFO) << "stream control batch window= " << window_ms << " ms";
+    stream_ctrl_batch_window_ms_ = window_ms;
+    if (!stream_ctrl_batch_window_ms_ && num_batched_stream_ctrl_frames_) {
+        _pump_spdy_send();
+    }
+}
+
+void
+BufloMuxChannelImplSpdy::_on_stream_ctrl_frame_submitted()
+{
+    if (!stream_ctrl_batch_window_ms_) {
+        _pump_spdy_send();
+        return;
+    }
+
+    ++num_batched_stream_ctrl_frames_;
+
+    if (!is_client_side_ && unanswered_connect_sids_.empty()) {
+        // we have answered everything the csp has asked so far, so
+        // no point waiting
+        vlogself(2) << "all connect requests answered; send batch now";
+        _pump_spdy_send();
+        return;
+    }
+
+    if (!stream_ctrl_batch_timer_->is_running()) {
+        vlogself(2) << "start a batch of stream control frames";
+        stream_ctrl_batch_timer_->start(stream_ctrl_batch_window_ms_);
+    }
+}
+
+void
+BufloMuxChannelImplSpdy::_stream_ctrl_batch_timer_fired(Timer*)
+{
+    DestructorGuard dg(this);
+
+    vlogself(2) << "batch window is up";
+    CHECK_GT(num_batched_stream_ctrl_frames_, 0);
+    _pump_spdy_send();
+}
+
+void
+BufloMuxChannelImplSpdy::enable_threaded_cell_pacer(const int cpu)
+{
+#ifdef IN_SHADOW
+    logself(FATAL) << "threaded cell pacer makes sense only outside shadow";
+#else
+    CHECK_GT(cell_size_, 0);
+    CHECK_LE(cell_size_, BufloCellPacer::max_cell_size);
+    CHECK_EQ(defense_info_.state, DefenseState::NONE);
+    CHECK(!cell_pacer_);
+
+    /* the dummy cell the pacer sends when we haven't given it
+     * anything to send */
+    uint8_t dummy_cell[BufloCellPacer::max_cell_size];
+    uint8_t type_n_flags = 0;
+    SET_CELL_TYPE(type_n_flags, CellType::DUMMY);
+    SET_CELL_DEFENSIVE_FLAG(&type_n_flags);
+    static const uint16_t len_field = 0;
+
+    memcpy(dummy_cell, &type_n_flags, sizeof type_n_flags);
+    memcpy(dummy_cell + sizeof type_n_flags, &len_field, sizeof len_field);
+    memcpy(dummy_cell + CELL_HEADER_SIZE, common::static_bytes->c_str(),
+           cell_body_size_);
+
+    cell_pacer_.reset(
+        new BufloCellPacer(evbase_, fd_, cell_size_, dummy_cell, cpu,
+                           boost::bind(&BufloMuxChannelImplSpdy::_on_cell_pacer_ticked,
+                                       this, _1)));
+
+    logself(INFO) << "using threaded cell pacer";
+#endif
+}
+
+#ifndef IN_SHADOW
+
+void
+BufloMuxChannelImplSpdy::_feed_cell_pacer()
+{
+    CHECK_EQ(defense_info_.state, DefenseState::ACTIVE);
+    // everything partially written is with the pacer
+    CHECK_EQ(front_cell_sent_progress_, 0);
+
+    const auto num_queued = cell_pacer_->num_queued_cells();
+
+    while ((num_queued + output_cells_data_bytes_info_.size())
+           < BufloCellPacer::lookahead_cells)
+    {
+        if (!_maybe_add_ONE_data_cell_to_outbuf()) {
+            if (defense_info_.need_start_flag_in_next_cell
+                || defense_info_.need_stop_flag_in_next_cell)
+            {
+                // the pacer's own dummy cells can't carry these
+                vlogself(2) << "no data to carry the flags; add a dummy cell";
+                _add_ONE_dummy_cell_to_outbuf();
+            } else {
+                break;
+            }
+        }
+    }
+
+    while (!output_cells_data_bytes_info_.empty()) {
+        const auto cell = evbuffer_pullup(cell_outbuf_, cell_size_);
+        CHECK_NOTNULL(cell);
+        if (!cell_pacer_->push_cell(cell, output_cells_data_bytes_info_.front())) {
+            vlogself(2) << "pacer ring is full";
+            break;
+        }
+        const auto rv = evbuffer_drain(cell_outbuf_, cell_size_);
+        CHECK_EQ(rv, 0);
+        output_cells_data_bytes_info_.pop_front();
+    }
+
+    // there can be no whole dummy cell left to drop
+    whole_dummy_cell_at_end_outbuf_ = false;
+}
+
+void
+BufloMuxChannelImplSpdy::_collect_cell_pacer_counters()
+{
+    const auto counters = cell_pacer_->collect_counters();
+    all_send_byte_count_ += counters.bytes_written;
+    all_users_data_send_byte_count_ += counters.useful_bytes_sent;
+    all_send_cell_count_ += counters.cells_sent;
+    dummy_send_cell_count_ += counters.dummy_cells_sent;
+    if (counters.short_writes) {
+        // the pacer thread can't log
+        vlogself(1) << "cell pacer had " << counters.short_writes
+                    << " short writes";
+    }
+}
+
+void
+BufloMuxChannelImplSpdy::_on_cell_pacer_ticked(BufloCellPacer*)
+{
+    DestructorGuard dg(this);
+
+    _collect_cell_pacer_counters();
+
+    if (defense_info_.state != DefenseState::ACTIVE) {
+        vlogself(2) << "tick from a session we have already wrapped up";
+        return;
+    }
+
+    vlogself(2) << "begin +++";
+
+    // each tick is one write attempt, like each buflo timer fire
+    defense_info_.num_write_attempts = cell_pacer_->num_ticks();
+
+    const auto write_errno = cell_pacer_->write_errno();
+    if (write_errno) {
+        // the pacer has stopped by itself
+        errno = write_errno;
+        _handle_failed_socket_io("write", -1, false);
+        return;
+    }
+
+    struct timeval current_tv;
+    const auto rv = gettimeofday(&current_tv, nullptr);
+    CHECK_EQ(rv, 0);
+
+    if (defense_info_.is_done_defending_send(tamaraw_L_)) {
+        _on_done_defending_send();
+    } else if (evutil_timercmp(&current_tv, &defense_info_.auto_stop_time_point, >=)) {
+        _on_defense_time_limit_reached();
+    } else {
+        _feed_cell_pacer();
+    }
+
+    vlogself(2) << "done ---";
+}
+
+#endif
+
 void
 BufloMuxChannelImplSpdy::_close_socket_and_events()
 {
+#ifndef IN_SHADOW
+    // the pacer thread must be done with the fd before we close it
+    if (cell_pacer_) {
+        cell_pacer_->stop();
+        cell_pacer_.reset();
+    }
+#endif
+
     // delete these events BEFORE closing the fd; this seems to fix
     // issue #6
     socket_read_ev_.reset();
@@ -2559,6 +2907,11 @@ BufloMuxChannelImplSpdy::~BufloMuxChannelImplSpdy()
     vlogself(2) << "begin destructing";
     _close_socket_and_events();
 
+    if (stream_ctrl_batch_window_ms_) {
+        logself(INFO) << "stream control batches sent= " << num_stream_ctrl_batches_sent_
+                      << " frames batched= " << num_stream_ctrl_frames_batched_;
+    }
+
 #define FREE_EVBUF(buf)                         \
     do {                                        \
         if (buf) {                              \
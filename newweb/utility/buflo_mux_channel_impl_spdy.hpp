@@ -12,11 +12,13 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <deque>
+#include <set>
 
 #include "object.hpp"
 #include "buflo_mux_channel.hpp"
 #include "timer.hpp"
 #include "tcp_channel.hpp"
+#include "buflo_cell_pacer.hpp"
 
 
 namespace myio { namespace buflo
@@ -31,16 +33,17 @@ public:
     // AsyncTransport.h for example)
     typedef std::unique_ptr<BufloMuxChannelImplSpdy, Destructor> UniquePtr;
 
-    /* "cell_size" can be two values:
+    /* "cell_size":
      *
      * * 0 means we are not sending cells at all, i.e., no buflo
      * stuff. just a straight spdy proxy. NOTE that this applies only
      * to our sending; the other peer can still send cells, and we
      * still receive them correctly.
      *
-     * * 750 means we will be sending cells of 750 bytes, with padding
-     * if necessary. again, the peer can independently choose to use 0
-     * or 750
+     * * otherwise we will be sending cells of that many bytes (750 is
+     * what the tamaraw paper uses), with padding if necessary. it
+     * must be larger than the cell header and fit in 16 bits. again,
+     * the peer can independently choose its own cell size, or 0
      *
      * "myaddr" will be sent to the other end, to help
      * troublingshooting. should be in host-byte order
@@ -110,6 +113,8 @@ public:
     virtual uint32_t cell_outbuf_length() const override;
 
     std::string peer_ip() const;
+    /* network byte order */
+    const in_addr_t& peer_addr() const { return peeraddr_; }
 
     const uint64_t& all_recv_byte_count() const { return all_recv_byte_count_; }
     const uint64_t& useful_recv_byte_count() const { return all_users_data_recv_byte_count_; }
@@ -118,15 +123,54 @@ public:
     const uint64_t& all_send_byte_count() const { return all_send_byte_count_; }
     const uint64_t& useful_send_byte_count() const { return all_users_data_send_byte_count_; }
     const uint32_t& dummy_send_cell_count() const { return dummy_send_cell_count_; }
+    /* whole cells, dummy or not, fully written into the socket */
+    const uint32_t& all_send_cell_count() const { return all_send_cell_count_; }
 
     const uint32_t& num_dummy_cells_avoided() const { return num_dummy_cells_avoided_; }
 
+    /* number of bytes we have buffered but not yet written into the
+     * socket, i.e., user data waiting to be read by spdy, spdy frames
+     * waiting to be packed into cells, and cells waiting to be sent
+     */
+    uint64_t buffered_send_byte_count() const;
+
+    /* batch the stream control frames -- SYN_STREAMs on the client
+     * side, SYN_REPLYs on the server side -- that are submitted
+     * within "window_ms" of the first one, so that they go out
+     * together, packed back to back into as few cells as possible,
+     * instead of each taking up its own (mostly padding) cell.
+     *
+     * the server side sends its batch early if every stream connect
+     * request it has received has been answered.
+     *
+     * any other send (e.g., stream data) also sends the current
+     * batch. zero (the default) disables batching
+     */
+    void set_stream_ctrl_batch_window_ms(const uint16_t& window_ms);
+
+    /* native builds only: during defense sessions, write our cells
+     * into the socket from a dedicated thread (see BufloCellPacer),
+     * pinned to "cpu" if it's not negative, instead of from the buflo
+     * timer on the event loop. must be called before the first
+     * defense session starts
+     */
+    void enable_threaded_cell_pacer(const int cpu);
+
 protected:
 
     virtual ~BufloMuxChannelImplSpdy();
 
     void _setup_spdylay_session();
     void _buflo_timer_fired(Timer* timer);
+    /* "first_write_now": the first defensive cell is to be written
+     * right away, i.e., we're starting from
+     * PENDING_NEXT_SOCKET_SEND */
+    bool _start_defense_session(const bool first_write_now);
+    void _on_done_defending_send();
+    void _on_defense_time_limit_reached();
+    /* cancel the buflo timer, or stop the cell pacer and take back
+     * into cell_outbuf_ the cells it has not sent */
+    void _stop_sending_defensive_cells();
     void _pump_spdy_send(const bool log_flushed_cell_count=false);
     void _pump_spdy_recv();
 
@@ -175,6 +219,19 @@ protected:
 
     void _update_output_cell_progress(int num_written);
 
+    /* call after submitting a stream control frame to spdylay, instead
+     * of _pump_spdy_send() */
+    void _on_stream_ctrl_frame_submitted();
+    void _stream_ctrl_batch_timer_fired(Timer*);
+
+#ifndef IN_SHADOW
+    /* keep the cell pacer lookahead_cells ahead: add data cells (or
+     * a dummy cell if we have a flag to send) and move them over */
+    void _feed_cell_pacer();
+    void _collect_cell_pacer_counters();
+    void _on_cell_pacer_ticked(BufloCellPacer*);
+#endif
+
     /* shadow doesn't support edge-triggered (epoll) monitoring, so we
      * have to disable write monitoring if we don't have data to
      * write, otherwise will keep getting notified of the write event
@@ -575,8 +632,26 @@ protected:
 
     uint64_t all_send_byte_count_;
     uint64_t all_users_data_send_byte_count_;
+    uint32_t all_send_cell_count_;
     uint32_t dummy_send_cell_count_;
 
+    /* see set_stream_ctrl_batch_window_ms() */
+    uint16_t stream_ctrl_batch_window_ms_;
+    Timer::UniquePtr stream_ctrl_batch_timer_;
+    /* number of control frames waiting in the current batch */
+    uint32_t num_batched_stream_ctrl_frames_;
+    /* server side: streams whose connect requests we have passed to
+     * the user but that the user has not yet answered */
+    std::set<int> unanswered_connect_sids_;
+
+    uint32_t num_stream_ctrl_batches_sent_;
+    uint32_t num_stream_ctrl_frames_batched_;
+
+#ifndef IN_SHADOW
+    /* if set, it sends our cells while the defense is active; the
+     * buflo timer is not used */
+    BufloCellPacer::UniquePtr cell_pacer_;
+#endif
 };
 
 }
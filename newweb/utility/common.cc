@@ -30,6 +30,7 @@ const char request_path[] = "/special_request";
 const char resp_meta_size_name[] = "resp-meta-size";
 const char resp_body_size_name[] = "resp-body-size";
 const char content_length_name[] = "content-length";
+const char transfer_encoding_name[] = "transfer-encoding";
 
 const char dummy_name[] = "dummy-header";
 
@@ -142,6 +143,12 @@ get_cmd_line_name_value_pairs(
     return 0;
 }
 
+string
+ioservice_ipc_shm_name(const uint16_t port)
+{
+    return "newweb-ioservice-ipc-" + std::to_string(port);
+}
+
 void
 parse_host_port(const string& host_port_str,
                 string& host, uint16_t* port)
@@ -35,6 +35,7 @@ extern const char request_path[];
 extern const char resp_meta_size_name[];
 extern const char resp_body_size_name[];
 extern const char content_length_name[];
+extern const char transfer_encoding_name[];
 
 extern const char dummy_name[];
 
@@ -58,6 +59,11 @@ const uint16_t transport_proxy_ipc = 8000;
 
 } // namespace ports
 
+/* name of the io service's ipc server, for the shared memory
+ * transport, instead of its tcp port */
+std::string
+ioservice_ipc_shm_name(const uint16_t port);
+
 
 int
 get_config_name_value_pairs(
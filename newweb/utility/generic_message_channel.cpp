@@ -1,5 +1,7 @@
 
+#include <algorithm>
 #include <event2/buffer.h>
+#include <boost/bind.hpp>
 
 #include "easylogging++.h"
 #include "generic_message_channel.hpp"
@@ -7,21 +9,43 @@
 namespace myio
 {
 
+const uint8_t GenericMessageChannel::FRAMING_CTL_MSG_TYPE;
+const uint32_t GenericMessageChannel::MAX_MSG_LEN;
+const GenericMessageChannel::Framing GenericMessageChannel::HIGHEST_FRAMING;
+
 
 GenericMessageChannel::GenericMessageChannel(
     StreamChannel::UniquePtr channel,
-    GenericMessageChannelObserver* observer)
+    GenericMessageChannelObserver* observer,
+    struct event_base* evbase)
     : channel_(std::move(channel)), observer_(observer)
     , with_msg_id_(true)
-    , header_size_(with_msg_id_
-                   ? (MSG_TYPE_SIZE + MSG_ID_SIZE + MSG_LEN_SIZE)
-                   : (MSG_TYPE_SIZE + MSG_LEN_SIZE))
+    , header_prefix_size_(with_msg_id_
+                          ? (MSG_TYPE_SIZE + MSG_ID_SIZE)
+                          : (MSG_TYPE_SIZE))
+    , out_framing_(Framing::V0_U16_LEN)
+    , in_framing_(Framing::V0_U16_LEN)
+    , offered_large_msgs_(false)
     , state_(StreamState::READ_HEADER)
-    , msg_type_(0), msg_id_(0), msg_len_(0)
+    , msg_type_(0), msg_id_(0), msg_len_(0), msg_header_size_(0)
+    , out_batch_(evbuffer_new(), evbuffer_free)
 {
+    CHECK_NOTNULL(out_batch_.get());
+    if (evbase) {
+        flush_out_batch_timer_.reset(
+            new Timer(evbase, true,
+                      boost::bind(&GenericMessageChannel::_on_flush_out_batch_timer_fired,
+                                  this, _1)));
+    }
     channel_->set_observer(this);
 }
 
+GenericMessageChannel::~GenericMessageChannel()
+{
+    // don't lose msgs that were sent just before we're destroyed
+    _flush_out_batch();
+}
+
 void
 GenericMessageChannel::onNewReadDataAvailable(StreamChannel* channel) noexcept
 {
@@ -32,134 +56,299 @@ GenericMessageChannel::onNewReadDataAvailable(StreamChannel* channel) noexcept
 void
 GenericMessageChannel::_consume_input()
 {
-    auto keep_consuming = true;
     auto input_evb = channel_->get_input_evbuf();
+    const size_t num_avail_bytes = evbuffer_get_length(input_evb);
+
+    // pull up everything once and dispatch all the complete msgs out
+    // of that, then drain them all at once at the end, to reduce
+    // memory operations
+    //
+    // we're using a libevent version without copyout[_from]()
+    auto buf = evbuffer_pullup(input_evb, num_avail_bytes);
+    CHECK(buf || !num_avail_bytes);
 
-    // only drain buffer after we read full msg, to reduce memory
-    // operations
+    DestructorGuard db(this);
+
+    size_t num_consumed = 0;
+    size_t num_msgs = 0;
+
+    // loop to process all complete msgs
+    while (state_ != StreamState::CLOSED) {
+        const auto num_left = num_avail_bytes - num_consumed;
 
-    do {
-        const auto num_avail_bytes = evbuffer_get_length(input_evb);
-        auto total_len = 0;
-        // loop to process all complete msgs
-        switch (state_) {
-        case StreamState::READ_HEADER:
+        if (state_ == StreamState::READ_HEADER) {
             VLOG(3) << "trying to read msg type and length";
             CHECK_EQ(msg_len_, 0);
-            if (num_avail_bytes >= header_size_) {
-                // we're using a libevent version without
-                // copyout[_from]()
-                auto buf = evbuffer_pullup(input_evb, header_size_);
-                CHECK_NOTNULL(buf);
-
-                memcpy((uint8_t*)&msg_type_, buf, MSG_TYPE_SIZE);
-                buf += MSG_TYPE_SIZE;
-
-                if (with_msg_id_) {
-                    memcpy((uint8_t*)&msg_id_, buf, MSG_ID_SIZE);
-                    buf += MSG_ID_SIZE;
-                    msg_id_ = ntohl(msg_id_);
-                }
-
-                memcpy((uint8_t*)&msg_len_, buf, MSG_LEN_SIZE);
-                buf += MSG_LEN_SIZE;
-                msg_len_ = ntohs(msg_len_);
-
-                VLOG(3) << "got type= " << unsigned(msg_type_)
-                        << " len= " << msg_len_
-                        << " id= " << msg_id_;
-
-                // update state
-                state_ = StreamState::READ_MSG;
-
-                // not draining input buf here!
-            } else {
-                VLOG(3) << "not enough bytes yet";
-                keep_consuming = false; // to break out of loop
-            }
-            break;
-        case StreamState::READ_MSG:
-            VLOG(3) << "trying to read msg of length " << msg_len_;
-            total_len = (header_size_ + msg_len_);
-            if (num_avail_bytes >= total_len) {
-                DestructorGuard db(this);
-                auto data = evbuffer_pullup(input_evb, total_len);
-                CHECK_NOTNULL(data);
-
-                // notify
-                observer_->onRecvMsg(
-                    this, msg_type_, msg_id_, msg_len_, data + header_size_);
-
-                msg_type_ = msg_id_ = msg_len_ = 0;
-
-                // update state
-                state_ = StreamState::READ_HEADER;
-
-                auto rv = evbuffer_drain(input_evb, total_len);
-                CHECK_EQ(rv, 0);
-            } else {
+            if (!_parse_header(buf + num_consumed, num_left)) {
                 VLOG(3) << "not enough bytes yet";
-                keep_consuming = false; // to break out of loop
+                break;
             }
+
+            // update state
+            state_ = StreamState::READ_MSG;
+            // not consuming the header here!
+        }
+
+        VLOG(3) << "trying to read msg of length " << msg_len_;
+        const size_t total_len = (msg_header_size_ + msg_len_);
+        if (num_left < total_len) {
+            VLOG(3) << "not enough bytes yet";
             break;
-        default:
-            CHECK(false); // not reached
         }
-    } while (keep_consuming);
+
+        const auto msg_data = buf + num_consumed + msg_header_size_;
+        if (msg_type_ == FRAMING_CTL_MSG_TYPE) {
+            // might change how we parse the following msgs
+            _handle_framing_ctl_msg(msg_len_, msg_data);
+        } else {
+            // notify
+            observer_->onRecvMsg(
+                this, msg_type_, msg_id_, msg_len_, msg_data);
+        }
+
+        msg_type_ = msg_id_ = msg_len_ = 0;
+        msg_header_size_ = 0;
+        num_consumed += total_len;
+        ++num_msgs;
+
+        // update state
+        state_ = StreamState::READ_HEADER;
+    }
+
+    VLOG(3) << "dispatched " << num_msgs << " msgs, "
+            << num_consumed << " bytes";
+
+    if (num_consumed) {
+        auto rv = evbuffer_drain(input_evb, num_consumed);
+        CHECK_EQ(rv, 0);
+    }
 
     // update read low watermark
     _update_read_watermark();
 }
 
+bool
+GenericMessageChannel::_parse_header(const uint8_t* buf, size_t len)
+{
+    if (len < header_prefix_size_) {
+        return false;
+    }
+    const auto buf_start = buf;
+    const auto buf_end = buf + len;
+
+    memcpy((uint8_t*)&msg_type_, buf, MSG_TYPE_SIZE);
+    buf += MSG_TYPE_SIZE;
+
+    if (with_msg_id_) {
+        memcpy((uint8_t*)&msg_id_, buf, MSG_ID_SIZE);
+        buf += MSG_ID_SIZE;
+        msg_id_ = ntohl(msg_id_);
+    }
+
+    if (in_framing_ == Framing::V0_U16_LEN) {
+        if ((buf_end - buf) < MSG_LEN_SIZE) {
+            return false;
+        }
+        uint16_t msg_len = 0;
+        memcpy((uint8_t*)&msg_len, buf, MSG_LEN_SIZE);
+        buf += MSG_LEN_SIZE;
+        msg_len_ = ntohs(msg_len);
+    } else {
+        uint64_t msg_len = 0;
+        auto shift = 0;
+        while (true) {
+            if (buf == buf_end) {
+                msg_len_ = 0;
+                return false;
+            }
+            const auto byte = *buf++;
+            msg_len |= uint64_t(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) {
+                break;
+            }
+            shift += 7;
+            CHECK_LT(shift, 7 * MAX_VARINT_LEN_SIZE) << "bad msg len varint";
+        }
+        CHECK_LE(msg_len, MAX_MSG_LEN) << "msg too big";
+        msg_len_ = msg_len;
+    }
+
+    msg_header_size_ = buf - buf_start;
+
+    VLOG(3) << "got type= " << unsigned(msg_type_)
+            << " len= " << msg_len_
+            << " id= " << msg_id_;
+    return true;
+}
+
 void
-GenericMessageChannel::sendMsg(uint8_t type, uint16_t len,
-                               const uint8_t* data, uint32_t id)
+GenericMessageChannel::_handle_framing_ctl_msg(uint32_t len, const uint8_t* data)
 {
-    VLOG(3) << "sending msg type: " << unsigned(type) << ", len: " << len;
-    _send_header(type, id, len);
+    CHECK_EQ(len, 2) << "bad framing control msg";
+    const auto op = FramingCtlOp(data[0]);
+    // what the peer speaks, capped by what we speak
+    const auto framing = Framing(std::min(data[1], uint8_t(HIGHEST_FRAMING)));
 
-    if (len) {
-        const auto rv = channel_->write(data, len);
-        CHECK_EQ(rv, 0);
+    switch (op) {
+    case FramingCtlOp::HELLO:
+        VLOG(2) << "peer speaks framing up to " << unsigned(data[1]);
+        break;
+    case FramingCtlOp::SWITCH:
+        VLOG(2) << "peer switches to framing " << unsigned(framing);
+        CHECK_EQ(unsigned(framing), unsigned(data[1]))
+            << "peer switches to a framing we don't speak";
+        in_framing_ = framing;
+        break;
+    default:
+        LOG(FATAL) << "bad framing control op " << unsigned(op);
+        break;
     }
+
+    if (out_framing_ == Framing::V0_U16_LEN
+        && framing != Framing::V0_U16_LEN)
+    {
+        _send_framing_ctl_msg(FramingCtlOp::SWITCH, framing);
+        out_framing_ = framing;
+    }
+}
+
+void
+GenericMessageChannel::_send_framing_ctl_msg(FramingCtlOp op, Framing framing)
+{
+    const uint8_t data[2] = {uint8_t(op), uint8_t(framing)};
+    _queue_msg(FRAMING_CTL_MSG_TYPE, 0, sizeof data, data);
+}
+
+void
+GenericMessageChannel::offer_large_msgs()
+{
+    if (offered_large_msgs_ || (out_framing_ != Framing::V0_U16_LEN)) {
+        // nothing new to tell the peer
+        return;
+    }
+    offered_large_msgs_ = true;
+    _send_framing_ctl_msg(FramingCtlOp::HELLO, HIGHEST_FRAMING);
+}
+
+uint32_t
+GenericMessageChannel::max_msg_len() const
+{
+    return (out_framing_ == Framing::V0_U16_LEN) ? 0xffff : MAX_MSG_LEN;
+}
+
+void
+GenericMessageChannel::sendMsg(uint8_t type, uint32_t len,
+                               const uint8_t* data, uint32_t id)
+{
+    VLOG(3) << "sending msg type: " << unsigned(type) << ", len: " << len;
+    CHECK_NE(type, FRAMING_CTL_MSG_TYPE) << "reserved msg type";
+    CHECK_LE(len, max_msg_len()) << "msg too big for the framing";
+    _queue_msg(type, id, len, data);
 }
 
 void
 GenericMessageChannel::sendMsg(uint8_t type, uint32_t id)
 {
-    _send_header(type, id, 0);
+    CHECK_NE(type, FRAMING_CTL_MSG_TYPE) << "reserved msg type";
+    _queue_msg(type, id, 0, nullptr);
 }
 
-/* type and len values should be HOST byte order */
+/* type, id, and len values should be HOST byte order */
 void
-GenericMessageChannel::_send_header(uint8_t type, uint32_t id, uint16_t len)
+GenericMessageChannel::_queue_msg(uint8_t type, uint32_t id, uint32_t len,
+                                  const uint8_t* data)
 {
     static_assert((sizeof type) == MSG_TYPE_SIZE, "bad sizes");
     static_assert((sizeof id) == MSG_ID_SIZE, "bad sizes");
 
-    auto rv = channel_->write((const uint8_t*)&type, sizeof(type));
-    CHECK_EQ(rv, 0);
+    uint8_t header[MSG_TYPE_SIZE + MSG_ID_SIZE + MAX_VARINT_LEN_SIZE];
+    auto p = header;
+
+    memcpy(p, (const uint8_t*)&type, MSG_TYPE_SIZE);
+    p += MSG_TYPE_SIZE;
 
     if (with_msg_id_) {
         id = htonl(id);
-        auto rv = channel_->write((const uint8_t*)&id, sizeof(id));
+        memcpy(p, (const uint8_t*)&id, MSG_ID_SIZE);
+        p += MSG_ID_SIZE;
+    }
+
+    if (out_framing_ == Framing::V0_U16_LEN) {
+        CHECK_LE(len, 0xffff);
+        const uint16_t msg_len = htons(len);
+        memcpy(p, (const uint8_t*)&msg_len, MSG_LEN_SIZE);
+        p += MSG_LEN_SIZE;
+    } else {
+        auto msg_len = len;
+        while (msg_len >= 0x80) {
+            *p++ = uint8_t(msg_len) | 0x80;
+            msg_len >>= 7;
+        }
+        *p++ = uint8_t(msg_len);
+    }
+
+    const size_t header_size = p - header;
+    CHECK_LE(header_size, sizeof header);
+
+    auto rv = evbuffer_add(out_batch_.get(), header, header_size);
+    CHECK_EQ(rv, 0);
+    if (len) {
+        rv = evbuffer_add(out_batch_.get(), data, len);
+        CHECK_EQ(rv, 0);
+    }
+
+    if (!flush_out_batch_timer_
+        || (evbuffer_get_length(out_batch_.get()) >= MAX_OUT_BATCH_SIZE))
+    {
+        _flush_out_batch();
+    } else if (!flush_out_batch_timer_->is_running()) {
+        // a zero timeout fires after the loop has handled the other
+        // events that are ready now, which might send more msgs
+        flush_out_batch_timer_->start(0u);
+    }
+}
+
+void
+GenericMessageChannel::_flush_out_batch()
+{
+    const auto batch_len = evbuffer_get_length(out_batch_.get());
+    if (!batch_len) {
+        return;
+    }
+
+    if ((state_ == StreamState::CLOSED) || channel_->is_closed()) {
+        VLOG(2) << "channel is closed; dropping " << batch_len
+                << " bytes of msgs";
+        auto rv = evbuffer_drain(out_batch_.get(), batch_len);
         CHECK_EQ(rv, 0);
+        return;
     }
 
-    len = htons(len);
-    rv = channel_->write((const uint8_t*)&len, sizeof(len));
+    VLOG(3) << "writing batch of " << batch_len << " bytes";
+    // this moves, not copies, the data
+    const auto rv = channel_->write_buffer(out_batch_.get());
     CHECK_EQ(rv, 0);
 }
 
+void
+GenericMessageChannel::_on_flush_out_batch_timer_fired(Timer*)
+{
+    _flush_out_batch();
+}
+
 void
 GenericMessageChannel::_update_read_watermark()
 {
     if (state_ == StreamState::READ_HEADER) {
         CHECK_EQ(msg_len_, 0);
-        channel_->set_read_watermark(header_size_, 0);
+        // a varint length might turn out to be longer than one byte,
+        // but then we just look again with more bytes
+        channel_->set_read_watermark(
+            header_prefix_size_
+            + ((in_framing_ == Framing::V0_U16_LEN) ? MSG_LEN_SIZE : 1), 0);
     } else {
         CHECK_GT(msg_len_, 0);
-        channel_->set_read_watermark(header_size_ + msg_len_, 0);
+        channel_->set_read_watermark(msg_header_size_ + msg_len_, 0);
     }
 }
 
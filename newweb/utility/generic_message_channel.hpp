@@ -9,6 +9,7 @@
 
 #include "object.hpp"
 #include "stream_channel.hpp"
+#include "timer.hpp"
 
 using myio::StreamChannel;
 
@@ -20,15 +21,46 @@ namespace myio
  *
  * each msg must have:
  *
- * - a header that contains: 2-byte type field and 2-byte len field
- * (both in network byte order). the type field is not interpreted
- * here; its semantic is up to the observer on top of this channel.
+ * - a header that contains: 1-byte type field, 4-byte id field, and
+ * a length field (type and id in network byte order). the type field
+ * is not interpreted here (except for FRAMING_CTL_MSG_TYPE, see
+ * below); its semantic is up to the observer on top of this channel.
  *
  * - the msg payload. the length in bytes of this message string is
- * specified by the 2-byte len field mentioned above.
+ * specified by the length field mentioned above.
+ *
+ * the length field depends on the framing version:
+ *
+ * - version 0, the original: 2 bytes, in network byte order, so a
+ * msg can be at most 64 KB.
+ *
+ * - version 1: a varint (7 bits per byte, least significant group
+ * first, high bit set on all bytes but the last), so a msg can be up
+ * to MAX_MSG_LEN.
+ *
+ * both directions start in version 0. offer_large_msgs() sends a
+ * version 0 HELLO control msg with the highest version we speak. a channel that gets a HELLO (whether it
+ * offered or not) and hasn't switched yet replies with a SWITCH
+ * control msg with the version both speak, and frames everything it
+ * sends after the SWITCH in that version; so does a channel that
+ * gets a SWITCH. each side parses the other's msgs after the SWITCH
+ * in the new version. a channel that gets neither stays in version
+ * 0, so it's the same as before on the wire -- but since older
+ * builds don't know the control msgs, offer large msgs only to peers
+ * of this build or later.
+ *
+ * control msgs use type FRAMING_CTL_MSG_TYPE and are not given to
+ * the observer. use max_msg_len() to know how big a msg we can send.
  *
  * if the length field contains value zero, then a nullptr will be
  * sent up to observer along with the type
+ *
+ * there is no framing beyond that, so a batch of msgs on the wire is
+ * just the msgs back to back: when given an event base, we queue up
+ * the msgs sent during one event loop iteration and hand them to the
+ * underlying channel in one write; and on the receiving side we
+ * dispatch all the complete msgs we have in the input buffer before
+ * draining it once.
  */
 
 class GenericMessageChannel;
@@ -37,9 +69,9 @@ class GenericMessageChannel;
 class GenericMessageChannelObserver
 {
 public:
-    /* "type" is the 2-byte type in the header mentioned above */
+    /* "type" is the 1-byte type in the header mentioned above */
     virtual void onRecvMsg(GenericMessageChannel*, uint8_t type, uint32_t id,
-                           uint16_t len, const uint8_t*) noexcept = 0;
+                           uint32_t len, const uint8_t*) noexcept = 0;
     virtual void onEOF(GenericMessageChannel*) noexcept = 0;
     virtual void onError(GenericMessageChannel*, int errorcode) noexcept = 0;
 };
@@ -62,25 +94,63 @@ public:
      *
      * assumes that the channel is already connected, ready for data
      * exchange, etc. i.e., will not call start_connecting()
+     *
+     * if "evbase" is given, sent msgs are batched (see above);
+     * otherwise each msg is written to the channel right away
      */
     explicit GenericMessageChannel(StreamChannel::UniquePtr,
-                                   GenericMessageChannelObserver*);
+                                   GenericMessageChannelObserver*,
+                                   struct event_base* evbase=nullptr);
 
-    void sendMsg(uint8_t type, uint16_t len, const uint8_t* data,
+    /* "len" must be at most max_msg_len() */
+    void sendMsg(uint8_t type, uint32_t len, const uint8_t* data,
                  uint32_t id=0);
     /* send empty msg, i.e., equivalent to sendMsg(type, 0, nullptr,
      * id) */
     void sendMsg(uint8_t type, uint32_t id=0);
 
+    /* see framing versions above. the peer must be of this build or
+     * later */
+    void offer_large_msgs();
+
+    /* the longest msg we can send now: 64 KB until the peer has
+     * agreed to framing version 1 */
+    uint32_t max_msg_len() const;
+
+    /* reserved for the framing negotiation */
+    static const uint8_t FRAMING_CTL_MSG_TYPE = 0xff;
+
+    /* the longest msg in framing version 1. it's a sanity limit:
+     * the whole msg has to be buffered before it's dispatched */
+    static const uint32_t MAX_MSG_LEN = 16 * 1024 * 1024;
+
 protected:
 
     static const int MSG_TYPE_SIZE = sizeof (uint8_t);
     static const int MSG_ID_SIZE = sizeof (uint32_t);
+    /* the length field of framing version 0 */
     static const int MSG_LEN_SIZE = sizeof (uint16_t);
+    /* the longest varint length field of framing version 1 */
+    static const int MAX_VARINT_LEN_SIZE = 5;
+
+    enum class Framing : uint8_t {
+        V0_U16_LEN = 0,
+        V1_VARINT_LEN = 1,
+    };
+    static const Framing HIGHEST_FRAMING = Framing::V1_VARINT_LEN;
+
+    /* the payload of a control msg is the op and a framing version */
+    enum class FramingCtlOp : uint8_t {
+        HELLO = 1,
+        SWITCH = 2,
+    };
+
+    /* write out the batch right away if it gets this big */
+    static const size_t MAX_OUT_BATCH_SIZE = 64 * 1024;
 
     /* keep the destructor protected/private to prevent direct
      * deletion; use DelayedDestruction's destroy() method */
-    virtual ~GenericMessageChannel() = default;
+    virtual ~GenericMessageChannel();
 
     /********* StreamChannelObserver interface *************/
     virtual void onNewReadDataAvailable(StreamChannel*) noexcept override;
@@ -92,12 +162,27 @@ protected:
 
     void _consume_input();
     void _update_read_watermark();
-    void _send_header(uint8_t type, uint32_t id, uint16_t len);
+    /* parse the header at "buf", which has "len" bytes, into
+     * msg_type_, msg_id_, msg_len_, and msg_header_size_. returns
+     * false if it needs more bytes */
+    bool _parse_header(const uint8_t* buf, size_t len);
+    void _handle_framing_ctl_msg(uint32_t len, const uint8_t* data);
+    void _send_framing_ctl_msg(FramingCtlOp, Framing);
+    void _queue_msg(uint8_t type, uint32_t id, uint32_t len,
+                    const uint8_t* data);
+    void _flush_out_batch();
+    void _on_flush_out_batch_timer_fired(Timer*);
 
     StreamChannel::UniquePtr channel_; // the underlying stream
     GenericMessageChannelObserver* observer_; // dont free
     const bool with_msg_id_;
-    const size_t header_size_;
+    /* of the header without the length field */
+    const size_t header_prefix_size_;
+
+    /* framing of what we send, and of what we receive */
+    Framing out_framing_;
+    Framing in_framing_;
+    bool offered_large_msgs_;
 
     enum class StreamState {
         READ_HEADER, READ_MSG, CLOSED
@@ -107,7 +192,13 @@ protected:
      * optional, depends on whether with_msg_id_ */
     uint8_t msg_type_;
     uint32_t msg_id_;
-    uint16_t msg_len_;
+    uint32_t msg_len_;
+    size_t msg_header_size_;
+
+    /* msgs we have yet to give to the channel */
+    std::unique_ptr<struct evbuffer, void(*)(struct evbuffer*)> out_batch_;
+    /* null if we're not batching */
+    Timer::UniquePtr flush_out_batch_timer_;
 };
 
 
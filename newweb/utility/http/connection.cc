@@ -1,9 +1,10 @@
 
 #include <string.h>
+#include <stdio.h>
+#include <ctype.h>
 #include <algorithm>
 #include <vector>
 
-#include <boost/lexical_cast.hpp>
 
 #include "connection.hpp"
 #include "../easylogging++.h"
@@ -27,7 +28,6 @@ using myio::Socks5ConnectorObserver;
 using myio::StreamChannel;
 using myio::TCPChannel;
 
-using boost::lexical_cast;
 
 
 #define _LOG_PREFIX(inst) << "conn= " << (inst)->objId() << ": "
@@ -67,8 +67,12 @@ Connection::Connection(
     , notify_pushed_body_data_(pushed_body_data_cb)
     , notify_pushed_body_done_(pushed_body_done_cb)
     , spdysess_{nullptr, spdylay_session_del}
+    , http_pipeline_depth_(1)
     , http_rsp_state_(HTTPRespState::HTTP_RSP_STATE_STATUS_LINE)
-    , http_rsp_status_(-1), remaining_resp_body_len_(0)
+    , http_rsp_status_(-1), rsp_parse_pos_(0)
+    , rsp_hdr_(RspHeader::OTHER)
+    , rsp_has_content_length_(false), rsp_is_chunked_(false)
+    , remaining_resp_body_len_(0), remaining_chunk_len_(0)
     , cumulative_num_sent_bytes_(0), cumulative_num_recv_bytes_(0)
 {
     /* ssp acts as an http proxy, only it uses spdy to transport. so
@@ -103,24 +107,24 @@ Connection::_maybe_http_write_to_transport()
 {
     vlogself(2) << "begin";
 
-    if (submitted_req_queue_.empty()) {
-        vlogself(2) << "submit queue is empty -> nothing to do";
-        return;
-    }
-
-    auto const qsize = active_req_queue_.size();
-    vlogself(2) << "active req qsize " << qsize;
-    CHECK_LE(qsize, 1);
-
-    if (qsize > 0) {
-        vlogself(2) << "there's an active req -> can't write to output";
-        return;
+    /* with pipelining, we can have up to http_pipeline_depth_
+     * requests written and waiting for their responses */
+    while (!submitted_req_queue_.empty()
+           && (active_req_queue_.size() < http_pipeline_depth_))
+    {
+        auto req = submitted_req_queue_.front();
+        CHECK_NOTNULL(req);
+        submitted_req_queue_.pop();
+        _http_write_request(req);
     }
 
-    auto req = submitted_req_queue_.front();
-    CHECK_NOTNULL(req);
-    submitted_req_queue_.pop();
+    vlogself(2) << "done, active req qsize " << active_req_queue_.size()
+                << ", submit qsize " << submitted_req_queue_.size();
+}
 
+void
+Connection::_http_write_request(Request* req)
+{
     vlogself(2) << "let's write a pending req, res:" << req->webkit_resInstNum_;
 
     std::unique_ptr<struct evbuffer, void(*)(struct evbuffer*)> buf(
@@ -165,7 +169,10 @@ Connection::_maybe_http_write_to_transport()
 
     active_req_queue_.push(req);
 
-    if (req->exp_resp_meta_size()) {
+    cumulative_num_sent_bytes_ += req->req_total_size();
+    _note_request_sent(req);
+
+    if (req->exp_resp_meta_size() && (active_req_queue_.size() == 1)) {
         // set the read size hint to the approximate expected size of meta
         // info of the response
         transport_->set_read_size_hint(req->exp_resp_meta_size());
@@ -186,8 +193,7 @@ Connection::submit_request(Request* req)
     vlogself(2) << "begin";
 
     if (use_spdy_) {
-        const auto& hdrs = req->get_headers();
-        const char **nv = (const char**)calloc(5*2 + hdrs.size()*2 + 1, sizeof(char*));
+        const char *nv[7*2 + 1];
         size_t hdidx = 0;
         nv[hdidx++] = ":method";
         nv[hdidx++] = "GET";
@@ -196,7 +202,8 @@ Connection::submit_request(Request* req)
         nv[hdidx++] = ":version";
         nv[hdidx++] = "HTTP/1.1";
         nv[hdidx++] = ":host";
-        nv[hdidx++] = req->host_.c_str();
+        // we talk to only the one netloc, so it's also the request's
+        nv[hdidx++] = host_.c_str();
         nv[hdidx++] = ":scheme";
         nv[hdidx++] = "http";
 
@@ -209,14 +216,38 @@ Connection::submit_request(Request* req)
         nv[hdidx++] = common::http::resp_body_size_name;
         nv[hdidx++] = resp_body_size_val_str.c_str();
 
-        CHECK(0) << "to implement!";
-
         nv[hdidx++] = nullptr;
+        DCHECK_EQ(hdidx, (sizeof nv / sizeof nv[0]));
+
+        /* like the http path, the request should take up
+         * req_total_size() bytes on the wire, so whatever the
+         * (uncompressed) headers don't use we send as a dummy
+         * request body
+         */
+        size_t hdrs_size = 0;
+        for (size_t i = 0; nv[i]; ++i) {
+            hdrs_size += strlen(nv[i]);
+        }
+        const auto req_body_len = (req->req_total_size() > hdrs_size)
+                                  ? (req->req_total_size() - hdrs_size)
+                                  : 0;
+        vlogself(2) << "spdy req body len= " << req_body_len;
+
+        spdylay_data_provider data_provider;
+        bzero(&data_provider, sizeof data_provider);
+        data_provider.read_callback = s_spdylay_data_read_cb;
 
         /* spdylay_submit_request() will make copies of nv */
-        int rv = spdylay_submit_request(spdysess_.get(), 0, nv, nullptr, req);
+        int rv = spdylay_submit_request(
+            spdysess_.get(), 0, nv,
+            req_body_len ? &data_provider : nullptr, req);
         CHECK_EQ(rv, 0);
-        free(nv);
+
+        /* the stream id is assigned only when the SYN_STREAM is about
+         * to be sent; until then the req waits in the submitted
+         * queue */
+        submitted_req_queue_.push(req);
+        spdy_req_body_lens_[req] = req_body_len;
     } else {
         submitted_req_queue_.push(req);
     }
@@ -227,6 +258,8 @@ Connection::submit_request(Request* req)
 
     req->conn = this;
 
+    _update_idle_period();
+
     vlogself(2) << "done";
     return 0;
 }
@@ -242,6 +275,13 @@ Connection::~Connection()
 std::queue<Request*>
 Connection::get_active_request_queue() const
 {
+    if (use_spdy_) {
+        std::queue<Request*> reqs;
+        for (const auto& kv : sid2req_) {
+            reqs.push(kv.second);
+        }
+        return reqs;
+    }
     return active_req_queue_;
 }
 
@@ -257,18 +297,24 @@ Connection::set_request_done_cb(ConnectionRequestDoneCb cb)
     notify_request_done_cb_ = cb;
 }
 
+void
+Connection::set_http_pipeline_depth(const uint8_t depth)
+{
+    CHECK_GT(depth, 0);
+    CHECK(!use_spdy_) << "spdy doesn't need pipelining";
+    http_pipeline_depth_ = depth;
+
+    if (state_ == State::CONNECTED) {
+        _maybe_http_write_to_transport();
+    }
+}
+
 bool
 Connection::is_idle() const {
     if (state_ == State::CONNECTED) {
-        if (use_spdy_) {
-            return (!spdylay_session_want_read(spdysess_.get())
-                    && !spdylay_session_want_write(spdysess_.get()));
-        } else {
-            const int subqsize = submitted_req_queue_.size();
-            const int activeqsize = active_req_queue_.size();
-            vlogself(2) << subqsize << ", " << activeqsize;
-            return (!subqsize && !activeqsize);
-        }
+        /* the spdy session always wants to read, so we can't use
+         * spdylay_session_want_read/write() */
+        return get_queue_size() == 0;
     }
     return false;
 }
@@ -290,9 +336,83 @@ Connection::disconnect()
                         // Connection's destructor
 
     state_ = State::NO_LONGER_USABLE;
+
+    if (!timestamps_.closed) {
+        timestamps_.closed = common::gettimeofdayMs(nullptr);
+        _update_idle_period();
+        _log_timestamps();
+    }
+
     vlogself(2) << "done";
 }
 
+void
+Connection::_note_request_sent(Request* req)
+{
+    const auto now = common::gettimeofdayMs(nullptr);
+
+    if (!timestamps_.first_req_sent) {
+        timestamps_.first_req_sent = now;
+    }
+    ++timestamps_.num_reqs_sent;
+
+    /* how much of the request's wait was for us to connect */
+    const auto ready = (socks5_addr_ && socks5_port_)
+                       ? timestamps_.socks_done : timestamps_.connected;
+    const auto wait_start = std::max(req->submit_time_ms(),
+                                     timestamps_.connect_start);
+    const uint32_t connect_wait_ms =
+        (req->submit_time_ms() && (ready > wait_start)) ? (ready - wait_start) : 0;
+
+    req->note_sent(objId(), now, connect_wait_ms);
+}
+
+void
+Connection::_note_bytes_recv(const size_t len)
+{
+    const bool is_first = (cumulative_num_recv_bytes_ == 0);
+    cumulative_num_recv_bytes_ += len;
+
+    if (is_first && len) {
+        timestamps_.first_byte_recv = common::gettimeofdayMs(nullptr);
+        if (cnx_first_recv_byte_cb_) {
+            cnx_first_recv_byte_cb_(this);
+        }
+    }
+}
+
+void
+Connection::_update_idle_period()
+{
+    const bool idle = is_idle();
+    if (idle && !timestamps_.idle_since) {
+        timestamps_.idle_since = common::gettimeofdayMs(nullptr);
+    } else if (!idle && timestamps_.idle_since) {
+        timestamps_.total_idle_ms +=
+            common::gettimeofdayMs(nullptr) - timestamps_.idle_since;
+        ++timestamps_.num_idle_periods;
+        timestamps_.idle_since = 0;
+    }
+}
+
+void
+Connection::_log_timestamps() const
+{
+    const auto& ts = timestamps_;
+    logself(INFO) << "cnxTimestamps= [" << host_ << "]:" << port_
+                  << " connectStart= " << ts.connect_start
+                  << " socksDone= " << ts.socks_done
+                  << " connected= " << ts.connected
+                  << " firstReqSent= " << ts.first_req_sent
+                  << " firstByte= " << ts.first_byte_recv
+                  << " closed= " << ts.closed
+                  << " numIdlePeriods= " << ts.num_idle_periods
+                  << " idleMs= " << ts.total_idle_ms
+                  << " numReqs= " << ts.num_reqs_sent
+                  << " txBytes= " << cumulative_num_sent_bytes_
+                  << " rxBytes= " << cumulative_num_recv_bytes_;
+}
+
 void
 Connection::_maybe_http_consume_input()
 {
@@ -301,7 +421,9 @@ Connection::_maybe_http_consume_input()
     CHECK(!active_req_queue_.empty())
         << "server sends us data when we have no active req waiting to be received";
 
-    char *line = nullptr;
+    /* the request callbacks we notify might close us */
+    DestructorGuard dg(this);
+
     bool keep_consuming = true;
 
     // don't free this inbuf
@@ -315,183 +437,69 @@ Connection::_maybe_http_consume_input()
         return;
     }
 
-    /*
-     * our use of evbuffer_readln() might be sub-optimal if data comes
-     * slowly, e.g., extreme case is one byte at a time, and thus the
-     * stream will notify us on every byte and we try readln() every
-     * time from begining of inputbuf. in that case, it would be best
-     * to:
-     *
-     * (1) set read low-water mark (but could be a problem if we set
-     * too high and input buf never reaches and we don't get notified
-     * --> would either need to set conservative value or need some
-     * kind of timeout mechanism); and/or
-     *
-     * (2) remember where in the input buf we stopped searching, so
-     * that next time we can start from where we left off instead of
-     * from beginning of input buf (would use evbuffer_search_eol(),
-     * which is what evbuffer_readln()).
-     *
-     */
-
     do {
-        line = nullptr;
         switch (http_rsp_state_) {
-        case HTTPRespState::HTTP_RSP_STATE_STATUS_LINE: {
-            /* readln() DOES drain the buffer if it returns a line */
-
-            if (evbuffer_get_length(inbuf) > 0) {
-                Request *req = active_req_queue_.front();
-                CHECK_NOTNULL(req);
-
-                req->notify_rsp_meta_bytes_recv();
-            }
-
-            size_t line_len = 0;
-            line = evbuffer_readln(
-                inbuf, &line_len, EVBUFFER_EOL_CRLF_STRICT);
-            if (line) {
-                vlogself(2) << "got status line: [" << line << "]";
-
-                CHECK_EQ(line_len, common::http::resp_status_line_len);
-                DCHECK(!strcmp(line, common::http::resp_status_line));
-
-                http_rsp_state_ = HTTPRespState::HTTP_RSP_STATE_HEADERS;
-                free(line);
-                line = nullptr;
-            } else {
-                // not enough input data to find whole status line
-                keep_consuming = false;
-            }
-
-            break; // out of switch
-        }
-
-        case HTTPRespState::HTTP_RSP_STATE_HEADERS: {
-            vlogself(2) << "try to get response headers";
-            size_t line_len = 0;
-            while (nullptr != (line = evbuffer_readln(
-                                   inbuf, &line_len, EVBUFFER_EOL_CRLF_STRICT)))
-            {
-                /* a header line is assumped to be:
-
-                   <name>: <value>
-
-                   the "line" returned by evbuffer_readln() needs to be
-                   freed, but we avoid allocating more memory by having
-                   our name and value pointers point to the same
-                   "line". so when we free, only free the name pointers.
-                */
-                if (line[0] == '\0') {
-                    // the end of headers, so we notify user of
-                    // response meta info and then maybe move to next
-                    // state to read body
-
-                    free(line);
-                    line = nullptr;
-
-                    CHECK_GE(remaining_resp_body_len_, 0);
-                    CHECK(0 == (rsp_hdrs_.size() % 2));
-
-                    // notify user of response meta info
-
-                    char **nv = (char**)malloc((rsp_hdrs_.size() + 1) * sizeof (char*));
-                    int j = 0;
-                    for (; j < rsp_hdrs_.size(); ++j) {
-                        nv[j] = rsp_hdrs_[j];
-                        dvlogself(2) << "nv[" << j << "] = [" << nv[j] << "]";
-                    }
-                    nv[j] = nullptr; /* null sentinel */
-                    Request *req = active_req_queue_.front();
-                    req->notify_rsp_meta(200, nv);
-                    free(nv);
-                    for (int i = 0; i < rsp_hdrs_.size(); i += 2) {
-                        free(rsp_hdrs_[i]);
-                    }
-                    rsp_hdrs_.clear();
-
-                    // what's next?
-                    if (remaining_resp_body_len_ > 0) {
-                        // there's a req body we need to consume
-                        http_rsp_state_ = HTTPRespState::HTTP_RSP_STATE_BODY;
-                    } else {
-                        vlogself(2) << "no response body";
-                        _done_with_resp();
-                    }
-
-                    break; // out of while loop trying to read header lines
-                } else {
-                    dvlogself(2) << "whole rsp hdr line: [" << line << "]";
-                    // XXX/TODO: expect all lower case
-                    char *tmp = strchr(line, ':');
-                    CHECK(tmp);
-                    rsp_hdrs_.push_back(line);
-                    *tmp = '\0'; /* colon becomes NULL */
-                    ++tmp;
-                    *tmp = '\0'; /* blank space becomes NULL */
-                    ++tmp;
-                    rsp_hdrs_.push_back(tmp);
-
-                    const auto name_str = line;
-                    const auto value_str = tmp;
-
-                    vlogself(2) << "rsp hdr name: [" << name_str << "]";
-
-                    if (!strcasecmp(name_str, common::http::content_length_name)) {
-                        try {
-                            remaining_resp_body_len_ = lexical_cast<size_t>(value_str);
-                        } catch (const boost::bad_lexical_cast&) {
-                            logself(FATAL) << "bad header value: " << value_str;
-                        }
-
-                        vlogself(2) << "body content length: " << remaining_resp_body_len_;
-                    }
-                    // DO NOT free line. because it's in the rsp_hdrs_;
-                    line = nullptr;
-                    // done processing one header line
-                }
-            } // end while loop
-
-            CHECK(!line);
-            if (http_rsp_state_ == HTTPRespState::HTTP_RSP_STATE_HEADERS) {
-                // if we're still trying to get more headers, that
-                // means there was not enough input
-                keep_consuming = false;
-            }
-            break; // out of switch
+        case HTTPRespState::HTTP_RSP_STATE_BODY_UNTIL_EOF: {
+            /* everything up to eof is body; onEOF() finishes the
+             * response */
+            const auto buflen = evbuffer_get_length(inbuf);
+            vlogself(2) << "get rsp body until eof, " << buflen << " bytes";
+            auto rv = evbuffer_drain(inbuf, buflen);
+            CHECK_EQ(rv, 0);
+            _note_bytes_recv(buflen);
+            _got_a_chunk_of_resp_body(buflen);
+            keep_consuming = false;
+            break;
         }
 
-        case HTTPRespState::HTTP_RSP_STATE_BODY: {
-            CHECK(remaining_resp_body_len_ > 0);
-            vlogself(2) << "get rsp body, remaining_resp_body_len_ "
-                        << remaining_resp_body_len_;
+        case HTTPRespState::HTTP_RSP_STATE_BODY:
+        case HTTPRespState::HTTP_RSP_STATE_CHUNK_DATA: {
+            /* body bytes, either up to the content-length or the end
+             * of the current chunk. we don't look at them: drain
+             * what's buffered and have the channel drop the rest as
+             * it comes in */
+            const bool is_chunk =
+                (http_rsp_state_ == HTTPRespState::HTTP_RSP_STATE_CHUNK_DATA);
+            const auto& remaining =
+                is_chunk ? remaining_chunk_len_ : remaining_resp_body_len_;
+            CHECK(remaining > 0);
+            vlogself(2) << "get rsp body, remaining " << remaining
+                        << (is_chunk ? " in chunk" : "");
 
             const auto current_req = active_req_queue_.front();
             CHECK_NOTNULL(current_req);
             const auto current_req_objId = current_req->objId();
 
             const auto buflen = evbuffer_get_length(inbuf);
-            const auto drain_len = std::min(buflen, remaining_resp_body_len_);
-            vlogself(2) << buflen << ", " << remaining_resp_body_len_ << ", "
+            const auto drain_len = std::min(buflen, remaining);
+            vlogself(2) << buflen << ", " << remaining << ", "
                         << drain_len;
             if (drain_len > 0) {
                 auto rv = evbuffer_drain(inbuf, drain_len);
                 CHECK_EQ(rv, 0);
+                _note_bytes_recv(drain_len);
                 _got_a_chunk_of_resp_body(drain_len);
             }
 
-            if (remaining_resp_body_len_ > 0) {
+            if (!transport_) {
+                // the callbacks closed us
+                keep_consuming = false;
+            } else if (remaining > 0) {
                 CHECK_EQ(drain_len, buflen);
                 CHECK_EQ(evbuffer_get_length(inbuf), 0);
                 keep_consuming = false;
                 vlogself(2) << "tell channel to drop "
-                            << remaining_resp_body_len_ << " future bytes";
-                transport_->drop_future_input(
-                    this, remaining_resp_body_len_, true);
+                            << remaining << " future bytes";
+                transport_->drop_future_input(this, remaining, true);
+            } else if (is_chunk) {
+                // on to the chunk's trailing crlf
+                if (evbuffer_get_length(inbuf) == 0) {
+                    keep_consuming = false;
+                }
             } else {
-                // have fully received resp body
-                /* no pipelining, so input buf should also be empty */
-                CHECK_EQ(evbuffer_get_length(inbuf), 0);
+                // have fully received resp body. with pipelining,
+                // the input buf might have (the start of) the next
+                // response
                 vlogself(2) << "fully received resp body";
 
                 /* don't call _done_with_resp() because
@@ -523,18 +531,356 @@ Connection::_maybe_http_consume_input()
                     const auto req_ObjId = current_req->objId();
                     CHECK_NE(req_ObjId, current_req_objId);
                 }
+
+                if (evbuffer_get_length(inbuf) == 0) {
+                    keep_consuming = false;
+                }
             }
 
             break;
         }
+
+        default: {
+            /* the response head, or the chunked body's framing. we
+             * scan the contiguous bytes at the front of the inbuf,
+             * and drain what we've scanned; the parser state is in
+             * our members, so when more input arrives we resume where
+             * we left off, instead of rescanning lines from the
+             * beginning
+             */
+            struct evbuffer_iovec vec;
+            const auto num_vecs = evbuffer_peek(inbuf, -1, nullptr, &vec, 1);
+            if (num_vecs < 1 || vec.iov_len == 0) {
+                keep_consuming = false;
+                break; // out of switch
+            }
+
+            if (http_rsp_state_ == HTTPRespState::HTTP_RSP_STATE_STATUS_LINE
+                && rsp_parse_pos_ == 0)
+            {
+                CHECK(!active_req_queue_.empty())
+                    << "server sends us data when we have no active req waiting to be received";
+                Request *req = active_req_queue_.front();
+                CHECK_NOTNULL(req);
+
+                req->notify_rsp_meta_bytes_recv();
+                if (notify_request_first_byte_cb_) {
+                    notify_request_first_byte_cb_(this, req);
+                }
+            }
+
+            RspParseEvent event = RspParseEvent::NONE;
+            const auto num_scanned = _http_parse_rsp_framing(
+                (const char*)vec.iov_base, vec.iov_len, event);
+            auto rv = evbuffer_drain(inbuf, num_scanned);
+            CHECK_EQ(rv, 0);
+            _note_bytes_recv(num_scanned);
+
+            switch (event) {
+            case RspParseEvent::NONE:
+                CHECK_EQ(num_scanned, vec.iov_len);
+                if (evbuffer_get_length(inbuf) == 0) {
+                    // not enough input yet
+                    keep_consuming = false;
+                }
+                break;
+            case RspParseEvent::HEAD_DONE:
+                _http_on_rsp_head_done();
+                break;
+            case RspParseEvent::CHUNK_DATA:
+                // even if the inbuf is now empty, go on to the chunk
+                // data state, so it can tell the channel to drop the
+                // chunk
+                break;
+            case RspParseEvent::CHUNKED_BODY_DONE:
+                vlogself(2) << "fully received chunked resp body";
+                _done_with_resp();
+                break;
+            }
+
+            break; // out of switch
+        }
+        }
+    } while (keep_consuming && transport_);
+
+    return;
+}
+
+size_t
+Connection::_http_parse_rsp_framing(const char* buf, const size_t len,
+                                    RspParseEvent& event)
+{
+    /* we expect the head to be:
+
+       <status line>\r\n
+       <name>: <value>\r\n
+       ...
+       \r\n
+
+       and only care about the content-length header, whose value we
+       accumulate into remaining_resp_body_len_ as its digits go by,
+       and whether transfer-encoding is chunked. with neither, the
+       body runs until the server closes the connection.
+
+       a chunked body is:
+
+       <hex size>[;<extensions>]\r\n
+       <size bytes>\r\n
+       ...
+       0\r\n
+       [<trailer line>\r\n ...]
+       \r\n
+    */
+
+    static const char chunked_value[] = "chunked";
+    static const size_t chunked_value_len = sizeof (chunked_value) - 1;
+
+    event = RspParseEvent::NONE;
+
+    size_t i = 0;
+    for (; i < len && event == RspParseEvent::NONE; ++i) {
+        const char c = buf[i];
+
+        switch (http_rsp_state_) {
+        case HTTPRespState::HTTP_RSP_STATE_STATUS_LINE:
+            if (rsp_parse_pos_ < common::http::resp_status_line_len) {
+                CHECK_EQ(c, common::http::resp_status_line[rsp_parse_pos_])
+                    << "unexpected status line";
+                ++rsp_parse_pos_;
+            } else {
+                CHECK_EQ(c, '\r') << "unexpected status line";
+                http_rsp_state_ = HTTPRespState::HTTP_RSP_STATE_STATUS_LINE_LF;
+            }
+            break;
+
+        case HTTPRespState::HTTP_RSP_STATE_STATUS_LINE_LF:
+        case HTTPRespState::HTTP_RSP_STATE_HEADER_LF:
+            CHECK_EQ(c, '\n');
+            vlogself(2) << "start of a header line";
+            http_rsp_state_ = HTTPRespState::HTTP_RSP_STATE_HEADER_NAME;
+            rsp_parse_pos_ = 0;
+            rsp_hdr_ = RspHeader::OTHER;
+            break;
+
+        case HTTPRespState::HTTP_RSP_STATE_HEADER_NAME:
+            if (c == ':') {
+                CHECK_GT(rsp_parse_pos_, 0) << "empty header name";
+                if (rsp_parse_pos_ != strlen(_rsp_header_name(rsp_hdr_))) {
+                    // only a prefix matched
+                    rsp_hdr_ = RspHeader::OTHER;
+                }
+                if (rsp_hdr_ == RspHeader::CONTENT_LENGTH) {
+                    rsp_has_content_length_ = true;
+                    remaining_resp_body_len_ = 0;
+                }
+                rsp_parse_pos_ = 0;
+                http_rsp_state_ = HTTPRespState::HTTP_RSP_STATE_HEADER_VALUE;
+            } else if (c == '\r') {
+                CHECK_EQ(rsp_parse_pos_, 0) << "header line without colon";
+                http_rsp_state_ = HTTPRespState::HTTP_RSP_STATE_HEADERS_END_LF;
+            } else {
+                const char lc = tolower(c);
+                if (rsp_parse_pos_ == 0) {
+                    // pick the header it might be by the first char
+                    if (lc == common::http::content_length_name[0]) {
+                        rsp_hdr_ = RspHeader::CONTENT_LENGTH;
+                    } else if (lc == common::http::transfer_encoding_name[0]) {
+                        rsp_hdr_ = RspHeader::TRANSFER_ENCODING;
+                    }
+                } else if (rsp_hdr_ != RspHeader::OTHER) {
+                    const char* name = _rsp_header_name(rsp_hdr_);
+                    if (rsp_parse_pos_ >= strlen(name)
+                        || lc != name[rsp_parse_pos_])
+                    {
+                        rsp_hdr_ = RspHeader::OTHER;
+                    }
+                }
+                ++rsp_parse_pos_;
+            }
+            break;
+
+        case HTTPRespState::HTTP_RSP_STATE_HEADER_VALUE:
+            if (c == '\r') {
+                if (rsp_hdr_ == RspHeader::CONTENT_LENGTH) {
+                    vlogself(2) << "body content length: " << remaining_resp_body_len_;
+                } else if (rsp_hdr_ == RspHeader::TRANSFER_ENCODING) {
+                    CHECK_EQ(rsp_parse_pos_, chunked_value_len)
+                        << "unsupported transfer-encoding";
+                    vlogself(2) << "body is chunked";
+                    rsp_is_chunked_ = true;
+                }
+                http_rsp_state_ = HTTPRespState::HTTP_RSP_STATE_HEADER_LF;
+            } else if (c == ' ') {
+                // ignore
+            } else if (rsp_hdr_ == RspHeader::CONTENT_LENGTH) {
+                if (!isdigit(c)) {
+                    logself(FATAL) << "bad content-length value char: " << c;
+                }
+                remaining_resp_body_len_ =
+                    (remaining_resp_body_len_ * 10) + (c - '0');
+            } else if (rsp_hdr_ == RspHeader::TRANSFER_ENCODING) {
+                CHECK(rsp_parse_pos_ < chunked_value_len
+                      && tolower(c) == chunked_value[rsp_parse_pos_])
+                    << "unsupported transfer-encoding";
+                ++rsp_parse_pos_;
+            }
+            break;
+
+        case HTTPRespState::HTTP_RSP_STATE_HEADERS_END_LF:
+            CHECK_EQ(c, '\n');
+            event = RspParseEvent::HEAD_DONE;
+            break;
+
+        case HTTPRespState::HTTP_RSP_STATE_CHUNK_SIZE:
+            if (isxdigit(c)) {
+                // 15 hex digits is plenty
+                CHECK_LT(rsp_parse_pos_, 15) << "chunk size too big";
+                remaining_chunk_len_ =
+                    (remaining_chunk_len_ << 4)
+                    | (isdigit(c) ? (c - '0') : (tolower(c) - 'a' + 10));
+                ++rsp_parse_pos_;
+            } else {
+                CHECK_GT(rsp_parse_pos_, 0) << "missing chunk size";
+                if (c == '\r') {
+                    http_rsp_state_ = HTTPRespState::HTTP_RSP_STATE_CHUNK_SIZE_LF;
+                } else {
+                    // chunk extensions, or whitespace before them
+                    CHECK(c == ';' || c == ' ' || c == '\t')
+                        << "bad chunk size char: " << c;
+                    http_rsp_state_ = HTTPRespState::HTTP_RSP_STATE_CHUNK_EXT;
+                }
+            }
+            break;
+
+        case HTTPRespState::HTTP_RSP_STATE_CHUNK_EXT:
+            if (c == '\r') {
+                http_rsp_state_ = HTTPRespState::HTTP_RSP_STATE_CHUNK_SIZE_LF;
+            }
+            break;
+
+        case HTTPRespState::HTTP_RSP_STATE_CHUNK_SIZE_LF:
+            CHECK_EQ(c, '\n');
+            vlogself(2) << "chunk size: " << remaining_chunk_len_;
+            if (remaining_chunk_len_ > 0) {
+                http_rsp_state_ = HTTPRespState::HTTP_RSP_STATE_CHUNK_DATA;
+                event = RspParseEvent::CHUNK_DATA;
+            } else {
+                // the last chunk
+                http_rsp_state_ = HTTPRespState::HTTP_RSP_STATE_TRAILER;
+            }
+            break;
+
+        case HTTPRespState::HTTP_RSP_STATE_CHUNK_DATA_CR:
+            CHECK_EQ(c, '\r');
+            http_rsp_state_ = HTTPRespState::HTTP_RSP_STATE_CHUNK_DATA_LF;
+            break;
+
+        case HTTPRespState::HTTP_RSP_STATE_CHUNK_DATA_LF:
+            CHECK_EQ(c, '\n');
+            http_rsp_state_ = HTTPRespState::HTTP_RSP_STATE_CHUNK_SIZE;
+            rsp_parse_pos_ = 0;
+            break;
+
+        case HTTPRespState::HTTP_RSP_STATE_TRAILER:
+            // start of a trailer line, or the end of the body
+            http_rsp_state_ = (c == '\r')
+                              ? HTTPRespState::HTTP_RSP_STATE_TRAILER_END_LF
+                              : HTTPRespState::HTTP_RSP_STATE_TRAILER_LINE;
+            break;
+
+        case HTTPRespState::HTTP_RSP_STATE_TRAILER_LINE:
+            if (c == '\r') {
+                http_rsp_state_ = HTTPRespState::HTTP_RSP_STATE_TRAILER_LF;
+            }
+            break;
+
+        case HTTPRespState::HTTP_RSP_STATE_TRAILER_LF:
+            CHECK_EQ(c, '\n');
+            http_rsp_state_ = HTTPRespState::HTTP_RSP_STATE_TRAILER;
+            break;
+
+        case HTTPRespState::HTTP_RSP_STATE_TRAILER_END_LF:
+            CHECK_EQ(c, '\n');
+            event = RspParseEvent::CHUNKED_BODY_DONE;
+            break;
+
         default:
             logself(FATAL) << "invalid http_rsp_state_: "
-                       << common::as_integer(http_rsp_state_);
+                           << common::as_integer(http_rsp_state_);
             break;
         }
-    } while (keep_consuming);
+    }
 
-    return;
+    return i;
+}
+
+const char*
+Connection::_rsp_header_name(const RspHeader hdr)
+{
+    switch (hdr) {
+    case RspHeader::CONTENT_LENGTH:
+        return common::http::content_length_name;
+    case RspHeader::TRANSFER_ENCODING:
+        return common::http::transfer_encoding_name;
+    default:
+        return "";
+    }
+}
+
+void
+Connection::_http_on_rsp_head_done()
+{
+    vlogself(2) << "end of response head";
+
+    DestructorGuard dg(this);
+
+    rsp_parse_pos_ = 0;
+
+    if (rsp_is_chunked_) {
+        // the chunks, not any content-length, tell the body length
+        remaining_resp_body_len_ = 0;
+    }
+
+    // notify user of response meta info. the only header we pass
+    // along is the content-length (if the server sent one), formatted into
+    // our member buffer so we don't allocate
+    snprintf(rsp_content_length_str_, sizeof rsp_content_length_str_,
+             "%zu", remaining_resp_body_len_);
+    char* nv[] = {
+        const_cast<char*>(common::http::content_length_name),
+        rsp_content_length_str_,
+        nullptr, /* null sentinel */
+    };
+    if (rsp_is_chunked_ || !rsp_has_content_length_) {
+        nv[0] = nullptr;
+    }
+
+    // what's next? set the state before notifying, in case the
+    // callback closes us
+    if (rsp_is_chunked_) {
+        http_rsp_state_ = HTTPRespState::HTTP_RSP_STATE_CHUNK_SIZE;
+        remaining_chunk_len_ = 0;
+    } else if (!rsp_has_content_length_) {
+        // take whatever the server sends until it closes
+        vlogself(2) << "no content-length; read body until eof";
+        http_rsp_state_ = HTTPRespState::HTTP_RSP_STATE_BODY_UNTIL_EOF;
+    } else if (remaining_resp_body_len_ > 0) {
+        // there's a resp body we need to consume
+        http_rsp_state_ = HTTPRespState::HTTP_RSP_STATE_BODY;
+    } else {
+        http_rsp_state_ = HTTPRespState::HTTP_RSP_STATE_STATUS_LINE;
+    }
+    const bool no_body =
+        (http_rsp_state_ == HTTPRespState::HTTP_RSP_STATE_STATUS_LINE);
+
+    CHECK(!active_req_queue_.empty());
+    Request *req = active_req_queue_.front();
+    req->notify_rsp_meta(200, nv);
+
+    if (no_body) {
+        vlogself(2) << "no response body";
+        _done_with_resp();
+    }
 }
 
 void
@@ -542,6 +888,7 @@ Connection::onInputBytesDropped(StreamChannel* ch, size_t len) noexcept
 {
     vlogself(2) << "begin, len= " << len;
     CHECK_EQ(transport_.get(), ch);
+    _note_bytes_recv(len);
     _got_a_chunk_of_resp_body(len);
     vlogself(2) << "done";
 }
@@ -550,17 +897,30 @@ void
 Connection::_got_a_chunk_of_resp_body(size_t len)
 {
     vlogself(2) << "begin, len: " << len;
-    CHECK_GE(remaining_resp_body_len_, len);
-    remaining_resp_body_len_ -= len;
+    if (rsp_is_chunked_) {
+        CHECK_EQ(http_rsp_state_, HTTPRespState::HTTP_RSP_STATE_CHUNK_DATA);
+        CHECK_GE(remaining_chunk_len_, len);
+        remaining_chunk_len_ -= len;
+        if (remaining_chunk_len_ == 0) {
+            // the parser takes it from here
+            http_rsp_state_ = HTTPRespState::HTTP_RSP_STATE_CHUNK_DATA_CR;
+        }
+    } else if (http_rsp_state_ != HTTPRespState::HTTP_RSP_STATE_BODY_UNTIL_EOF) {
+        CHECK_GE(remaining_resp_body_len_, len);
+        remaining_resp_body_len_ -= len;
+    }
 
     DestructorGuard dg(this);
 
     vlogself(2) << "notify request of recv'ed resp body chunk"
-                << ", remaining_resp_body_len_= " << remaining_resp_body_len_;
+                << ", remaining_resp_body_len_= " << remaining_resp_body_len_
+                << ", remaining_chunk_len_= " << remaining_chunk_len_;
     Request *req = active_req_queue_.front();
     req->notify_rsp_body_data(nullptr, len);
 
-    if (remaining_resp_body_len_ == 0) {
+    if (http_rsp_state_ == HTTPRespState::HTTP_RSP_STATE_BODY
+        && remaining_resp_body_len_ == 0)
+    {
         vlogself(2) << "notify request we're done receving resp body";
         _done_with_resp();
     }
@@ -582,12 +942,13 @@ Connection::_done_with_resp()
     /* remove req from active queue before notifying */
     active_req_queue_.pop();
 
-    CHECK(active_req_queue_.empty());
-
     DestructorGuard dg(this);
     req->notify_rsp_done();
 
     http_rsp_state_ = HTTPRespState::HTTP_RSP_STATE_STATUS_LINE;
+    rsp_has_content_length_ = false;
+    rsp_is_chunked_ = false;
+    rsp_parse_pos_ = 0;
     if (!notify_request_done_cb_.empty()) {
         notify_request_done_cb_(this, req);
     }
@@ -595,7 +956,10 @@ Connection::_done_with_resp()
      * able move some into the active queue, now that we just
      * cleared some space in the active queue
      */
-    _maybe_http_write_to_transport();
+    if (state_ == State::CONNECTED) {
+        _maybe_http_write_to_transport();
+    }
+    _update_idle_period();
 
     vlogself(2) << "done";
 }
@@ -652,6 +1016,15 @@ void
 Connection::onEOF(StreamChannel*) noexcept
 {
     DestructorGuard dg(this);
+
+    if (http_rsp_state_ == HTTPRespState::HTTP_RSP_STATE_BODY_UNTIL_EOF) {
+        vlogself(2) << "eof ends the resp body";
+        /* the connection is done for, so don't let finishing this
+         * response send more requests on it */
+        state_ = State::NO_LONGER_USABLE;
+        _done_with_resp();
+    }
+
     cnx_eof_cb_(this);
 }
 
@@ -681,12 +1054,14 @@ Connection::onSocksTargetConnectResult(
 
         vlogself(2) << "connected to target (thru socks proxy)";
         state_ = State::CONNECTED;
+        timestamps_.socks_done = common::gettimeofdayMs(nullptr);
 
         // need to set ourselves as observer again because
         // socks5connector overtook us
         transport_->set_observer(this);
 
         _maybe_send();
+        _update_idle_period();
 
         break;
     }
@@ -714,6 +1089,7 @@ Connection::onConnected(StreamChannel* ch) noexcept
 
         CHECK_EQ(transport_.get(), ch);
         state_ = State::PROXY_CONNECTED;
+        timestamps_.connected = common::gettimeofdayMs(nullptr);
 
         const auto& host = (!ssp_host_.empty()) ? ssp_host_ : host_;
         const uint16_t port = (!ssp_host_.empty()) ? ssp_port_ : port_;
@@ -747,7 +1123,9 @@ Connection::onConnected(StreamChannel* ch) noexcept
     else if (state_ == State::CONNECTING) {
         vlogself(2) << "connected to target";
         state_ = State::CONNECTED;
+        timestamps_.connected = common::gettimeofdayMs(nullptr);
         _maybe_send();
+        _update_idle_period();
     }
     else {
         logself(FATAL) << "invalid state";
@@ -775,6 +1153,8 @@ Connection::initiate_connection()
 
     vlogself(2) << "socks5 " << socks5_addr_ << ":" << socks5_port_;
 
+    timestamps_.connect_start = common::gettimeofdayMs(nullptr);
+
     if (state_ == State::DISCONNECTED && socks5_addr_ && socks5_port_) {
         vlogself(2) << "first, connect to socks proxy";
 
@@ -853,6 +1233,11 @@ Connection::spdylay_send_cb(spdylay_session *session, const uint8_t *data,
 
     ssize_t retval = SPDYLAY_ERR_CALLBACK_FAILURE;
 
+    if (!transport_) {
+        // we disconnected inside one of the session's callbacks
+        return retval;
+    }
+
     const auto rv = transport_->write(data, length);
     if (rv == 0) {
         cumulative_num_sent_bytes_ += length;
@@ -880,6 +1265,11 @@ Connection::spdylay_recv_cb(spdylay_session *session, uint8_t *buf,
 
     ssize_t retval = SPDYLAY_ERR_CALLBACK_FAILURE;
 
+    if (!transport_) {
+        // we disconnected inside one of the session's callbacks
+        return SPDYLAY_ERR_EOF;
+    }
+
     const auto numread = transport_->read(buf, length);
 
     if (numread == 0) {
@@ -891,12 +1281,7 @@ Connection::spdylay_recv_cb(spdylay_session *session, uint8_t *buf,
     else if (numread > 0) {
         vlogself(2) << "able to read " << numread << " bytes";
         retval = numread;
-        if (0 == cumulative_num_recv_bytes_
-            && cnx_first_recv_byte_cb_)
-        {
-            cnx_first_recv_byte_cb_(this);
-        }
-        cumulative_num_recv_bytes_ += numread;
+        _note_bytes_recv(numread);
     }
     else {
         logself(WARNING) << "transport::read() returns: " << numread;
@@ -925,9 +1310,7 @@ Connection::spdylay_on_data_recv_cb(spdylay_session *session,
             return;
         }
 
-        CHECK(inMap(sid2req_, sid));
-        Request* req = sid2req_[sid];
-        req->notify_rsp_done();
+        _spdy_done_with_resp(sid);
     }
     vlogself(2) << "done";
 }
@@ -956,6 +1339,91 @@ Connection::spdylay_on_data_chunk_recv_cb(spdylay_session *session,
     // logself(DEBUG, "done");
 }
 
+void
+Connection::spdylay_on_stream_close_cb(spdylay_session *session,
+                                       int32_t stream_id,
+                                       spdylay_status_code status_code)
+{
+    CHECK_EQ(session, spdysess_.get());
+    const int32_t sid = stream_id;
+    vlogself(2) << "begin, sid " << sid << ", status " << status_code;
+
+    psids_.erase(sid);
+
+    if (inMap(sid2req_, sid)) {
+        /* the stream closed before we got the whole response, e.g.,
+         * the server reset it. the conn is still usable for other
+         * streams, but we have no way to retry just this one, so
+         * treat it like the whole conn failed
+         */
+        logself(WARNING) << "stream " << sid << " closed with status "
+                         << status_code << " before response is done";
+        DestructorGuard dg(this);
+        disconnect();
+        cnx_error_cb_(this);
+        return;
+    }
+
+    vlogself(2) << "done";
+}
+
+ssize_t
+Connection::spdylay_data_read_cb(spdylay_session *session,
+                                 int32_t stream_id,
+                                 uint8_t *buf, size_t length,
+                                 int *eof,
+                                 spdylay_data_source *source)
+{
+    CHECK_EQ(session, spdysess_.get());
+
+    Request *req = reinterpret_cast<Request*>(
+        spdylay_session_get_stream_user_data(session, stream_id));
+    CHECK_NOTNULL(req);
+
+    auto it = spdy_req_body_lens_.find(req);
+    CHECK(it != spdy_req_body_lens_.end());
+
+    /* the body is dummy, so its contents don't matter */
+    const auto len = std::min(std::min(length, it->second),
+                              common::static_bytes_length);
+    memcpy(buf, common::static_bytes->c_str(), len);
+    it->second -= len;
+
+    vlogself(2) << "sid " << stream_id << ": give " << len
+                << " req body bytes, " << it->second << " left";
+
+    if (it->second == 0) {
+        *eof = 1;
+        spdy_req_body_lens_.erase(it);
+    }
+
+    return len;
+}
+
+void
+Connection::_spdy_done_with_resp(const int32_t sid)
+{
+    vlogself(2) << "begin, sid " << sid;
+
+    auto it = sid2req_.find(sid);
+    CHECK(it != sid2req_.end());
+    Request* req = it->second;
+    CHECK_NOTNULL(req);
+
+    /* remove req before notifying, like the http path */
+    sid2req_.erase(it);
+
+    DestructorGuard dg(this);
+    req->notify_rsp_done();
+
+    if (!notify_request_done_cb_.empty()) {
+        notify_request_done_cb_(this, req);
+    }
+    _update_idle_period();
+
+    vlogself(2) << "done";
+}
+
 void
 Connection::handle_server_push_ctrl_recv(spdylay_frame *frame)
 {
@@ -1011,45 +1479,45 @@ Connection::spdylay_on_ctrl_recv_cb(spdylay_session *session,
         handle_server_push_ctrl_recv(frame);
         break;
     case SPDYLAY_RST_STREAM:
-        CHECK(0);
+        /* spdylay_on_stream_close_cb() will deal with it */
+        logself(WARNING) << "server reset stream "
+                         << frame->rst_stream.stream_id;
         break;
     case SPDYLAY_SYN_REPLY: {
         const int32_t sid = frame->syn_reply.stream_id;
         CHECK(inMap(sid2req_, sid));
         Request* req = sid2req_[sid];
         CHECK(req);
-        // logself(DEBUG,
-        //         "SYN REPLY sid: %d, cnx: %u, req: %u",
-        //         sid, instNum_, req->instNum_);
+        vlogself(2) << "SYN_REPLY sid " << sid << ", req " << req->objId();
+
+        req->notify_rsp_meta_bytes_recv();
+        if (notify_request_first_byte_cb_) {
+            notify_request_first_byte_cb_(this, req);
+        }
 
         char **nv = frame->syn_reply.nv;
         const char *status = 0;
         const char *version = 0;
-        const char *content_length = 0;
         unsigned int code = 0;
         for(size_t i = 0; nv[i]; i += 2) {
-            // logself(DEBUG, "name-value pair: %s: %s", nv[i], nv[i+1]);
             if(strcmp(nv[i], ":status") == 0) {
                 code = strtoul(nv[i+1], 0, 10);
                 CHECK(code == 200);
                 status = nv[i+1];
             } else if(strcmp(nv[i], ":version") == 0) {
                 version = nv[i+1];
-            } else if(nv[i][0] != ':') {
-                // if(strcmp(nv[i], "content-length") == 0) {
-                //     content_length = nv[i+1];
-                //     downstream->content_length_ = strtoul(content_length, 0, 10);
-                // }
-                //downstream->add_response_header(nv[i], nv[i+1]);
             }
         }
-        if(!status || !version) {
-            CHECK(0);
-            return;
-        }
+        CHECK(status && version);
+
         DestructorGuard dg(this);
-        // logself(DEBUG, "notifying of response meta");
         req->notify_rsp_meta(code, nv);
+
+        if (frame->syn_reply.hd.flags & SPDYLAY_CTRL_FLAG_FIN) {
+            vlogself(2) << "no response body";
+            _spdy_done_with_resp(sid);
+        }
+        break;
     }
     default:
         break;
@@ -1071,8 +1539,14 @@ Connection::spdylay_before_ctrl_send_cb(spdylay_session *session,
         CHECK(req);
         // logself(DEBUG, "new SYN sid: %d, cnx: %u, req: %u",
         //         sid, instNum_, req->instNum_);
+        CHECK(!submitted_req_queue_.empty());
+        CHECK_EQ(submitted_req_queue_.front(), req)
+            << "requests all have the same priority, so spdylay should"
+            << " send them in submission order";
+        submitted_req_queue_.pop();
         sid2req_[frame->syn_stream.stream_id] = req;
         req->dump_debug();
+        _note_request_sent(req);
         DestructorGuard dg(this);
         req->notify_req_about_to_send();
     }
@@ -1115,6 +1589,29 @@ Connection::s_spdylay_on_data_chunk_recv_cb(spdylay_session *session,
                                         data, len);
 }
 
+void
+Connection::s_spdylay_on_stream_close_cb(spdylay_session *session,
+                                         int32_t stream_id,
+                                         spdylay_status_code status_code,
+                                         void *user_data)
+{
+    Connection *conn = (Connection*)(user_data);
+    conn->spdylay_on_stream_close_cb(session, stream_id, status_code);
+}
+
+ssize_t
+Connection::s_spdylay_data_read_cb(spdylay_session *session,
+                                   int32_t stream_id,
+                                   uint8_t *buf, size_t length,
+                                   int *eof,
+                                   spdylay_data_source *source,
+                                   void *user_data)
+{
+    Connection *conn = (Connection*)(user_data);
+    return conn->spdylay_data_read_cb(session, stream_id, buf, length,
+                                      eof, source);
+}
+
 void
 Connection::s_spdylay_on_ctrl_recv_cb(spdylay_session *session, spdylay_frame_type type,
                                     spdylay_frame *frame, void *user_data)
@@ -1143,7 +1640,7 @@ Connection::_setup_spdylay_session()
     callbacks.on_ctrl_recv_callback = s_spdylay_on_ctrl_recv_cb;
     callbacks.on_data_chunk_recv_callback = s_spdylay_on_data_chunk_recv_cb;
     callbacks.on_data_recv_callback = s_spdylay_on_data_recv_cb;
-    /* callbacks.on_stream_close_callback = spdylay_on_stream_close_cb; */
+    callbacks.on_stream_close_callback = s_spdylay_on_stream_close_cb;
     callbacks.before_ctrl_send_callback = s_spdylay_before_ctrl_send_cb;
     /* callbacks.on_ctrl_not_send_callback = spdylay_on_ctrl_not_send_cb; */
 
@@ -14,6 +14,7 @@
 #include <event2/buffer.h>
 
 #include <boost/function.hpp>
+#include <boost/intrusive/list.hpp>
 
 #include "../object.hpp"
 #include "../common.hpp"
@@ -41,6 +42,7 @@ typedef boost::function<void(Connection*)> ConnectionEOFCb;
 typedef boost::function<void(Connection*)> ConnectionFirstRecvByteCb;
 
 typedef boost::function<void(Connection*, const Request*)> ConnectionRequestDoneCb;
+typedef boost::function<void(Connection*, Request*)> ConnectionRequestFirstByteCb;
 
 typedef void (*PushedMetaCb)(int id, const char* url, ssize_t contentlen,
                              const char **nv, Connection* cnx, void* cb_data);
@@ -53,12 +55,21 @@ typedef void (*PushedBodyDoneCb)(int id, Connection* cnx, void* cb_data);
  *
  * it can talk basic http or spdy with the "server".
  *
- * caveat: if http, chunked encoding not supported, i.e., response
- * must provide content length.
+ * with http, the response must provide either content length or
+ * chunked transfer encoding. either way, body bytes are only counted,
+ * never buffered: we drain what's in the input buffer and have the
+ * channel drop the rest as it arrives.
+ *
+ * with http, requests can be pipelined: see set_http_pipeline_depth().
+ *
+ * with spdy, all requests submitted are multiplexed onto the one
+ * connection right away, each on its own stream. requests not yet
+ * assigned a stream are in the submitted queue, and requests with a
+ * stream are in sid2req_.
  *
  * submit requests onto this connection by calling
- * submit_request(). the request object will be notified of "meta"
- * (status and headers), body_data, and body_done via callbacks.
+ * submit_request(). the request's observer will be notified of "meta"
+ * (status and headers), body_data, and body_done.
  */
 
 
@@ -118,7 +129,8 @@ public:
     bool is_idle() const;
     size_t get_queue_size() const
     {
-        return submitted_req_queue_.size() + active_req_queue_.size();
+        return submitted_req_queue_.size()
+            + (use_spdy_ ? sid2req_.size() : active_req_queue_.size());
     }
     const size_t& get_total_num_sent_bytes() const
     {
@@ -129,13 +141,53 @@ public:
         return cumulative_num_recv_bytes_;
     }
 
+    /* when things happened on this connection, in ms since the epoch
+     * (common::gettimeofdayMs()); zero if they haven't (yet). when
+     * the connection closes, these are logged on one line, so they
+     * can be matched up with the requests' timings */
+    struct Timestamps
+    {
+        uint64_t connect_start = 0;
+        /* the socks proxy has connected us to the target */
+        uint64_t socks_done = 0;
+        uint64_t connected = 0;
+        uint64_t first_req_sent = 0;
+        uint64_t first_byte_recv = 0;
+        uint64_t closed = 0;
+
+        /* idle means connected with no requests */
+        uint64_t idle_since = 0;
+        uint64_t total_idle_ms = 0;
+        uint32_t num_idle_periods = 0;
+
+        uint32_t num_reqs_sent = 0;
+    };
+    const Timestamps& timestamps() const { return timestamps_; }
+
     std::queue<Request*> get_active_request_queue() const;
     std::queue<Request*> get_pending_request_queue() const;
 
     void set_request_done_cb(ConnectionRequestDoneCb cb);
+    /* called when we get the first byte of a request's response,
+     * right after the request itself is told */
+    void set_request_first_byte_cb(ConnectionRequestFirstByteCb cb) {
+        notify_request_first_byte_cb_ = cb;
+    }
+
+    /* http only: how many requests we may have written and waiting
+     * for their responses, i.e., 1 means no pipelining (the
+     * default). responses come back in request order */
+    void set_http_pipeline_depth(const uint8_t depth);
+    const uint8_t& http_pipeline_depth() const { return http_pipeline_depth_; }
 
     const bool use_spdy_;
 
+    /* for the connection manager to keep its idle connections in an
+     * intrusive list, so it can find one without searching. unlinks
+     * itself when the connection is destroyed */
+    boost::intrusive::list_member_hook<
+        boost::intrusive::link_mode<boost::intrusive::auto_unlink> > cnxman_idle_hook;
+
 private:
 
     /***** implement Socks5ConnectorObserver interface */
@@ -204,6 +256,24 @@ private:
                                  uint8_t flags, int32_t stream_id,
                                  int32_t len);
 
+    static void s_spdylay_on_stream_close_cb(spdylay_session *,
+                                             int32_t,
+                                             spdylay_status_code,
+                                             void *);
+    void spdylay_on_stream_close_cb(spdylay_session *session,
+                                    int32_t stream_id,
+                                    spdylay_status_code status_code);
+
+    /* provides the dummy request body */
+    static ssize_t s_spdylay_data_read_cb(spdylay_session *, int32_t,
+                                          uint8_t *, size_t, int *,
+                                          spdylay_data_source *, void *);
+    ssize_t spdylay_data_read_cb(spdylay_session *session,
+                                 int32_t stream_id,
+                                 uint8_t *buf, size_t length,
+                                 int *eof,
+                                 spdylay_data_source *source);
+
     virtual ~Connection();
 
     int initiate_connection();
@@ -218,14 +288,36 @@ private:
 
     void disconnect();
 
-    // return true if did write to transport, otherwise return false
+    /* instrumentation */
+    void _note_request_sent(Request*);
+    void _note_bytes_recv(const size_t);
+    void _update_idle_period();
+    void _log_timestamps() const;
+
+    // write as many submitted requests as the pipeline depth allows
     void _maybe_http_write_to_transport();
+    void _http_write_request(Request*);
 
     // read from socket and process the read data
     void _maybe_http_consume_input();
+    enum class RspParseEvent {
+        NONE,
+        HEAD_DONE,
+        /* parsed a (non-last) chunk's size line */
+        CHUNK_DATA,
+        CHUNKED_BODY_DONE,
+    };
+    /* scan up to "len" bytes of the response head or the chunked
+     * body's framing (i.e., not the body/chunk data), and return how
+     * many were scanned. stops right after a byte that triggers an
+     * event */
+    size_t _http_parse_rsp_framing(const char* buf, const size_t len,
+                                   RspParseEvent& event);
+    void _http_on_rsp_head_done();
 
     void _got_a_chunk_of_resp_body(size_t);
     void _done_with_resp();
+    void _spdy_done_with_resp(const int32_t sid);
 
     void handle_server_push_ctrl_recv(spdylay_frame *frame);
 
@@ -269,6 +361,7 @@ private:
     PushedBodyDoneCb notify_pushed_body_done_;
 
     ConnectionRequestDoneCb notify_request_done_cb_;
+    ConnectionRequestFirstByteCb notify_request_first_byte_cb_;
 
     /* for spdy-to-server support */
     std::unique_ptr<spdylay_session, void(*)(spdylay_session*)> spdysess_;
@@ -276,36 +369,78 @@ private:
     std::map<int32_t, Request*> sid2req_;
     /* set of pushed stream ids */
     std::set<int32_t> psids_;
+    /* remaining dummy request body to send for each request */
+    std::map<const Request*, size_t> spdy_req_body_lens_;
     /* for http-to-server support */
 
     /* requests submitted by browser are enqueued in
      * submitted_req_queue_. when a request is written into the
-     * outbuf_, it is moved to active_req_queue_.
+     * outbuf_, it is moved to active_req_queue_ (http) or sid2req_
+     * (spdy).
      */
     std::queue<Request* > submitted_req_queue_; // dont free these ptrs
     std::queue<Request* > active_req_queue_; // dont free these ptrs
+    uint8_t http_pipeline_depth_;
 
+    /* the response head is parsed one byte at a time, so the parser
+     * can stop at any byte and resume when more input arrives */
     enum class HTTPRespState {
-        HTTP_RSP_STATE_STATUS_LINE, /* waiting for a full status line */
-        HTTP_RSP_STATE_HEADERS,
-        HTTP_RSP_STATE_BODY,
+        HTTP_RSP_STATE_STATUS_LINE, /* expecting (more of) status line */
+        HTTP_RSP_STATE_STATUS_LINE_LF,
+        HTTP_RSP_STATE_HEADER_NAME,
+        HTTP_RSP_STATE_HEADER_VALUE,
+        HTTP_RSP_STATE_HEADER_LF,
+        HTTP_RSP_STATE_HEADERS_END_LF, /* got the blank line's \r */
+        HTTP_RSP_STATE_BODY, /* content-length body */
+        /* neither content-length nor chunked: the body runs until
+         * the server closes the connection */
+        HTTP_RSP_STATE_BODY_UNTIL_EOF,
+
+        /* chunked body */
+        HTTP_RSP_STATE_CHUNK_SIZE,
+        HTTP_RSP_STATE_CHUNK_EXT,
+        HTTP_RSP_STATE_CHUNK_SIZE_LF,
+        HTTP_RSP_STATE_CHUNK_DATA,
+        HTTP_RSP_STATE_CHUNK_DATA_CR,
+        HTTP_RSP_STATE_CHUNK_DATA_LF,
+        HTTP_RSP_STATE_TRAILER, /* at the start of a trailer line */
+        HTTP_RSP_STATE_TRAILER_LINE,
+        HTTP_RSP_STATE_TRAILER_LF,
+        HTTP_RSP_STATE_TRAILER_END_LF,
     } http_rsp_state_;
     int http_rsp_status_;
-    std::vector<char *> rsp_hdrs_; // DO free every _other_ one of
-                                   // these ptrs (i.e., index 0, 2, 4,
-                                   // etc)
+    /* how far into the status line, the current header name or
+     * value, or the chunk size */
+    size_t rsp_parse_pos_;
+    /* the headers we care about */
+    enum class RspHeader {
+        OTHER,
+        CONTENT_LENGTH,
+        TRANSFER_ENCODING,
+    };
+    static const char* _rsp_header_name(const RspHeader);
+    /* which one the current header (so far) is */
+    RspHeader rsp_hdr_;
+    bool rsp_has_content_length_;
+    bool rsp_is_chunked_;
+    /* the content-length value we give to the rsp meta callback */
+    char rsp_content_length_str_[24];
     size_t remaining_resp_body_len_; /* amount of data _left_ to read
                                       * from server/deliver to
                                       * user. this is of the response
                                       * body only, and not of the full
                                       * entity.
                                       */
+    /* of the current chunk, if chunked */
+    size_t remaining_chunk_len_;
 
     /* total num bytes sent/received on this cnx (not counting the
      * socks handshake, which is negligible) */
     size_t cumulative_num_sent_bytes_;
     size_t cumulative_num_recv_bytes_;
 
+    Timestamps timestamps_;
+
 };
 
 } // namespace http
@@ -1,6 +1,7 @@
 
 #include <string>
 #include <utility>
+#include <algorithm>
 #include <boost/bind.hpp>
 
 #include "connection_manager.hpp"
@@ -36,6 +37,16 @@ using std::make_shared;
 namespace http
 {
 
+/* a retried request waits kRetryBackoffBaseMs before its first retry,
+ * doubling for every further retry */
+static const uint32_t kRetryBackoffBaseMs = 500;
+static const int32_t kMaxRetryBackoffShift = 4;
+
+/* how many recent time-to-first-bytes we base the hedging deadline
+ * on, and how many we need before we hedge at all */
+static const size_t kMaxNumTTFBSamples = 100;
+static const size_t kMinNumTTFBSamplesToHedge = 10;
+
 /***************************************************/
 
 ConnectionManager::ConnectionManager(struct event_base *evbase,
@@ -43,24 +54,223 @@ ConnectionManager::ConnectionManager(struct event_base *evbase,
                                      const in_port_t& socks5_port,
                                      RequestErrorCb request_error_cb,
                                      const uint8_t max_persist_cnx_per_srv,
-                                     const uint8_t max_retries_per_resource)
+                                     const uint8_t max_retries_per_resource,
+                                     const bool use_spdy,
+                                     const uint8_t http_pipeline_depth,
+                                     const uint8_t hedge_ttfb_percentile)
     : evbase_(evbase)
     , socks5_addr_(socks5_addr), socks5_port_(socks5_port)
-    , max_persist_cnx_per_srv_(max_persist_cnx_per_srv)
+    , max_persist_cnx_per_srv_(use_spdy ? 1 : max_persist_cnx_per_srv)
     , max_retries_per_resource_(max_retries_per_resource)
+    , use_spdy_(use_spdy)
+    , http_pipeline_depth_(use_spdy ? 1 : http_pipeline_depth)
+    , hedge_ttfb_percentile_(
+        (use_spdy || (http_pipeline_depth > 1)) ? 0 : hedge_ttfb_percentile)
 
     , timestamp_recv_first_byte_(0)
     , totaltxbytes_(0), totalrxbytes_(0)
     , is_resetting_(false)
 
     , notify_req_error_(request_error_cb)
+    , next_pending_req_seq_(0)
+    , next_ttfb_sample_idx_(0)
 {
     CHECK(evbase_);
     CHECK(request_error_cb);
     CHECK(max_persist_cnx_per_srv > 0);
+    CHECK_GT(http_pipeline_depth_, 0);
+    CHECK_LE(hedge_ttfb_percentile, 100);
+
+    /* we hedge by closing the loser's connection, so the loser must
+     * be alone on it */
+    if (hedge_ttfb_percentile && !hedge_ttfb_percentile_) {
+        logself(WARNING) << "can't hedge requests with spdy or pipelining";
+    }
+}
+
+
+/***************************************************/
+
+uint32_t
+ConnectionManager::get_netloc_id(const std::string& host, const uint16_t& port)
+{
+    NetLoc netloc(host, port);
+    auto it = netloc_ids_.find(netloc);
+    if (it == netloc_ids_.end()) {
+        netlocs_.push_back(netloc);
+        const uint32_t id = netlocs_.size();
+        it = netloc_ids_.insert(make_pair(std::move(netloc), id)).first;
+        vlogself(2) << "netloc [" << host << "]:" << port
+                    << " gets id " << id;
+    }
+
+    return it->second;
+}
+
+/***************************************************/
 
-    CHECK_EQ(max_retries_per_resource_, 0)
-        << "don't use retries for this project";
+shared_ptr<Connection>
+ConnectionManager::find_conn_with_room(Server* server)
+{
+    auto& conns = server->connections_;
+
+    if (use_spdy_) {
+        if (!conns.empty()) {
+            CHECK_EQ(conns.size(), 1);
+            return conns.begin()->second;
+        }
+        return nullptr;
+    }
+
+    auto& idle_conns = server->idle_connections_;
+    if (!idle_conns.empty()) {
+        Connection& c = idle_conns.front();
+        DCHECK_EQ(c.get_queue_size(), 0);
+        auto it = conns.find(c.objId());
+        CHECK(it != conns.end());
+        return it->second;
+    }
+
+    if (http_pipeline_depth_ == 1) {
+        // without pipelining, only idle connections have room
+        return nullptr;
+    }
+
+    // pipeline onto the least loaded connection with room. there are
+    // at most max_persist_cnx_per_srv_ of them
+    shared_ptr<Connection> conn;
+    size_t min_qsize = http_pipeline_depth_;
+    for (auto& kv : conns) {
+        const auto qsize = kv.second->get_queue_size();
+        if (qsize < min_qsize) {
+            conn = kv.second;
+            min_qsize = qsize;
+        }
+    }
+    return conn;
+}
+
+/***************************************************/
+
+void
+ConnectionManager::update_idle_state(Server* server, Connection* conn)
+{
+    const bool is_idle = (conn->get_queue_size() == 0);
+    if (is_idle && !conn->cnxman_idle_hook.is_linked()) {
+        vlogself(2) << "conn= " << conn->objId() << " is now idle";
+        server->idle_connections_.push_back(*conn);
+    } else if (!is_idle && conn->cnxman_idle_hook.is_linked()) {
+        conn->cnxman_idle_hook.unlink();
+    }
+}
+
+/***************************************************/
+
+void
+ConnectionManager::dispatch_waiting_requests(const uint32_t netloc_id)
+{
+    CHECK_LT(netloc_id, servers_.size());
+    auto server = servers_[netloc_id];
+    CHECK(server);
+
+    auto& requests = server->requests_;
+    while (!requests.empty()) {
+        auto conn = find_conn_with_room(server.get());
+        if (!conn) {
+            if (server->connections_.size() >= max_persist_cnx_per_srv_) {
+                break;
+            }
+            conn = create_connection(server.get(), netloc_id);
+        }
+
+        auto reqtosubmit = requests.top().req;
+        requests.pop();
+        vlogself(2) << "submit req= " << reqtosubmit->objId()
+                    << " on conn= " << conn->objId();
+        conn->submit_request(reqtosubmit);
+        update_idle_state(server.get(), conn.get());
+    }
+
+    if (server->connections_.empty()) {
+        servers_[netloc_id].reset();
+    }
+}
+
+/***************************************************/
+
+shared_ptr<ConnectionManager::Server>
+ConnectionManager::get_server(const uint32_t netloc_id)
+{
+    if (servers_.size() <= netloc_id) {
+        servers_.resize(netloc_id + 1);
+    }
+    if (!servers_[netloc_id]) {
+        servers_[netloc_id] = make_shared<Server>();
+    }
+    return servers_[netloc_id];
+}
+
+/***************************************************/
+
+shared_ptr<Connection>
+ConnectionManager::create_connection(Server* server, const uint32_t netloc_id)
+{
+    const auto& netloc = netlocs_[netloc_id - 1];
+    shared_ptr<Connection> conn(
+        new Connection(
+            evbase_,
+            netloc.first.c_str(), netloc.second,
+            socks5_addr_, socks5_port_,
+            nullptr, 0,
+            boost::bind(&ConnectionManager::cnx_error_cb, this, _1, netloc_id),
+            boost::bind(&ConnectionManager::cnx_eof_cb, this, _1, netloc_id),
+            nullptr, nullptr, nullptr,
+            this,
+            use_spdy_
+            ),
+        [=](Connection* c) { c->destroy(); });
+    CHECK(conn);
+    vlogself(2) << "new conn= "<< conn->objId() << " to netloc " << netloc_id;
+    conn->set_request_done_cb(
+        boost::bind(&ConnectionManager::cnx_request_done_cb, this, _1, _2, netloc_id));
+    conn->set_first_recv_byte_cb(
+        boost::bind(&ConnectionManager::cnx_first_recv_byte_cb, this, _1));
+    if (hedge_ttfb_percentile_) {
+        conn->set_request_first_byte_cb(
+            boost::bind(&ConnectionManager::cnx_request_first_byte_cb, this, _1, _2));
+    }
+    if (!use_spdy_) {
+        conn->set_http_pipeline_depth(http_pipeline_depth_);
+    }
+    const auto ret = server->connections_.insert(make_pair(conn->objId(), conn));
+    CHECK(ret.second); // insist it was newly inserted
+    return conn;
+}
+
+/***************************************************/
+
+void
+ConnectionManager::preconnect(const std::string& host, const uint16_t& port,
+                              const uint8_t& num_cnx)
+{
+    const auto netloc_id = get_netloc_id(host, port);
+    auto server = get_server(netloc_id);
+
+    const size_t target = std::min<size_t>(num_cnx, max_persist_cnx_per_srv_);
+
+    vlogself(2) << "preconnect to [" << host << "]:" << port
+                << ", have " << server->connections_.size()
+                << " connections, want " << target;
+
+    while (server->connections_.size() < target) {
+        auto conn = create_connection(server.get(), netloc_id);
+        update_idle_state(server.get(), conn.get());
+    }
+
+    if (server->connections_.empty()) {
+        // num_cnx was zero; don't keep around an empty server
+        servers_[netloc_id].reset();
+    }
 }
 
 /***************************************************/
@@ -70,57 +280,42 @@ ConnectionManager::submit_request(Request *req)
 {
     vlogself(2) << "begin, req= " << req->objId() << ", res:" << req->webkit_resInstNum_;
 
-    const NetLoc netloc(req->host_, req->port_);
+    const auto netloc_id = req->netloc_id_;
 
-    vlogself(2) << "netloc: " << netloc.first << ":" << netloc.second;
+    vlogself(2) << "netloc id: " << netloc_id;
+    CHECK_LE(netloc_id, netlocs_.size());
 
-    if (!inMap(servers_, netloc)) {
-        servers_[netloc] = make_shared<Server>();
+    // only for the request's queueing stat, so keep the time of its
+    // first submission (the session may have stamped it already)
+    if (!req->submit_time_ms()) {
+        req->set_submit_time_ms(common::gettimeofdayMs(nullptr));
     }
-    auto server = servers_[netloc];
-    server->requests_.push_back(req);
+
+    if (hedge_ttfb_percentile_ && (req->get_num_retries() == 0)) {
+        maybe_arm_hedge(req, netloc_id);
+    }
+
+    auto server = get_server(netloc_id);
+    server->requests_.push({req, next_pending_req_seq_++});
 
     vlogself(2) << "server queue size " << server->requests_.size();
 
-    shared_ptr<Connection> conn;
     auto& conns = server->connections_;
 
-    // first, is there a connection with an empty queue
-    for (auto& c : conns) {
-        if (c->get_queue_size() == 0) {
-            conn = c;
-            vlogself(2) << "conn= " << c->objId() << " has empty queue -> use it";
-            goto done;
-        }
+    shared_ptr<Connection> conn = find_conn_with_room(server.get());
+    if (conn) {
+        vlogself(2) << "conn= " << conn->objId() << " has room -> use it";
+        goto done;
     }
 
-    vlogself(2) << "reaching here means no idle connection";
-    CHECK(!conn); // make sure conn IS NULL
+    vlogself(2) << "reaching here means no connection with room";
 
     vlogself(2) << "there are " << conns.size()<< " connections to this netloc";
 
     if (conns.size() < max_persist_cnx_per_srv_) {
         vlogself(2) << " --> create a new connection";
         CHECK(!conn);
-        conn.reset(new Connection(
-                       evbase_,
-                       netloc.first.c_str(), netloc.second,
-                       socks5_addr_, socks5_port_,
-                       nullptr, 0,
-                       boost::bind(&ConnectionManager::cnx_error_cb, this, _1, netloc),
-                       boost::bind(&ConnectionManager::cnx_eof_cb, this, _1, netloc),
-                       nullptr, nullptr, nullptr,
-                       this,
-                       false
-                       ),
-                   [=](Connection* c) { c->destroy(); });
-        CHECK(conn);
-        vlogself(2) << " ... with objId() "<< conn->objId();
-        conn->set_request_done_cb(
-            boost::bind(&ConnectionManager::cnx_request_done_cb, this, _1, _2, netloc));
-        conn->set_first_recv_byte_cb(
-            boost::bind(&ConnectionManager::cnx_first_recv_byte_cb, this, _1));
-        conns.push_back(conn);
+        conn = create_connection(server.get(), netloc_id);
         goto done;
     } else {
         vlogself(2)<< "reached max persist cnx per srv -> do nothing now";
@@ -130,11 +325,13 @@ done:
     if (conn) {
         CHECK(server->requests_.size() > 0);
 
-        auto reqtosubmit = server->requests_.front();
-        vlogself(2) << "submit req= " << reqtosubmit->objId() << ", res:" << req->webkit_resInstNum_
+        /* not necessarily "req": it's the highest priority one */
+        auto reqtosubmit = server->requests_.top().req;
+        server->requests_.pop();
+        vlogself(2) << "submit req= " << reqtosubmit->objId() << ", res:" << reqtosubmit->webkit_resInstNum_
                     << ": on conn= " << conn->objId();
         conn->submit_request(reqtosubmit);
-        server->requests_.pop_front();
+        update_idle_state(server.get(), conn.get());
     }
     vlogself(2) << "done";
     return;
@@ -142,6 +339,103 @@ done:
 
 /***************************************************/
 
+bool
+ConnectionManager::cancel_request(Request *req)
+{
+    vlogself(2) << "begin, req= " << req->objId();
+
+    const auto netloc_id = req->netloc_id_;
+
+    if (hedge_ttfb_percentile_) {
+        // closes its copy's connection, if any. if the copy had won,
+        // the original is no longer on any connection
+        cancel_hedge(req, true);
+    }
+
+    if (retry_timers_.erase(req)) {
+        vlogself(2) << "was waiting out its backoff";
+        return true;
+    }
+
+    if ((netloc_id >= servers_.size()) || !servers_[netloc_id]) {
+        return true;
+    }
+    auto server = servers_[netloc_id];
+
+    // a priority queue can't remove from the middle, so rebuild it
+    bool was_waiting = false;
+    std::priority_queue<PendingRequest> requests;
+    while (!server->requests_.empty()) {
+        const auto& pending = server->requests_.top();
+        if (pending.req == req) {
+            was_waiting = true;
+        } else {
+            requests.push(pending);
+        }
+        server->requests_.pop();
+    }
+    server->requests_.swap(requests);
+    if (was_waiting) {
+        vlogself(2) << "was waiting for a connection";
+        return true;
+    }
+
+    // "req->conn" might be from an earlier try, so look for it
+    shared_ptr<Connection> conn;
+    queue<Request*> others;
+    for (const auto& kv : server->connections_) {
+        auto active_requests = kv.second->get_active_request_queue();
+        auto pending_requests = kv.second->get_pending_request_queue();
+        bool found = false;
+        others = queue<Request*>();
+        for (auto q : {&active_requests, &pending_requests}) {
+            while (!q->empty()) {
+                if (q->front() == req) {
+                    found = true;
+                } else {
+                    others.push(q->front());
+                }
+                q->pop();
+            }
+        }
+        if (found) {
+            conn = kv.second;
+            break;
+        }
+    }
+    if (!conn) {
+        return true;
+    }
+
+    if (use_spdy_) {
+        vlogself(2) << "is on spdy conn= " << conn->objId() << "; leave it";
+        return false;
+    }
+
+    logself(INFO) << "close conn= " << conn->objId()
+                  << " to cancel req= " << req->objId() << "; "
+                  << others.size() << " other requests on it";
+    close_conn(conn.get(), netloc_id);
+    conn.reset();
+
+    // nothing is wrong with the others, so they just wait for a
+    // connection again, and the closed connection's slot can serve
+    // them or whoever else is waiting
+    server = get_server(netloc_id);
+    while (!others.empty()) {
+        auto other = others.front();
+        others.pop();
+        other->restart_try();
+        server->requests_.push({other, next_pending_req_seq_++});
+    }
+    dispatch_waiting_requests(netloc_id);
+
+    vlogself(2) << "done";
+    return true;
+}
+
+/***************************************************/
+
 void
 ConnectionManager::cnx_first_recv_byte_cb(Connection* conn)
 {
@@ -159,20 +453,73 @@ ConnectionManager::cnx_first_recv_byte_cb(Connection* conn)
 
 /***************************************************/
 
+void
+ConnectionManager::cnx_request_first_byte_cb(Connection* conn, Request* req)
+{
+    const auto now = common::gettimeofdayMs(nullptr);
+
+    auto orig_it = hedge_origs_.find(req);
+    if (orig_it != hedge_origs_.end()) {
+        auto orig = orig_it->second;
+        auto it = hedges_.find(orig);
+        CHECK(it != hedges_.end());
+        auto& hs = it->second;
+        CHECK(!hs.hedge_won);
+
+        logself(INFO) << "hedge req= " << req->objId()
+                      << " beats original req= " << orig->objId();
+        hs.hedge_won = true;
+        add_ttfb_sample(now - hs.submit_time_ms);
+        orig->notify_rsp_meta_bytes_recv();
+        orig->note_sent(req->sent_on_conn_id(), req->sent_time_ms(),
+                        req->connect_wait_ms());
+        if (hs.orig_conn) {
+            auto orig_conn = hs.orig_conn;
+            hs.orig_conn = nullptr;
+            close_conn(orig_conn, hs.netloc_id);
+        }
+        return;
+    }
+
+    auto it = hedges_.find(req);
+    if (it == hedges_.end()) {
+        return;
+    }
+
+    add_ttfb_sample(now - it->second.submit_time_ms);
+    if (it->second.hedge) {
+        logself(INFO) << "original req= " << req->objId() << " beats its hedge";
+    }
+    cancel_hedge(req, true);
+}
+
+/***************************************************/
+
 void
 ConnectionManager::cnx_request_done_cb(Connection* conn,
                                        const Request* req,
-                                       const NetLoc& netloc)
+                                       const uint32_t netloc_id)
 {
-    vlogself(2) << "begin, req= " <<  req->objId() << ", res:" << req->webkit_resInstNum_;
+    vlogself(2) << "begin, conn= " << conn->objId();
+
+    // the user might have destroyed "req" by now, unless it's a
+    // hedge, which we own
+    if (hedge_ttfb_percentile_) {
+        auto orig_it = hedge_origs_.find(const_cast<Request*>(req));
+        if (orig_it != hedge_origs_.end()) {
+            // the winning hedge is done; its connection is free
+            cancel_hedge(orig_it->second, false);
+        }
+    }
 
-    // we don't free anything in here
+    // other than a finished hedge, we don't free anything in here
 
     // see if there's a request waiting to be sent
 
     Request* reqtosubmit = nullptr;
 
-    auto server = servers_[netloc];
+    CHECK_LT(netloc_id, servers_.size());
+    auto server = servers_[netloc_id];
     CHECK(server);
 
     auto& requests = server->requests_;
@@ -183,13 +530,14 @@ ConnectionManager::cnx_request_done_cb(Connection* conn,
         goto done;
     }
 
-    reqtosubmit = requests.front();
-    vlogself(2) << "submit req= " << reqtosubmit->objId() << ", res:" << req->webkit_resInstNum_
+    reqtosubmit = requests.top().req;
+    requests.pop();
+    vlogself(2) << "submit req= " << reqtosubmit->objId() << ", res:" << reqtosubmit->webkit_resInstNum_
                 << " on conn= " << conn->objId();
     conn->submit_request(reqtosubmit);
-    requests.pop_front();
 
 done:
+    update_idle_state(server.get(), conn);
     vlogself(2) << "done";
     return;
 }
@@ -198,21 +546,21 @@ done:
 
 void
 ConnectionManager::cnx_error_cb(Connection* conn,
-                                const NetLoc& netloc)
+                                const uint32_t netloc_id)
 {
     logself(WARNING) << "connection error";
-    handle_unusable_conn(conn, netloc);
+    handle_unusable_conn(conn, netloc_id);
 }
 
 /***************************************************/
 
 void
 ConnectionManager::cnx_eof_cb(Connection* conn,
-                              const NetLoc& netloc)
+                              const uint32_t netloc_id)
 {
     if (!is_resetting_) {
         logself(WARNING) << "connection eof";
-        handle_unusable_conn(conn, netloc);
+        handle_unusable_conn(conn, netloc_id);
     }
 }
 
@@ -220,14 +568,11 @@ ConnectionManager::cnx_eof_cb(Connection* conn,
 
 void
 ConnectionManager::handle_unusable_conn(Connection *conn,
-                                        const NetLoc& netloc)
+                                        const uint32_t netloc_id)
 {
     vlogself(2) << "begin, conn= "<< conn->objId();
 
-    // we should mark any requests being handled by this connection as
-    // error. for now, we don't attempt to request elsewhere.
-
-    release_conn(conn, netloc);
+    release_conn(conn, netloc_id);
 
     /* release_conn() only removes the conn from the list. it does not
      * yet delete the conn object. so we can still get its request
@@ -235,14 +580,68 @@ ConnectionManager::handle_unusable_conn(Connection *conn,
      *
      * retry_requests() honors the max_retries_per_resource_
      */
-    retry_requests(conn->get_active_request_queue());
-    retry_requests(conn->get_pending_request_queue());
+    auto active_requests = conn->get_active_request_queue();
+    auto pending_requests = conn->get_pending_request_queue();
+    queue<Request*> requests;
+    for (auto q : {&active_requests, &pending_requests}) {
+        while (!q->empty()) {
+            auto req = q->front();
+            q->pop();
+
+            if (hedge_ttfb_percentile_) {
+                auto orig_it = hedge_origs_.find(req);
+                if (orig_it != hedge_origs_.end()) {
+                    // a hedge is never retried itself: if it has won,
+                    // or the original's connection is gone too, the
+                    // original is retried
+                    auto orig = orig_it->second;
+                    const auto& hs = hedges_.at(orig);
+                    const bool retry_orig = hs.hedge_won || !hs.orig_conn;
+                    cancel_hedge(orig, false);
+                    if (retry_orig) {
+                        requests.push(orig);
+                    }
+                    continue;
+                }
+
+                auto it = hedges_.find(req);
+                if (it != hedges_.end() && it->second.hedge) {
+                    // let its hedge carry on
+                    it->second.orig_conn = nullptr;
+                    continue;
+                }
+            }
+
+            requests.push(req);
+        }
+    }
+
+    retry_requests(requests);
 
     vlogself(2) << "done";
 }
 
 /***************************************************/
 
+void
+ConnectionManager::close_conn(Connection *conn,
+                              const uint32_t netloc_id)
+{
+    vlogself(2) << "closing conn= " << conn->objId();
+
+    CHECK_LT(netloc_id, servers_.size());
+    auto server = servers_[netloc_id];
+    CHECK(server);
+    auto it = server->connections_.find(conn->objId());
+    CHECK(it != server->connections_.end());
+
+    // keep it until it's out of the pool, then let it go
+    auto conn_ptr = it->second;
+    release_conn(conn, netloc_id);
+}
+
+/***************************************************/
+
 bool
 ConnectionManager::retry_requests(queue<Request*> requests)
 {
@@ -253,26 +652,33 @@ ConnectionManager::retry_requests(queue<Request*> requests)
         CHECK(req);
         vlogself(2) << "req= " << req->objId();
         requests.pop();
-        if (req->get_num_retries() == max_retries_per_resource_) {
+        if (hedge_ttfb_percentile_) {
+            // retries aren't hedged
+            cancel_hedge(req, true);
+        }
+        if (req->get_num_retries() >= max_retries_per_resource_) {
             logself(WARNING) << "req= " << req->objId() << "] has exhausted "
                              <<  unsigned(max_retries_per_resource_) << " retries";
             notify_req_error_(req);
             continue;
         }
+        /* the server sends the whole response again, and the request
+         * skips what it has already told the user about */
         req->increment_num_retries();
+        const auto shift = std::min(req->get_num_retries() - 1,
+                                    kMaxRetryBackoffShift);
+        const uint32_t backoff_ms = kRetryBackoffBaseMs << shift;
         logself(INFO) <<
-            "re-requesting req= "<<req->objId()<<" for the "<<req->get_num_retries()<<" time";
-        if (req->actual_resp_body_size() > 0) {
-            /* the request "body_size()" represents number of
-             * contiguous bytes from 0 that we have received. so, we
-             * can use that as the next first_byte_pos.
-             */
-            // req->set_first_byte_pos(req->get_body_size());
-            // vlogself(2) << "set first_byte_pos to %d",
-            //         req->get_first_byte_pos());
-        }
-
-        this->submit_request(req);
+            "re-requesting req= "<<req->objId()<<" for the "<<req->get_num_retries()
+                      <<" time, in " << backoff_ms << " ms";
+
+        Timer::UniquePtr timer(
+            new Timer(evbase_, true,
+                      boost::bind(&ConnectionManager::retry_timer_fired,
+                                  this, _1, req)));
+        timer->start(backoff_ms);
+        const auto ret = retry_timers_.insert(make_pair(req, std::move(timer)));
+        CHECK(ret.second);
     }
 
     vlogself(2) << "done";
@@ -281,6 +687,183 @@ ConnectionManager::retry_requests(queue<Request*> requests)
 
 /***************************************************/
 
+void
+ConnectionManager::retry_timer_fired(Timer* timer, Request* req)
+{
+    vlogself(2) << "backoff over for req= " << req->objId();
+
+    const auto num_erased = retry_timers_.erase(req);
+    CHECK_EQ(num_erased, 1);
+
+    submit_request(req);
+}
+
+/***************************************************/
+
+void
+ConnectionManager::maybe_arm_hedge(Request* req, const uint32_t netloc_id)
+{
+    auto& hs = hedges_[req];
+    CHECK(!hs.timer);
+    hs.netloc_id = netloc_id;
+    hs.submit_time_ms = common::gettimeofdayMs(nullptr);
+    hs.orig_conn = nullptr;
+    hs.hedge_conn = nullptr;
+    hs.hedge_won = false;
+
+    if (ttfb_samples_ms_.size() < kMinNumTTFBSamplesToHedge) {
+        // we track it anyway, for its time-to-first-byte
+        return;
+    }
+
+    auto samples = ttfb_samples_ms_;
+    const auto nth = samples.begin()
+                     + ((samples.size() - 1) * hedge_ttfb_percentile_ / 100);
+    std::nth_element(samples.begin(), nth, samples.end());
+    const uint32_t deadline_ms = *nth;
+
+    vlogself(2) << "hedge req= " << req->objId()
+                << " if no response in " << deadline_ms << " ms";
+
+    hs.timer.reset(
+        new Timer(evbase_, true,
+                  boost::bind(&ConnectionManager::hedge_timer_fired,
+                              this, _1, req)));
+    hs.timer->start(deadline_ms);
+}
+
+/***************************************************/
+
+void
+ConnectionManager::hedge_timer_fired(Timer* timer, Request* orig)
+{
+    auto it = hedges_.find(orig);
+    CHECK(it != hedges_.end());
+    auto& hs = it->second;
+    CHECK(!hs.hedge);
+
+    if (!orig->conn) {
+        vlogself(2) << "req= " << orig->objId()
+                    << " is still waiting for a connection; don't hedge";
+        return;
+    }
+
+    CHECK_LT(hs.netloc_id, servers_.size());
+    auto server = servers_[hs.netloc_id];
+    CHECK(server);
+
+    // the original's connection is not idle, so any idle one is
+    // another connection
+    shared_ptr<Connection> conn;
+    if (!server->idle_connections_.empty()) {
+        conn = server->connections_.at(server->idle_connections_.front().objId());
+    } else if (server->connections_.size() < max_persist_cnx_per_srv_) {
+        conn = create_connection(server.get(), hs.netloc_id);
+    } else {
+        vlogself(2) << "no connection to hedge req= " << orig->objId() << " on";
+        return;
+    }
+    CHECK_NE(conn.get(), orig->conn);
+
+    // we are the copy's observer, and forward to the original
+    Request::UniquePtr hedge(
+        new Request(
+            this, orig->webkit_resInstNum_, hs.netloc_id,
+            orig->req_total_size(),
+            orig->exp_resp_meta_size(), orig->exp_resp_body_size()));
+    hedge->set_priority(orig->priority());
+    hedge->set_submit_time_ms(orig->submit_time_ms());
+
+    logself(INFO) << "hedge req= " << orig->objId() << " with req= "
+                  << hedge->objId() << " on conn= " << conn->objId();
+
+    auto hedge_ptr = hedge.get();
+    hs.orig_conn = orig->conn;
+    hs.hedge = std::move(hedge);
+    hs.hedge_conn = conn.get();
+    const auto ret = hedge_origs_.insert(make_pair(hedge_ptr, orig));
+    CHECK(ret.second);
+
+    conn->submit_request(hedge_ptr);
+    update_idle_state(server.get(), conn.get());
+}
+
+/***************************************************/
+
+Request*
+ConnectionManager::get_hedge_orig(Request* hedge) const
+{
+    const auto it = hedge_origs_.find(hedge);
+    CHECK(it != hedge_origs_.end()) << "req= " << hedge->objId()
+                                    << " is not a hedge";
+    return it->second;
+}
+
+/***************************************************/
+
+void
+ConnectionManager::onResponseMeta(Request* hedge, const int status,
+                                  char **headers) noexcept
+{
+    get_hedge_orig(hedge)->notify_rsp_meta(status, headers);
+}
+
+/***************************************************/
+
+void
+ConnectionManager::onResponseBodyData(Request* hedge,
+                                      const uint8_t *data,
+                                      const size_t& len) noexcept
+{
+    get_hedge_orig(hedge)->notify_rsp_body_data(data, len);
+}
+
+/***************************************************/
+
+void
+ConnectionManager::onResponseDone(Request* hedge) noexcept
+{
+    // we forget the hedge when its connection tells us it's done
+    get_hedge_orig(hedge)->notify_rsp_done();
+}
+
+/***************************************************/
+
+void
+ConnectionManager::cancel_hedge(Request* orig, const bool close_hedge_conn)
+{
+    auto it = hedges_.find(orig);
+    if (it == hedges_.end()) {
+        return;
+    }
+
+    auto& hs = it->second;
+    if (hs.hedge) {
+        if (close_hedge_conn && hs.hedge_conn) {
+            close_conn(hs.hedge_conn, hs.netloc_id);
+        }
+        hedge_origs_.erase(hs.hedge.get());
+    }
+
+    // this destroys the timer and the hedge
+    hedges_.erase(it);
+}
+
+/***************************************************/
+
+void
+ConnectionManager::add_ttfb_sample(const uint64_t ttfb_ms)
+{
+    if (ttfb_samples_ms_.size() < kMaxNumTTFBSamples) {
+        ttfb_samples_ms_.push_back(ttfb_ms);
+    } else {
+        ttfb_samples_ms_[next_ttfb_sample_idx_] = ttfb_ms;
+        next_ttfb_sample_idx_ = (next_ttfb_sample_idx_ + 1) % kMaxNumTTFBSamples;
+    }
+}
+
+/***************************************************/
+
 void
 ConnectionManager::get_total_bytes(size_t& tx, size_t& rx)
 {
@@ -289,13 +872,16 @@ ConnectionManager::get_total_bytes(size_t& tx, size_t& rx)
     tx = totaltxbytes_;
     rx = totalrxbytes_;
 
-    // pair<NetLoc, Server*> kv_pair;
-    for (const auto& kv_pair : servers_) {
-        vlogself(2) << "server [" << kv_pair.first.first << "]:" << kv_pair.first.second;
-        const auto server = kv_pair.second;
-        for (auto& c : server->connections_) {
-            tx += c->get_total_num_sent_bytes();
-            rx += c->get_total_num_recv_bytes();
+    for (size_t id = 1; id < servers_.size(); ++id) {
+        const auto& server = servers_[id];
+        if (!server) {
+            continue;
+        }
+        vlogself(2) << "server [" << netlocs_[id - 1].first << "]:"
+                    << netlocs_[id - 1].second;
+        for (const auto& kv : server->connections_) {
+            tx += kv.second->get_total_num_sent_bytes();
+            rx += kv.second->get_total_num_recv_bytes();
         }
     }
 
@@ -313,8 +899,10 @@ ConnectionManager::reset()
     is_resetting_ = true;
 
     // we don't touch the Request* pointers.
-    // pair<NetLoc, Server*> kv_pair;
     servers_.clear();
+    retry_timers_.clear();
+    hedges_.clear();
+    hedge_origs_.clear();
 
     timestamp_recv_first_byte_ = 0;
     totaltxbytes_ = totalrxbytes_ = 0;
@@ -328,33 +916,37 @@ ConnectionManager::reset()
 
 void
 ConnectionManager::release_conn(Connection *conn,
-                                const NetLoc& netloc)
+                                const uint32_t netloc_id)
 {
     vlogself(2) << "begin, releasing conn= "<< conn->objId();
 
     // remove it from active connections
-    CHECK(inMap(servers_, netloc));
-    auto& conns = servers_[netloc]->connections_;
-
-    auto finditer = std::find_if(
-        conns.begin(), conns.end(),
-        [&](shared_ptr<Connection> const& p) { return p.get() == conn; });
-    CHECK(finditer != conns.end());
-    conns.erase(finditer);
-    if (conns.size() == 0) {
-        vlogself(2) << "list is now empty --> remove this list from map"
-                    << " " << servers_[netloc]->requests_.size();
-        for (auto req : servers_[netloc]->requests_) {
-            notify_req_error_(req);
-        }
-        servers_.erase(netloc);
+    CHECK_LT(netloc_id, servers_.size());
+    auto server = servers_[netloc_id];
+    CHECK(server);
+    auto& conns = server->connections_;
+
+    if (conn->cnxman_idle_hook.is_linked()) {
+        conn->cnxman_idle_hook.unlink();
     }
 
+    const auto num_erased = conns.erase(conn->objId());
+    CHECK_EQ(num_erased, 1);
     totaltxbytes_ += conn->get_total_num_sent_bytes();
     totalrxbytes_ += conn->get_total_num_recv_bytes();
 
     vlogself(2) << "totaltxbytes_ " << totaltxbytes_ << ", totalrxbytes_ " << totalrxbytes_;
 
+    if (conns.size() == 0) {
+        vlogself(2) << "list is now empty, "
+                    << server->requests_.size() << " waiting requests";
+        /* the waiting requests haven't been sent, so whatever
+         * happened to this connection doesn't count against them:
+         * they get a new one. (this removes the server if none are
+         * waiting) */
+        dispatch_waiting_requests(netloc_id);
+    }
+
     vlogself(2) << "done";
 }
 
@@ -5,11 +5,15 @@
 #include <list>
 #include <map>
 #include <queue>
+#include <vector>
+#include <unordered_map>
 #include <utility>
 
 #include <boost/function.hpp>
+#include <boost/intrusive/list.hpp>
 
 #include "../object.hpp"
+#include "../timer.hpp"
 
 #include "request.hpp"
 #include "connection.hpp"
@@ -19,6 +23,7 @@ namespace http
 {
 
 class ConnectionManager : public Object
+                        , public RequestObserver
 {
 public:
 
@@ -30,16 +35,60 @@ public:
      *
      * Do NOT destroy the ConnectionManager object within the
      * "request_error_cb" stack.
+     *
+     * if "use_spdy", we use only one connection per server and
+     * multiplex all requests to that server onto it, i.e.,
+     * "max_persist_cnx_per_srv" is ignored.
+     *
+     * otherwise, if "http_pipeline_depth" > 1, we pipeline requests
+     * onto existing connections (the least loaded one first), up to
+     * that many per connection, before opening new connections.
+     *
+     * a request whose connection fails is sent again, up to
+     * "max_retries_per_resource" times, after an exponential backoff;
+     * the user sees one continuous response across the tries.
+     *
+     * if "hedge_ttfb_percentile" is non-zero (and we're using neither
+     * spdy nor pipelining), a request that hasn't received its first
+     * response byte by that percentile of the recent time-to-first-
+     * bytes gets a copy sent on another connection. whichever of the
+     * two gets its first response byte first wins, and the other's
+     * connection is closed.
      */
     ConnectionManager(struct event_base *evbase, 
                       const in_addr_t& socks5_addr, const in_port_t& socks5_port,
                       RequestErrorCb request_error_cb,
                       const uint8_t max_persist_cnx_per_srv=8,
-                      const uint8_t max_retries_per_resource=2);
+                      const uint8_t max_retries_per_resource=2,
+                      const bool use_spdy=false,
+                      const uint8_t http_pipeline_depth=1,
+                      const uint8_t hedge_ttfb_percentile=0);
 
     void submit_request(Request *req);
     void reset();
 
+    /* take back "req", which the user no longer wants, wherever it
+     * is: waiting for a connection or for its retry, or sent. an http
+     * connection that has it is closed, and the connection's other
+     * requests are sent again, without counting it as a retry.
+     *
+     * returns false if it's on a spdy connection, which we can't take
+     * it back from without closing everybody's streams: the user then
+     * gets its notifications as usual, and must keep it until it's
+     * done */
+    bool cancel_request(Request *req);
+
+    /* open connections to the netloc ahead of demand, so that there
+     * are "num_cnx" of them, capped at max_persist_cnx_per_srv. it's
+     * ok if there already are that many */
+    void preconnect(const std::string& host, const uint16_t& port,
+                    const uint8_t& num_cnx);
+
+    /* returns the interned id of the netloc, assigning one if this is
+     * the first time we see it. requests are created with this id.
+     * ids stay valid across reset() */
+    uint32_t get_netloc_id(const std::string& host, const uint16_t& port);
+
     uint64_t get_timestamp_recv_first_byte() const { return timestamp_recv_first_byte_; }
     void get_total_bytes(size_t& tx, size_t& rx);
 
@@ -49,32 +98,107 @@ private:
 
     virtual ~ConnectionManager() = default;
 
+    /***** RequestObserver interface, for the hedge copies: we
+     * forward to the originals */
+    virtual void onResponseMeta(Request*, const int status,
+                                char **headers) noexcept override;
+    virtual void onResponseBodyData(Request*, const uint8_t *data,
+                                    const size_t& len) noexcept override;
+    virtual void onResponseDone(Request*) noexcept override;
+
     /* to receive notification from Connection object. */
     void cnx_first_recv_byte_cb(Connection*);
-    void cnx_error_cb(Connection*, const NetLoc&);
-    void cnx_eof_cb(Connection*, const NetLoc&);
-    void cnx_request_done_cb(Connection*, const Request*, const NetLoc&);
+    void cnx_request_first_byte_cb(Connection*, Request*);
+    void cnx_error_cb(Connection*, const uint32_t netloc_id);
+    void cnx_eof_cb(Connection*, const uint32_t netloc_id);
+    void cnx_request_done_cb(Connection*, const Request*, const uint32_t netloc_id);
 
     bool retry_requests(std::queue<Request*> requests);
-    void handle_unusable_conn(Connection*, const NetLoc&);
+    void retry_timer_fired(Timer*, Request*);
+    void handle_unusable_conn(Connection*, const uint32_t netloc_id);
 
     // remove conn from pool but won't free it
-    void release_conn(Connection*, const NetLoc&);
+    void release_conn(Connection*, const uint32_t netloc_id);
+    // remove conn from pool and free it, without it notifying anybody
+    void close_conn(Connection*, const uint32_t netloc_id);
+
+    /* hedging */
+    void maybe_arm_hedge(Request*, const uint32_t netloc_id);
+    void hedge_timer_fired(Timer*, Request* orig);
+    /* the copy's original */
+    Request* get_hedge_orig(Request* hedge) const;
+    /* forget the hedge state of "orig", closing the copy's connection
+     * if "close_hedge_conn" */
+    void cancel_hedge(Request* orig, const bool close_hedge_conn);
+    void add_ttfb_sample(const uint64_t ttfb_ms);
+
+    struct NetLocHash
+    {
+        size_t operator()(const NetLoc& netloc) const
+        {
+            return std::hash<std::string>()(netloc.first) ^ netloc.second;
+        }
+    };
+
+    /* a request waiting for a connection */
+    struct PendingRequest
+    {
+        Request* req;
+        /* to keep requests of the same priority in submission order */
+        uint64_t seq;
+
+        /* for std::priority_queue, which puts the "largest" first */
+        bool operator<(const PendingRequest& other) const
+        {
+            if (req->priority() != other.req->priority()) {
+                return req->priority() < other.req->priority();
+            }
+            return seq > other.seq;
+        }
+    };
+
+    typedef boost::intrusive::list<
+        Connection,
+        boost::intrusive::member_hook<
+            Connection,
+            boost::intrusive::list_member_hook<
+                boost::intrusive::link_mode<boost::intrusive::auto_unlink> >,
+            &Connection::cnxman_idle_hook>,
+        boost::intrusive::constant_time_size<false> > IdleConnectionList;
 
     struct Server
     {
     public:
         ~Server() = default;
 
-        std::list<Request*> requests_;
-        std::list<std::shared_ptr<Connection> > connections_;
+        std::priority_queue<PendingRequest> requests_;
+        /* keyed by connection objId() */
+        std::unordered_map<uint32_t, std::shared_ptr<Connection> > connections_;
+        /* the connections in connections_ that have nothing queued */
+        IdleConnectionList idle_connections_;
     };
 
+    /* the server's connection with room for another request, or null
+     * if none */
+    std::shared_ptr<Connection> find_conn_with_room(Server*);
+    /* update whether conn is in the server's idle list */
+    void update_idle_state(Server*, Connection*);
+    /* give the server's waiting requests to connections with room,
+     * opening connections up to the limit */
+    void dispatch_waiting_requests(const uint32_t netloc_id);
+
+    /* the server state for the netloc, created if necessary */
+    std::shared_ptr<Server> get_server(const uint32_t netloc_id);
+    std::shared_ptr<Connection> create_connection(Server*, const uint32_t netloc_id);
+
     struct event_base *evbase_; // dont free
     const in_addr_t socks5_addr_;
     const in_port_t socks5_port_;
     uint8_t max_persist_cnx_per_srv_;
     uint8_t max_retries_per_resource_;
+    const bool use_spdy_;
+    const uint8_t http_pipeline_depth_;
+    const uint8_t hedge_ttfb_percentile_;
 
     uint64_t timestamp_recv_first_byte_;
     size_t totaltxbytes_;
@@ -84,9 +208,49 @@ private:
 
     RequestErrorCb notify_req_error_;
 
-    /* map key is "[hostname, port]" pair.
+    /* interned netlocs: id -> netloc is netlocs_[id - 1]. these stay
+     * across reset(), since requests keep their ids */
+    std::unordered_map<NetLoc, uint32_t, NetLocHash> netloc_ids_;
+    std::vector<NetLoc> netlocs_;
+
+    uint64_t next_pending_req_seq_;
+
+    /* indexed by netloc id; null if we have no state for that server
      */
-    std::map<NetLoc, std::shared_ptr<Server> > servers_;
+    std::vector<std::shared_ptr<Server> > servers_;
+
+    /* requests waiting out their backoff before being sent again */
+    std::unordered_map<Request*, Timer::UniquePtr> retry_timers_;
+
+    /* the requests that can be hedged, i.e., on their first try and
+     * with no response byte yet, keyed by the original request */
+    struct HedgeState
+    {
+        uint32_t netloc_id;
+        /* when we got the request, as opposed to the request's own
+         * submit time, which includes the session's throttling. the
+         * ttfb samples and the hedging deadline are both from this */
+        uint64_t submit_time_ms;
+        /* fires at the hedging deadline */
+        Timer::UniquePtr timer;
+        /* the original's connection, once hedged; null if we have
+         * closed it, or it has failed */
+        Connection* orig_conn;
+        /* the copy, once sent, and its connection */
+        Request::UniquePtr hedge;
+        Connection* hedge_conn;
+        /* the copy got the first response byte, so its response is
+         * the original's */
+        bool hedge_won;
+    };
+    std::unordered_map<Request*, HedgeState> hedges_;
+    /* copy -> original */
+    std::unordered_map<Request*, Request*> hedge_origs_;
+
+    /* recent times-to-first-byte, from submission to us (see
+     * HedgeState), as a ring */
+    std::vector<uint32_t> ttfb_samples_ms_;
+    size_t next_ttfb_sample_idx_;
 };
 
 } // end namespace http
@@ -2,10 +2,6 @@
 #include "request.hpp"
 #include "../easylogging++.h"
 
-using std::vector;
-using std::pair;
-using std::string;
-
 
 #define _LOG_PREFIX(inst) << "req= " << (inst)->objId() << ", res:" << (inst)->webkit_resInstNum_ << ": "
 
@@ -24,27 +20,28 @@ namespace http
 {
 
 Request::Request(
+    RequestObserver* observer,
     const uint32_t& webkit_resInstNum,
-    const string& host, const uint16_t& port,
+    const uint32_t& netloc_id,
     const size_t& req_total_size,
-    const size_t& resp_meta_size, const size_t& resp_body_size,
-    RequestAboutToSendCb req_about_to_send_cb,
-    ResponseMetaCb rsp_meta_cb, ResponseBodyDataCb rsp_body_data_cb,
-    ResponseDoneCb rsp_done_cb
+    const size_t& resp_meta_size, const size_t& resp_body_size
     )
     : webkit_resInstNum_(webkit_resInstNum)
-    , host_(host), port_(port)
+    , netloc_id_(netloc_id)
+    , conn(NULL)
+    , observer_(observer)
+    , num_retries_(0), priority_(0)
     , req_total_size_(req_total_size)
     , exp_resp_meta_size_(resp_meta_size), exp_resp_body_size_(resp_body_size)
-    , req_about_to_send_cb_(req_about_to_send_cb)
-    , rsp_meta_cb_(rsp_meta_cb), rsp_body_data_cb_(rsp_body_data_cb)
-    , rsp_done_cb_(rsp_done_cb)
-    , conn(NULL), num_retries_(0)
-    , actual_resp_body_size_(0)
+    , actual_resp_body_size_(0), resp_body_size_this_try_(0)
+    , rsp_meta_notified_(false)
     , first_byte_recv_time_(0)
+    , submit_time_ms_(0), sent_on_conn_id_(0), sent_time_ms_(0)
+    , connect_wait_ms_(0)
 {
     vlogself(2) << "a new request, res:" << webkit_resInstNum;
-    CHECK_GT(host_.length(), 0);
+    CHECK_NOTNULL(observer_);
+    CHECK_GT(netloc_id_, 0);
 }
 
 Request::~Request()
@@ -56,7 +53,7 @@ void
 Request::dump_debug() const
 {
     vlogself(2) << "dumping request to log:";
-    vlogself(2) << "  host: " << host_;
+    vlogself(2) << "  netloc id: " << netloc_id_;
 }
 
 } // end namespace http
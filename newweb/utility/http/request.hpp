@@ -1,10 +1,7 @@
 #ifndef SHD_REQUEST_HPP
 #define SHD_REQUEST_HPP
 
-#include <string>
-#include <vector>
 #include <memory>
-#include <boost/function.hpp>
 
 #include "../object.hpp"
 #include "../common.hpp"
@@ -14,47 +11,60 @@ namespace http
 {
 
 class Connection;
+class Request;
 
 
 /*
  * response "meta" is the non-body part of the response, i.e., the
  * status[line] and headers
+ *
+ * a user typically has many requests in flight, all handled the same
+ * way, so instead of each request carrying its own set of callbacks,
+ * the requests share the user's one observer.
  */
 
-class Request : public Object
+class RequestObserver
 {
 public:
+    /* the request is about to be sent into the network */
+    virtual void onRequestAboutToSend(Request*) noexcept {}
+
+    virtual void onResponseMeta(Request*, const int status,
+                                char **headers) noexcept = 0;
 
-    typedef boost::function<void(const int status, char **headers, Request* req)> ResponseMetaCb;
-    /* tell the user of a block of response body data */
-    typedef boost::function<void(const uint8_t *data, const size_t& len, Request* req)> ResponseBodyDataCb;
+    /* a block of response body data */
+    virtual void onResponseBodyData(Request*, const uint8_t *data,
+                                    const size_t& len) noexcept = 0;
 
     /*
-     * tell the user THE WHOLE response is done, whether or not there
-     * is a response body, i.e., if there is response no body, then
-     * this will be called after done receiving the headers
-     *
+     * THE WHOLE response is done, whether or not there is a response
+     * body, i.e., if there is response no body, then this will be
+     * called after done receiving the headers
      */
-    typedef boost::function<void(Request *req)> ResponseDoneCb;
+    virtual void onResponseDone(Request*) noexcept = 0;
+};
 
-    /* tell the user the request is about to be sent into the
-     * network */
-    typedef boost::function<void(Request *req)> RequestAboutToSendCb;
+/* just the sizes and ids of a request, and the state of its
+ * response: no strings or callbacks, so creating one is just the one
+ * allocation.
+ */
 
+class Request : public Object
+{
+public:
+    typedef std::unique_ptr<Request, folly::DelayedDestruction::Destructor> UniquePtr;
 
-    Request(const uint32_t& webkit_resInstNum,
-            const std::string& host, const uint16_t& port,
+    Request(RequestObserver* observer,
+            const uint32_t& webkit_resInstNum,
+            /* the [host, port] to send the request to, as interned by
+             * the connection manager's get_netloc_id() */
+            const uint32_t& netloc_id,
             /* how much to send to server, counting both header and
              * body */
             const size_t& req_total_size,
 
             /* how much to instruct server to send back */
-            const size_t& resp_meta_size, const size_t& resp_body_size,
-
-            RequestAboutToSendCb req_about_to_send_cb,
-            ResponseMetaCb rsp_meta_cb,
-            ResponseBodyDataCb rsp_body_data_cb,
-            ResponseDoneCb rsp_done_cb
+            const size_t& resp_meta_size, const size_t& resp_body_size
         );
 
     void notify_rsp_meta_bytes_recv()
@@ -66,46 +76,85 @@ public:
 
     // for response
     void notify_rsp_meta(const int status, char ** headers) {
+        if (rsp_meta_notified_) {
+            // an earlier try already told the user
+            return;
+        }
+        rsp_meta_notified_ = true;
         DestructorGuard dg(this);
-        rsp_meta_cb_(status, headers, this);
+        observer_->onResponseMeta(this, status, headers);
     }
     void notify_rsp_body_data(const uint8_t *data, const size_t& len) {
         // "data" IS null since we don't care about data, only len
-        actual_resp_body_size_ += len;
+        resp_body_size_this_try_ += len;
+        if (resp_body_size_this_try_ <= actual_resp_body_size_) {
+            // an earlier try already told the user about these bytes
+            return;
+        }
+        const size_t new_len = resp_body_size_this_try_ - actual_resp_body_size_;
+        actual_resp_body_size_ = resp_body_size_this_try_;
         DestructorGuard dg(this);
-        rsp_body_data_cb_(data, len, this);
+        observer_->onResponseBodyData(this, data, new_len);
     }
     void notify_rsp_done() {
         CHECK_EQ(exp_resp_body_size_, actual_resp_body_size_)
             << "exp: " << exp_resp_body_size_
             << ", actual: " << actual_resp_body_size_;
         DestructorGuard dg(this);
-        rsp_done_cb_(this);
+        observer_->onResponseDone(this);
     }
     void notify_req_about_to_send() {
-        if (req_about_to_send_cb_) {
-            DestructorGuard dg(this);
-            req_about_to_send_cb_(this);
-        }
+        DestructorGuard dg(this);
+        observer_->onRequestAboutToSend(this);
     }
     const size_t& actual_resp_body_size() const { return actual_resp_body_size_; }
     void dump_debug() const;
-    const std::vector<std::pair<std::string, std::string> > & get_headers() const {
-        return headers_;
-    }
+
+    /* higher is more important. a server's requests waiting for a
+     * connection are served in priority order, then in submission
+     * order */
+    void set_priority(const uint8_t& priority) { priority_ = priority; }
+    const uint8_t& priority() const { return priority_; }
 
     int32_t get_num_retries() const { return num_retries_; }
-    void increment_num_retries() { ++num_retries_; }
+    /* the conn man is about to send this request again. the response
+     * meta and body bytes that earlier tries have already told the
+     * user about won't be told again, so to the user the retry just
+     * continues the response */
+    void increment_num_retries() {
+        ++num_retries_;
+        restart_try();
+    }
+    /* likewise, but it's not the request's fault that it's sent
+     * again (e.g., its connection was closed for another request), so
+     * it doesn't count as a retry */
+    void restart_try() { resp_body_size_this_try_ = 0; }
 
     const size_t& req_total_size() const { return req_total_size_; }
     const size_t& exp_resp_meta_size() const { return exp_resp_meta_size_; }
     const size_t& exp_resp_body_size() const { return exp_resp_body_size_; }
     const uint64_t& first_byte_time_ms() const { return first_byte_recv_time_; }
 
+    /* for instrumentation: the conn man sets when the request is
+     * first submitted to it, and the connection that sends the
+     * request notes when it did, and how much of the wait in between
+     * was for the connection to connect. all in ms since the epoch */
+    void set_submit_time_ms(const uint64_t& t) { submit_time_ms_ = t; }
+    const uint64_t& submit_time_ms() const { return submit_time_ms_; }
+    void note_sent(const uint32_t& conn_id, const uint64_t& sent_time_ms,
+                   const uint32_t& connect_wait_ms)
+    {
+        sent_on_conn_id_ = conn_id;
+        sent_time_ms_ = sent_time_ms;
+        connect_wait_ms_ = connect_wait_ms;
+    }
+    const uint32_t& sent_on_conn_id() const { return sent_on_conn_id_; }
+    const uint64_t& sent_time_ms() const { return sent_time_ms_; }
+    const uint32_t& connect_wait_ms() const { return connect_wait_ms_; }
+
     // these are const, so ok to expose
     const uint32_t webkit_resInstNum_;
-    const std::string host_; /* for host header */
-    const uint16_t port_;
+    const uint32_t netloc_id_;
     /* the cnx handling this req. currently Request class is not doing
      * anything with this pointer; it's here only for convenience of
      * other code */
@@ -115,14 +164,10 @@ private:
 
     virtual ~Request();
 
-    std::vector<std::pair<std::string, std::string> > headers_;
-
-    RequestAboutToSendCb req_about_to_send_cb_;
-    ResponseMetaCb rsp_meta_cb_;
-    ResponseBodyDataCb rsp_body_data_cb_;
-    ResponseDoneCb rsp_done_cb_;
+    RequestObserver* observer_; // don't free
 
     uint8_t num_retries_;
+    uint8_t priority_;
 
     // this is how much we send to sever, counting both header and
     // body
@@ -132,12 +177,21 @@ private:
     const size_t exp_resp_meta_size_;
     const size_t exp_resp_body_size_;
 
-    // this is what we see
+    // this is what we see, and have told the user about, over all
+    // tries
     size_t actual_resp_body_size_;
+    size_t resp_body_size_this_try_;
+    bool rsp_meta_notified_;
 
     // time when we have the first byte for the response (NOT BODY but
     // any byte, i.e., the response status line)
     uint64_t first_byte_recv_time_;
+
+    uint64_t submit_time_ms_;
+    /* of the latest try */
+    uint32_t sent_on_conn_id_;
+    uint64_t sent_time_ms_;
+    uint32_t connect_wait_ms_;
 };
 
 
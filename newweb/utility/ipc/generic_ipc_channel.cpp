@@ -32,9 +32,11 @@ GenericIpcChannel::GenericIpcChannel(struct event_base* evbase,
     : evbase_(evbase)
     , stream_ch_(std::move(stream_ch))
     , is_client_(true)
+    , offer_large_msgs_(false)
     , msg_cb_(msg_cb)
     , channel_status_cb_(channel_status_cb)
     , next_call_msg_id_(1) /* client use odd call ids */
+    , call_timeout_timer_deadline_ms_(0)
 {
     stream_ch_->start_connecting(this);
 }
@@ -46,17 +48,19 @@ GenericIpcChannel::GenericIpcChannel(struct event_base* evbase,
     : evbase_(evbase)
     , stream_ch_(std::move(stream_ch))
     , is_client_(false)
+    , offer_large_msgs_(false)
     , msg_cb_(msg_cb)
     , called_cb_(called_cb)
     , channel_status_cb_(channel_status_cb)
     , next_call_msg_id_(2) /* server use even call ids */
+    , call_timeout_timer_deadline_ms_(0)
 {
     gen_msg_ch_.reset(
-        new GenericMessageChannel(std::move(stream_ch_), this));
+        new GenericMessageChannel(std::move(stream_ch_), this, evbase_));
 }
 
 void
-GenericIpcChannel::sendMsg(uint8_t type, uint16_t len, const uint8_t* buf)
+GenericIpcChannel::sendMsg(uint8_t type, uint32_t len, const uint8_t* buf)
 {
     DCHECK(gen_msg_ch_) << "generic ipc ch not avail yet";
     gen_msg_ch_->sendMsg(type, len, buf);
@@ -70,7 +74,24 @@ GenericIpcChannel::sendMsg(uint8_t type)
 }
 
 void
-GenericIpcChannel::call(uint8_t type, uint16_t len, const uint8_t* buf,
+GenericIpcChannel::offer_large_msgs()
+{
+    if (gen_msg_ch_) {
+        gen_msg_ch_->offer_large_msgs();
+    } else {
+        offer_large_msgs_ = true;
+    }
+}
+
+uint32_t
+GenericIpcChannel::max_msg_len() const
+{
+    DCHECK(gen_msg_ch_) << "generic ipc ch not avail yet";
+    return gen_msg_ch_->max_msg_len();
+}
+
+void
+GenericIpcChannel::call(uint8_t type, uint32_t len, const uint8_t* buf,
                         uint8_t resp_type, OnRespStatusCb on_resp_status_cb,
                         const uint8_t *timeoutSecs)
 {
@@ -83,26 +104,23 @@ GenericIpcChannel::call(uint8_t type, uint16_t len, const uint8_t* buf,
     auto const id = next_call_msg_id_;
     next_call_msg_id_ += 2;
 
-    pending_calls_[id].call_msg_type = type;
-    pending_calls_[id].exp_resp_msg_type = resp_type;
-    pending_calls_[id].on_resp_status_cb = on_resp_status_cb;
+    auto& call_info = pending_calls_[id];
+    call_info.call_msg_type = type;
+    call_info.exp_resp_msg_type = resp_type;
+    call_info.on_resp_status_cb = on_resp_status_cb;
     if (timeoutSecs) {
         CHECK_LE(*timeoutSecs, 30);
-        struct timeval timeout_tv = {0};
-        timeout_tv.tv_sec = *timeoutSecs;
-
-        pending_calls_[id].timeout_timer.reset(
-            new Timer(evbase_, true,
-                      boost::bind(&GenericIpcChannel::_on_timeout_waiting_resp,
-                                  this, _1, id)));
-        pending_calls_[id].timeout_timer->start(&timeout_tv);
+        const auto deadline_ms =
+            common::gettimeofdayMs(nullptr) + (*timeoutSecs * 1000);
+        call_deadlines_.push(std::make_pair(deadline_ms, id));
+        _arm_call_timeout_timer();
     }
 
     gen_msg_ch_->sendMsg(type, len, buf, id);
 }
 
 void
-GenericIpcChannel::reply(uint32_t id, uint8_t type, uint16_t len,
+GenericIpcChannel::reply(uint32_t id, uint8_t type, uint32_t len,
                          const uint8_t* buf)
 {
     vlogself(2) << "sending reply id: " << id << " type: " << unsigned(type);
@@ -113,7 +131,10 @@ void
 GenericIpcChannel::onConnected(StreamChannel*) noexcept
 {
     gen_msg_ch_.reset(
-        new GenericMessageChannel(std::move(stream_ch_), this));
+        new GenericMessageChannel(std::move(stream_ch_), this, evbase_));
+    if (offer_large_msgs_) {
+        gen_msg_ch_->offer_large_msgs();
+    }
     DestructorGuard dg(this);
     channel_status_cb_(this, ChannelStatus::READY);
 }
@@ -132,22 +153,26 @@ GenericIpcChannel::onConnectTimeout(StreamChannel*) noexcept
 
 void
 GenericIpcChannel::onRecvMsg(GenericMessageChannel*, uint8_t type, uint32_t id,
-                            uint16_t len, const uint8_t* buf) noexcept
+                            uint32_t len, const uint8_t* buf) noexcept
 {
     DestructorGuard dg(this);
 
     if (id == 0) {
         msg_cb_(this, type, len, buf);
     } else {
-        if (inMap(pending_calls_, id)) {
+        auto it = pending_calls_.find(id);
+        if (it != pending_calls_.end()) {
             // it's a response to one of our pending call
-            CHECK_EQ(type, pending_calls_[id].exp_resp_msg_type)
+            CHECK_EQ(type, it->second.exp_resp_msg_type)
                 << "call id " << id
-                << " type " << unsigned(pending_calls_[id].call_msg_type)
-                << " expects resp type " << unsigned(pending_calls_[id].exp_resp_msg_type)
+                << " type " << unsigned(it->second.call_msg_type)
+                << " expects resp type " << unsigned(it->second.exp_resp_msg_type)
                 << " but got type " << unsigned(type);
-            pending_calls_[id].on_resp_status_cb(this, RespStatus::RECV, len, buf);
-            pending_calls_.erase(id);
+            // done with it before the callback, which might make
+            // more calls. its deadline, if any, is left to expire
+            const auto on_resp_status_cb = std::move(it->second.on_resp_status_cb);
+            pending_calls_.erase(it);
+            on_resp_status_cb(this, RespStatus::RECV, len, buf);
 
         } else if (inSet(timed_out_call_ids_, id)) {
             timed_out_call_ids_.erase(id);
@@ -175,15 +200,72 @@ GenericIpcChannel::onError(myio::GenericMessageChannel*, int) noexcept
 }
 
 void
-GenericIpcChannel::_on_timeout_waiting_resp(Timer*, uint32_t id)
+GenericIpcChannel::_on_call_timeout_timer_fired(Timer*)
 {
-    CHECK(inMap(pending_calls_, id));
+    DestructorGuard dg(this);
+
+    call_timeout_timer_deadline_ms_ = 0;
+    const auto now_ms = common::gettimeofdayMs(nullptr);
 
-    pending_calls_[id].on_resp_status_cb(
-        this, RespStatus::TIMEDOUT, 0, nullptr);
-    pending_calls_.erase(id);
+    while (!call_deadlines_.empty()
+           && (call_deadlines_.top().first <= now_ms))
+    {
+        const auto id = call_deadlines_.top().second;
+        call_deadlines_.pop();
+
+        auto it = pending_calls_.find(id);
+        if (it == pending_calls_.end()) {
+            // got its response already
+            continue;
+        }
+
+        vlogself(2) << "call id " << id << " timed out";
+        const auto on_resp_status_cb = std::move(it->second.on_resp_status_cb);
+        pending_calls_.erase(it);
+        timed_out_call_ids_.insert(id);
+
+        on_resp_status_cb(this, RespStatus::TIMEDOUT, 0, nullptr);
+    }
+
+    _arm_call_timeout_timer();
+}
+
+void
+GenericIpcChannel::_arm_call_timeout_timer()
+{
+    // drop the deadlines of calls that are done, so we don't wake up
+    // for nothing
+    while (!call_deadlines_.empty()
+           && !inMap(pending_calls_, call_deadlines_.top().second))
+    {
+        call_deadlines_.pop();
+    }
+
+    if (call_deadlines_.empty()) {
+        return;
+    }
+
+    const auto deadline_ms = call_deadlines_.top().first;
+    if (call_timeout_timer_deadline_ms_
+        && (call_timeout_timer_deadline_ms_ <= deadline_ms))
+    {
+        // will fire in time
+        return;
+    }
+
+    if (!call_timeout_timer_) {
+        call_timeout_timer_.reset(
+            new Timer(evbase_, true,
+                      boost::bind(&GenericIpcChannel::_on_call_timeout_timer_fired,
+                                  this, _1)));
+    } else if (call_timeout_timer_->is_running()) {
+        call_timeout_timer_->cancel();
+    }
 
-    timed_out_call_ids_.insert(id);
+    const auto now_ms = common::gettimeofdayMs(nullptr);
+    const uint32_t delay_ms = (deadline_ms > now_ms) ? (deadline_ms - now_ms) : 0;
+    call_timeout_timer_->start(delay_ms);
+    call_timeout_timer_deadline_ms_ = deadline_ms;
 }
 
 } // end namespace myipc
@@ -5,8 +5,10 @@
 // #include <event2/event.h>
 // #include <event2/bufferevent.h>
 #include <memory>
-#include <map>
-#include <set>
+#include <queue>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 #include <boost/function.hpp>
 
 #include "../object.hpp"
@@ -54,14 +56,14 @@ public:
     };
 
     typedef boost::function<void(GenericIpcChannel*, ChannelStatus)> ChannelStatusCb;
-    typedef boost::function<void(GenericIpcChannel*, uint8_t type, uint16_t len,
+    typedef boost::function<void(GenericIpcChannel*, uint8_t type, uint32_t len,
                                  const uint8_t*)> OnMsgCb;
 
     /* if the status is RECV, then the resp msg can be obtained from
      * the buf pointer. any other status, e.g., TIMEDOUT or ERR, then
      * "len" will be 0 and the buf will be nullptr
      */
-    typedef boost::function<void(GenericIpcChannel*, RespStatus status, uint16_t len,
+    typedef boost::function<void(GenericIpcChannel*, RespStatus status, uint32_t len,
                                  const uint8_t* buf)> OnRespStatusCb;
     /* timed out waiting for response */
     typedef boost::function<void(GenericIpcChannel*)> RespTimeoutCb;
@@ -70,7 +72,7 @@ public:
      * the user must specify in its response
      */
     typedef boost::function<void(GenericIpcChannel*, uint32_t id, uint8_t type,
-                                 uint16_t len, const uint8_t*)> CalledCb;
+                                 uint32_t len, const uint8_t*)> CalledCb;
 
     /* will take ownership of the stream channel.
      *
@@ -89,19 +91,30 @@ public:
                                myio::StreamChannel::UniquePtr,
                                OnMsgCb, CalledCb, ChannelStatusCb);
 
-    void sendMsg(uint8_t type, uint16_t len, const uint8_t* buf);
+    /* "len" must be at most max_msg_len() */
+    void sendMsg(uint8_t type, uint32_t len, const uint8_t* buf);
     void sendMsg(uint8_t type); // send empty msg
 
+    /* offer the peer the framing that allows msgs over 64 KB; see
+     * GenericMessageChannel. the peer must be of this build or
+     * later. can be called before the channel is ready */
+    void offer_large_msgs();
+
+    /* the longest msg we can send now: 64 KB until the peer has
+     * agreed to larger ones, which takes a round trip after the
+     * offer */
+    uint32_t max_msg_len() const;
+
     /* make a call to the other peer, expecting a response message of
      * type "resp_type".
      *
      * "timeoutSecs" is optional timeout in seconds waiting for
      * response */
-    void call(uint8_t type, uint16_t len, const uint8_t* buf,
+    void call(uint8_t type, uint32_t len, const uint8_t* buf,
               uint8_t resp_type, OnRespStatusCb on_resp_status_cb,
               const uint8_t *timeoutSecs=nullptr);
     /* respond to a call */
-    void reply(uint32_t id, uint8_t type, uint16_t len, const uint8_t*);
+    void reply(uint32_t id, uint8_t type, uint32_t len, const uint8_t*);
 
 protected:
 
@@ -114,20 +127,25 @@ protected:
 
     /**** implement GeneriMessageChannelObserver interface *****/
     virtual void onRecvMsg(myio::GenericMessageChannel*, uint8_t, uint32_t,
-                           uint16_t, const uint8_t*) noexcept override;
+                           uint32_t, const uint8_t*) noexcept override;
     virtual void onEOF(myio::GenericMessageChannel*) noexcept override;
     virtual void onError(myio::GenericMessageChannel*, int) noexcept override;
 
     ////////
 
 
-    void _on_timeout_waiting_resp(Timer*, uint32_t id);
+    void _on_call_timeout_timer_fired(Timer*);
+    /* arm call_timeout_timer_ for the earliest pending deadline, if
+     * it's not armed for that already */
+    void _arm_call_timeout_timer();
 
 
     struct event_base* evbase_;
     myio::StreamChannel::UniquePtr stream_ch_;
     myio::GenericMessageChannel::UniquePtr gen_msg_ch_;
     const bool is_client_;
+    /* to offer once the client is connected */
+    bool offer_large_msgs_;
 
     OnMsgCb msg_cb_; /* for notifying user of non-reply msgs */
     ChannelStatusCb channel_status_cb_;
@@ -140,14 +158,26 @@ protected:
         uint8_t call_msg_type; /* save the msg type of the call */
         uint8_t exp_resp_msg_type; /* expected response msg type */
         OnRespStatusCb on_resp_status_cb;
-        Timer::UniquePtr timeout_timer;
     };
-    std::map<uint32_t, CallInfo> pending_calls_;
+    std::unordered_map<uint32_t, CallInfo> pending_calls_;
+
+    /* (deadline in ms, call id) of the calls with timeouts, earliest
+     * first. one timer for all of them: it's armed for the earliest
+     * deadline. a call that gets its response before its deadline
+     * stays here until the deadline comes up, when we see it's no
+     * longer pending and skip it
+     */
+    typedef std::pair<uint64_t, uint32_t> CallDeadline;
+    std::priority_queue<CallDeadline, std::vector<CallDeadline>,
+                        std::greater<CallDeadline> > call_deadlines_;
+    Timer::UniquePtr call_timeout_timer_;
+    /* the deadline the timer is armed for; 0 if not armed */
+    uint64_t call_timeout_timer_deadline_ms_;
 
     /* to store ids of calls that have timed out so we can ignore the
      * response when they arrive
      */
-    std::set<uint32_t> timed_out_call_ids_;
+    std::unordered_set<uint32_t> timed_out_call_ids_;
 };
 
 
@@ -0,0 +1,57 @@
+#ifndef msg_buf_builder_hpp
+#define msg_buf_builder_hpp
+
+#include <flatbuffers/flatbuffers.h>
+
+namespace myipc
+{
+
+/* a flatbuffers builder to keep around, e.g., one per ipc endpoint,
+ * and reuse for all the msgs it sends: clearing it keeps its buffer,
+ * so once that has grown to fit the biggest msg, building and sending
+ * msgs doesn't allocate.
+ *
+ * it's for one msg at a time: call start() before creating anything
+ * (strings, vectors, etc.) for the msg, and finish_msg() when done,
+ * e.g.:
+ *
+ *   {
+ *       auto& bufbuilder = bufbuilder_.start();
+ *       auto url = bufbuilder.CreateString(...);
+ *       msgs::FooMsgBuilder msgbuilder(bufbuilder);
+ *       msgbuilder.add_url(url);
+ *       const auto len = bufbuilder.finish_msg(msgbuilder);
+ *       ipc_ch->sendMsg(msgs::type_Foo, len, bufbuilder.GetBufferPointer());
+ *   }
+ *
+ * the BEGIN_BUILD_*_AND_SEND_AT_END macros of the ipc senders wrap
+ * the last three lines.
+ */
+class MsgBufBuilder : public flatbuffers::FlatBufferBuilder
+{
+public:
+    explicit MsgBufBuilder(size_t initial_size=1024)
+        : flatbuffers::FlatBufferBuilder(initial_size)
+    {}
+
+    /* clear the builder for a new msg; returns *this for
+     * convenience */
+    MsgBufBuilder& start()
+    {
+        Clear();
+        return *this;
+    }
+
+    /* finish the msg and the buffer, and return the length to send.
+     * the channel checks that it's within its max_msg_len() */
+    template <typename MsgBuilderT>
+    uint32_t finish_msg(MsgBuilderT& msgbuilder)
+    {
+        Finish(msgbuilder.Finish());
+        return GetSize();
+    }
+};
+
+} // end myipc namespace
+
+#endif /* msg_buf_builder_hpp */
@@ -0,0 +1,823 @@
+
+#ifndef IN_SHADOW
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <string.h>
+#include <stddef.h>
+#include <event2/event.h>
+#include <event2/buffer.h>
+#include <atomic>
+#include <new>
+#include <boost/bind.hpp>
+
+#include "shm_ring_channel.hpp"
+#include "spsc_ring.hpp"
+#include "easylogging++.h"
+#include "common.hpp"
+
+
+#define _LOG_PREFIX(inst) << "shmCh= " << (inst)->objId() << " (fd=" << sock_fd_ << "): "
+
+/* "inst" stands for instance, as in, instance of a class */
+#define vloginst(level, inst) VLOG(level) _LOG_PREFIX(inst)
+#define vlogself(level) vloginst(level, this)
+
+#define dvloginst(level, inst) DVLOG(level) _LOG_PREFIX(inst)
+#define dvlogself(level) dvloginst(level, this)
+
+#define loginst(level, inst) LOG(level) _LOG_PREFIX(inst)
+#define logself(level) loginst(level, this)
+
+
+namespace myio {
+
+/* what's in the memfd. both sides must be the same build, which the
+ * magic and version try to catch */
+struct ShmRingRegion
+{
+    static const uint32_t MAGIC = 0x6e777368; // "nwsh"
+    static const uint32_t VERSION = 1;
+
+    typedef SPSCRing<uint8_t, (1 << 20)> Ring;
+
+    /* rings[0] is client to server, rings[1] server to client */
+    static const int CLIENT_TO_SERVER = 0;
+    static const int SERVER_TO_CLIENT = 1;
+
+    uint32_t magic;
+    uint32_t version;
+
+    /* set by the writer of a ring when it finds the ring full; the
+     * reader clears it and rings the writer's doorbell once it has
+     * made space */
+    std::atomic<uint32_t> writer_waiting[2];
+    /* likewise, set by the reader of a ring when it finds the ring
+     * empty and is about to sleep; the writer clears it and rings the
+     * reader's doorbell once it has pushed */
+    std::atomic<uint32_t> reader_waiting[2];
+
+    Ring rings[2];
+};
+
+/* what the client sends along with the fds */
+struct ShmRingHello
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t region_size;
+};
+
+/* the fds the client sends, in this order */
+static const int s_num_passed_fds = 3; // memfd, server's and client's doorbells
+
+/* how long the server waits for the client's hello after accepting */
+static const int s_hello_timeout_ms = 1000;
+
+/*******************************************/
+
+ShmRingChannel::ShmRingChannel(struct event_base *evbase,
+                               const std::string& name,
+                               StreamChannelObserver* observer)
+    : ShmRingChannel(evbase, name, observer, true)
+{
+    // observer can be set later with set_observer()
+}
+
+ShmRingChannel::ShmRingChannel(struct event_base *evbase,
+                               const std::string& name,
+                               StreamChannelObserver* observer,
+                               const bool is_client)
+    : StreamChannel(observer)
+    , evbase_(evbase), connect_observer_(nullptr)
+    , name_(name), is_client_(is_client)
+    , state_(ChannelState::INIT)
+    , sock_fd_(-1), my_doorbell_fd_(-1), peer_doorbell_fd_(-1)
+    , region_(nullptr)
+    , in_ring_idx_(is_client
+                   ? ShmRingRegion::SERVER_TO_CLIENT
+                   : ShmRingRegion::CLIENT_TO_SERVER)
+    , out_ring_idx_(is_client
+                    ? ShmRingRegion::CLIENT_TO_SERVER
+                    : ShmRingRegion::SERVER_TO_CLIENT)
+    , connect_errno_(0)
+    , doorbell_ev_(nullptr, event_free)
+    , socket_read_ev_(nullptr, event_free)
+    , input_evb_(evbuffer_new(), evbuffer_free)
+    , output_evb_(evbuffer_new(), evbuffer_free)
+    , read_lw_mark_(0)
+{
+    CHECK_NOTNULL(input_evb_.get());
+    CHECK_NOTNULL(output_evb_.get());
+    // the rings only work across processes if these don't need locks
+    CHECK(std::atomic<size_t>().is_lock_free());
+    CHECK(std::atomic<uint32_t>().is_lock_free());
+}
+
+ShmRingChannel::UniquePtr
+ShmRingChannel::create_from_accepted(struct event_base *evbase,
+                                     const int sock_fd,
+                                     StreamChannelConnectObserver* observer)
+{
+    UniquePtr channel(new ShmRingChannel(evbase, "", nullptr, false));
+    channel->sock_fd_ = sock_fd;
+    channel->connect_observer_ = observer;
+    CHECK_NOTNULL(channel->connect_observer_);
+    channel->_start_reading_hello();
+    return channel;
+}
+
+void
+ShmRingChannel::get_sockaddr(const std::string& name,
+                             struct sockaddr_un& addr, socklen_t& addrlen)
+{
+    bzero(&addr, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    // abstract socket: starts with a nul, and is not a file
+    CHECK_LT(name.size() + 1, sizeof addr.sun_path) << "name too long";
+    memcpy(addr.sun_path + 1, name.c_str(), name.size());
+    addrlen = offsetof(struct sockaddr_un, sun_path) + 1 + name.size();
+}
+
+ShmRingChannel::~ShmRingChannel()
+{
+    close();
+}
+
+int
+ShmRingChannel::start_connecting(StreamChannelConnectObserver* observer,
+                                 struct timeval */*connect_timeout*/)
+{
+    CHECK_EQ(state_, ChannelState::INIT);
+    CHECK(is_client_);
+
+    vlogself(2) << "start connecting to " << name_;
+
+    connect_observer_ = observer;
+    CHECK_NOTNULL(connect_observer_);
+
+    // connecting to a local unix socket, and sending it our fds,
+    // doesn't block, so do it now; but call the connect observer in a
+    // separate stack, like TCPChannel
+    connect_errno_ = _setup_as_client();
+    state_ = ChannelState::CONNECTING;
+
+    connect_cb_timer_.reset(
+        new Timer(evbase_, true,
+                  boost::bind(&ShmRingChannel::_on_connect_cb_timer_fired, this, _1)));
+    connect_cb_timer_->start(0u);
+
+    return 0;
+}
+
+int
+ShmRingChannel::_setup_as_client()
+{
+    sock_fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    CHECK_NE(sock_fd_, -1);
+
+    struct sockaddr_un addr;
+    socklen_t addrlen = 0;
+    get_sockaddr(name_, addr, addrlen);
+
+    auto rv = connect(sock_fd_, (struct sockaddr*)&addr, addrlen);
+    if (rv) {
+        const auto err = errno;
+        vlogself(1) << "connect() errno: " << err << " (" << strerror(err) << ")";
+        return err;
+    }
+
+    const int shm_fd = memfd_create("newweb-shm-ring", MFD_CLOEXEC);
+    CHECK_NE(shm_fd, -1) << "memfd_create: " << strerror(errno);
+    rv = ftruncate(shm_fd, sizeof (ShmRingRegion));
+    CHECK_EQ(rv, 0) << "ftruncate: " << strerror(errno);
+    CHECK(_map_region(shm_fd, true));
+
+    my_doorbell_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    CHECK_NE(my_doorbell_fd_, -1);
+    peer_doorbell_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    CHECK_NE(peer_doorbell_fd_, -1);
+
+    ShmRingHello hello;
+    hello.magic = ShmRingRegion::MAGIC;
+    hello.version = ShmRingRegion::VERSION;
+    hello.region_size = sizeof (ShmRingRegion);
+
+    struct iovec iov;
+    iov.iov_base = &hello;
+    iov.iov_len = sizeof hello;
+
+    const int fds[s_num_passed_fds] = {shm_fd, peer_doorbell_fd_, my_doorbell_fd_};
+    char cmsgbuf[CMSG_SPACE(sizeof fds)];
+    bzero(cmsgbuf, sizeof cmsgbuf);
+
+    struct msghdr msg;
+    bzero(&msg, sizeof msg);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cmsgbuf;
+    msg.msg_controllen = sizeof cmsgbuf;
+
+    auto cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof fds);
+    memcpy(CMSG_DATA(cmsg), fds, sizeof fds);
+
+    const auto sent = sendmsg(sock_fd_, &msg, MSG_NOSIGNAL);
+    // the mapping keeps the memory
+    ::close(shm_fd);
+    if (sent != sizeof hello) {
+        const auto err = (sent < 0) ? errno : EPROTO;
+        vlogself(1) << "sendmsg() errno: " << err << " (" << strerror(err) << ")";
+        return err;
+    }
+
+    rv = evutil_make_socket_nonblocking(sock_fd_);
+    CHECK_EQ(rv, 0);
+
+    return 0;
+}
+
+void
+ShmRingChannel::_start_reading_hello()
+{
+    CHECK_EQ(state_, ChannelState::INIT);
+    CHECK(!is_client_);
+    CHECK_NE(sock_fd_, -1);
+
+    state_ = ChannelState::CONNECTING;
+
+    auto rv = evutil_make_socket_nonblocking(sock_fd_);
+    CHECK_EQ(rv, 0);
+
+    socket_read_ev_.reset(
+        event_new(evbase_, sock_fd_, EV_READ, s_hello_readable_cb, this));
+    CHECK_NOTNULL(socket_read_ev_.get());
+    rv = event_add(socket_read_ev_.get(), nullptr);
+    CHECK_EQ(rv, 0);
+
+    // the client sends its hello right after connecting, so we
+    // shouldn't wait long
+    hello_timeout_timer_.reset(
+        new Timer(evbase_, true,
+                  boost::bind(&ShmRingChannel::_on_hello_timeout_timer_fired,
+                              this, _1)));
+    hello_timeout_timer_->start(s_hello_timeout_ms);
+}
+
+int
+ShmRingChannel::_setup_as_server()
+{
+    CHECK(!is_client_);
+    CHECK_NE(sock_fd_, -1);
+
+    ShmRingHello hello;
+    struct iovec iov;
+    iov.iov_base = &hello;
+    iov.iov_len = sizeof hello;
+
+    int fds[s_num_passed_fds];
+    char cmsgbuf[CMSG_SPACE(sizeof fds)];
+
+    struct msghdr msg;
+    bzero(&msg, sizeof msg);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cmsgbuf;
+    msg.msg_controllen = sizeof cmsgbuf;
+
+    const auto received = recvmsg(sock_fd_, &msg, MSG_CMSG_CLOEXEC);
+    if ((received < 0) && (errno == EAGAIN)) {
+        return EAGAIN;
+    }
+    auto cmsg = CMSG_FIRSTHDR(&msg);
+    if ((received != sizeof hello) || !cmsg
+        || (cmsg->cmsg_level != SOL_SOCKET) || (cmsg->cmsg_type != SCM_RIGHTS)
+        || (cmsg->cmsg_len != CMSG_LEN(sizeof fds)))
+    {
+        logself(WARNING) << "bad hello from client, received= " << received;
+        return (received < 0) ? errno : EPROTO;
+    }
+    memcpy(fds, CMSG_DATA(cmsg), sizeof fds);
+
+    const auto shm_fd = fds[0];
+    my_doorbell_fd_ = fds[1];
+    peer_doorbell_fd_ = fds[2];
+
+    if ((hello.magic != ShmRingRegion::MAGIC)
+        || (hello.version != ShmRingRegion::VERSION)
+        || (hello.region_size != sizeof (ShmRingRegion)))
+    {
+        logself(WARNING) << "client's region is not what we expect: magic= "
+                         << hello.magic << " version= " << hello.version
+                         << " size= " << hello.region_size;
+        ::close(shm_fd);
+        return EPROTO;
+    }
+
+    const auto mapped = _map_region(shm_fd, false);
+    ::close(shm_fd);
+    if (!mapped) {
+        return EPROTO;
+    }
+
+    vlogself(2) << "contructed a (server) shm ring chan";
+    return 0;
+}
+
+bool
+ShmRingChannel::_map_region(const int shm_fd, const bool init)
+{
+    CHECK(!region_);
+
+    auto addr = mmap(nullptr, sizeof (ShmRingRegion), PROT_READ | PROT_WRITE,
+                     MAP_SHARED, shm_fd, 0);
+    if (addr == MAP_FAILED) {
+        logself(WARNING) << "mmap: " << strerror(errno);
+        return false;
+    }
+
+    if (init) {
+        region_ = new (addr) ShmRingRegion();
+        region_->magic = ShmRingRegion::MAGIC;
+        region_->version = ShmRingRegion::VERSION;
+        region_->writer_waiting[0] = region_->writer_waiting[1] = 0;
+        // neither reader has looked yet
+        region_->reader_waiting[0] = region_->reader_waiting[1] = 1;
+    } else {
+        region_ = (ShmRingRegion*)addr;
+        if (region_->magic != ShmRingRegion::MAGIC) {
+            logself(WARNING) << "bad magic in region";
+            return false;
+        }
+    }
+    return true;
+}
+
+void
+ShmRingChannel::_initialize_events()
+{
+    CHECK_EQ(state_, ChannelState::CONNECTED);
+
+    doorbell_ev_.reset(
+        event_new(evbase_, my_doorbell_fd_, EV_READ | EV_PERSIST,
+                  s_doorbell_cb, this));
+    CHECK_NOTNULL(doorbell_ev_.get());
+    auto rv = event_add(doorbell_ev_.get(), nullptr);
+    CHECK_EQ(rv, 0);
+
+    socket_read_ev_.reset(
+        event_new(evbase_, sock_fd_, EV_READ | EV_PERSIST,
+                  s_socket_readable_cb, this));
+    CHECK_NOTNULL(socket_read_ev_.get());
+    rv = event_add(socket_read_ev_.get(), nullptr);
+    CHECK_EQ(rv, 0);
+}
+
+void
+ShmRingChannel::_on_connect_cb_timer_fired(Timer*)
+{
+    CHECK_EQ(state_, ChannelState::CONNECTING);
+
+    DestructorGuard dg(this);
+
+    if (connect_errno_) {
+        close();
+        connect_observer_->onConnectError(this, connect_errno_);
+        return;
+    }
+
+    state_ = ChannelState::CONNECTED;
+    _initialize_events();
+    // anything written before we were connected
+    _flush_output();
+    connect_observer_->onConnected(this);
+}
+
+void
+ShmRingChannel::_on_hello_readable(int fd, short /*what*/)
+{
+    CHECK_EQ(fd, sock_fd_);
+    CHECK_EQ(state_, ChannelState::CONNECTING);
+
+    DestructorGuard dg(this);
+
+    const auto err = _setup_as_server();
+    if (err == EAGAIN) {
+        // spurious; keep waiting
+        const auto rv = event_add(socket_read_ev_.get(), nullptr);
+        CHECK_EQ(rv, 0);
+        return;
+    }
+
+    hello_timeout_timer_.reset();
+
+    if (err) {
+        close();
+        connect_observer_->onConnectError(this, err);
+        return;
+    }
+
+    state_ = ChannelState::CONNECTED;
+    // replaces the hello event
+    _initialize_events();
+    connect_observer_->onConnected(this);
+}
+
+void
+ShmRingChannel::_on_hello_timeout_timer_fired(Timer*)
+{
+    CHECK_EQ(state_, ChannelState::CONNECTING);
+
+    DestructorGuard dg(this);
+
+    logself(WARNING) << "no hello from client";
+    close();
+    connect_observer_->onConnectTimeout(this);
+}
+
+void
+ShmRingChannel::get_peer_name(std::string& address, uint16_t& port) const
+{
+    CHECK_EQ(state_, ChannelState::CONNECTED);
+    address = name_;
+    port = 0;
+}
+
+void
+ShmRingChannel::set_observer(StreamChannelObserver* observer)
+{
+    StreamChannel::set_observer(observer);
+
+    // same limitation as TCPChannel: the new observer hears about
+    // input only when more comes in
+    CHECK_EQ(get_avail_input_length(), 0);
+}
+
+int
+ShmRingChannel::read(uint8_t *data, size_t len)
+{
+    CHECK(input_evb_);
+    return evbuffer_remove(input_evb_.get(), data, len);
+}
+
+int
+ShmRingChannel::read_buffer(struct evbuffer* buf, size_t len)
+{
+    CHECK(input_evb_);
+    return evbuffer_remove_buffer(input_evb_.get(), buf, len);
+}
+
+int
+ShmRingChannel::drain(size_t len)
+{
+    CHECK(input_evb_);
+    return evbuffer_drain(input_evb_.get(), len);
+}
+
+uint8_t*
+ShmRingChannel::peek(ssize_t len)
+{
+    CHECK(input_evb_);
+    return evbuffer_pullup(input_evb_.get(), len);
+}
+
+void
+ShmRingChannel::drop_future_input(StreamChannelInputDropObserver*,
+                                  size_t, bool)
+{
+    logself(FATAL) << "not supported";
+}
+
+size_t
+ShmRingChannel::get_avail_input_length() const
+{
+    CHECK(input_evb_);
+    return evbuffer_get_length(input_evb_.get());
+}
+
+size_t
+ShmRingChannel::get_output_length() const
+{
+    CHECK(output_evb_);
+    return evbuffer_get_length(output_evb_.get());
+}
+
+void
+ShmRingChannel::set_read_watermark(size_t lowmark, size_t highmark)
+{
+    read_lw_mark_ = lowmark;
+    CHECK_EQ(highmark, 0);
+}
+
+int
+ShmRingChannel::write(const uint8_t *data, size_t size)
+{
+    CHECK(output_evb_);
+    const auto rv = evbuffer_add(output_evb_.get(), data, size);
+    if (!rv) {
+        _flush_output();
+    }
+    return rv;
+}
+
+int
+ShmRingChannel::write_buffer(struct evbuffer* buf)
+{
+    CHECK(output_evb_) _LOG_PREFIX(this);
+    const auto rv = evbuffer_add_buffer(output_evb_.get(), buf);
+    if (!rv) {
+        _flush_output();
+    }
+    return rv;
+}
+
+int
+ShmRingChannel::write_dummy(size_t len)
+{
+    CHECK(output_evb_);
+    while (len > 0) {
+        const auto num_to_add = std::min(len, common::static_bytes_length);
+        const auto rv = evbuffer_add_reference(
+            output_evb_.get(), common::static_bytes->c_str(),
+            num_to_add, nullptr, nullptr);
+        CHECK_EQ(rv, 0);
+        len -= num_to_add;
+    }
+    _flush_output();
+    return 0;
+}
+
+int
+ShmRingChannel::write_reference(const uint8_t *data, size_t len)
+{
+    CHECK(output_evb_);
+    const auto rv = evbuffer_add_reference(
+        output_evb_.get(), data, len, nullptr, nullptr);
+    if (!rv) {
+        _flush_output();
+    }
+    return rv;
+}
+
+void
+ShmRingChannel::close()
+{
+    if (state_ == ChannelState::CLOSED) {
+        return;
+    }
+
+    state_ = ChannelState::CLOSED;
+    connect_cb_timer_.reset();
+    hello_timeout_timer_.reset();
+    doorbell_ev_.reset();
+    socket_read_ev_.reset();
+    input_evb_.reset();
+    output_evb_.reset();
+
+    if (region_) {
+        munmap(region_, sizeof (ShmRingRegion));
+        region_ = nullptr;
+    }
+    for (auto fd : {&sock_fd_, &my_doorbell_fd_, &peer_doorbell_fd_}) {
+        if (*fd != -1) {
+            ::close(*fd);
+            *fd = -1;
+        }
+    }
+}
+
+bool
+ShmRingChannel::is_closed() const
+{
+    return state_ == ChannelState::CLOSED;
+}
+
+int
+ShmRingChannel::release_fd()
+{
+    logself(FATAL) << "not supported";
+    return -1;
+}
+
+/********************/
+
+/* the rings have no locks, and neither do the doorbells: a side that
+ * is about to sleep sets its waiting flag, and a side that has made
+ * progress updates its ring index; each then reads what the other
+ * wrote after a seq_cst fence, so at least one of the two always sees
+ * the other's update, and either the sleeper doesn't sleep or it gets
+ * rung */
+
+void
+ShmRingChannel::_flush_output()
+{
+    if (state_ != ChannelState::CONNECTED) {
+        // will flush when connected
+        return;
+    }
+
+    auto& ring = region_->rings[out_ring_idx_];
+    size_t num_pushed = 0;
+
+    while (evbuffer_get_length(output_evb_.get())) {
+        struct evbuffer_iovec vec;
+        const auto nvecs = evbuffer_peek(output_evb_.get(), -1, nullptr, &vec, 1);
+        CHECK_GE(nvecs, 1);
+
+        const auto pushed = ring.push_n((const uint8_t*)vec.iov_base, vec.iov_len);
+        if (pushed) {
+            auto rv = evbuffer_drain(output_evb_.get(), pushed);
+            CHECK_EQ(rv, 0);
+            num_pushed += pushed;
+            continue;
+        }
+
+        // the ring is full: ask the reader to ring us when it makes
+        // space, then look again in case it just did
+        region_->writer_waiting[out_ring_idx_].store(1);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (ring.size() == ring.capacity()) {
+            vlogself(3) << "ring full; "
+                        << evbuffer_get_length(output_evb_.get())
+                        << " bytes wait";
+            break;
+        }
+    }
+
+    if (num_pushed) {
+        num_total_written_bytes_ += num_pushed;
+
+        // the reader might have found the ring empty before we
+        // pushed, and gone to sleep
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        auto& reader_waiting = region_->reader_waiting[out_ring_idx_];
+        if (reader_waiting.load() && reader_waiting.exchange(0)) {
+            _ring_peer();
+        }
+    }
+}
+
+size_t
+ShmRingChannel::_pull_input()
+{
+    auto& ring = region_->rings[in_ring_idx_];
+    size_t num_pulled = 0;
+
+    while (true) {
+        const uint8_t* data = nullptr;
+        const auto avail = ring.front_n(&data);
+        if (!avail) {
+            // ask the writer to ring us when it pushes, then look
+            // again in case it just did
+            region_->reader_waiting[in_ring_idx_].store(1);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (ring.empty()) {
+                break;
+            }
+            continue;
+        }
+
+        auto rv = evbuffer_add(input_evb_.get(), data, avail);
+        CHECK_EQ(rv, 0);
+        ring.pop_n(avail);
+        num_pulled += avail;
+    }
+
+    if (num_pulled) {
+        num_total_read_bytes_ += num_pulled;
+
+        // we have made space; the fence above is between our pop and
+        // this load
+        auto& writer_waiting = region_->writer_waiting[in_ring_idx_];
+        if (writer_waiting.load() && writer_waiting.exchange(0)) {
+            _ring_peer();
+        }
+    }
+
+    return num_pulled;
+}
+
+void
+ShmRingChannel::_ring_peer()
+{
+    const uint64_t one = 1;
+    const auto rv = ::write(peer_doorbell_fd_, &one, sizeof one);
+    // EAGAIN only if the counter is about to overflow, in which case
+    // the peer has plenty of wake-ups pending anyway
+    CHECK((rv == sizeof one) || (errno == EAGAIN))
+        << "errno= " << errno << " (" << strerror(errno) << ")";
+}
+
+void
+ShmRingChannel::_on_doorbell(int fd, short /*what*/)
+{
+    CHECK_EQ(fd, my_doorbell_fd_);
+
+    vlogself(3) << "begin";
+
+    DestructorGuard dg(this);
+
+    uint64_t count = 0;
+    const auto rv = ::read(my_doorbell_fd_, &count, sizeof count);
+    CHECK((rv == sizeof count) || (errno == EAGAIN));
+
+    // the peer might have made space for our output, and/or given us
+    // input
+    const auto had_output = evbuffer_get_length(output_evb_.get()) > 0;
+    _flush_output();
+
+    const auto num_pulled = _pull_input();
+    vlogself(3) << "pulled " << num_pulled << " bytes";
+    if (num_pulled
+        && (evbuffer_get_length(input_evb_.get()) >= read_lw_mark_)
+        && observer_)
+    {
+        observer_->onNewReadDataAvailable(this);
+    }
+
+    if (had_output && (state_ == ChannelState::CONNECTED)
+        && !evbuffer_get_length(output_evb_.get()) && observer_)
+    {
+        observer_->onWrittenData(this);
+    }
+
+    vlogself(3) << "done";
+}
+
+void
+ShmRingChannel::_on_socket_readable(int fd, short /*what*/)
+{
+    CHECK_EQ(fd, sock_fd_);
+
+    DestructorGuard dg(this);
+
+    char buf[64];
+    const auto rv = ::read(sock_fd_, buf, sizeof buf);
+    if (rv > 0) {
+        logself(WARNING) << "unexpected " << rv << " bytes on the socket";
+    } else if (rv == 0) {
+        // the peer is gone, but it might have left us input
+        if (_pull_input() && observer_) {
+            observer_->onNewReadDataAvailable(this);
+        }
+        if (state_ != ChannelState::CLOSED) {
+            _on_eof();
+        }
+    } else if (errno != EAGAIN) {
+        _on_error(errno);
+    }
+}
+
+void
+ShmRingChannel::_on_eof()
+{
+    vlogself(2) << "begin";
+    // assuming desctructorguard already set up
+    close();
+
+    CHECK_NOTNULL(observer_);
+    observer_->onEOF(this);
+    vlogself(2) << "done";
+}
+
+void
+ShmRingChannel::_on_error(int errorcode)
+{
+    vlogself(2) << "begin";
+    // assuming desctructorguard already set up
+    close();
+
+    CHECK_NOTNULL(observer_);
+    observer_->onError(this, errorcode);
+    vlogself(2) << "done";
+}
+
+void
+ShmRingChannel::s_doorbell_cb(int fd, short what, void* arg)
+{
+    auto ch = (ShmRingChannel*)arg;
+    ch->_on_doorbell(fd, what);
+}
+
+void
+ShmRingChannel::s_socket_readable_cb(int fd, short what, void* arg)
+{
+    auto ch = (ShmRingChannel*)arg;
+    ch->_on_socket_readable(fd, what);
+}
+
+void
+ShmRingChannel::s_hello_readable_cb(int fd, short what, void* arg)
+{
+    auto ch = (ShmRingChannel*)arg;
+    ch->_on_hello_readable(fd, what);
+}
+
+} // end myio namespace
+
+#endif /* IN_SHADOW */
@@ -0,0 +1,192 @@
+#ifndef shm_ring_channel_hpp
+#define shm_ring_channel_hpp
+
+/* shared memory is only for native builds */
+#ifndef IN_SHADOW
+
+#include <memory>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "folly/DelayedDestruction.h"
+
+#include "object.hpp"
+#include "timer.hpp"
+#include "stream_channel.hpp"
+#include "easylogging++.h"
+
+namespace myio
+{
+
+struct ShmRingRegion;
+
+/*
+ * a stream channel between two processes on the same host, through
+ * two single-producer single-consumer byte rings (one per direction)
+ * in a memfd that both processes map.
+ *
+ * each side has an eventfd "doorbell" that the other side rings when
+ * it has put data into a ring the side found empty, or has made space
+ * in a ring the side found full; so a busy link needs no syscalls
+ * other than the occasional doorbell.
+ *
+ * the client creates the memfd and the doorbells, and hands them to
+ * the server over an (abstract) unix socket; see ShmRingServer. the
+ * socket then stays open only so each side sees the other go away:
+ * that's the channel's eof.
+ *
+ * like TCPChannel, has input and output evbuffers: writes go into the
+ * output evbuffer, and as much of it as fits is moved into the ring
+ * right away; whatever doesn't fit waits for the doorbell. input is
+ * moved from the ring into the input evbuffer when the doorbell
+ * rings.
+ *
+ * drop_future_input() is not supported.
+ */
+class ShmRingChannel : public StreamChannel
+{
+public:
+    typedef std::unique_ptr<ShmRingChannel, folly::DelayedDestruction::Destructor> UniquePtr;
+
+    /* meant to be used by a client: start_connecting() will connect
+     * to the ShmRingServer listening on "name" */
+    explicit ShmRingChannel(struct event_base *,
+                            const std::string& name,
+                            StreamChannelObserver*);
+
+    /* meant to be used by server: receive the client's memfd and
+     * doorbells on "sock_fd", an accepted unix socket, and take
+     * ownership of "sock_fd". the hello is read without blocking:
+     * "observer" is told onConnected() once we have it, or
+     * onConnectError()/onConnectTimeout() if the client doesn't hand
+     * us what we expect in time */
+    static UniquePtr create_from_accepted(struct event_base *, const int sock_fd,
+                                          StreamChannelConnectObserver* observer);
+
+    /* the address of the abstract unix socket for "name" */
+    static void get_sockaddr(const std::string& name,
+                             struct sockaddr_un& addr, socklen_t& addrlen);
+
+    virtual void set_observer(StreamChannelObserver*) override;
+
+    /* --------- StreamChannel impl ------------- */
+    virtual int start_connecting(StreamChannelConnectObserver*,
+                                 struct timeval *connect_timeout=nullptr) override;
+
+    virtual int read(uint8_t *data, size_t len) override;
+    virtual int read_buffer(struct evbuffer* buf, size_t len) override;
+    virtual int drain(size_t len) override;
+    virtual uint8_t* peek(ssize_t len) override;
+
+    virtual struct evbuffer* get_input_evbuf() override { return input_evb_.get(); }
+
+    virtual void drop_future_input(StreamChannelInputDropObserver*,
+                                   size_t, bool notify_progress) override;
+    virtual size_t get_avail_input_length() const override;
+    virtual size_t get_output_length() const override;
+    virtual void set_read_watermark(size_t lowmark, size_t highmark) override;
+    virtual int write(const uint8_t *data, size_t len) override;
+    virtual int write_buffer(struct evbuffer *buf) override;
+    virtual int write_dummy(size_t len) override;
+    virtual int write_reference(const uint8_t *data, size_t len) override;
+    virtual void close() override;
+    virtual bool is_closed() const override;
+    virtual int release_fd() override;
+
+    virtual void get_peer_name(std::string& address, uint16_t& port) const override;
+
+protected:
+
+    enum class ChannelState {
+        INIT,
+        CONNECTING,
+        CONNECTED,
+        CLOSED /* after either eof or error */
+    };
+
+    ShmRingChannel(struct event_base *evbase, const std::string& name,
+                   StreamChannelObserver* observer, const bool is_client);
+
+    // destructor should be private or protected to prevent direct
+    // deletion. we're using folly::DelayedDestruction
+    virtual ~ShmRingChannel();
+
+    /* client: create the memfd and the doorbells, and send them to
+     * the server. returns 0 or an errno */
+    int _setup_as_client();
+    /* server: the counterpart of _setup_as_client(): wait for the
+     * client's hello, then _setup_as_server() */
+    void _start_reading_hello();
+    /* returns 0, EAGAIN if the hello isn't here yet, or another
+     * errno */
+    int _setup_as_server();
+    bool _map_region(const int shm_fd, const bool init);
+
+    void _initialize_events();
+
+    /* move as much of the output evbuffer into our outbound ring as
+     * fits, and ring the peer if it might be waiting for the data */
+    void _flush_output();
+    /* move everything in our inbound ring into the input evbuffer;
+     * returns the number of bytes */
+    size_t _pull_input();
+    void _ring_peer();
+
+    void _on_eof();
+    void _on_error(int errorcode);
+    void _on_connect_cb_timer_fired(Timer*);
+    void _on_hello_readable(int fd, short what);
+    void _on_hello_timeout_timer_fired(Timer*);
+    void _on_doorbell(int fd, short what);
+    void _on_socket_readable(int fd, short what);
+
+    static void s_doorbell_cb(int fd, short what, void* arg);
+    static void s_socket_readable_cb(int fd, short what, void* arg);
+    static void s_hello_readable_cb(int fd, short what, void* arg);
+
+    ////////////////////////////////////////////////
+
+    struct event_base* evbase_; // don't free
+    StreamChannelConnectObserver* connect_observer_; // don't free
+
+    const std::string name_;
+    const bool is_client_;
+    ChannelState state_;
+
+    /* the unix socket with the peer */
+    int sock_fd_;
+    /* the peer rings my_doorbell_fd_, and we ring peer_doorbell_fd_ */
+    int my_doorbell_fd_;
+    int peer_doorbell_fd_;
+
+    ShmRingRegion* region_;
+    /* index into the region's rings */
+    int in_ring_idx_;
+    int out_ring_idx_;
+
+    /* to call the connect observer in a separate stack */
+    int connect_errno_;
+    Timer::UniquePtr connect_cb_timer_;
+    /* server: how long we wait for the client's hello */
+    Timer::UniquePtr hello_timeout_timer_;
+
+    std::unique_ptr<struct event, void(*)(struct event*)> doorbell_ev_;
+    /* server: for the hello until we're connected */
+    std::unique_ptr<struct event, void(*)(struct event*)> socket_read_ev_;
+
+    std::unique_ptr<struct evbuffer, void(*)(struct evbuffer*)> input_evb_;
+    std::unique_ptr<struct evbuffer, void(*)(struct evbuffer*)> output_evb_;
+
+    // read low-water mark, same as TCPChannel's
+    size_t read_lw_mark_;
+};
+
+
+/**************************************************/
+
+} // end myio namespace
+
+#endif /* IN_SHADOW */
+
+#endif /* shm_ring_channel_hpp */
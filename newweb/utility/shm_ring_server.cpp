@@ -0,0 +1,201 @@
+
+#ifndef IN_SHADOW
+
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "easylogging++.h"
+#include "shm_ring_channel.hpp"
+#include "shm_ring_server.hpp"
+
+/* "inst" stands for instance, as in, instance of a class */
+#define vloginst(level, inst) VLOG(level) << "shmServ= " << (inst)->objId() << " "
+#define vlogself(level) vloginst(level, this)
+
+#define loginst(level, inst) LOG(level) << "shmServ= " << (inst)->objId() << " "
+#define logself(level) loginst(level, this)
+
+namespace myio
+{
+
+ShmRingServer::ShmRingServer(
+    struct event_base* evbase,
+    const std::string& name,
+    StreamServerObserver* observer,
+    const bool start_listening
+    )
+    : evbase_(evbase), observer_(observer), name_(name)
+    , state_(ServerState::INIT)
+    , listening_(false)
+    , evlistener_(nullptr, evconnlistener_free)
+{
+    fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    CHECK_GT(fd_, 0);
+
+    struct sockaddr_un addr;
+    socklen_t addrlen = 0;
+    ShmRingChannel::get_sockaddr(name_, addr, addrlen);
+
+    // abstract sockets don't leave files behind, so there's nothing
+    // to clean up from a previous run
+    const auto rv = bind(fd_, (struct sockaddr *) &addr, addrlen);
+    CHECK_EQ(rv, 0) << "bind(" << name_ << ") errno= " << errno
+                    << " (" << strerror(errno) << ")";
+
+    if (start_listening) {
+        _start_listening();
+    }
+}
+
+bool
+ShmRingServer::start_accepting()
+{
+    CHECK(listening_);
+
+    CHECK((state_ == ServerState::INIT) || (state_ == ServerState::PAUSED));
+
+    auto rv = evconnlistener_enable(evlistener_.get());
+    CHECK_EQ(rv, 0);
+
+    state_ = ServerState::ACCEPTING;
+
+    vlogself(2) << "shm ring server has started accepting";
+    return !!evlistener_;
+}
+
+bool
+ShmRingServer::pause_accepting()
+{
+    CHECK_EQ(state_, ServerState::ACCEPTING);
+    const auto rv = evconnlistener_disable(evlistener_.get());
+    CHECK_EQ(rv, 0);
+    state_ = ServerState::PAUSED;
+    return true;
+}
+
+void
+ShmRingServer::set_observer(myio::StreamServerObserver* observer)
+{
+    observer_ = observer;
+}
+
+void
+ShmRingServer::on_conn_accepted(
+    struct evconnlistener *listener,
+    int fd, struct sockaddr */*addr*/, int /*len*/)
+{
+    vlogself(2) << "got a client conn, fd= " << fd;
+
+    DestructorGuard dg(this);
+
+    CHECK_EQ(state_, ServerState::ACCEPTING);
+    CHECK_EQ(evlistener_.get(), listener);
+
+    // the observer gets it once it has the client's hello
+    auto channel = ShmRingChannel::create_from_accepted(evbase_, fd, this);
+    auto channel_ptr = channel.get();
+    const auto ret = pending_channels_.insert(
+        std::make_pair(channel_ptr, std::move(channel)));
+    CHECK(ret.second);
+}
+
+void
+ShmRingServer::onConnected(StreamChannel* ch) noexcept
+{
+    DestructorGuard dg(this);
+
+    auto it = pending_channels_.find(ch);
+    CHECK(it != pending_channels_.end());
+    auto channel = std::move(it->second);
+    pending_channels_.erase(it);
+
+    vlogself(2) << "got hello from client";
+    observer_->onAccepted(this, std::move(channel));
+}
+
+void
+ShmRingServer::onConnectError(StreamChannel* ch, int errorcode) noexcept
+{
+    logself(WARNING) << "could not set up channel with client, error= "
+                     << errorcode;
+    // the channel is in its own callback, so is destroyed after
+    const auto num_erased = pending_channels_.erase(ch);
+    CHECK_EQ(num_erased, 1);
+}
+
+void
+ShmRingServer::onConnectTimeout(StreamChannel* ch) noexcept
+{
+    logself(WARNING) << "timed out waiting for client's hello";
+    const auto num_erased = pending_channels_.erase(ch);
+    CHECK_EQ(num_erased, 1);
+}
+
+void
+ShmRingServer::on_accept_error(
+    struct evconnlistener *listener, int errorcode)
+{
+    DestructorGuard dg(this);
+
+    CHECK_EQ(state_, ServerState::ACCEPTING);
+    CHECK_EQ(evlistener_.get(), listener);
+
+    observer_->onAcceptError(this, errorcode);
+}
+
+bool
+ShmRingServer::start_listening()
+{
+    if (listening_) {
+        logself(WARNING) << "is already listening";
+    } else {
+        _start_listening();
+    }
+    return true;
+}
+
+void
+ShmRingServer::_start_listening()
+{
+    CHECK(!listening_);
+
+    static const auto backlog = 20;
+
+    auto rv = listen(fd_, backlog);
+    CHECK_EQ(rv, 0) << "listen(fd=" << fd_ << ") fails :( rv= " << rv
+                    << " errno= " << errno << " (" << strerror(errno) << ")";
+
+    CHECK(!evlistener_);
+    evlistener_.reset(
+        evconnlistener_new(
+            evbase_, s_listener_acceptcb, this,
+            LEV_OPT_CLOSE_ON_FREE, backlog, fd_));
+    CHECK_NOTNULL(evlistener_);
+    evconnlistener_set_error_cb(evlistener_.get(), s_listener_errorcb);
+
+    rv = evconnlistener_disable(evlistener_.get());
+    CHECK_EQ(rv, 0);
+
+    listening_ = true;
+}
+
+void
+ShmRingServer::s_listener_acceptcb(
+    struct evconnlistener *listener,
+    int fd, struct sockaddr *addr, int len, void *arg)
+{
+    auto serverlistener = (ShmRingServer*)arg;
+    serverlistener->on_conn_accepted(listener, fd, addr, len);
+}
+
+void
+ShmRingServer::s_listener_errorcb(
+    struct evconnlistener *listener, void *arg)
+{
+    auto serverlistener = (ShmRingServer*)arg;
+    serverlistener->on_accept_error(listener, EVUTIL_SOCKET_ERROR());
+}
+
+}
+
+#endif /* IN_SHADOW */
@@ -0,0 +1,85 @@
+#ifndef shm_ring_server_hpp
+#define shm_ring_server_hpp
+
+/* shared memory is only for native builds */
+#ifndef IN_SHADOW
+
+#include <map>
+#include <string>
+#include <event2/listener.h>
+
+#include "stream_server.hpp"
+#include "shm_ring_channel.hpp"
+
+namespace myio
+{
+
+/* accepts ShmRingChannel clients on the abstract unix socket "name",
+ * and gives the observer ShmRingChannels, once each has the client's
+ * hello */
+class ShmRingServer : public StreamServer
+                    , public StreamChannelConnectObserver
+{
+public:
+    typedef std::unique_ptr<ShmRingServer, /*folly::*/Destructor> UniquePtr;
+
+    explicit ShmRingServer(struct event_base*,
+                           const std::string& name,
+                           StreamServerObserver*,
+                           const bool start_listening=true);
+
+    virtual bool start_listening() override;
+    virtual bool start_accepting() override;
+    virtual bool pause_accepting() override;
+    virtual void set_observer(myio::StreamServerObserver*) override;
+
+    virtual bool is_listening() const override { return listening_ ;}
+    virtual bool is_accepting() const override { return state_ == ServerState::ACCEPTING; }
+
+protected:
+
+    virtual ~ShmRingServer() = default;
+
+    /* for the channels waiting for their client's hello */
+    virtual void onConnected(StreamChannel*) noexcept override;
+    virtual void onConnectError(StreamChannel*, int errorcode) noexcept override;
+    virtual void onConnectTimeout(StreamChannel*) noexcept override;
+
+    void on_conn_accepted(struct evconnlistener *listener,
+                          int fd, struct sockaddr *addr, int len);
+    void on_accept_error(struct evconnlistener *listener, int errorcode);
+
+    static void s_listener_acceptcb(struct evconnlistener *,
+                                    int, struct sockaddr *, int, void *);
+    static void s_listener_errorcb(struct evconnlistener *, void *);
+
+    void _start_listening();
+
+    ////////////////
+
+    struct event_base* evbase_; // don't free
+    StreamServerObserver* observer_; // don't free
+
+    int fd_;
+    const std::string name_;
+
+    enum class ServerState {
+        INIT,
+        ACCEPTING,
+        PAUSED,
+        CLOSED /* after either eof or error */
+    } state_;
+
+    bool listening_;
+
+    std::unique_ptr<struct evconnlistener, void(*)(struct evconnlistener*)> evlistener_;
+
+    /* accepted, but waiting for the client's hello */
+    std::map<StreamChannel*, ShmRingChannel::UniquePtr> pending_channels_;
+};
+
+}
+
+#endif /* IN_SHADOW */
+
+#endif /* shm_ring_server_hpp */
@@ -0,0 +1,144 @@
+#ifndef spsc_ring_hpp
+#define spsc_ring_hpp
+
+#include <algorithm>
+#include <atomic>
+#include <stddef.h>
+#include <string.h>
+
+
+/* bounded lock-free ring for exactly one producer thread and exactly
+ * one consumer thread. "CAPACITY" must be a power of two.
+ *
+ * the producer only calls begin_push()/commit_push()/push()/push_n();
+ * the consumer only calls front()/pop()/front_n()/pop_n()/empty().
+ * size() is safe from either, but is only a snapshot.
+ *
+ * the roles can be handed to another thread, as long as the handoff
+ * itself synchronizes (e.g., through a mutex), so that the new owner
+ * sees the old owner's updates
+ *
+ * it has no pointers, so (for a trivially copyable "T") it can also
+ * live in memory shared by two processes, as long as std::atomic<size_t>
+ * is lock-free
+ */
+template <typename T, size_t CAPACITY>
+class SPSCRing
+{
+    static_assert(CAPACITY >= 2, "capacity too small");
+    static_assert((CAPACITY & (CAPACITY - 1)) == 0, "capacity must be a power of two");
+
+public:
+    SPSCRing() : head_(0), tail_(0) {}
+
+    SPSCRing(const SPSCRing&) = delete;
+    SPSCRing& operator=(const SPSCRing&) = delete;
+
+    /* producer. returns a slot to fill in, or nullptr if full; the
+     * slot becomes visible to the consumer with commit_push() */
+    T* begin_push()
+    {
+        const auto tail = tail_.load(std::memory_order_relaxed);
+        if ((tail - head_.load(std::memory_order_acquire)) == CAPACITY) {
+            return nullptr;
+        }
+        return &slots_[tail & (CAPACITY - 1)];
+    }
+
+    void commit_push()
+    {
+        tail_.store(tail_.load(std::memory_order_relaxed) + 1,
+                    std::memory_order_release);
+    }
+
+    bool push(const T& item)
+    {
+        auto slot = begin_push();
+        if (!slot) {
+            return false;
+        }
+        *slot = item;
+        commit_push();
+        return true;
+    }
+
+    /* consumer. returns nullptr if empty; the slot stays valid until
+     * pop() */
+    T* front()
+    {
+        const auto head = head_.load(std::memory_order_relaxed);
+        if (head == tail_.load(std::memory_order_acquire)) {
+            return nullptr;
+        }
+        return &slots_[head & (CAPACITY - 1)];
+    }
+
+    void pop()
+    {
+        head_.store(head_.load(std::memory_order_relaxed) + 1,
+                    std::memory_order_release);
+    }
+
+    /* bulk versions of the above, for trivially copyable "T" */
+
+    /* producer. copies in as many of the "n" items as fit, and
+     * returns how many that is; they become visible to the consumer
+     * all at once */
+    size_t push_n(const T* items, size_t n)
+    {
+        const auto tail = tail_.load(std::memory_order_relaxed);
+        const auto space =
+            CAPACITY - (tail - head_.load(std::memory_order_acquire));
+        n = std::min(n, space);
+
+        const auto idx = tail & (CAPACITY - 1);
+        const auto first = std::min(n, CAPACITY - idx);
+        memcpy(&slots_[idx], items, first * sizeof (T));
+        memcpy(&slots_[0], items + first, (n - first) * sizeof (T));
+
+        tail_.store(tail + n, std::memory_order_release);
+        return n;
+    }
+
+    /* consumer. points "items" at the items at the front that are
+     * contiguous in the ring, and returns how many (0 if empty). they
+     * stay valid until pop_n() */
+    size_t front_n(const T** items)
+    {
+        const auto head = head_.load(std::memory_order_relaxed);
+        const auto avail = tail_.load(std::memory_order_acquire) - head;
+        const auto idx = head & (CAPACITY - 1);
+        *items = &slots_[idx];
+        return std::min(avail, CAPACITY - idx);
+    }
+
+    void pop_n(size_t n)
+    {
+        head_.store(head_.load(std::memory_order_relaxed) + n,
+                    std::memory_order_release);
+    }
+
+    bool empty() const
+    {
+        return head_.load(std::memory_order_acquire)
+            == tail_.load(std::memory_order_acquire);
+    }
+
+    size_t size() const
+    {
+        // head first, so the tail we read can't be behind it
+        const auto head = head_.load(std::memory_order_acquire);
+        return tail_.load(std::memory_order_acquire) - head;
+    }
+
+    static constexpr size_t capacity() { return CAPACITY; }
+
+private:
+    /* keep the two indices on separate cache lines so the producer
+     * and consumer don't false-share */
+    alignas(64) std::atomic<size_t> head_;
+    alignas(64) std::atomic<size_t> tail_;
+    alignas(64) T slots_[CAPACITY];
+};
+
+#endif /* spsc_ring_hpp */
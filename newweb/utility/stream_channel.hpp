@@ -175,6 +175,12 @@ public:
      * ascii. return 0 on success */
     virtual int write_dummy(size_t len) = 0;
 
+    /* like write(), but without copying "data", so it must stay
+     * valid and unchanged for as long as the channel might have it
+     * buffered, e.g., for the life of the process. returns 0 on
+     * success */
+    virtual int write_reference(const uint8_t *data, size_t len) = 0;
+
     /* close/disconnect the channel, dropping pending/buffered data if
      * any
      *
@@ -198,7 +198,8 @@ TCPChannel::get_output_length() const
 void
 TCPChannel::set_read_watermark(size_t lowmark, size_t highmark)
 {
-    CHECK_LE(lowmark, 0xffff);
+    // no upper limit: a GenericMessageChannel with large msgs waits
+    // for a whole msg of up to its MAX_MSG_LEN
     read_lw_mark_ = lowmark;
     CHECK_EQ(highmark, 0);
 }
@@ -307,6 +308,18 @@ TCPChannel::write_dummy(size_t len)
     return 0;
 }
 
+int
+TCPChannel::write_reference(const uint8_t *data, size_t len)
+{
+    CHECK(output_evb_);
+    const auto rv = evbuffer_add_reference(
+        output_evb_.get(), data, len, nullptr, nullptr);
+    if (!rv) {
+        _maybe_toggle_write_monitoring(true);
+    }
+    return rv;
+}
+
 /********************/
 
 void
@@ -65,6 +65,7 @@ public:
     virtual int write(const uint8_t *data, size_t len) override;
     virtual int write_buffer(struct evbuffer *buf) override;
     virtual int write_dummy(size_t len) override;
+    virtual int write_reference(const uint8_t *data, size_t len) override;
     virtual void close() override;
     virtual bool is_closed() const override;
     virtual int release_fd() override;
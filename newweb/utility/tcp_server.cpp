@@ -17,7 +17,8 @@ TCPServer::TCPServer(
     struct event_base* evbase,
     const in_addr_t& addr, const in_port_t& port,
     StreamServerObserver* observer,
-    const bool start_listening
+    const bool start_listening,
+    const bool reuse_port
     )
     : evbase_(evbase), observer_(observer), addr_(addr), port_(port)
     , state_(ServerState::INIT)
@@ -37,6 +38,17 @@ TCPServer::TCPServer(
     rv = evutil_make_listen_socket_reuseable(fd_);
     CHECK_EQ(rv, 0);
 
+    if (reuse_port) {
+#if defined(IN_SHADOW) || !defined(SO_REUSEPORT)
+        LOG(FATAL) << "SO_REUSEPORT is not supported";
+#else
+        const int one = 1;
+        rv = setsockopt(fd_, SOL_SOCKET, SO_REUSEPORT, &one, sizeof one);
+        CHECK_EQ(rv, 0) << "errno= " << errno
+                        << " (" << strerror(errno) << ")";
+#endif
+    }
+
     struct sockaddr_in server;
     bzero(&server, sizeof(server));
     server.sin_family = AF_INET;
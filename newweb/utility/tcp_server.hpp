@@ -13,11 +13,16 @@ class TCPServer : public StreamServer
 public:
     typedef std::unique_ptr<TCPServer, /*folly::*/Destructor> UniquePtr;
 
-    /* "port" should be in host byte order */
+    /* "port" should be in host byte order.
+     *
+     * with "reuse_port", several processes can each have a TCPServer
+     * on the same port, and the kernel spreads the incoming
+     * connections among them (SO_REUSEPORT; not in shadow) */
     explicit TCPServer(struct event_base*,
                        const in_addr_t& addr, const in_port_t& port,
                        StreamServerObserver*,
-                       const bool start_listening=true);
+                       const bool start_listening=true,
+                       const bool reuse_port=false);
 
     virtual bool start_listening() override;
     virtual bool start_accepting() override;
@@ -3,6 +3,7 @@
 
 
 #include <strings.h>
+#include <unordered_map>
 
 #include "handler.hpp"
 #include "../utility/common.hpp"
@@ -43,12 +44,141 @@ using myio::StreamChannel;
 #define logself(level) loginst(level, this)
 
 
+/* longest request line or header line we accept; ours are all much
+ * shorter */
+static const size_t max_req_line_len = 127;
+
+/* the response header blocks are the same for all responses with the
+ * same (resp meta size, resp body size), and a page model has only so
+ * many distinct resource sizes, so we format each block once and
+ * have the channels write it by reference. the blocks are never
+ * freed, so they're safe to reference from any channel's output
+ * buffer; past the limit, we format per response.
+ */
+static const size_t max_num_resp_meta_templates = 4096;
+
+struct RespMetaTemplateKey
+{
+    size_t resp_meta_size;
+    size_t resp_body_size;
+
+    bool operator==(const RespMetaTemplateKey& other) const
+    {
+        return (resp_meta_size == other.resp_meta_size)
+            && (resp_body_size == other.resp_body_size);
+    }
+};
+
+struct RespMetaTemplateKeyHash
+{
+    size_t operator()(const RespMetaTemplateKey& key) const
+    {
+        return std::hash<size_t>()(key.resp_meta_size)
+            ^ (std::hash<size_t>()(key.resp_body_size) << 1);
+    }
+};
+
+/* std::unordered_map never moves its elements, so the strings' data
+ * stay put as the map grows */
+static std::unordered_map<RespMetaTemplateKey, std::string,
+                          RespMetaTemplateKeyHash> s_resp_meta_templates;
+
+static void
+format_resp_meta(std::string& block, const size_t& resp_meta_size,
+                 const size_t& resp_body_size)
+{
+    block = common::http::resp_status_line;
+    block += "\r\n";
+    block += common::http::content_length_name;
+    block += ": ";
+    block += std::to_string(resp_body_size);
+    block += "\r\n";
+    block += common::http::dummy_name;
+    block += ": ";
+
+    /* the resp_meta_size is NOT strict; we don't have to write
+     * exactly that amount, just close to it is fine.
+     *
+     * the 4 is for the \r\n\r\n that closes the resp status/header
+     * part
+     */
+    const ssize_t num_dummy_hdr_bytes_needed =
+        resp_meta_size - block.length() - 4;
+    if (num_dummy_hdr_bytes_needed > 0) {
+        block.append(num_dummy_hdr_bytes_needed, 'A');
+    } else {
+        // need to write at least one byte for dummy header value
+        block += "n/a";
+    }
+
+    block += "\r\n\r\n";
+}
+
+enum class ReadLineResult {
+    LINE,
+    NEED_MORE,
+    /* no crlf within max_req_line_len bytes */
+    TOO_LONG
+};
+
+/* copy the next crlf-terminated line, without the crlf and
+ * nul-terminated, from "inbuf" into "line" and drain it from inbuf.
+ *
+ * "scan_offset" is how much of inbuf we have already searched for
+ * the crlf without finding one, so we don't search it again every
+ * time more input arrives. it should be zero initially, and we reset
+ * it to zero when we return a line.
+ *
+ * unlike evbuffer_readln(), this doesn't allocate
+ */
+static ReadLineResult
+read_line(struct evbuffer* inbuf, char (&line)[max_req_line_len + 1],
+          size_t& line_len, size_t& scan_offset)
+{
+    const auto buflen = evbuffer_get_length(inbuf);
+    CHECK_LE(scan_offset, buflen);
+
+    struct evbuffer_ptr start;
+    auto rv = evbuffer_ptr_set(inbuf, &start, scan_offset, EVBUFFER_PTR_SET);
+    CHECK_EQ(rv, 0);
+
+    size_t eol_len = 0;
+    const auto eol = evbuffer_search_eol(
+        inbuf, &start, &eol_len, EVBUFFER_EOL_CRLF_STRICT);
+    if (eol.pos < 0) {
+        if (buflen > (max_req_line_len + 1)) {
+            return ReadLineResult::TOO_LONG;
+        }
+        /* the last byte might be the cr of a crlf whose lf hasn't
+         * arrived yet, so search it again next time */
+        scan_offset = buflen ? (buflen - 1) : 0;
+        return ReadLineResult::NEED_MORE;
+    }
+
+    line_len = eol.pos;
+    if (line_len > max_req_line_len) {
+        return ReadLineResult::TOO_LONG;
+    }
+    rv = evbuffer_copyout(inbuf, line, line_len);
+    CHECK_EQ(rv, (ev_ssize_t)line_len);
+    line[line_len] = '\0';
+
+    rv = evbuffer_drain(inbuf, line_len + eol_len);
+    CHECK_EQ(rv, 0);
+    scan_offset = 0;
+    return ReadLineResult::LINE;
+}
+
+
 Handler::Handler(StreamChannel::UniquePtr channel,
                  HandlerObserver* observer)
     : channel_(std::move(channel))
     , observer_(observer)
     , http_req_state_(HTTPReqState::HTTP_REQ_STATE_REQ_LINE)
     , remaining_req_body_length_(0)
+    , sniffed_protocol_(false)
+    , line_scan_offset_(0)
+    , num_reqs_served_(0)
 {
     CHECK_NOTNULL(observer_);
     bzero(&current_req_, sizeof current_req_);
@@ -61,7 +191,9 @@ Handler::_maybe_consume_input()
 {
     vlogself(2) << "begin";
 
-    char *line = nullptr;
+    char line[max_req_line_len + 1];
+    size_t line_len = 0;
+    ReadLineResult read_line_result = ReadLineResult::NEED_MORE;
     bool keep_consuming = true;
 
     // don't free this inbuf
@@ -76,26 +208,33 @@ Handler::_maybe_consume_input()
         return;
     }
 
+    if (!sniffed_protocol_) {
+        sniffed_protocol_ = true;
+        /* a spdy connection starts with a control frame, which has
+         * the high bit set; an http request line starts with a
+         * method name */
+        const auto first_byte = channel_->peek(1);
+        CHECK_NOTNULL(first_byte);
+        if (first_byte[0] & 0x80) {
+            vlogself(2) << "client speaks spdy";
+            DestructorGuard dg(this);
+            observer_->onHandlerSpdyDetected(this);
+            return;
+        }
+    }
+
     do {
         switch (http_req_state_) {
         case HTTPReqState::HTTP_REQ_STATE_REQ_LINE: {
-            /* readln() does drain the buffer */
-            size_t line_len = 0;
-            line = evbuffer_readln(
-                inbuf, &line_len, EVBUFFER_EOL_CRLF_STRICT);
-            if (line) {
-                CHECK_EQ(current_req_.active, 0);
+            /* read_line() does drain the buffer */
+            read_line_result = read_line(inbuf, line, line_len, line_scan_offset_);
+            if (read_line_result == ReadLineResult::LINE) {
                 vlogself(2) << "got request line: [" << line << "]";
 
-                // we handle exactly one request
                 CHECK_EQ(line_len, common::http::request_line_len);
                 DCHECK(!strcmp(line, common::http::request_line));
 
-                current_req_.active = 1;
-
                 http_req_state_ = HTTPReqState::HTTP_REQ_STATE_HEADERS;
-                free(line);
-                line = nullptr;
             } else {
                 // not enough input data to find whole request line
                 keep_consuming = false;
@@ -104,14 +243,12 @@ Handler::_maybe_consume_input()
         }
 
         case HTTPReqState::HTTP_REQ_STATE_HEADERS: {
-            size_t line_len = 0;
-            while (nullptr != (line = evbuffer_readln(
-                                   inbuf, &line_len, EVBUFFER_EOL_CRLF_STRICT)))
+            while ((read_line_result = read_line(inbuf, line, line_len,
+                                                 line_scan_offset_))
+                   == ReadLineResult::LINE)
             {
                 if (line[0] == '\0') {
                     vlogself(2) << "no more hdrs";
-                    free(line);
-                    line = nullptr;
 
                     const RequestInfo& reqinfo = current_req_;
                     vlogself(2) << "req: resp_meta_size: "
@@ -126,7 +263,7 @@ Handler::_maybe_consume_input()
                         http_req_state_ = HTTPReqState::HTTP_REQ_STATE_BODY;
                     } else {
                         // no req body, so go serve response
-                        _serve_response();
+                        _finish_request();
                     }
 
                     break; // out of while loop trying to read header
@@ -135,8 +272,6 @@ Handler::_maybe_consume_input()
                 else {
                     vlogself(2) << "whole req hdr line: [" << line << "]";
 
-                    CHECK_LT(line_len, 127); // arbitrary value
-
                     char *tmp = strchr(line, ':');
                     CHECK_NOTNULL(tmp);
                     // check bounds
@@ -185,9 +320,6 @@ Handler::_maybe_consume_input()
                     }
 
                     CHECK(matched) << "unknown header name: [" << name_str << "]";
-
-                    free(line);
-                    line = nullptr;
                 }
             } // end while readline for headers
 
@@ -223,7 +355,7 @@ Handler::_maybe_consume_input()
                     this, remaining_req_body_length_, false);
             } else {
                 // have fully finished with req body, so go serve
-                _serve_response();
+                _finish_request();
             }
             break;
         }
@@ -233,85 +365,91 @@ Handler::_maybe_consume_input()
             break;
         }
 
+        if (read_line_result == ReadLineResult::TOO_LONG) {
+            logself(WARNING) << "bad request: line longer than "
+                             << max_req_line_len << " bytes; close connection";
+            DestructorGuard dg(this);
+            observer_->onHandlerDone(this);
+            return;
+        }
+
     } while (keep_consuming && evbuffer_get_length(inbuf) > 0);
 
-    if (line) {
-        free(line);
-    }
     vlogself(2) << "done";
     return;
 }
 
 void
-Handler::_serve_response()
+Handler::_finish_request()
 {
     CHECK_EQ(remaining_req_body_length_, 0);
-    CHECK_EQ(current_req_.active, 1);
-
-    std::unique_ptr<struct evbuffer, void(*)(struct evbuffer*)> buf(
-        evbuffer_new(), evbuffer_free);
-    CHECK_NOTNULL(buf.get());
-
-    auto rv = evbuffer_add_printf(
-        buf.get(),
-        "%s\r\n"
-        "%s: %ld\r\n"
-        "%s: ",
-        common::http::resp_status_line,
-        common::http::content_length_name, current_req_.resp_body_size,
-        common::http::dummy_name);
-    CHECK_GT(rv, 0);
 
-    /* the resp_meta_size is NOT strict; we don't have to write
-     * exactly that amount, just close to it is fine.
-     */
+    queued_reqs_.push_back(current_req_);
+    vlogself(2) << "queued req, " << queued_reqs_.size() << " to serve";
 
-    // how much extra dummy header/meta bytes do we need to send
-    ssize_t num_dummy_hdr_bytes_needed =
-        current_req_.resp_meta_size - evbuffer_get_length(buf.get());
-    num_dummy_hdr_bytes_needed -= 4; /* for the \r\n\r\n we will add
-                                      * later to close the resp
-                                      * status/header part */
-    if (num_dummy_hdr_bytes_needed > 0) {
-        // only if it's greater than zero do we tell channel to write
-        // dummy
+    vlogself(2) << "reset state to get next request";
 
-        // BUT FIRST: tell channel to write buf
-        rv = channel_->write_buffer(buf.get());
-        CHECK_EQ(rv, 0);
-        DCHECK_EQ(evbuffer_get_length(buf.get()), 0);
+    bzero(&current_req_, sizeof current_req_);
+    http_req_state_ = HTTPReqState::HTTP_REQ_STATE_REQ_LINE;
 
-        vlogself(2) << "tell channel to write "
-                    << num_dummy_hdr_bytes_needed
-                    << " dummy header bytes";
-        rv = channel_->write_dummy(num_dummy_hdr_bytes_needed);
-        CHECK_EQ(rv, 0);
-    } else {
-        // need to write at least one byte for dummy header value
-        rv = evbuffer_add_printf(buf.get(), "n/a");
-        CHECK_EQ(rv, 3) << "rv= " << rv;
+    _maybe_serve_responses();
+}
+
+void
+Handler::_maybe_serve_responses()
+{
+    /* the responses are mostly dummy bytes, which the channel
+     * buffers by reference, so this is only to keep the output
+     * buffer from growing without bound */
+    static const size_t max_output_backlog = 256 * 1024;
+
+    while (!queued_reqs_.empty()
+           && channel_->get_output_length() < max_output_backlog)
+    {
+        _serve_response(queued_reqs_.front());
+        queued_reqs_.pop_front();
     }
 
-    // end the dummy header and overall resp meta info
-    rv = evbuffer_add_printf(buf.get(), "\r\n\r\n");
-    CHECK_GT(rv, 0);
+    if (!queued_reqs_.empty()) {
+        vlogself(2) << queued_reqs_.size()
+                    << " reqs wait for the channel to write its backlog";
+    }
+}
 
-    rv = channel_->write_buffer(buf.get());
+void
+Handler::_serve_response(const RequestInfo& reqinfo)
+{
+    ++num_reqs_served_;
+
+    const RespMetaTemplateKey key = {
+        reqinfo.resp_meta_size, reqinfo.resp_body_size};
+    auto it = s_resp_meta_templates.find(key);
+    if (it == s_resp_meta_templates.end()
+        && s_resp_meta_templates.size() < max_num_resp_meta_templates)
+    {
+        it = s_resp_meta_templates.insert(std::make_pair(key, string())).first;
+        format_resp_meta(it->second, key.resp_meta_size, key.resp_body_size);
+    }
+
+    int rv = 0;
+    if (it != s_resp_meta_templates.end()) {
+        const auto& block = it->second;
+        rv = channel_->write_reference((const uint8_t*)block.data(),
+                                       block.length());
+    } else {
+        string block;
+        format_resp_meta(block, key.resp_meta_size, key.resp_body_size);
+        rv = channel_->write((const uint8_t*)block.data(), block.length());
+    }
     CHECK_EQ(rv, 0);
-    DCHECK_EQ(evbuffer_get_length(buf.get()), 0);
 
-    if (current_req_.resp_body_size > 0) {
+    if (reqinfo.resp_body_size > 0) {
         vlogself(2) << "tell channel to write "
-                    << current_req_.resp_body_size << " dummy BODY bytes";
+                    << reqinfo.resp_body_size << " dummy BODY bytes";
 
-        rv = channel_->write_dummy(current_req_.resp_body_size);
+        rv = channel_->write_dummy(reqinfo.resp_body_size);
         CHECK_EQ(rv, 0);
     }
-
-    vlogself(2) << "reset state to get next request";
-
-    bzero(&current_req_, sizeof current_req_);
-    http_req_state_ = HTTPReqState::HTTP_REQ_STATE_REQ_LINE;
 }
 
 void
@@ -350,7 +488,29 @@ Handler::onInputBytesDropped(StreamChannel* channel, size_t len) noexcept
     remaining_req_body_length_ -= len;
     CHECK_EQ(remaining_req_body_length_, 0);
 
-    _serve_response();
+    _finish_request();
+}
+
+void
+Handler::onWrittenData(StreamChannel* channel) noexcept
+{
+    CHECK_EQ(channel_.get(), channel);
+    _maybe_serve_responses();
+}
+
+StreamChannel::UniquePtr
+Handler::release_channel()
+{
+    CHECK(channel_);
+    /* the new owner will set itself as the observer */
+    return std::move(channel_);
+}
+
+void
+Handler::get_total_bytes(size_t& tx, size_t& rx) const
+{
+    tx = channel_ ? channel_->num_total_written_bytes() : 0;
+    rx = channel_ ? channel_->num_total_read_bytes() : 0;
 }
 
 Handler::~Handler()
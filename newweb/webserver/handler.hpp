@@ -3,6 +3,7 @@
 
 #include <string>
 #include <queue>
+#include <deque>
 #include <set>
 
 #include "../utility/object.hpp"
@@ -15,6 +16,11 @@ class HandlerObserver
 {
 public:
     virtual void onHandlerDone(Handler*) noexcept = 0;
+
+    /* the client speaks spdy, not http, on this connection. the
+     * observer should take the channel back (release_channel()) and
+     * hand it to a SpdyHandler, and destroy this handler */
+    virtual void onHandlerSpdyDetected(Handler*) noexcept = 0;
 };
 
 class Handler : public Object
@@ -27,6 +33,14 @@ public:
     explicit Handler(myio::StreamChannel::UniquePtr channel,
                      HandlerObserver* observer);
 
+    /* give up the channel, with whatever input it has buffered */
+    myio::StreamChannel::UniquePtr release_channel();
+
+    /* for stats. the bytes are zero once we have given up the
+     * channel */
+    const size_t& num_reqs_served() const { return num_reqs_served_; }
+    void get_total_bytes(size_t& tx, size_t& rx) const;
+
 private:
 
     virtual ~Handler();
@@ -35,7 +49,7 @@ private:
     virtual void onNewReadDataAvailable(myio::StreamChannel*) noexcept override;
     virtual void onEOF(myio::StreamChannel*) noexcept override;
     virtual void onError(myio::StreamChannel*, int errorcode) noexcept override;
-    virtual void onWrittenData(myio::StreamChannel*) noexcept override {};
+    virtual void onWrittenData(myio::StreamChannel*) noexcept override;
 
     /********* StreamChannelInputDropObserver interface *************/
     virtual void onInputBytesDropped(myio::StreamChannel*, size_t) noexcept override;
@@ -43,7 +57,9 @@ private:
     ///////////////////
 
     void _maybe_consume_input();
-    void _serve_response();
+    /* done reading the current request: queue it to be served */
+    void _finish_request();
+    void _maybe_serve_responses();
 
     myio::StreamChannel::UniquePtr channel_; // the underlying stream
     HandlerObserver* observer_;
@@ -52,7 +68,7 @@ private:
      *
      * since we only serve dummy response body, we don't a separate
      * state machine for serving the response: it's just one
-     * _serve_response() call
+     * _serve_response() call per request
      */
     enum class HTTPReqState {
         HTTP_REQ_STATE_REQ_LINE,
@@ -60,19 +76,38 @@ private:
         HTTP_REQ_STATE_BODY
     } http_req_state_;
 
-    // we don't support pipelining, so there can be only one active
-    // request at a time
     struct RequestInfo
     {
-        int active; // this request is currently being processed
         size_t resp_meta_size;
         size_t resp_body_size;
-    } current_req_;
+    };
+
+    void _serve_response(const RequestInfo&);
+
+    // the request we're currently reading from the client
+    RequestInfo current_req_;
+
+    /* the client can pipeline requests, so we might have read several
+     * requests that we have not served yet. we serve them in order,
+     * but only while the channel doesn't have too much output
+     * buffered already, so a client that pipelines deeply doesn't
+     * make us buffer many responses at once
+     */
+    std::deque<RequestInfo> queued_reqs_;
 
     // of the current _request_ we're extracting from client (parsed
     // from content-length header)
     size_t remaining_req_body_length_;
 
+    /* whether we have looked at the first input byte, to tell http
+     * from spdy */
+    bool sniffed_protocol_;
+
+    /* how much of the input buffer we have searched for the end of
+     * the current request/header line */
+    size_t line_scan_offset_;
+
+    size_t num_reqs_served_;
 };
 
 #endif /* HANDLER_HPP */
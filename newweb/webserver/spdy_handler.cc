@@ -0,0 +1,428 @@
+/* handles a spdy connection with the client
+ */
+
+
+#include <strings.h>
+#include <string.h>
+
+#include "spdy_handler.hpp"
+#include "../utility/common.hpp"
+#include "../utility/easylogging++.h"
+
+#include <boost/lexical_cast.hpp>
+
+
+using std::string;
+using boost::lexical_cast;
+using myio::StreamChannel;
+
+
+#define _LOG_PREFIX(inst) << "spdyhndlr= " << (inst)->objId() << ": "
+
+/* "inst" stands for instance, as in, instance of a class */
+#define vloginst(level, inst) VLOG(level) _LOG_PREFIX(inst)
+#define vlogself(level) vloginst(level, this)
+
+#define dvloginst(level, inst) DVLOG(level) _LOG_PREFIX(inst)
+#define dvlogself(level) dvloginst(level, this)
+
+#define loginst(level, inst) LOG(level) _LOG_PREFIX(inst)
+#define logself(level) loginst(level, this)
+
+
+/* stop giving spdylay's output to the channel once the channel has
+ * this much buffered, so we don't generate big response bodies all at
+ * once into memory. we resume when the channel has written it all */
+static const size_t s_max_channel_output_length = 64 * 1024;
+
+
+SpdyHandler::SpdyHandler(StreamChannel::UniquePtr channel,
+                         SpdyHandlerObserver* observer)
+    : channel_(std::move(channel))
+    , observer_(observer)
+    , spdysess_{nullptr, spdylay_session_del}
+    , done_(false)
+    , num_reqs_served_(0)
+{
+    CHECK_NOTNULL(observer_);
+
+    _setup_spdylay_session();
+    CHECK(spdysess_);
+}
+
+void
+SpdyHandler::start()
+{
+    DestructorGuard dg(this);
+
+    /* consume the buffered input first: the channel wants no input
+     * buffered when it gets a new observer */
+    _pump();
+
+    if (!done_) {
+        CHECK_EQ(channel_->get_avail_input_length(), 0);
+        channel_->set_observer(this);
+    }
+}
+
+void
+SpdyHandler::_pump()
+{
+    vlogself(2) << "begin";
+
+    if (done_) {
+        return;
+    }
+
+    spdylay_session* session = spdysess_.get();
+
+    auto rv = spdylay_session_recv(session);
+    if (rv == 0) {
+        rv = spdylay_session_send(session);
+    }
+
+    if (rv) {
+        if (SPDYLAY_ERR_EOF == rv) {
+            vlogself(2) << "client closed";
+        } else {
+            logself(WARNING) << "spdylay returned \""
+                             << spdylay_strerror(rv) << "\"";
+        }
+        _done();
+        return;
+    }
+
+    if (!spdylay_session_want_read(session)
+        && !spdylay_session_want_write(session))
+    {
+        vlogself(2) << "session is finished";
+        _done();
+        return;
+    }
+
+    vlogself(2) << "done";
+}
+
+void
+SpdyHandler::_done()
+{
+    if (done_) {
+        return;
+    }
+    done_ = true;
+    DestructorGuard dg(this);
+    observer_->onSpdyHandlerDone(this);
+}
+
+void
+SpdyHandler::_serve_response(const int32_t sid)
+{
+    auto it = sid2req_.find(sid);
+    CHECK(it != sid2req_.end());
+    const auto& reqinfo = it->second;
+
+    ++num_reqs_served_;
+
+    vlogself(2) << "sid " << sid << ": resp_meta_size: " << reqinfo.resp_meta_size
+                << ", resp_body_size: " << reqinfo.resp_body_size;
+
+    const string content_length_str = std::to_string(reqinfo.resp_body_size);
+
+    const char* nv[] = {
+        ":status", "200 OK",
+        ":version", "HTTP/1.1",
+        common::http::content_length_name, content_length_str.c_str(),
+        common::http::dummy_name, nullptr,
+        nullptr
+    };
+
+    /* like Handler, the resp_meta_size is NOT strict. the dummy header
+     * value makes up whatever the other headers don't use. (note that
+     * spdy compresses the headers, so on the wire the meta will be
+     * much smaller than with http.)
+     */
+    size_t used_size = 0;
+    for (size_t i = 0; nv[i]; ++i) {
+        used_size += strlen(nv[i]);
+    }
+    used_size += strlen(common::http::dummy_name);
+
+    size_t dummy_value_len = 3;
+    if (reqinfo.resp_meta_size > (used_size + dummy_value_len)) {
+        dummy_value_len = std::min(reqinfo.resp_meta_size - used_size,
+                                   common::static_bytes_length);
+    }
+    const string dummy_value(*common::static_bytes, 0, dummy_value_len);
+    nv[7] = dummy_value.c_str();
+
+    spdylay_data_provider data_provider;
+    bzero(&data_provider, sizeof data_provider);
+    data_provider.read_callback = s_spdylay_data_read_cb;
+
+    /* spdylay_submit_response() will make copies of nv */
+    const auto rv = spdylay_submit_response(
+        spdysess_.get(), sid, nv,
+        reqinfo.resp_body_size ? &data_provider : nullptr);
+    CHECK_EQ(rv, 0);
+}
+
+ssize_t
+SpdyHandler::spdylay_send_cb(spdylay_session *session, const uint8_t *data,
+                             size_t length, int flags)
+{
+    CHECK_EQ(session, spdysess_.get());
+
+    if (channel_->get_output_length() >= s_max_channel_output_length) {
+        vlogself(2) << "channel has enough to write for now";
+        return SPDYLAY_ERR_WOULDBLOCK;
+    }
+
+    const auto rv = channel_->write(data, length);
+    if (rv) {
+        logself(WARNING) << "channel didn't accept our write";
+        return SPDYLAY_ERR_CALLBACK_FAILURE;
+    }
+
+    vlogself(2) << "wrote " << length << " bytes to channel";
+    return length;
+}
+
+ssize_t
+SpdyHandler::spdylay_recv_cb(spdylay_session *session, uint8_t *buf,
+                             size_t length, int flags)
+{
+    CHECK_EQ(session, spdysess_.get());
+
+    const auto numread = channel_->read(buf, length);
+
+    if (numread == 0) {
+        return channel_->is_closed()
+               ? SPDYLAY_ERR_EOF
+               : SPDYLAY_ERR_WOULDBLOCK;
+    } else if (numread < 0) {
+        logself(WARNING) << "channel::read() returns: " << numread;
+        return SPDYLAY_ERR_CALLBACK_FAILURE;
+    }
+
+    vlogself(2) << "read " << numread << " bytes from channel";
+    return numread;
+}
+
+void
+SpdyHandler::spdylay_on_ctrl_recv_cb(spdylay_session *session,
+                                     spdylay_frame_type type,
+                                     spdylay_frame *frame)
+{
+    CHECK_EQ(session, spdysess_.get());
+
+    if (type != SPDYLAY_SYN_STREAM) {
+        return;
+    }
+
+    const int32_t sid = frame->syn_stream.stream_id;
+    vlogself(2) << "new stream " << sid;
+
+    RequestInfo reqinfo;
+    bzero(&reqinfo, sizeof reqinfo);
+
+    struct {
+        const char* hdr_name;
+        size_t* hdr_value_ptr;
+    } hdrs_to_parse[] = {
+        {
+            common::http::resp_meta_size_name,
+            &(reqinfo.resp_meta_size),
+        },
+        {
+            common::http::resp_body_size_name,
+            &(reqinfo.resp_body_size),
+        },
+    };
+
+    char **nv = frame->syn_stream.nv;
+    for (size_t i = 0; nv[i]; i += 2) {
+        for (auto hdr_to_parse : hdrs_to_parse) {
+            if (!strcmp(nv[i], hdr_to_parse.hdr_name)) {
+                try {
+                    *(hdr_to_parse.hdr_value_ptr) =
+                        lexical_cast<size_t>(nv[i+1]);
+                } catch (const boost::bad_lexical_cast&) {
+                    logself(FATAL) << "bad header value: " << nv[i+1];
+                }
+                break;
+            }
+        }
+    }
+
+    reqinfo.remaining_resp_body_len = reqinfo.resp_body_size;
+
+    const auto ret = sid2req_.insert(std::make_pair(sid, reqinfo));
+    CHECK(ret.second); // insist it was newly inserted
+}
+
+void
+SpdyHandler::spdylay_on_request_recv_cb(spdylay_session *session,
+                                        int32_t stream_id)
+{
+    CHECK_EQ(session, spdysess_.get());
+    vlogself(2) << "whole request received on stream " << stream_id;
+    _serve_response(stream_id);
+}
+
+void
+SpdyHandler::spdylay_on_stream_close_cb(spdylay_session *session,
+                                        int32_t stream_id,
+                                        spdylay_status_code status_code)
+{
+    CHECK_EQ(session, spdysess_.get());
+    vlogself(2) << "stream " << stream_id << " closed, status " << status_code;
+    sid2req_.erase(stream_id);
+}
+
+ssize_t
+SpdyHandler::spdylay_data_read_cb(spdylay_session *session,
+                                  int32_t stream_id,
+                                  uint8_t *buf, size_t length,
+                                  int *eof,
+                                  spdylay_data_source *source)
+{
+    CHECK_EQ(session, spdysess_.get());
+
+    auto it = sid2req_.find(stream_id);
+    CHECK(it != sid2req_.end());
+    auto& reqinfo = it->second;
+
+    /* the body is dummy, so its contents don't matter */
+    const auto len = std::min(std::min(length, reqinfo.remaining_resp_body_len),
+                              common::static_bytes_length);
+    memcpy(buf, common::static_bytes->c_str(), len);
+    reqinfo.remaining_resp_body_len -= len;
+
+    if (reqinfo.remaining_resp_body_len == 0) {
+        *eof = 1;
+    }
+
+    return len;
+}
+
+void
+SpdyHandler::onNewReadDataAvailable(StreamChannel* channel) noexcept
+{
+    CHECK_EQ(channel_.get(), channel);
+    vlogself(2) << "notified of new data";
+    _pump();
+}
+
+void
+SpdyHandler::onWrittenData(StreamChannel* channel) noexcept
+{
+    CHECK_EQ(channel_.get(), channel);
+    /* the channel has written everything we gave it, so we can give
+     * it more */
+    _pump();
+}
+
+void
+SpdyHandler::onEOF(StreamChannel* channel) noexcept
+{
+    CHECK_EQ(channel_.get(), channel);
+    _done();
+}
+
+void
+SpdyHandler::onError(StreamChannel* channel, int errorcode) noexcept
+{
+    CHECK_EQ(channel_.get(), channel);
+    logself(WARNING) << "channel closed on error: " << errorcode;
+    _done();
+}
+
+ssize_t
+SpdyHandler::s_spdylay_send_cb(spdylay_session *session, const uint8_t *data,
+                               size_t length, int flags, void *user_data)
+{
+    SpdyHandler *handler = (SpdyHandler*)(user_data);
+    return handler->spdylay_send_cb(session, data, length, flags);
+}
+
+ssize_t
+SpdyHandler::s_spdylay_recv_cb(spdylay_session *session, uint8_t *buf,
+                               size_t length, int flags, void *user_data)
+{
+    SpdyHandler *handler = (SpdyHandler*)(user_data);
+    return handler->spdylay_recv_cb(session, buf, length, flags);
+}
+
+void
+SpdyHandler::s_spdylay_on_ctrl_recv_cb(spdylay_session *session,
+                                       spdylay_frame_type type,
+                                       spdylay_frame *frame, void *user_data)
+{
+    SpdyHandler *handler = (SpdyHandler*)(user_data);
+    handler->spdylay_on_ctrl_recv_cb(session, type, frame);
+}
+
+void
+SpdyHandler::s_spdylay_on_request_recv_cb(spdylay_session *session,
+                                          int32_t stream_id, void *user_data)
+{
+    SpdyHandler *handler = (SpdyHandler*)(user_data);
+    handler->spdylay_on_request_recv_cb(session, stream_id);
+}
+
+void
+SpdyHandler::s_spdylay_on_stream_close_cb(spdylay_session *session,
+                                          int32_t stream_id,
+                                          spdylay_status_code status_code,
+                                          void *user_data)
+{
+    SpdyHandler *handler = (SpdyHandler*)(user_data);
+    handler->spdylay_on_stream_close_cb(session, stream_id, status_code);
+}
+
+ssize_t
+SpdyHandler::s_spdylay_data_read_cb(spdylay_session *session,
+                                    int32_t stream_id,
+                                    uint8_t *buf, size_t length,
+                                    int *eof,
+                                    spdylay_data_source *source,
+                                    void *user_data)
+{
+    SpdyHandler *handler = (SpdyHandler*)(user_data);
+    return handler->spdylay_data_read_cb(session, stream_id, buf, length,
+                                         eof, source);
+}
+
+void
+SpdyHandler::_setup_spdylay_session()
+{
+    spdylay_session_callbacks callbacks;
+    bzero(&callbacks, sizeof callbacks);
+    callbacks.send_callback = s_spdylay_send_cb;
+    callbacks.recv_callback = s_spdylay_recv_cb;
+    callbacks.on_ctrl_recv_callback = s_spdylay_on_ctrl_recv_cb;
+    callbacks.on_request_recv_callback = s_spdylay_on_request_recv_cb;
+    callbacks.on_stream_close_callback = s_spdylay_on_stream_close_cb;
+
+    spdylay_session *session = nullptr;
+
+    // same version as http::Connection uses
+    auto r = spdylay_session_server_new(&session, 2, &callbacks, this);
+    CHECK_EQ(r, 0);
+
+    spdysess_.reset(session);
+    session = nullptr;
+}
+
+void
+SpdyHandler::get_total_bytes(size_t& tx, size_t& rx) const
+{
+    tx = channel_->num_total_written_bytes();
+    rx = channel_->num_total_read_bytes();
+}
+
+SpdyHandler::~SpdyHandler()
+{
+    vlogself(2) << "spdy handler destructor";
+    spdysess_.reset();
+}
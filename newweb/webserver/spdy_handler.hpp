@@ -0,0 +1,129 @@
+#ifndef SPDY_HANDLER_HPP
+#define SPDY_HANDLER_HPP
+
+#include <string>
+#include <map>
+
+#include <spdylay/spdylay.h>
+
+#include "../utility/object.hpp"
+#include "../utility/stream_channel.hpp"
+
+
+class SpdyHandler;
+
+class SpdyHandlerObserver
+{
+public:
+    virtual void onSpdyHandlerDone(SpdyHandler*) noexcept = 0;
+};
+
+/* like Handler, but speaks spdy with the client, so there can be many
+ * concurrent requests on the one connection, each on its own stream.
+ *
+ * as with Handler, the responses are dummy: the request's
+ * "resp-meta-size" and "resp-body-size" headers tell us how big to
+ * make the response headers and body.
+ */
+class SpdyHandler : public Object
+                  , public myio::StreamChannelObserver
+{
+public:
+    typedef std::unique_ptr<SpdyHandler, folly::DelayedDestruction::Destructor> UniquePtr;
+
+    explicit SpdyHandler(myio::StreamChannel::UniquePtr channel,
+                         SpdyHandlerObserver* observer);
+
+    /* start handling the channel, which might already have input
+     * buffered, e.g., the client's first frames that Handler looked
+     * at to tell it's spdy. the observer might be notified within
+     * this call */
+    void start();
+
+    /* for stats */
+    const size_t& num_reqs_served() const { return num_reqs_served_; }
+    void get_total_bytes(size_t& tx, size_t& rx) const;
+
+private:
+
+    virtual ~SpdyHandler();
+
+    /********* StreamChannelObserver interface *************/
+    virtual void onNewReadDataAvailable(myio::StreamChannel*) noexcept override;
+    virtual void onEOF(myio::StreamChannel*) noexcept override;
+    virtual void onError(myio::StreamChannel*, int errorcode) noexcept override;
+    virtual void onWrittenData(myio::StreamChannel*) noexcept override;
+
+    ///////////////////
+
+    static ssize_t s_spdylay_send_cb(spdylay_session *, const uint8_t *,
+                                     size_t, int, void*);
+    ssize_t spdylay_send_cb(spdylay_session *session, const uint8_t *data,
+                            size_t length, int flags);
+
+    static ssize_t s_spdylay_recv_cb(spdylay_session *, uint8_t *,
+                                     size_t, int, void*);
+    ssize_t spdylay_recv_cb(spdylay_session *session, uint8_t *buf,
+                            size_t length, int flags);
+
+    static void s_spdylay_on_ctrl_recv_cb(spdylay_session *,
+                                          spdylay_frame_type,
+                                          spdylay_frame *,
+                                          void *);
+    void spdylay_on_ctrl_recv_cb(spdylay_session *session,
+                                 spdylay_frame_type type,
+                                 spdylay_frame *frame);
+
+    /* called when we have the whole request, i.e., the frame with
+     * FIN: either the SYN_STREAM or the last DATA frame */
+    static void s_spdylay_on_request_recv_cb(spdylay_session *,
+                                             int32_t, void *);
+    void spdylay_on_request_recv_cb(spdylay_session *session,
+                                    int32_t stream_id);
+
+    static void s_spdylay_on_stream_close_cb(spdylay_session *,
+                                             int32_t,
+                                             spdylay_status_code,
+                                             void *);
+    void spdylay_on_stream_close_cb(spdylay_session *session,
+                                    int32_t stream_id,
+                                    spdylay_status_code status_code);
+
+    /* provides the dummy response body */
+    static ssize_t s_spdylay_data_read_cb(spdylay_session *, int32_t,
+                                          uint8_t *, size_t, int *,
+                                          spdylay_data_source *, void *);
+    ssize_t spdylay_data_read_cb(spdylay_session *session,
+                                 int32_t stream_id,
+                                 uint8_t *buf, size_t length,
+                                 int *eof,
+                                 spdylay_data_source *source);
+
+    void _setup_spdylay_session();
+    void _serve_response(const int32_t sid);
+
+    /* let the session read and write; on error or when the client is
+     * gone, tell observer we're done */
+    void _pump();
+    void _done();
+
+    myio::StreamChannel::UniquePtr channel_; // the underlying stream
+    SpdyHandlerObserver* observer_;
+
+    std::unique_ptr<spdylay_session, void(*)(spdylay_session*)> spdysess_;
+
+    struct RequestInfo
+    {
+        size_t resp_meta_size;
+        size_t resp_body_size;
+        /* of the dummy body that we have yet to give to spdylay */
+        size_t remaining_resp_body_len;
+    };
+    std::map<int32_t, RequestInfo> sid2req_;
+
+    bool done_;
+
+    size_t num_reqs_served_;
+};
+
+#endif /* SPDY_HANDLER_HPP */
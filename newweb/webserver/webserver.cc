@@ -4,6 +4,10 @@
 #include <set>
 #include <boost/lexical_cast.hpp>
 
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
 
 
 #include "../utility/tcp_server.hpp"
@@ -34,6 +38,8 @@ Webserver::onAccepted(StreamServer*, StreamChannel::UniquePtr channel) noexcept
 {
     VLOG(2) << "web server got new client";
 
+    ++stats_.num_conns;
+
     Handler::UniquePtr handler(new Handler(std::move(channel), this));
     const auto id = handler->objId();
     const auto ret = handlers_.insert(make_pair(id, std::move(handler)));
@@ -51,7 +57,66 @@ Webserver::onHandlerDone(Handler* handler) noexcept
 {
     auto const id = handler->objId();
     CHECK(inMap(handlers_, id));
+    _add_handler_stats(stats_, *handler);
+    handlers_.erase(id);
+}
+
+void
+Webserver::onHandlerSpdyDetected(Handler* handler) noexcept
+{
+    auto const id = handler->objId();
+    CHECK(inMap(handlers_, id));
+
+    VLOG(2) << "client speaks spdy; hand over to a spdy handler";
+
+    StreamChannel::UniquePtr channel = handler->release_channel();
     handlers_.erase(id);
+
+    SpdyHandler::UniquePtr spdy_handler(
+        new SpdyHandler(std::move(channel), this));
+    auto spdy_handler_ptr = spdy_handler.get();
+    const auto spdy_id = spdy_handler->objId();
+    const auto ret = spdy_handlers_.insert(
+        make_pair(spdy_id, std::move(spdy_handler)));
+    CHECK(ret.second); // insist it was newly inserted
+
+    spdy_handler_ptr->start();
+}
+
+void
+Webserver::onSpdyHandlerDone(SpdyHandler* handler) noexcept
+{
+    auto const id = handler->objId();
+    CHECK(inMap(spdy_handlers_, id));
+    _add_handler_stats(stats_, *handler);
+    spdy_handlers_.erase(id);
+}
+
+void
+Webserver::get_stats(Stats& stats) const
+{
+    stats.num_conns += stats_.num_conns;
+    stats.num_reqs += stats_.num_reqs;
+    stats.tx_bytes += stats_.tx_bytes;
+    stats.rx_bytes += stats_.rx_bytes;
+
+    for (const auto& kv : handlers_) {
+        _add_handler_stats(stats, *(kv.second));
+    }
+    for (const auto& kv : spdy_handlers_) {
+        _add_handler_stats(stats, *(kv.second));
+    }
+}
+
+template <typename HandlerT>
+void
+Webserver::_add_handler_stats(Stats& stats, const HandlerT& handler)
+{
+    size_t tx = 0, rx = 0;
+    handler.get_total_bytes(tx, rx);
+    stats.num_reqs += handler.num_reqs_served();
+    stats.tx_bytes += tx;
+    stats.rx_bytes += rx;
 }
 
 Webserver::~Webserver()
@@ -63,10 +128,13 @@ Webserver::~Webserver()
 struct MyConfig
 {
     MyConfig()
+        : num_workers(1)
   {
     }
 
   std::set<uint16_t> listenports;
+  /* native only: the number of processes serving the same ports */
+  uint16_t num_workers;
 };
 
 static void
@@ -81,12 +149,175 @@ set_my_config(MyConfig& conf,
           conf.listenports.insert(boost::lexical_cast<uint16_t>(value));
 	}
 
+        else if (name == "workers") {
+            conf.num_workers = boost::lexical_cast<uint16_t>(value);
+            CHECK_GT(conf.num_workers, 0);
+        }
+
         else {
             // ignore other args
         }
     }
 }
 
+static void
+create_webservers(struct event_base* evbase, const MyConfig& conf,
+                  const bool reuse_port,
+                  std::vector<Webserver::UniquePtr>& webservers)
+{
+    for (const auto& listenport : conf.listenports) {
+        LOG(INFO) << "listening on port " << listenport;
+        myio::TCPServer::UniquePtr tcpserver(
+            new myio::TCPServer(evbase, INADDR_ANY, listenport, nullptr,
+                                true, reuse_port));
+        Webserver::UniquePtr webserver(new Webserver(std::move(tcpserver)));
+        webservers.push_back(std::move(webserver));
+    }
+}
+
+#ifndef IN_SHADOW
+
+/* when a single process can't keep up, e.g., when generating load
+ * natively, we fork workers that each listen on the same ports with
+ * SO_REUSEPORT. on SIGTERM or SIGINT, the parent tells the workers to
+ * exit, and each sends the parent its stats through a pipe, so the
+ * parent can log the totals
+ */
+
+struct WorkerContext
+{
+    int stats_fd;
+    std::vector<Webserver::UniquePtr> webservers;
+};
+
+static void
+s_worker_on_SIGTERM_SIGINT(int, short, void *arg)
+{
+    auto ctx = (WorkerContext*)arg;
+    CHECK_NOTNULL(ctx);
+
+    Webserver::Stats stats;
+    for (const auto& webserver : ctx->webservers) {
+        webserver->get_stats(stats);
+    }
+
+    const auto rv = write(ctx->stats_fd, &stats, sizeof stats);
+    CHECK_EQ(rv, (ssize_t)sizeof stats);
+
+    exit(0);
+}
+
+/* "sigmask" is the signal mask to run with once we're ready to
+ * handle SIGTERM and SIGINT; until then they stay blocked, so they
+ * wait for us instead of killing us */
+static void
+run_worker(const MyConfig& conf, const int stats_fd, const sigset_t& sigmask)
+{
+    std::unique_ptr<struct event_base, void(*)(struct event_base*)> evbase(
+        common::init_evbase(), event_base_free);
+
+    WorkerContext ctx;
+    ctx.stats_fd = stats_fd;
+    create_webservers(evbase.get(), conf, true, ctx.webservers);
+
+    std::unique_ptr<struct event, void(*)(struct event*)> sigterm_ev(
+        evsignal_new(evbase.get(), SIGTERM, s_worker_on_SIGTERM_SIGINT, &ctx),
+        event_free);
+    CHECK_NOTNULL(sigterm_ev.get());
+    auto rv = event_add(sigterm_ev.get(), nullptr);
+    CHECK_EQ(rv, 0);
+
+    std::unique_ptr<struct event, void(*)(struct event*)> sigint_ev(
+        evsignal_new(evbase.get(), SIGINT, s_worker_on_SIGTERM_SIGINT, &ctx),
+        event_free);
+    CHECK_NOTNULL(sigint_ev.get());
+    rv = event_add(sigint_ev.get(), nullptr);
+    CHECK_EQ(rv, 0);
+
+    rv = sigprocmask(SIG_SETMASK, &sigmask, nullptr);
+    CHECK_EQ(rv, 0);
+
+    common::dispatch_evbase(evbase.get());
+
+    LOG(FATAL) << "not reached";
+}
+
+static int
+run_workers(const MyConfig& conf)
+{
+    /* block the signals we wait for before forking, so we can't miss
+     * them; the workers unblock them once they have their handlers */
+    sigset_t sigs, old_sigs;
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGTERM);
+    sigaddset(&sigs, SIGINT);
+    // a worker has died
+    sigaddset(&sigs, SIGCHLD);
+    auto rv = sigprocmask(SIG_BLOCK, &sigs, &old_sigs);
+    CHECK_EQ(rv, 0);
+
+    std::vector<pid_t> pids;
+    std::vector<int> stats_fds;
+
+    for (uint16_t i = 0; i < conf.num_workers; ++i) {
+        int fds[2];
+        rv = pipe(fds);
+        CHECK_EQ(rv, 0);
+
+        const auto pid = fork();
+        CHECK_GE(pid, 0) << "errno= " << errno;
+        if (pid == 0) {
+            close(fds[0]);
+            for (const auto& fd : stats_fds) {
+                close(fd);
+            }
+            run_worker(conf, fds[1], old_sigs);
+        }
+
+        close(fds[1]);
+        pids.push_back(pid);
+        stats_fds.push_back(fds[0]);
+    }
+
+    LOG(INFO) << "started " << pids.size() << " workers";
+
+    int sig = 0;
+    rv = sigwait(&sigs, &sig);
+    CHECK_EQ(rv, 0);
+
+    LOG(INFO) << "received signal " << sig << "; stop the workers";
+
+    for (const auto& pid : pids) {
+        kill(pid, SIGTERM);
+    }
+
+    Webserver::Stats total;
+    for (size_t i = 0; i < pids.size(); ++i) {
+        Webserver::Stats stats;
+        const auto len = read(stats_fds[i], &stats, sizeof stats);
+        if (len == (ssize_t)sizeof stats) {
+            total.num_conns += stats.num_conns;
+            total.num_reqs += stats.num_reqs;
+            total.tx_bytes += stats.tx_bytes;
+            total.rx_bytes += stats.rx_bytes;
+        } else {
+            LOG(WARNING) << "worker " << pids[i]
+                         << " exited without reporting its stats";
+        }
+        close(stats_fds[i]);
+        waitpid(pids[i], nullptr, 0);
+    }
+
+    LOG(INFO) << "webserverStats= workers= " << pids.size()
+              << " conns= " << total.num_conns
+              << " reqs= " << total.num_reqs
+              << " txBytes= " << total.tx_bytes
+              << " rxBytes= " << total.rx_bytes;
+    return 0;
+}
+
+#endif
+
 INITIALIZE_EASYLOGGINGPP
 
 int main(int argc, char **argv)
@@ -122,20 +353,21 @@ int main(int argc, char **argv)
 
     LOG(INFO) << "webserver starting...";
 
+#ifdef IN_SHADOW
+    CHECK_EQ(conf.num_workers, 1) << "can't have multiple workers in shadow";
+#else
+    if (conf.num_workers > 1) {
+        return run_workers(conf);
+    }
+#endif
+
     std::unique_ptr<struct event_base, void(*)(struct event_base*)> evbase(
         common::init_evbase(), event_base_free);
 
     /* ***************************************** */
 
     std::vector<Webserver::UniquePtr> webservers;
-
-    for (const auto& listenport : conf.listenports) {
-        LOG(INFO) << "listening on port " << listenport;
-        myio::TCPServer::UniquePtr tcpserver(
-            new myio::TCPServer(evbase.get(), INADDR_ANY, listenport, nullptr));
-        Webserver::UniquePtr webserver(new Webserver(std::move(tcpserver)));
-        webservers.push_back(std::move(webserver));
-    }
+    create_webservers(evbase.get(), conf, false, webservers);
 
     /* ***************************************** */
 
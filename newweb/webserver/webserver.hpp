@@ -3,16 +3,34 @@
 
 #include "../utility/stream_server.hpp"
 #include "handler.hpp"
+#include "spdy_handler.hpp"
 
+/* serves both http and spdy clients on the same port: a connection
+ * starts out with a Handler, which hands it over to a SpdyHandler if
+ * the client speaks spdy
+ */
 class Webserver : public Object
                 , public myio::StreamServerObserver
                 , public HandlerObserver
+                , public SpdyHandlerObserver
 {
 public:
     typedef std::unique_ptr<Webserver, /*folly::*/Destructor> UniquePtr;
 
     explicit Webserver(myio::StreamServer::UniquePtr);
 
+    struct Stats
+    {
+        uint64_t num_conns = 0;
+        uint64_t num_reqs = 0;
+        uint64_t tx_bytes = 0;
+        uint64_t rx_bytes = 0;
+    };
+
+    /* add to "stats" those of all the connections we have accepted,
+     * including the ones still open */
+    void get_stats(Stats& stats) const;
+
 private:
 
     /* StreamServerObserver interface */
@@ -22,11 +40,23 @@ private:
 
     /****** HandlerObserver interface *****/
     virtual void onHandlerDone(Handler*) noexcept override;
+    virtual void onHandlerSpdyDetected(Handler*) noexcept override;
+
+    /****** SpdyHandlerObserver interface *****/
+    virtual void onSpdyHandlerDone(SpdyHandler*) noexcept override;
 
     virtual ~Webserver();
 
+    template <typename HandlerT>
+    static void _add_handler_stats(Stats&, const HandlerT&);
+
     myio::StreamServer::UniquePtr stream_server_;
     std::map<uint32_t, Handler::UniquePtr> handlers_;
+    std::map<uint32_t, SpdyHandler::UniquePtr> spdy_handlers_;
+
+    /* the connections accepted, and the requests and bytes of the
+     * handlers that are done */
+    Stats stats_;
 };
 
 #endif /* WEBSERVER_HPP */